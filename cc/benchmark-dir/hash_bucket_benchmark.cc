@@ -0,0 +1,204 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include "core/faster.h"
+#include "device/null_disk.h"
+
+using namespace FASTER::core;
+
+/// Compares lookup cost of the hash bucket layouts (see hash_bucket.h): ns per lookup, and
+/// records fetched per 1000 lookups, for keys present and absent.
+
+/// 8-byte key that counts how often it's compared against a record's key--i.e., how many records
+/// a lookup had to fetch from the log.
+class CountingKey {
+ public:
+  CountingKey(uint64_t key)
+    : key_{ key } {
+  }
+
+  inline static constexpr uint32_t size() {
+    return static_cast<uint32_t>(sizeof(CountingKey));
+  }
+  inline KeyHash GetHash() const {
+    // (MurmurHash3's 64-bit finalizer, so that every hash bit depends on every key bit.)
+    uint64_t hash = key_;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return KeyHash{ hash };
+  }
+
+  inline bool operator==(const CountingKey& other) const {
+    ++num_compares;
+    return key_ == other.key_;
+  }
+  inline bool operator!=(const CountingKey& other) const {
+    ++num_compares;
+    return key_ != other.key_;
+  }
+
+  static uint64_t num_compares;
+
+ private:
+  uint64_t key_;
+};
+uint64_t CountingKey::num_compares = 0;
+
+class Value {
+ public:
+  Value()
+    : value{ 0 } {
+  }
+
+  inline static constexpr uint32_t size() {
+    return static_cast<uint32_t>(sizeof(Value));
+  }
+
+  union {
+    uint64_t value;
+    std::atomic<uint64_t> atomic_value;
+  };
+};
+
+class UpsertContext : public IAsyncContext {
+ public:
+  typedef CountingKey key_t;
+  typedef Value value_t;
+
+  UpsertContext(uint64_t key)
+    : key_{ key } {
+  }
+
+  /// Copy (and deep-copy) constructor.
+  UpsertContext(const UpsertContext& other)
+    : key_{ other.key_ } {
+  }
+
+  /// The implicit and explicit interfaces require a key() accessor.
+  inline const CountingKey& key() const {
+    return key_;
+  }
+  inline static constexpr uint32_t value_size() {
+    return sizeof(value_t);
+  }
+  /// Non-atomic and atomic Put() methods.
+  inline void Put(Value& value) {
+    value.value = 1;
+  }
+  inline bool PutAtomic(Value& value) {
+    value.atomic_value.store(1);
+    return true;
+  }
+
+ protected:
+  /// The explicit interface requires a DeepCopy_Internal() implementation.
+  Status DeepCopy_Internal(IAsyncContext*& context_copy) {
+    return IAsyncContext::DeepCopy_Internal(*this, context_copy);
+  }
+
+ private:
+  CountingKey key_;
+};
+
+class ReadContext : public IAsyncContext {
+ public:
+  typedef CountingKey key_t;
+  typedef Value value_t;
+
+  ReadContext(uint64_t key)
+    : key_{ key }
+    , output{ 0 } {
+  }
+
+  /// Copy (and deep-copy) constructor.
+  ReadContext(const ReadContext& other)
+    : key_{ other.key_ }
+    , output{ other.output } {
+  }
+
+  /// The implicit and explicit interfaces require a key() accessor.
+  inline const CountingKey& key() const {
+    return key_;
+  }
+
+  inline void Get(const Value& value) {
+    output = value.value;
+  }
+  inline void GetAtomic(const Value& value) {
+    output = value.atomic_value.load();
+  }
+
+ protected:
+  /// The explicit interface requires a DeepCopy_Internal() implementation.
+  Status DeepCopy_Internal(IAsyncContext*& context_copy) {
+    return IAsyncContext::DeepCopy_Internal(*this, context_copy);
+  }
+
+ private:
+  CountingKey key_;
+ public:
+  uint64_t output;
+};
+
+template <class B>
+using store_t = FasterKv<CountingKey, Value, FASTER::device::NullDisk, B>;
+
+template <class B>
+void BenchmarkLayout(const char* name, uint64_t table_size, uint64_t num_keys) {
+  auto callback = [](IAsyncContext* ctxt, Status result) {
+    // In-memory store.
+    printf("Unexpected pending request\n");
+    exit(1);
+  };
+
+  store_t<B> store{ table_size, 1073741824, "" };
+  store.StartSession();
+  for(uint64_t idx = 0; idx < num_keys; ++idx) {
+    UpsertContext context{ idx };
+    store.Upsert(context, callback, 1);
+  }
+
+  for(uint64_t begin : { uint64_t{ 0 }, num_keys }) {
+    CountingKey::num_compares = 0;
+    uint64_t num_found = 0;
+    auto start_time = std::chrono::high_resolution_clock::now();
+    for(uint64_t idx = begin; idx < begin + num_keys; ++idx) {
+      ReadContext context{ idx };
+      Status result = store.Read(context, callback, 1);
+      num_found += (result == Status::Ok);
+    }
+    auto end_time = std::chrono::high_resolution_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end_time - start_time).count();
+    if(num_found != (begin == 0 ? num_keys : 0)) {
+      printf("%s: found %" PRIu64 " keys\n", name, num_found);
+      exit(1);
+    }
+    printf("%-28s %-7s %7.1f ns/lookup, %8.2f record fetches / 1000 lookups\n", name,
+           begin == 0 ? "present" : "absent", ns / num_keys,
+           1000.0 * CountingKey::num_compares / num_keys);
+  }
+
+  store.StopSession();
+}
+
+int main(int argc, char* argv[]) {
+  // ~64 keys per bucket chain.
+  static constexpr uint64_t kTableSize = 16384;
+  static constexpr uint64_t kNumKeys = 1 << 19;
+  BenchmarkLayout<HashBucket>("HashBucket", kTableSize, kNumKeys);
+  BenchmarkLayout<FingerprintHashBucket<uint8_t>>("FingerprintHashBucket<8>", kTableSize,
+      kNumKeys);
+  BenchmarkLayout<FingerprintHashBucket<uint16_t>>("FingerprintHashBucket<16>", kTableSize,
+      kNumKeys);
+  return 0;
+}
@@ -0,0 +1,56 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "core/key_hash.h"
+
+using namespace FASTER::core;
+
+/// Compares the byte hashes that variable-length keys can choose (see key_hash.h): ns per hash,
+/// by key size.
+
+std::vector<uint8_t> RandomBytes(size_t len, uint64_t seed) {
+  std::mt19937_64 rng{ seed };
+  std::vector<uint8_t> bytes(len);
+  for(auto& byte : bytes) {
+    byte = static_cast<uint8_t>(rng());
+  }
+  return bytes;
+}
+
+template <class H>
+double NanosecondsPerHash(const std::vector<uint8_t>& bytes, size_t len, uint64_t& sink) {
+  const size_t num_keys = bytes.size() - len;
+  const size_t num_iterations = std::max<size_t>(1, (16 << 20) / (num_keys * (len + 8)));
+  H hash_fn;
+  auto start_time = std::chrono::high_resolution_clock::now();
+  for(size_t iteration = 0; iteration < num_iterations; ++iteration) {
+    for(size_t offset = 0; offset < num_keys; ++offset) {
+      sink += hash_fn(bytes.data() + offset, len);
+    }
+  }
+  auto end_time = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double, std::nano>(end_time - start_time).count() /
+         (num_iterations * num_keys);
+}
+
+int main(int argc, char* argv[]) {
+  std::vector<uint8_t> bytes = RandomBytes(4096 + 1024, 4);
+  uint64_t sink = 0;
+  printf("%8s %18s %18s\n", "key size", "Hash8BitBytes", "FastHashBytes");
+  for(size_t len : { 8, 16, 32, 64, 128, 256, 512, 1024 }) {
+    double slow = NanosecondsPerHash<DefaultBytesHash>(bytes, len, sink);
+    double fast = NanosecondsPerHash<FastBytesHash>(bytes, len, sink);
+    printf("%8zu %15.1f ns %15.1f ns\n", len, slow, fast);
+  }
+  // (Keep the compiler from discarding the hashes.)
+  printf("(%" PRIx64 ")\n", sink);
+  return 0;
+}
@@ -5,6 +5,7 @@
 
 #include <atomic>
 #include <cstdint>
+#include <vector>
 #include "address.h"
 #include "async.h"
 #include "native_buffer_pool.h"
@@ -29,7 +30,8 @@ class AsyncIOContext : public IAsyncContext {
     , address{ address_ }
     , caller_context{ caller_context_ }
     , thread_io_responses{ thread_io_responses_ }
-    , io_id{ io_id_ } {
+    , io_id{ io_id_ }
+    , cold{ false } {
   }
   /// No copy constructor.
   AsyncIOContext(const AsyncIOContext& other) = delete;
@@ -40,7 +42,8 @@ class AsyncIOContext : public IAsyncContext {
     , caller_context{ caller_context_ }
     , thread_io_responses{ other.thread_io_responses }
     , record{ std::move(other.record) }
-    , io_id{ other.io_id } {
+    , io_id{ other.io_id }
+    , cold{ other.cold } {
   }
  protected:
   Status DeepCopy_Internal(IAsyncContext*& context_copy) final {
@@ -52,9 +55,42 @@ class AsyncIOContext : public IAsyncContext {
   IAsyncContext* caller_context;
   concurrent_queue<AsyncIOContext*>* thread_io_responses;
   uint64_t io_id;
+  /// Whether "address" is in the cold log, rather than in the hybrid log.
+  bool cold;
 
   SectorAlignedMemory record;
 };
 
+/// Context for one disk read that fetches the records of several AsyncIOContexts at once; see
+/// FasterKv::MultiRead(). Each record is copied out of the shared buffer into its own context,
+/// which then proceeds as if it had been read by itself.
+class MultiReadIoContext : public IAsyncContext {
+ public:
+  MultiReadIoContext(void* faster_, Address begin_address_, std::vector<AsyncIOContext*>&& reads_)
+    : faster{ faster_ }
+    , begin_address{ begin_address_ }
+    , reads{ std::move(reads_) } {
+  }
+  /// The deep-copy constructor.
+  MultiReadIoContext(MultiReadIoContext& other)
+    : faster{ other.faster }
+    , begin_address{ other.begin_address }
+    , reads{ std::move(other.reads) }
+    , buffer{ std::move(other.buffer) } {
+  }
+ protected:
+  Status DeepCopy_Internal(IAsyncContext*& context_copy) final {
+    return IAsyncContext::DeepCopy_Internal(*this, context_copy);
+  }
+ public:
+  void* faster;
+  /// (Sector-aligned) log address of the first byte in the buffer.
+  Address begin_address;
+  /// The (heap-allocated) contexts whose records this read covers, in address order.
+  std::vector<AsyncIOContext*> reads;
+
+  SectorAlignedMemory buffer;
+};
+
 }
 } // namespace FASTER::core
\ No newline at end of file
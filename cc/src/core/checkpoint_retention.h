@@ -0,0 +1,71 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <experimental/filesystem>
+#include <vector>
+
+#include "guid.h"
+
+namespace FASTER {
+namespace core {
+
+/// A checkpoint's directory, as listed by the disk: its token, and when it was last written; and
+/// the checkpoint's version, which the store reads from its metadata.
+struct CheckpointDirectory {
+  typedef std::experimental::filesystem::file_time_type write_time_t;
+
+  Guid token;
+  write_time_t write_time;
+  uint32_t version;
+};
+
+/// Which checkpoints the store keeps, once a newer checkpoint completes. Index and hybrid-log
+/// checkpoints are counted separately: a checkpoint is kept if it is one of the "keep_last"
+/// newest of its kind, or if it was written less than "keep_for" ago. A zero leaves that rule
+/// out; by default, the store keeps every checkpoint.
+///
+/// Whatever the rules, the store never deletes a checkpoint that a kept one (or the next
+/// incremental or delta checkpoint) builds on, nor the newest index checkpoint that the newest
+/// hybrid-log checkpoint can be recovered with.
+struct CheckpointRetention {
+  CheckpointRetention(uint32_t keep_last_ = 0,
+                      std::chrono::seconds keep_for_ = std::chrono::seconds::zero())
+    : keep_last{ keep_last_ }
+    , keep_for{ keep_for_ } {
+  }
+
+  inline bool enabled() const {
+    return keep_last > 0 || keep_for > std::chrono::seconds::zero();
+  }
+
+  /// Sorts "directories" newest first, and returns the tokens of those that the rules keep. The
+  /// newest checkpoint has the highest version; write times (which a copy or a coarse clock can
+  /// reorder) only break ties.
+  std::vector<Guid> Select(std::vector<CheckpointDirectory>& directories) const {
+    std::sort(directories.begin(), directories.end(),
+    [](const CheckpointDirectory& lhs, const CheckpointDirectory& rhs) {
+      return lhs.version != rhs.version ? lhs.version > rhs.version :
+             lhs.write_time > rhs.write_time;
+    });
+    auto now = CheckpointDirectory::write_time_t::clock::now();
+    std::vector<Guid> kept;
+    for(size_t idx = 0; idx < directories.size(); ++idx) {
+      if(idx < keep_last || (keep_for > std::chrono::seconds::zero() &&
+                             now - directories[idx].write_time < keep_for)) {
+        kept.push_back(directories[idx].token);
+      }
+    }
+    return kept;
+  }
+
+  uint32_t keep_last;
+  std::chrono::seconds keep_for;
+};
+
+}
+} // namespace FASTER::core
@@ -5,6 +5,9 @@
 
 #include <atomic>
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
 #include <unordered_map>
 #include "address.h"
 #include "guid.h"
@@ -15,9 +18,69 @@
 namespace FASTER {
 namespace core {
 
+/// How a hybrid-log checkpoint makes the records in memory durable.
+enum class LogCheckpointType : uint8_t {
+  /// Flush the log up to its tail (which makes all of it read-only).
+  FoldOver,
+  /// Write the part of the log that hasn't been flushed yet to a snapshot file, leaving the
+  /// mutable region in place.
+  Snapshot,
+  /// Like Snapshot, but write only the pages modified since the previous snapshot checkpoint (if
+  /// that one succeeded; else, all of them). Recovery applies the chain of snapshots in order.
+  DeltaSnapshot
+};
+
+/// Each checkpoint's metadata file (info.dat) starts with this header, so that the metadata's
+/// layout can change: a file written with another layout is rejected instead of misread. Files
+/// written before the header existed hold just the metadata, in its original layout; they are
+/// told apart by their size, and upgraded as they are read. New fields go at the end of the
+/// metadata, and don't change the format version: a file written before a field was added holds
+/// a prefix of the metadata, and the field keeps its default.
+struct CheckpointMetadataHeader {
+  /// "FKCM"
+  static constexpr uint32_t kMagic = 0x4D434B46;
+  static constexpr uint32_t kFormatVersion = 1;
+
+  uint32_t magic;
+  uint32_t format_version;
+  /// Size of the metadata that follows.
+  uint64_t size;
+};
+static_assert(sizeof(CheckpointMetadataHeader) == 16,
+              "sizeof(CheckpointMetadataHeader) != 16");
+
+/// The index metadata's original layout.
+struct LegacyIndexMetadata {
+  uint32_t version;
+  uint64_t table_size;
+  uint64_t num_ht_bytes;
+  uint64_t num_ofb_bytes;
+  FixedPageAddress ofb_count;
+  Address log_begin_address;
+  Address checkpoint_start_address;
+};
+static_assert(sizeof(LegacyIndexMetadata) == 56, "sizeof(LegacyIndexMetadata) != 56");
+
+/// The log metadata's original layout.
+struct LegacyLogMetadata {
+  bool use_snapshot_file;
+  uint32_t version;
+  uint32_t num_threads;
+  Address flushed_address;
+  Address final_address;
+  uint64_t monotonic_serial_nums[Thread::kMaxNumThreads];
+  Guid guids[Thread::kMaxNumThreads];
+};
+static_assert(sizeof(LegacyLogMetadata) == 32 + (24 * Thread::kMaxNumThreads),
+              "sizeof(LegacyLogMetadata) != 32 + (24 * Thread::kMaxNumThreads)");
+
 /// Checkpoint metadata for the index itself.
 class IndexMetadata {
  public:
+  typedef LegacyIndexMetadata legacy_t;
+  /// Size of the metadata when the header was introduced; fields added since are optional.
+  static constexpr uint64_t kBaseSize = 80;
+
   IndexMetadata()
     : version{ 0 }
     , table_size{ 0 }
@@ -25,7 +88,9 @@ class IndexMetadata {
     , num_ofb_bytes{ 0 }
     , ofb_count{ FixedPageAddress::kInvalidAddress }
     , log_begin_address{ Address::kInvalidAddress }
-    , checkpoint_start_address{ Address::kInvalidAddress } {
+    , checkpoint_start_address{ Address::kInvalidAddress }
+    , base_index_token{}
+    , key_hash_id{ 0 } {
   }
 
   inline void Initialize(uint32_t version_, uint64_t size_, Address log_begin_address_,
@@ -37,6 +102,8 @@ class IndexMetadata {
     num_ht_bytes = 0;
     num_ofb_bytes = 0;
     ofb_count = FixedPageAddress::kInvalidAddress;
+    base_index_token = Guid{};
+    key_hash_id = 0;
   }
   inline void Reset() {
     version = 0;
@@ -46,6 +113,21 @@ class IndexMetadata {
     ofb_count = FixedPageAddress::kInvalidAddress;
     log_begin_address = Address::kInvalidAddress;
     checkpoint_start_address = Address::kInvalidAddress;
+    base_index_token = Guid{};
+    key_hash_id = 0;
+  }
+
+  inline void Upgrade(const legacy_t& legacy) {
+    Initialize(legacy.version, legacy.table_size, legacy.log_begin_address,
+               legacy.checkpoint_start_address);
+    num_ht_bytes = legacy.num_ht_bytes;
+    num_ofb_bytes = legacy.num_ofb_bytes;
+    ofb_count = legacy.ofb_count;
+  }
+
+  /// An incremental index checkpoint stores only the buckets that changed since its base.
+  inline bool incremental() const {
+    return !(base_index_token == Guid{});
   }
 
   uint32_t version;
@@ -57,18 +139,29 @@ class IndexMetadata {
   Address log_begin_address;
   /// Address as of which this checkpoint was taken.
   Address checkpoint_start_address;
+  /// The index checkpoint that this one is incremental to, if any.
+  Guid base_index_token;
+  /// The keys' hash function (see KeyHashId); recovery needs keys that hash the same way.
+  uint32_t key_hash_id;
 };
-static_assert(sizeof(IndexMetadata) == 56, "sizeof(IndexMetadata) != 56");
+static_assert(sizeof(IndexMetadata) == 80, "sizeof(IndexMetadata) != 80");
 
 /// Checkpoint metadata, for the log.
 class LogMetadata {
  public:
+  typedef LegacyLogMetadata legacy_t;
+  /// Size of the metadata when the header was introduced; fields added since are optional.
+  static constexpr uint64_t kBaseSize = 56 + (24 * Thread::kMaxNumThreads);
+
   LogMetadata()
     : use_snapshot_file{ false }
     , version{ UINT32_MAX }
     , num_threads{ 0 }
     , flushed_address{ Address::kInvalidAddress }
-    , final_address{ Address::kMaxAddress } {
+    , final_address{ Address::kMaxAddress }
+    , cold_log_tail{ Address::kInvalidAddress }
+    , base_log_token{}
+    , cold_log_begin{ Address::kInvalidAddress } {
     std::memset(guids, 0, sizeof(guids));
     std::memset(monotonic_serial_nums, 0, sizeof(monotonic_serial_nums));
   }
@@ -79,23 +172,119 @@ class LogMetadata {
     num_threads = 0;
     flushed_address = flushed_address_;
     final_address = Address::kMaxAddress;
+    cold_log_tail = Address::kInvalidAddress;
+    base_log_token = Guid{};
     std::memset(guids, 0, sizeof(guids));
     std::memset(monotonic_serial_nums, 0, sizeof(monotonic_serial_nums));
+    cold_log_begin = Address::kInvalidAddress;
   }
   inline void Reset() {
     Initialize(false, UINT32_MAX, Address::kInvalidAddress);
   }
+  inline void Upgrade(const legacy_t& legacy) {
+    Initialize(legacy.use_snapshot_file, legacy.version, legacy.flushed_address);
+    num_threads = legacy.num_threads;
+    final_address = legacy.final_address;
+    std::memcpy(monotonic_serial_nums, legacy.monotonic_serial_nums,
+                sizeof(monotonic_serial_nums));
+    std::memcpy(guids, legacy.guids, sizeof(guids));
+  }
+
+  /// A delta snapshot stores only the pages that changed since its base snapshot.
+  inline bool delta() const {
+    return !(base_log_token == Guid{});
+  }
 
   bool use_snapshot_file;
   uint32_t version;
   std::atomic<uint32_t> num_threads;
   Address flushed_address;
   Address final_address;
+  /// The cold log's tail (if the store has a cold log; else invalid).
+  Address cold_log_tail;
+  /// The snapshot checkpoint that this one is a delta to, if any.
+  Guid base_log_token;
   uint64_t monotonic_serial_nums[Thread::kMaxNumThreads];
   Guid guids[Thread::kMaxNumThreads];
+  /// The cold log's begin address, if it has been truncated (see
+  /// FasterKv::ShiftColdLogBeginAddress()); else invalid.
+  Address cold_log_begin;
 };
-static_assert(sizeof(LogMetadata) == 32 + (24 * Thread::kMaxNumThreads),
-              "sizeof(LogMetadata) != 32 + (24 * Thread::kMaxNumThreads)");
+static_assert(sizeof(LogMetadata) == 64 + (24 * Thread::kMaxNumThreads),
+              "sizeof(LogMetadata) != 64 + (24 * Thread::kMaxNumThreads)");
+
+/// Writes (IndexMetadata or LogMetadata) metadata to a file, after its header.
+template <class M>
+Status WriteCheckpointMetadata(const std::string& filename, const M& metadata) {
+  // (This code will need to be refactored into the disk_t interface, if we want to support
+  // unformatted disks.)
+  std::FILE* file = std::fopen(filename.c_str(), "wb");
+  if(!file) {
+    return Status::IOError;
+  }
+  CheckpointMetadataHeader header{ CheckpointMetadataHeader::kMagic,
+                                   CheckpointMetadataHeader::kFormatVersion, sizeof(M) };
+  if(std::fwrite(&header, sizeof(header), 1, file) != 1 ||
+      std::fwrite(&metadata, sizeof(metadata), 1, file) != 1) {
+    std::fclose(file);
+    return Status::IOError;
+  }
+  if(std::fclose(file) != 0) {
+    return Status::IOError;
+  }
+  return Status::Ok;
+}
+
+/// Reads metadata written by WriteCheckpointMetadata() (possibly before fields were added to the
+/// metadata), or in the original layout. Fails with Status::Corruption if the file was written
+/// with some other layout.
+template <class M>
+Status ReadCheckpointMetadata(const std::string& filename, M& metadata) {
+  typedef typename M::legacy_t legacy_t;
+  static_assert(sizeof(legacy_t) != sizeof(CheckpointMetadataHeader) + sizeof(M),
+                "legacy metadata files can't be told apart by their size");
+
+  std::FILE* file = std::fopen(filename.c_str(), "rb");
+  if(!file) {
+    return Status::IOError;
+  }
+  Status result = Status::Ok;
+  if(std::fseek(file, 0, SEEK_END) != 0) {
+    result = Status::IOError;
+  }
+  long size = std::ftell(file);
+  if(result == Status::Ok && (size < 0 || std::fseek(file, 0, SEEK_SET) != 0)) {
+    result = Status::IOError;
+  }
+  if(result == Status::Ok && static_cast<uint64_t>(size) == sizeof(legacy_t)) {
+    legacy_t legacy;
+    if(std::fread(&legacy, sizeof(legacy), 1, file) != 1) {
+      result = Status::IOError;
+    } else {
+      metadata.Upgrade(legacy);
+    }
+  } else if(result == Status::Ok) {
+    CheckpointMetadataHeader header;
+    if(std::fread(&header, sizeof(header), 1, file) != 1) {
+      result = Status::Corruption;
+    } else if(header.magic != CheckpointMetadataHeader::kMagic ||
+              header.format_version != CheckpointMetadataHeader::kFormatVersion ||
+              header.size < M::kBaseSize || header.size > sizeof(M) ||
+              static_cast<uint64_t>(size) != sizeof(header) + header.size) {
+      result = Status::Corruption;
+    } else {
+      // (Fields that the file doesn't have keep their defaults.)
+      metadata.Reset();
+      if(std::fread(&metadata, static_cast<size_t>(header.size), 1, file) != 1) {
+        result = Status::IOError;
+      }
+    }
+  }
+  if(std::fclose(file) != 0 && result == Status::Ok) {
+    result = Status::IOError;
+  }
+  return result;
+}
 
 /// State of the active Checkpoint()/Recover() call, including metadata written to disk.
 template <class F>
@@ -107,6 +296,8 @@ class CheckpointState {
 
   CheckpointState()
     : index_checkpoint_started{ false }
+    , incremental_index{ false }
+    , delta_snapshot{ false }
     , failed{ false }
     , flush_pending{ UINT32_MAX }
     , index_persistence_callback{ nullptr }
@@ -115,9 +306,11 @@ class CheckpointState {
 
   void InitializeIndexCheckpoint(const Guid& token, uint32_t version, uint64_t table_size,
                                  Address log_begin_address, Address checkpoint_start_address,
-                                 index_persistence_callback_t callback) {
+                                 bool incremental_index_, index_persistence_callback_t callback) {
     failed = false;
     index_checkpoint_started = false;
+    incremental_index = incremental_index_;
+    delta_snapshot = false;
     continue_tokens.clear();
     index_token = token;
     hybrid_log_token = Guid{};
@@ -128,14 +321,18 @@ class CheckpointState {
     hybrid_log_persistence_callback = nullptr;
   }
 
-  void InitializeHybridLogCheckpoint(const Guid& token, uint32_t version, bool use_snapshot_file,
+  void InitializeHybridLogCheckpoint(const Guid& token, uint32_t version,
+                                     LogCheckpointType log_checkpoint_type,
                                      Address flushed_until_address,
                                      hybrid_log_persistence_callback_t callback) {
+    bool use_snapshot_file = log_checkpoint_type != LogCheckpointType::FoldOver;
     failed = false;
     index_checkpoint_started = false;
     continue_tokens.clear();
     index_token = Guid{};
     hybrid_log_token = token;
+    incremental_index = false;
+    delta_snapshot = log_checkpoint_type == LogCheckpointType::DeltaSnapshot;
     index_metadata.Reset();
     log_metadata.Initialize(use_snapshot_file, version, flushed_until_address);
     if(use_snapshot_file) {
@@ -149,11 +346,15 @@ class CheckpointState {
 
   void InitializeCheckpoint(const Guid& token, uint32_t version, uint64_t table_size,
                             Address log_begin_address, Address checkpoint_start_address,
-                            bool use_snapshot_file, Address flushed_until_address,
+                            bool incremental_index_, LogCheckpointType log_checkpoint_type,
+                            Address flushed_until_address,
                             index_persistence_callback_t index_persistence_callback_,
                             hybrid_log_persistence_callback_t hybrid_log_persistence_callback_) {
+    bool use_snapshot_file = log_checkpoint_type != LogCheckpointType::FoldOver;
     failed = false;
     index_checkpoint_started = false;
+    incremental_index = incremental_index_;
+    delta_snapshot = log_checkpoint_type == LogCheckpointType::DeltaSnapshot;
     continue_tokens.clear();
     index_token = token;
     hybrid_log_token = token;
@@ -194,6 +395,10 @@ class CheckpointState {
   }
 
   std::atomic<bool> index_checkpoint_started;
+  /// Whether the caller asked for an incremental index checkpoint (taken if possible).
+  bool incremental_index;
+  /// Whether the caller asked for a delta snapshot of the log (taken if possible).
+  bool delta_snapshot;
   std::atomic<bool> failed;
   IndexMetadata index_metadata;
   LogMetadata log_metadata;
@@ -201,7 +406,7 @@ class CheckpointState {
   Guid index_token;
   Guid hybrid_log_token;
 
-  /// State used when fold_over_snapshot = false.
+  /// State used when the log checkpoint writes a snapshot file.
   file_t snapshot_file;
   std::atomic<uint32_t> flush_pending;
 
@@ -0,0 +1,184 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <mutex>
+
+#include "address.h"
+#include "async.h"
+#include "async_result_types.h"
+#include "gc_state.h"
+#include "native_buffer_pool.h"
+#include "status.h"
+
+namespace FASTER {
+namespace core {
+
+/// Context for the cold log's synchronous reads and writes.
+class ColdLogIoContext : public IAsyncContext {
+ public:
+  ColdLogIoContext(std::atomic<bool>* done_, Status* result_)
+    : done{ done_ }
+    , result{ result_ } {
+  }
+
+  /// The deep-copy constructor.
+  ColdLogIoContext(const ColdLogIoContext& other)
+    : done{ other.done }
+    , result{ other.result } {
+  }
+
+ protected:
+  Status DeepCopy_Internal(IAsyncContext*& context_copy) {
+    return IAsyncContext::DeepCopy_Internal(*this, context_copy);
+  }
+
+ public:
+  std::atomic<bool>* done;
+  Status* result;
+};
+
+/// The cold log: an append-only file of records that generational compaction has moved out of
+/// the hybrid log. Its records have the hybrid log's format, and are addressed by their offset in
+/// the file; a hash bucket entry with its cold bit set (see HashBucketEntry::cold()) heads a chain
+/// of them, linked by their previous addresses, like any hash chain on disk.
+///
+/// The cold log is never read into memory, and nothing is ever written to it in place: a batch of
+/// records is appended, and becomes visible (through the index) only once it is durable. As in the
+/// hybrid log, records never span (32 MB) pages. Garbage collection, too, works as in the hybrid
+/// log: FasterKv::CompactColdLog() moves a range's live records to the tail, and then the begin
+/// address can be shifted past the range (see FasterKv::ShiftColdLogBeginAddress()).
+template <class D>
+class ColdLog {
+ public:
+  typedef D disk_t;
+  typedef typename D::log_file_t log_file_t;
+
+  static constexpr uint64_t kPageSize = Address::kMaxOffset + 1;
+
+  ColdLog(disk_t& disk, log_file_t& file)
+    : sector_size{ static_cast<uint32_t>(file.alignment()) }
+    , file{ &file }
+    , read_buffer_pool{ 1, sector_size }
+    , begin_address{ Address{ sector_size } }
+    , tail_address{ Address{ sector_size } }
+    , disk_{ &disk } {
+  }
+
+  /// Reads [address, address + num_records) (clamped to the end of the page), and calls
+  /// "callback" with "context"; as PersistentMemoryMalloc::AsyncGetFromDisk().
+  void AsyncGetFromDisk(Address address, uint32_t num_records, AsyncIOCallback callback,
+                        AsyncIOContext& context, uint32_t read_ahead_bytes = 0) {
+    num_records = std::min(num_records, Address::kMaxOffset + 1 - address.offset());
+    uint32_t read_ahead = std::min(read_ahead_bytes, address.offset());
+    uint64_t alignment_mask = sector_size - 1;
+    uint64_t begin_read = (address.control() - read_ahead) & ~alignment_mask;
+    uint64_t end_read = (address.control() + num_records + alignment_mask) & ~alignment_mask;
+    uint32_t length = static_cast<uint32_t>(end_read - begin_read);
+    uint32_t offset = static_cast<uint32_t>(address.control() - begin_read);
+    context.record = read_buffer_pool.Get(length);
+    context.record.valid_offset = offset;
+    context.record.available_bytes = length - offset;
+    context.record.required_bytes = num_records;
+
+    file->ReadAsync(begin_read, context.record.buffer(), length, callback, context);
+  }
+
+  /// Synchronously writes a sector-aligned buffer at a sector-aligned address, within one page.
+  Status Write(Address address, const uint8_t* buffer, uint32_t length) {
+    assert(address.control() % sector_size == 0);
+    assert(length % sector_size == 0);
+    assert(address.offset() + length <= kPageSize);
+    std::atomic<bool> done{ false };
+    Status result = Status::Ok;
+    ColdLogIoContext context{ &done, &result };
+    Status status = file->WriteAsync(buffer, address.control(), length, IoCallback, context);
+    if(status != Status::Ok) {
+      return status;
+    }
+    Wait(done);
+    return result;
+  }
+
+  /// Synchronously reads a sector-aligned range, within one page, into a sector-aligned buffer.
+  Status Read(Address address, uint8_t* buffer, uint32_t length) const {
+    assert(address.control() % sector_size == 0);
+    assert(length % sector_size == 0);
+    assert(address.offset() + length <= kPageSize);
+    std::atomic<bool> done{ false };
+    Status result = Status::Ok;
+    ColdLogIoContext context{ &done, &result };
+    Status status = file->ReadAsync(address.control(), buffer, length, IoCallback, context);
+    if(status != Status::Ok) {
+      return status;
+    }
+    Wait(done);
+    return result;
+  }
+
+  /// Where to append a record of "size" bytes, if the previous record ends at "address": there,
+  /// or at the start of the next page, if the record doesn't fit in this one.
+  static Address NextRecordAddress(Address address, uint32_t size) {
+    if(address.offset() + size > kPageSize) {
+      return Address{ address.page() + 1, 0 };
+    }
+    return address;
+  }
+
+  /// The sector-aligned address at or after "address".
+  Address SectorAlign(Address address) const {
+    uint64_t alignment_mask = sector_size - 1;
+    return Address{ (address.control() + alignment_mask) & ~alignment_mask };
+  }
+
+  /// Deletes the file's segments below the (sector-aligned) begin address.
+  void Truncate(GcState::truncate_callback_t callback) {
+    uint64_t alignment_mask = sector_size - 1;
+    file->Truncate(begin_address.load().control() & ~alignment_mask, callback);
+  }
+
+  /// Recovery: the log spanned [begin, tail) when the checkpoint was taken. (An invalid "begin"
+  /// means that the log had never been truncated.)
+  void RecoveryReset(Address begin, Address tail) {
+    if(begin != Address::kInvalidAddress) {
+      begin_address.store(begin);
+    }
+    tail_address.store(tail);
+  }
+
+ private:
+  static void IoCallback(IAsyncContext* ctxt, Status result, size_t bytes_transferred) {
+    CallbackContext<ColdLogIoContext> context{ ctxt };
+    *context->result = result;
+    context->done->store(true);
+  }
+
+  void Wait(const std::atomic<bool>& done) const {
+    while(!done.load()) {
+      disk_->TryComplete();
+    }
+  }
+
+ public:
+  uint32_t sector_size;
+  log_file_t* file;
+  NativeSectorAlignedBufferPool read_buffer_pool;
+
+  /// The first address in the log. (Address 0 is reserved, as in the hybrid log: a hash chain
+  /// ends at a previous address below this one.) It moves forward when the log is truncated.
+  AtomicAddress begin_address;
+  /// Everything before the tail address is durable. Appenders hold "append_mutex".
+  AtomicAddress tail_address;
+  std::mutex append_mutex;
+
+ private:
+  disk_t* disk_;
+};
+
+}
+} // namespace FASTER::core
@@ -3,13 +3,127 @@
 
 #pragma once
 
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
 #include "core/async.h"
 
+#include "address.h"
 #include "record.h"
 
 namespace FASTER {
 namespace core {
 
+/// How compaction decides which records in the compacted range are live.
+enum class CompactionType : uint8_t {
+  /// Replay the range into a temporary FasterKv, then scan the rest of the log to remove the
+  /// keys that have been overwritten since. Needs memory for the temporary store.
+  Scan,
+  /// Probe the main index for each record in the range, and copy it to the tail if its hash
+  /// chain still leads to it. Needs no extra memory, and never scans beyond the range.
+  Lookup
+};
+
+/// Progress of a Compact() call. Another thread may watch it, and cancel the compaction.
+class CompactionProgress {
+ public:
+  CompactionProgress()
+   : pages_total{ 0 }
+   , pages_done{ 0 }
+   , records_scanned{ 0 }
+   , cancelled_{ false }
+  {}
+
+  /// Asks compaction to stop as soon as its threads notice (they check before each record).
+  /// Compact() then returns false; records already copied stay copied, but the range isn't fully
+  /// compacted, so it must not be truncated.
+  inline void Cancel() {
+    cancelled_.store(true);
+  }
+  inline bool cancelled() const {
+    return cancelled_.load();
+  }
+
+  /// The number of (possibly partial) log pages in the compacted range, and how many of them have
+  /// been scanned so far.
+  std::atomic<uint32_t> pages_total;
+  std::atomic<uint32_t> pages_done;
+  /// The number of records scanned so far.
+  std::atomic<uint64_t> records_scanned;
+
+ private:
+  std::atomic<bool> cancelled_;
+};
+
+/// What a compaction filter decides to do with a live record that compaction is about to copy
+/// forward.
+enum class CompactionAction : uint8_t {
+  /// Copy the record (with its value, as the filter may have rewritten it) forward.
+  Keep,
+  /// Don't copy the record; once the log is truncated past the compacted range, the key is gone.
+  Drop
+};
+
+/// The default compaction filter: keeps every live record, unchanged.
+///
+/// A filter is invoked as filter(key, value), with a mutable copy of the record's value, and
+/// returns a CompactionAction. It may rewrite the value (e.g., to downsample it) before keeping
+/// it; since compaction copies fixed-size values, a rewritten value keeps the size of V.
+struct CompactionKeepAll {
+  template <class K, class V>
+  inline CompactionAction operator()(const K& key, V& value) const {
+    return CompactionAction::Keep;
+  }
+};
+
+/// A compaction filter that counts the live records it is shown and drops them all. Run through
+/// lookup compaction's conditional copy, it measures how much of a range is live without copying
+/// anything (see FasterKv::EstimateLiveFraction()).
+struct CompactionCountLive {
+  CompactionCountLive(uint64_t* live_)
+    : live{ live_ } {
+  }
+
+  template <class K, class V>
+  inline CompactionAction operator()(const K& key, V& value) const {
+    ++*live;
+    return CompactionAction::Drop;
+  }
+
+  uint64_t* live;
+};
+
+/// Context for the small, synchronous disk reads that FasterKv::EstimateLiveFraction() issues to
+/// sample records below the head address.
+class LogSampleReadContext : public IAsyncContext {
+ public:
+  LogSampleReadContext(std::atomic<bool>* done_, Status* result_, size_t* bytes_)
+    : done{ done_ }
+    , result{ result_ }
+    , bytes{ bytes_ } {
+  }
+
+  /// The deep-copy constructor.
+  LogSampleReadContext(const LogSampleReadContext& other)
+    : done{ other.done }
+    , result{ other.result }
+    , bytes{ other.bytes } {
+  }
+
+ protected:
+  Status DeepCopy_Internal(IAsyncContext*& context_copy) {
+    return IAsyncContext::DeepCopy_Internal(*this, context_copy);
+  }
+
+ public:
+  std::atomic<bool>* done;
+  /// Set, before "done", to the read's result and length.
+  Status* result;
+  size_t* bytes;
+};
+
 /// Upsert context used by FASTER's compaction algorithm.
 ///
 /// The following are template arguments.
@@ -43,6 +157,11 @@ class CompactionUpsert : public IAsyncContext {
     return key_;
   }
 
+  /// Accessor for the value, so that a compaction filter can rewrite it.
+  inline V& value() {
+    return value_;
+  }
+
   /// Returns the size of the value. Invoked from within FASTER when creating
   /// a new key-value pair (because the key did not map to a value to begin
   /// with).
@@ -80,6 +199,202 @@ class CompactionUpsert : public IAsyncContext {
   V value_;
 };
 
+/// Context used by lookup compaction (CompactionType::Lookup) to copy a record, found at a given
+/// address in the compacted range, to the tail of the log; FASTER runs it as a conditional RMW,
+/// which applies only if the key's latest record is still at that address.
+///
+/// The following are template arguments.
+///    K: The type on the key of each record.
+///    V: The type on the value stored inside FASTER.
+///    F: The type of the compaction filter.
+template <class K, class V, class F>
+class CompactionCopyToTail : public IAsyncContext {
+ public:
+  // Typedefs on the key and value required internally by FASTER.
+  typedef K key_t;
+  typedef V value_t;
+
+  // Type signature on the record. Required by the constructor.
+  typedef Record<K, V> record_t;
+
+  /// Constructs and returns a context given a pointer to a record, and its address.
+  CompactionCopyToTail(const record_t* record, Address address, const F& filter)
+   : key_(record->key())
+   , value_(record->value())
+   , address_(address)
+   , filter_(filter)
+   , filtered_(false)
+   , keep_(false)
+  {}
+
+  /// Copy constructor. Required for when the operation goes async inside FASTER.
+  CompactionCopyToTail(const CompactionCopyToTail& from)
+   : key_(from.key_)
+   , value_(from.value_)
+   , address_(from.address_)
+   , filter_(from.filter_)
+   , filtered_(from.filtered_)
+   , keep_(from.keep_)
+  {}
+
+  /// Accessor for the key. Invoked from within FASTER.
+  inline const K& key() const {
+    return key_;
+  }
+
+  /// Returns the size of the value. Invoked from within FASTER.
+  inline static constexpr uint32_t value_size() {
+    return V::size();
+  }
+
+  /// Invoked from within FASTER with the address of the key's latest record (and whether that
+  /// record has a value, i.e., isn't a tombstone or expired): returns true if the record should be
+  /// copied, i.e., if it is still the latest and the filter keeps it. The filter runs (at most)
+  /// once, even if FASTER retries the copy.
+  inline bool Check(bool has_value, Address latest_address) {
+    if(!has_value || latest_address != address_) {
+      return false;
+    }
+    if(!filtered_) {
+      keep_ = filter_(static_cast<const K&>(key_), value_) == CompactionAction::Keep;
+      filtered_ = true;
+    }
+    return keep_;
+  }
+
+  /// Stores this context's (possibly rewritten) value into the new record at the tail.
+  inline void Put(V& val) {
+    new(&val) V(value_);
+  }
+
+ protected:
+  /// Copies this context into a passed-in pointer if the operation goes
+  /// asynchronous inside FASTER.
+  Status DeepCopy_Internal(IAsyncContext*& context_copy) {
+    return IAsyncContext::DeepCopy_Internal(*this, context_copy);
+  }
+
+ private:
+  /// The key of the record being copied.
+  K key_;
+
+  /// The value of the record being copied.
+  V value_;
+
+  /// The address at which compaction found the record.
+  Address address_;
+
+  /// The compaction filter, and what it decided (once it has run).
+  F filter_;
+  bool filtered_;
+  bool keep_;
+};
+
+/// A record that generational compaction moves to the cold log: the key, and its value, or a
+/// tombstone (which shadows any older version of the key in the cold log).
+template <class K, class V>
+struct ColdLogRecord {
+  ColdLogRecord(const K& key_, const V& value_, bool tombstone_)
+    : key(key_)
+    , value(value_)
+    , tombstone(tombstone_)
+  {}
+
+  K key;
+  V value;
+  bool tombstone;
+};
+
+/// Context used by generational compaction (see ColdLog) to check whether a record, found at a
+/// given address in the compacted range, is still its key's latest record; if it is, the context
+/// adds it (or a tombstone, if it is one, has expired, or the filter drops it) to the calling
+/// thread's batch for the cold log. FASTER runs it as a conditional RMW that never applies: the
+/// record is moved, in batches, by the compaction thread.
+///
+/// The following are template arguments.
+///    K: The type on the key of each record.
+///    V: The type on the value stored inside FASTER.
+///    F: The type of the compaction filter.
+template <class K, class V, class F>
+class CompactionCopyToCold : public IAsyncContext {
+ public:
+  // Typedefs on the key and value required internally by FASTER.
+  typedef K key_t;
+  typedef V value_t;
+
+  // Type signature on the record. Required by the constructor.
+  typedef Record<K, V> record_t;
+
+  /// Constructs and returns a context given a pointer to a record, its address, and the batch
+  /// that the record goes into, if it is live.
+  CompactionCopyToCold(const record_t* record, Address address, const F& filter,
+                       std::vector<ColdLogRecord<K, V>>* batch)
+   : key_(record->key())
+   , value_(record->value())
+   , address_(address)
+   , filter_(filter)
+   , batch_(batch)
+  {}
+
+  /// Copy constructor. Required for when the operation goes async inside FASTER.
+  CompactionCopyToCold(const CompactionCopyToCold& from)
+   : key_(from.key_)
+   , value_(from.value_)
+   , address_(from.address_)
+   , filter_(from.filter_)
+   , batch_(from.batch_)
+  {}
+
+  /// Accessor for the key. Invoked from within FASTER.
+  inline const K& key() const {
+    return key_;
+  }
+
+  /// Returns the size of the value. Invoked from within FASTER.
+  inline static constexpr uint32_t value_size() {
+    return V::size();
+  }
+
+  /// Invoked from within FASTER with the address of the key's latest record. Always returns
+  /// false, so that FASTER writes nothing to the hybrid log.
+  inline bool Check(bool has_value, Address latest_address) {
+    if(latest_address == address_) {
+      bool keep = has_value &&
+                  filter_(static_cast<const K&>(key_), value_) == CompactionAction::Keep;
+      batch_->emplace_back(key_, value_, !keep);
+    }
+    return false;
+  }
+
+  /// Not reached: Check() never lets FASTER copy the record.
+  inline void Put(V& val) {
+    assert(false);
+  }
+
+ protected:
+  /// Copies this context into a passed-in pointer if the operation goes
+  /// asynchronous inside FASTER.
+  Status DeepCopy_Internal(IAsyncContext*& context_copy) {
+    return IAsyncContext::DeepCopy_Internal(*this, context_copy);
+  }
+
+ private:
+  /// The key of the record being moved.
+  K key_;
+
+  /// The value of the record being moved.
+  V value_;
+
+  /// The address at which compaction found the record.
+  Address address_;
+
+  /// The compaction filter.
+  F filter_;
+
+  /// The compaction thread's batch of records for the cold log.
+  std::vector<ColdLogRecord<K, V>>* batch_;
+};
+
 /// Delete context used by FASTER's compaction algorithm.
 ///
 /// The following are template arguments.
@@ -0,0 +1,225 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#include "address.h"
+#include "constants.h"
+#include "compact.h"
+
+namespace FASTER {
+namespace core {
+
+/// When, and how fast, AutoCompaction compacts and truncates the log.
+struct AutoCompactionConfig {
+  /// Compact when the log (tail address minus begin address) grows past this many bytes, as
+  /// long as the sampled region holds any garbage at all. 0 disables the budget.
+  uint64_t log_size_budget = 0;
+  /// Compact when at least this fraction of the sampled region's records are dead.
+  double max_garbage_ratio = 0.5;
+  /// The oldest region of the log that each round samples, and then compacts. Rounded down to
+  /// whole pages (at least one), and capped at the safe-read-only address.
+  uint64_t compaction_bytes = 256 * 1024 * 1024;
+  /// The number of windows of records sampled from the region, per round.
+  uint32_t num_samples = 16;
+  /// Compaction compacts and truncates the region in chunks of this many bytes (rounded down to
+  /// whole pages, at least one), and waits between chunks so as to compact no more than
+  /// max_bytes_per_second on average. 0 means no limit.
+  uint64_t chunk_bytes = 32 * 1024 * 1024;
+  uint64_t max_bytes_per_second = 0;
+  /// How often the background thread runs a round.
+  std::chrono::milliseconds check_interval{ 1000 };
+  /// Threads per compaction (see FasterKv::Compact()).
+  uint32_t num_threads = 1;
+};
+
+/// Keeps a FasterKv's log within a garbage ratio and a disk budget. Each round samples the oldest
+/// region of the log, estimates how much of it is garbage, and, if a threshold is crossed, runs
+/// lookup compaction over the region and truncates the log past it; compaction is split into
+/// chunks and rate-limited, so it doesn't starve foreground operations of I/O. Rounds run on a
+/// background thread (Start()/Stop()), which holds its own session, or on demand (RunOnce()).
+///
+/// `F` is the FasterKv type.
+template <class F>
+class AutoCompaction {
+ public:
+  typedef F faster_t;
+  typedef typename F::hlog_t hlog_t;
+
+  AutoCompaction(faster_t& store, const AutoCompactionConfig& config)
+    : store_(store)
+    , config_(config)
+    , stop_{ false }
+    , rounds_{ 0 }
+    , compactions_{ 0 }
+    , bytes_compacted_{ 0 }
+    , garbage_ratio_{ 0.0 }
+    , space_amplification_{ 1.0 } {
+  }
+
+  ~AutoCompaction() {
+    Stop();
+  }
+
+  /// Disallow copy and copy-assign constructors.
+  AutoCompaction(const AutoCompaction& other) = delete;
+  AutoCompaction& operator=(const AutoCompaction& other) = delete;
+
+  /// Starts the background thread.
+  void Start() {
+    if(thread_.joinable()) {
+      return;
+    }
+    stop_.store(false);
+    thread_ = std::thread{ &AutoCompaction::Run, this };
+  }
+
+  /// Stops the background thread, after the compaction chunk that it is running (if any). The
+  /// calling thread may hold a session: it is parked while the background thread finishes.
+  void Stop() {
+    if(!thread_.joinable()) {
+      return;
+    }
+    stop_.store(true);
+    // The background thread's truncation, and its StopSession(), wait for every active session
+    // to acknowledge the GC phases, and the caller's session won't while it waits here.
+    bool park = store_.IsSessionActive();
+    if(park) {
+      store_.ParkSession();
+    }
+    thread_.join();
+    if(park) {
+      store_.UnparkSession();
+    }
+  }
+
+  /// Runs one round on the calling thread, which must have started a session. Returns true if it
+  /// compacted (and truncated) the log.
+  bool RunOnce() {
+    ++rounds_;
+    Address begin = store_.hlog.begin_address.load();
+    Address tail = store_.hlog.GetTailAddress();
+    Address until = std::min(PageAlignedEnd(begin, config_.compaction_bytes),
+                             store_.hlog.safe_read_only_address.load());
+    if(until <= begin) {
+      return false;
+    }
+
+    double live = store_.EstimateLiveFraction(until.control(), config_.num_samples);
+    double garbage = 1.0 - live;
+    garbage_ratio_.store(garbage);
+    // Assume everything past the sampled region is live; that makes this a lower bound.
+    double log_size = static_cast<double>(tail.control() - begin.control());
+    double live_size = log_size - garbage * (until.control() - begin.control());
+    space_amplification_.store(live_size > 0 ? log_size / live_size : 1.0);
+
+    bool over_budget = config_.log_size_budget != 0 &&
+                       tail.control() - begin.control() > config_.log_size_budget;
+    if(garbage < config_.max_garbage_ratio && !(over_budget && garbage > 0)) {
+      return false;
+    }
+    if(!CompactChunks(begin, until)) {
+      return false;
+    }
+    ++compactions_;
+    return true;
+  }
+
+  /// Statistics.
+  inline uint64_t rounds() const {
+    return rounds_.load();
+  }
+  inline uint64_t compactions() const {
+    return compactions_.load();
+  }
+  inline uint64_t bytes_compacted() const {
+    return bytes_compacted_.load();
+  }
+  /// The fraction of dead records, and the space amplification (log size over live data size), as
+  /// estimated by the latest round.
+  inline double garbage_ratio() const {
+    return garbage_ratio_.load();
+  }
+  inline double space_amplification() const {
+    return space_amplification_.load();
+  }
+
+ private:
+  /// The page boundary at most "bytes" past "begin" (but at least one page past it).
+  static Address PageAlignedEnd(Address begin, uint64_t bytes) {
+    uint64_t num_pages = std::max<uint64_t>(bytes / hlog_t::kPageSize, 1);
+    uint64_t page = std::min<uint64_t>(begin.page() + num_pages, Address::kMaxPage);
+    return Address{ static_cast<uint32_t>(page), 0 };
+  }
+
+  /// Compacts and truncates [begin, until) a chunk at a time; chunks end at page boundaries,
+  /// since a record never spans pages. Returns false if stopped before compacting anything.
+  bool CompactChunks(Address begin, Address until) {
+    auto start_time = std::chrono::steady_clock::now();
+    uint64_t compacted = 0;
+    Address chunk_begin = begin;
+    while(chunk_begin < until && !stop_.load()) {
+      Address chunk_end = std::min(PageAlignedEnd(chunk_begin, config_.chunk_bytes), until);
+      CompactionProgress progress;
+      if(!store_.Compact(chunk_end.control(), CompactionKeepAll{}, CompactionType::Lookup,
+                         config_.num_threads, &progress)) {
+        break;
+      }
+      // Truncating needs the GC state machine; wait for any checkpoint (say) to finish first.
+      while(!store_.ShiftBeginAddress(chunk_end, nullptr, nullptr)) {
+        store_.CompletePending(false);
+        std::this_thread::yield();
+      }
+      compacted += chunk_end.control() - chunk_begin.control();
+      bytes_compacted_ += chunk_end.control() - chunk_begin.control();
+      chunk_begin = chunk_end;
+
+      if(config_.max_bytes_per_second != 0 && chunk_begin < until) {
+        auto earliest = start_time + std::chrono::microseconds{
+                          compacted * 1000000 / config_.max_bytes_per_second };
+        Idle(earliest);
+      }
+    }
+    return chunk_begin > begin;
+  }
+
+  /// Waits until "deadline" (or Stop()), refreshing the session so that it doesn't hold back the
+  /// epoch, or a checkpoint, in the meantime.
+  void Idle(std::chrono::steady_clock::time_point deadline) {
+    while(!stop_.load() && std::chrono::steady_clock::now() < deadline) {
+      store_.CompletePending(false);
+      std::this_thread::sleep_for(std::chrono::milliseconds{ 1 });
+    }
+  }
+
+  /// The background thread.
+  void Run() {
+    store_.StartSession();
+    while(!stop_.load()) {
+      RunOnce();
+      Idle(std::chrono::steady_clock::now() + config_.check_interval);
+    }
+    store_.StopSession();
+  }
+
+  faster_t& store_;
+  AutoCompactionConfig config_;
+
+  std::thread thread_;
+  std::atomic<bool> stop_;
+
+  std::atomic<uint64_t> rounds_;
+  std::atomic<uint64_t> compactions_;
+  std::atomic<uint64_t> bytes_compacted_;
+  std::atomic<double> garbage_ratio_;
+  std::atomic<double> space_amplification_;
+};
+
+}
+} // namespace FASTER::core
@@ -7,13 +7,19 @@
 #include "device/file_system_disk.h"
 #include "device/null_disk.h"
 
-extern "C" {
+using namespace FASTER::core;
 
-  using namespace FASTER::core;
+extern "C" {
   void deallocate_vec(uint8_t*, uint64_t);
+}
 
+  /// C API keys are byte strings, hashed with H: DefaultBytesHash, unless the store was opened
+  /// with the fast hash (see faster_open_with_disk_fast_hash()).
+  template <class H>
   class Key {
     public:
+      typedef H key_hash_t;
+
       Key(const uint8_t* key, const uint64_t key_length)
         : temp_buffer_{ key }
         , key_length_{ key_length } {
@@ -41,9 +47,9 @@ extern "C" {
       }
       inline KeyHash GetHash() const {
         if (this->temp_buffer_ != NULL) {
-          return KeyHash(Utility::Hash8BitBytes(temp_buffer_, key_length_));
+          return KeyHash(key_hash_t{}(temp_buffer_, key_length_));
         }
-        return KeyHash(Utility::Hash8BitBytes(buffer(), key_length_));
+        return KeyHash(key_hash_t{}(buffer(), key_length_));
       }
 
       /// Comparison operators.
@@ -72,9 +78,9 @@ extern "C" {
       }
   };
 
-  class ReadContext;
-  class UpsertContext;
-  class RmwContext;
+  template <class K> class ReadContext;
+  template <class K> class UpsertContext;
+  template <class K> class RmwContext;
 
   class GenLock {
   public:
@@ -159,9 +165,9 @@ extern "C" {
       return size_;
     }
 
-    friend class ReadContext;
-    friend class UpsertContext;
-    friend class RmwContext;
+    template <class K> friend class ReadContext;
+    template <class K> friend class UpsertContext;
+    template <class K> friend class RmwContext;
 
   private:
     AtomicGenLock gen_lock_;
@@ -176,9 +182,10 @@ extern "C" {
     }
   };
 
+  template <class K>
   class ReadContext : public IAsyncContext {
   public:
-    typedef Key key_t;
+    typedef K key_t;
     typedef Value value_t;
 
     ReadContext(const uint8_t* key, uint64_t key_length, read_callback cb, void* target)
@@ -195,7 +202,7 @@ extern "C" {
     }
 
     /// The implicit and explicit interfaces require a key() accessor.
-    inline const Key& key() const {
+    inline const K& key() const {
       return key_;
     }
 
@@ -229,14 +236,15 @@ extern "C" {
     }
 
   private:
-    Key key_;
+    K key_;
     read_callback cb_;
     void* target_;
   };
 
+  template <class K>
   class UpsertContext : public IAsyncContext {
   public:
-    typedef Key key_t;
+    typedef K key_t;
     typedef Value value_t;
 
     UpsertContext(const uint8_t* key, uint64_t key_length, uint8_t* input, uint64_t length)
@@ -260,7 +268,7 @@ extern "C" {
     }
 
     /// The implicit and explicit interfaces require a key() accessor.
-    inline const Key& key() const {
+    inline const K& key() const {
       return key_;
     }
     inline uint32_t value_size() const {
@@ -306,9 +314,10 @@ extern "C" {
     uint64_t length_;
   };
 
+  template <class K>
   class RmwContext : public IAsyncContext {
   public:
-    typedef Key key_t;
+    typedef K key_t;
     typedef Value value_t;
 
     RmwContext(const uint8_t* key, uint64_t key_length, uint8_t* modification, uint64_t length, rmw_callback cb)
@@ -336,7 +345,7 @@ extern "C" {
     }
 
     /// The implicit and explicit interfaces require a key() accessor.
-    inline const Key& key() const {
+    inline const K& key() const {
       return key_;
     }
     inline uint32_t value_size() const {
@@ -391,16 +400,17 @@ extern "C" {
     }
 
   private:
-    Key key_;
+    K key_;
     uint8_t* modification_;
     uint64_t length_;
     rmw_callback cb_;
     uint64_t new_length_;
   };
 
+  template <class K>
   class DeleteContext : public IAsyncContext {
   public:
-      typedef Key key_t;
+      typedef K key_t;
       typedef Value value_t;
 
       DeleteContext(const uint8_t* key, uint64_t key_length)
@@ -414,7 +424,7 @@ extern "C" {
       }
 
       /// The implicit and explicit interfaces require a key() accessor.
-      inline const Key& key() const {
+      inline const K& key() const {
         return key_;
       }
       inline uint32_t value_size() const {
@@ -431,25 +441,53 @@ extern "C" {
       key_t key_;
   };
 
+  typedef FASTER::environment::QueueIoHandler handler_t;
+  typedef FASTER::device::FileSystemDisk<handler_t, 1073741824L> disk_t;
+  typedef FASTER::device::NullDisk  disk_null_t;
+  using store_t = FasterKv<Key<DefaultBytesHash>, Value, disk_t>;
+  using fast_hash_store_t = FasterKv<Key<FastBytesHash>, Value, disk_t>;
+  using null_store_t = FasterKv<Key<DefaultBytesHash>, Value, disk_null_t>;
+
+extern "C" {
+
   enum store_type {
       NULL_DISK,
       FILESYSTEM_DISK,
+      FILESYSTEM_DISK_FAST_HASH,
   };
   typedef enum store_type store_type;
 
-  typedef FASTER::environment::QueueIoHandler handler_t;
-  typedef FASTER::device::FileSystemDisk<handler_t, 1073741824L> disk_t;
-  typedef FASTER::device::NullDisk  disk_null_t;
-  using store_t = FasterKv<Key, Value, disk_t>;
-  using null_store_t = FasterKv<Key, Value, disk_null_t>;
   struct faster_t {
       union {
           store_t* store;
+          fast_hash_store_t* fast_hash_store;
           null_store_t* null_store;
       } obj;
       store_type type;
   };
 
+} // extern "C"
+
+  /// Calls "fn" with the store, whichever type it is.
+  template <class F>
+  inline auto with_store(faster_t* faster_t, F fn) -> decltype(fn(*faster_t->obj.store)) {
+    switch (faster_t->type) {
+      case NULL_DISK:
+        return fn(*faster_t->obj.null_store);
+      case FILESYSTEM_DISK_FAST_HASH:
+        return fn(*faster_t->obj.fast_hash_store);
+      case FILESYSTEM_DISK:
+      default:
+        return fn(*faster_t->obj.store);
+    }
+  }
+
+  /// The key type of a store passed to with_store()'s function.
+  template <class S>
+  using key_of = typename std::remove_reference<S>::type::key_t;
+
+extern "C" {
+
   faster_t* faster_open(const uint64_t table_size, const uint64_t log_size, bool pre_allocate_log = false) {
     faster_t* res = new faster_t();
     res->obj.null_store = new null_store_t { table_size, log_size, "", 1.0, pre_allocate_log };
@@ -466,63 +504,58 @@ extern "C" {
     return res;
   }
 
+  faster_t* faster_open_with_disk_fast_hash(const uint64_t table_size, const uint64_t log_size,
+                                            const char* storage, double log_mutable_fraction,
+                                            bool pre_allocate_log) {
+    faster_t* res = new faster_t();
+    std::experimental::filesystem::create_directory(storage);
+    res->obj.fast_hash_store = new fast_hash_store_t { table_size, log_size, storage,
+                                                       log_mutable_fraction, pre_allocate_log };
+    res->type = FILESYSTEM_DISK_FAST_HASH;
+    return res;
+  }
+
   uint8_t faster_upsert(faster_t* faster_t, const uint8_t* key, const uint64_t key_length,
                         uint8_t* value, uint64_t value_length, const uint64_t monotonic_serial_number) {
     auto callback = [](IAsyncContext* ctxt, Status result) {
       assert(result == Status::Ok);
     };
 
-    UpsertContext context { key, key_length, value, value_length };
-    Status result;
-    switch (faster_t->type) {
-      case NULL_DISK:
-        result = faster_t->obj.null_store->Upsert(context, callback, monotonic_serial_number);
-        break;
-      case FILESYSTEM_DISK:
-        result = faster_t->obj.store->Upsert(context, callback, monotonic_serial_number);
-        break;
-    }
+    Status result = with_store(faster_t, [&](auto& store) {
+      UpsertContext<key_of<decltype(store)>> context { key, key_length, value, value_length };
+      return store.Upsert(context, callback, monotonic_serial_number);
+    });
     return static_cast<uint8_t>(result);
   }
 
   uint8_t faster_rmw(faster_t* faster_t, const uint8_t* key, const uint64_t key_length, uint8_t* modification,
                      const uint64_t length, const uint64_t monotonic_serial_number, rmw_callback cb) {
-    auto callback = [](IAsyncContext* ctxt, Status result) {
-      CallbackContext<RmwContext> context { ctxt };
-    };
+    Status result = with_store(faster_t, [&](auto& store) {
+      typedef RmwContext<key_of<decltype(store)>> context_t;
+      auto callback = [](IAsyncContext* ctxt, Status result) {
+        CallbackContext<context_t> context { ctxt };
+      };
 
-    RmwContext context{ key, key_length, modification, length, cb};
-    Status result;
-    switch (faster_t->type) {
-      case NULL_DISK:
-        result = faster_t->obj.null_store->Rmw(context, callback, monotonic_serial_number);
-        break;
-      case FILESYSTEM_DISK:
-        result = faster_t->obj.store->Rmw(context, callback, monotonic_serial_number);
-        break;
-    }
+      context_t context{ key, key_length, modification, length, cb};
+      return store.Rmw(context, callback, monotonic_serial_number);
+    });
     return static_cast<uint8_t>(result);
   }
 
   uint8_t faster_read(faster_t* faster_t, const uint8_t* key, const uint64_t key_length,
                        const uint64_t monotonic_serial_number, read_callback cb, void* target) {
-    auto callback = [](IAsyncContext* ctxt, Status result) {
-      CallbackContext<ReadContext> context { ctxt };
-      if (result == Status::NotFound) {
-        context->ReturnNotFound();
-      }
-    };
+    Status result = with_store(faster_t, [&](auto& store) {
+      typedef ReadContext<key_of<decltype(store)>> context_t;
+      auto callback = [](IAsyncContext* ctxt, Status result) {
+        CallbackContext<context_t> context { ctxt };
+        if (result == Status::NotFound) {
+          context->ReturnNotFound();
+        }
+      };
 
-    ReadContext context {key, key_length, cb, target};
-    Status result;
-    switch (faster_t->type) {
-      case NULL_DISK:
-        result = faster_t->obj.null_store->Read(context, callback, monotonic_serial_number);
-        break;
-      case FILESYSTEM_DISK:
-        result = faster_t->obj.store->Read(context, callback, monotonic_serial_number);
-        break;
-    }
+      context_t context {key, key_length, cb, target};
+      return store.Read(context, callback, monotonic_serial_number);
+    });
 
     if (result == Status::NotFound) {
       cb(target, NULL, 0, NotFound);
@@ -533,21 +566,16 @@ extern "C" {
 
   uint8_t faster_delete(faster_t* faster_t, const uint8_t* key, const uint64_t key_length,
                         const uint64_t monotonic_serial_number) {
-    auto callback = [](IAsyncContext* ctxt, Status result) {
-      CallbackContext<DeleteContext> context { ctxt };
-      assert(result == Status::Ok || result == Status::NotFound);
-    };
+    Status result = with_store(faster_t, [&](auto& store) {
+      typedef DeleteContext<key_of<decltype(store)>> context_t;
+      auto callback = [](IAsyncContext* ctxt, Status result) {
+        CallbackContext<context_t> context { ctxt };
+        assert(result == Status::Ok || result == Status::NotFound);
+      };
 
-    DeleteContext context {key, key_length};
-    Status result;
-    switch (faster_t->type) {
-      case NULL_DISK:
-        result = faster_t->obj.null_store->Delete(context, callback, monotonic_serial_number);
-        break;
-      case FILESYSTEM_DISK:
-        result = faster_t->obj.store->Delete(context, callback, monotonic_serial_number);
-        break;
-    }
+      context_t context {key, key_length};
+      return store.Delete(context, callback, monotonic_serial_number);
+    });
     return static_cast<uint8_t>(result);
   }
 
@@ -559,15 +587,9 @@ extern "C" {
     };
 
     Guid token;
-    bool checked;
-    switch (faster_t->type) {
-      case NULL_DISK:
-        checked = faster_t->obj.null_store->Checkpoint(nullptr, hybrid_log_persistence_callback, token);
-        break;
-      case FILESYSTEM_DISK:
-        checked = faster_t->obj.store->Checkpoint(nullptr, hybrid_log_persistence_callback, token);
-        break;
-    }
+    bool checked = with_store(faster_t, [&](auto& store) {
+      return store.Checkpoint(nullptr, hybrid_log_persistence_callback, token);
+    });
     faster_checkpoint_result* res = (faster_checkpoint_result*) malloc(sizeof(faster_checkpoint_result));
     res->checked = checked;
     res->token = (char*) malloc(37 * sizeof(char));
@@ -583,15 +605,9 @@ extern "C" {
     };
 
     Guid token;
-    bool checked;
-    switch (faster_t->type) {
-      case NULL_DISK:
-        checked = faster_t->obj.null_store->CheckpointIndex(index_persistence_callback, token);
-        break;
-      case FILESYSTEM_DISK:
-        checked = faster_t->obj.store->CheckpointIndex(index_persistence_callback, token);
-        break;
-    }
+    bool checked = with_store(faster_t, [&](auto& store) {
+      return store.CheckpointIndex(index_persistence_callback, token);
+    });
     faster_checkpoint_result* res = (faster_checkpoint_result*) malloc(sizeof(faster_checkpoint_result));
     res->checked = checked;
     res->token = (char*) malloc(37 * sizeof(char));
@@ -607,15 +623,9 @@ extern "C" {
     };
 
     Guid token;
-    bool checked;
-    switch (faster_t->type) {
-      case NULL_DISK:
-        checked = faster_t->obj.null_store->CheckpointHybridLog(hybrid_log_persistence_callback, token);
-        break;
-      case FILESYSTEM_DISK:
-        checked = faster_t->obj.store->CheckpointHybridLog(hybrid_log_persistence_callback, token);
-        break;
-    }
+    bool checked = with_store(faster_t, [&](auto& store) {
+      return store.CheckpointHybridLog(hybrid_log_persistence_callback, token);
+    });
     faster_checkpoint_result* res = (faster_checkpoint_result*) malloc(sizeof(faster_checkpoint_result));
     res->checked = checked;
     res->token = (char*) malloc(37 * sizeof(char));
@@ -634,6 +644,9 @@ extern "C" {
       case FILESYSTEM_DISK:
         delete faster_t->obj.store;
         break;
+      case FILESYSTEM_DISK_FAST_HASH:
+        delete faster_t->obj.fast_hash_store;
+        break;
     }
     delete faster_t;
   }
@@ -642,12 +655,9 @@ extern "C" {
     if (faster_t == NULL) {
       return -1;
     } else {
-      switch (faster_t->type) {
-        case NULL_DISK:
-          return faster_t->obj.null_store->Size();
-        case FILESYSTEM_DISK:
-          return faster_t->obj.store->Size();
-      }
+      return with_store(faster_t, [](auto& store) {
+        return store.Size();
+      });
     }
   }
 
@@ -664,15 +674,10 @@ extern "C" {
       //TODO: error handling
       Guid index_guid = Guid::Parse(index_str);
       Guid hybrid_guid = Guid::Parse(hybrid_str);
-      Status sres;
-      switch (faster_t->type) {
-        case NULL_DISK:
-          sres = faster_t->obj.null_store->Recover(index_guid, hybrid_guid, ver, _session_ids);
-          break;
-        case FILESYSTEM_DISK:
-          sres = faster_t->obj.store->Recover(index_guid, hybrid_guid, ver, _session_ids);
-          break;
-      }
+      // (Fails with Corrupted if the checkpoint was taken by a store opened with the other hash.)
+      Status sres = with_store(faster_t, [&](auto& store) {
+        return store.Recover(index_guid, hybrid_guid, ver, _session_ids);
+      });
 
       uint8_t status_result = static_cast<uint8_t>(sres);
       faster_recover_result* res = (faster_recover_result*) malloc(sizeof(faster_recover_result));
@@ -696,14 +701,9 @@ extern "C" {
 
   void faster_complete_pending(faster_t* faster_t, bool b) {
     if (faster_t != NULL) {
-      switch (faster_t->type) {
-        case NULL_DISK:
-          faster_t->obj.null_store->CompletePending(b);
-          break;
-        case FILESYSTEM_DISK:
-          faster_t->obj.store->CompletePending(b);
-          break;
-      }
+      with_store(faster_t, [&](auto& store) {
+        store.CompletePending(b);
+      });
     }
   }
 
@@ -713,15 +713,9 @@ extern "C" {
     if (faster_t == NULL) {
       return NULL;
     } else {
-      Guid guid;
-      switch (faster_t->type) {
-        case NULL_DISK:
-          guid = faster_t->obj.null_store->StartSession();
-          break;
-        case FILESYSTEM_DISK:
-          guid = faster_t->obj.store->StartSession();
-          break;
-      }
+      Guid guid = with_store(faster_t, [](auto& store) {
+        return store.StartSession();
+      });
       char* str = new char[37];
       std::strcpy(str, guid.ToString().c_str());
       return str;
@@ -735,51 +729,33 @@ extern "C" {
     } else {
       std::string guid_str(token);
       Guid guid = Guid::Parse(guid_str);
-      switch (faster_t->type) {
-        case NULL_DISK:
-          return faster_t->obj.null_store->ContinueSession(guid);
-        case FILESYSTEM_DISK:
-          return faster_t->obj.store->ContinueSession(guid);
-      }
+      return with_store(faster_t, [&](auto& store) {
+        return store.ContinueSession(guid);
+      });
     }
   }
 
   void faster_stop_session(faster_t* faster_t) {
     if (faster_t != NULL) {
-      switch (faster_t->type) {
-        case NULL_DISK:
-          faster_t->obj.null_store->StopSession();
-          break;
-        case FILESYSTEM_DISK:
-          faster_t->obj.store->StopSession();
-          break;
-      }
+      with_store(faster_t, [](auto& store) {
+        store.StopSession();
+      });
     }
   }
 
   void faster_refresh_session(faster_t* faster_t) {
     if (faster_t != NULL) {
-      switch (faster_t->type) {
-        case NULL_DISK:
-          faster_t->obj.null_store->Refresh();
-          break;
-        case FILESYSTEM_DISK:
-          faster_t->obj.store->Refresh();
-          break;
-      }
+      with_store(faster_t, [](auto& store) {
+        store.Refresh();
+      });
     }
   }
 
   void faster_dump_distribution(faster_t* faster_t) {
     if (faster_t != NULL) {
-      switch (faster_t->type) {
-        case NULL_DISK:
-          faster_t->obj.null_store->DumpDistribution();
-          break;
-        case FILESYSTEM_DISK:
-          faster_t->obj.store->DumpDistribution();
-          break;
-      }
+      with_store(faster_t, [](auto& store) {
+        store.DumpDistribution();
+      });
     }
   }
 
@@ -788,13 +764,11 @@ extern "C" {
         assert(new_size > 0);
     };
     if (faster_t != NULL) {
-      switch (faster_t->type) {
-        case NULL_DISK:
-          return faster_t->obj.null_store->GrowIndex(grow_index_callback);
-        case FILESYSTEM_DISK:
-          return faster_t->obj.store->GrowIndex(grow_index_callback);
-      }
+      return with_store(faster_t, [&](auto& store) {
+        return store.GrowIndex(grow_index_callback);
+      });
     }
+    return false;
   }
 
 } // extern "C"
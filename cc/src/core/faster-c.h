@@ -65,6 +65,11 @@ extern "C" {
   faster_t* faster_open(const uint64_t table_size, const uint64_t log_size, bool pre_allocate_log);
   faster_t* faster_open_with_disk(const uint64_t table_size, const uint64_t log_size, const char* storage,
                                   double log_mutable_fraction, bool pre_allocate_log);
+  // Like faster_open_with_disk(), but hashes keys with the faster hash function. Checkpoints
+  // record which hash the store used; recovering one into a store opened with the other fails.
+  faster_t* faster_open_with_disk_fast_hash(const uint64_t table_size, const uint64_t log_size,
+                                            const char* storage, double log_mutable_fraction,
+                                            bool pre_allocate_log);
   uint8_t faster_upsert(faster_t* faster_t, const uint8_t* key, const uint64_t key_length,
                         uint8_t* value, uint64_t value_length, const uint64_t monotonic_serial_number);
   uint8_t faster_rmw(faster_t* faster_t, const uint8_t* key, const uint64_t key_length, uint8_t* modification,
@@ -11,24 +11,35 @@
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
+#include <mutex>
+#include <random>
+#include <thread>
 #include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
 #include <algorithm>
 
 #include "device/file_system_disk.h"
 
 #include "alloc.h"
 #include "checkpoint_locks.h"
+#include "checkpoint_retention.h"
 #include "checkpoint_state.h"
+#include "cold_log.h"
 #include "constants.h"
+#include "fuzzy_bucket_set.h"
 #include "gc_state.h"
 #include "grow_state.h"
 #include "guid.h"
 #include "hash_table.h"
+#include "in_place_read_context.h"
 #include "internal_contexts.h"
 #include "key_hash.h"
+#include "maintenance_pool.h"
 #include "malloc_fixed_page_size.h"
 #include "persistent_memory_malloc.h"
 #include "record.h"
+#include "record_size_histogram.h"
 #include "recovery_status.h"
 #include "state_transitions.h"
 #include "status.h"
@@ -74,11 +85,14 @@ class alignas(Constants::kCacheLineBytes) ThreadContext {
 };
 static_assert(sizeof(ThreadContext) == 448, "sizeof(ThreadContext) != 448");
 
-/// The FASTER key-value store.
-template <class K, class V, class D>
+/// The FASTER key-value store. (B selects the hash-bucket layout of the index: HashBucket,
+/// FingerprintHashBucket, or InlineKeyHashBucket; by default, as the key type's KeyIndexTraits
+/// say.)
+template <class K, class V, class D,
+          class B = typename KeyIndexTraits<K>::hash_bucket_t>
 class FasterKv {
  public:
-  typedef FasterKv<K, V, D> faster_t;
+  typedef FasterKv<K, V, D, B> faster_t;
 
   /// Keys and values stored in this key-value store.
   typedef K key_t;
@@ -89,6 +103,10 @@ class FasterKv {
   typedef typename D::log_file_t log_file_t;
 
   typedef PersistentMemoryMalloc<disk_t> hlog_t;
+  typedef ColdLog<disk_t> cold_log_t;
+
+  typedef B hash_bucket_t;
+  typedef typename B::fingerprint_t fingerprint_t;
 
   /// Contexts that have been deep-copied, for async continuations, and must be accessed via
   /// virtual function calls.
@@ -97,39 +115,114 @@ class FasterKv {
   typedef AsyncPendingRmwContext<key_t> async_pending_rmw_context_t;
   typedef AsyncPendingDeleteContext<key_t> async_pending_delete_context_t;
 
+  /// With "cold_log" set, compaction moves live records out of the hybrid log into a separate,
+  /// append-only cold log (see ColdLog), which needs a backing file. With
+  /// "num_maintenance_threads" set, a pool of that many threads (see MaintenancePool) splits and
+  /// cleans the hash table while the index grows or the log is truncated, and does the work of
+  /// index checkpoints and recovery; application threads only acknowledge the phase changes
+  /// (though, while the index grows, they still wait for the split to finish).
   FasterKv(uint64_t table_size, uint64_t log_size, const std::string& filename,
-           double log_mutable_fraction = 0.9, bool pre_allocate_log = false)
+           double log_mutable_fraction = 0.9, bool pre_allocate_log = false,
+           bool cold_log = false, uint32_t num_maintenance_threads = 0)
     : min_table_size_{ table_size }
     , disk{ filename, epoch_ }
     , hlog{ filename.empty() /*hasNoBackingStorage*/, log_size, epoch_, disk, disk.log(), log_mutable_fraction, pre_allocate_log }
+    , use_cold_log_{ cold_log }
+    , cold_log_{ disk, disk.cold_log() }
     , system_state_{ Action::None, Phase::REST, 1 }
-    , num_pending_ios{ 0 } {
+    , last_snapshot_version_{ 0 }
+    , parked_{}
+    , num_parked_{ 0 }
+    , commit_callbacks_{}
+    , commit_serial_nums_{}
+    , commit_addresses_{}
+    , commit_results_{}
+    , num_commit_writes_{ 0 }
+    , num_pending_ios{ 0 }
+    , disk_chain_hops_{ 0 }
+    , buffered_disk_chain_hops_{ 0 }
+    , disk_record_sizes_{ MinIoRequestSize() }
+    , track_fuzzy_buckets_{ false }
+    , lazy_recovery_{ false }
+    , lazy_recovery_status_{ Status::Ok } {
     if(!Utility::IsPowerOfTwo(table_size)) {
       throw std::invalid_argument{ " Size is not a power of 2" };
     }
     if(table_size > INT32_MAX) {
       throw std::invalid_argument{ " Cannot allocate such a large hash table " };
     }
+    if(cold_log && filename.empty()) {
+      throw std::invalid_argument{ " A cold log needs a backing file " };
+    }
 
     resize_info_.version = 0;
     state_[0].Initialize(table_size, disk.log().alignment());
     overflow_buckets_allocator_[0].Initialize(disk.log().alignment(), epoch_);
+
+    if(num_maintenance_threads > 0) {
+      maintenance_pool_.Start(num_maintenance_threads);
+      for(uint32_t version = 0; version < 2; ++version) {
+        state_[version].set_maintenance_pool(&maintenance_pool_);
+        overflow_buckets_allocator_[version].set_maintenance_pool(&maintenance_pool_);
+      }
+    }
   }
 
   // No copy constructor.
   FasterKv(const FasterKv& other) = delete;
 
+  ~FasterKv() {
+    if(recovery_thread_.joinable()) {
+      recovery_thread_.join();
+    }
+    maintenance_pool_.Stop();
+  }
+
  public:
   /// Thread-related operations
   Guid StartSession();
   uint64_t ContinueSession(const Guid& guid);
   void StopSession();
   void Refresh();
+  /// An idle session can park: it then takes no part in the epoch protocol, so checkpoints, log
+  /// truncation and index growth advance without waiting for it to call Refresh(). Whichever
+  /// thread advances the state machine does the parked session's part on its behalf: a
+  /// checkpoint records the session's serial number as of parking, and the session's persistence
+  /// callback runs on that thread. A parked session mustn't issue requests; unparking catches it
+  /// up with the state machine. If no session is active, some thread (not one with an active
+  /// session) has to drive the state machine with CompleteAction(), which returns true once no
+  /// action is in progress.
+  void ParkSession();
+  void UnparkSession();
+  bool CompleteAction(bool wait = false);
+  /// Whether the calling thread has a session that is started and not parked.
+  inline bool IsSessionActive() {
+    return epoch_.IsProtected();
+  }
 
   /// Store interface
   template <class RC>
   inline Status Read(RC& context, AsyncCallback callback, uint64_t monotonic_serial_num);
 
+  /// Reads a key without copying its value out: calls "visitor(const value_t& value,
+  /// bool concurrent)" on the value where it lies. For a record in memory, the visitor runs
+  /// inside ReadInPlace(), under epoch protection; "concurrent" is true if other threads may be
+  /// updating the value in place, in which case the visitor should read it as GetAtomic() would.
+  /// For a record on disk, ReadInPlace() returns Status::Pending, and the visitor later runs on
+  /// the I/O buffer, from CompletePending(), just before "callback" gets the (deep-copied)
+  /// InPlaceReadContext. Either way, the reference is valid only for the duration of the call.
+  template <class F>
+  inline Status ReadInPlace(const key_t& key, const F& visitor, AsyncCallback callback,
+                            uint64_t monotonic_serial_num);
+
+  /// Reads a batch of keys. Each key's status goes into results[idx]: keys found in memory
+  /// complete right away; the rest go Pending, and complete through "callback", as for Read().
+  /// Disk reads are sorted by address, and records in the same or adjacent sectors are fetched
+  /// with a single I/O. Returns Status::Pending if any key went pending, else Status::Ok.
+  template <class RC>
+  inline Status MultiRead(RC* contexts, size_t num_contexts, Status* results,
+                          AsyncCallback callback, uint64_t monotonic_serial_num);
+
   template <class UC>
   inline Status Upsert(UC& context, AsyncCallback callback, uint64_t monotonic_serial_num);
 
@@ -139,25 +232,110 @@ class FasterKv {
   template <class DC>
   inline Status Delete(DC& context, AsyncCallback callback, uint64_t monotonic_serial_num);
 
+  /// Compare-and-swap: installs the context's value only if the context's Compare() accepts the
+  /// key's current value (or its CompareNotFound(), if the key has none). Returns Status::Aborted
+  /// if the comparison failed. Works like Rmw(): in the mutable region, the context's
+  /// CompareAndPutAtomic() checks and updates the value in place; elsewhere, the check is made on
+  /// the latest record (reading it from disk, if need be) and the new record is installed with a
+  /// CAS on the hash bucket entry, which retries if the record changed in the meantime.
+  template <class CC>
+  inline Status ConditionalUpsert(CC& context, AsyncCallback callback,
+                                  uint64_t monotonic_serial_num);
+
   inline bool CompletePending(bool wait = false);
 
-  /// Checkpoint/recovery operations.
+  /// Checkpoint/recovery operations. An incremental index checkpoint writes only the hash
+  /// buckets that changed since the previous index checkpoint (if that one succeeded, and the
+  /// index hasn't grown since); recovering from it reads the whole chain of index checkpoints.
+  /// Likewise, a delta snapshot of the log writes only the pages modified since the previous
+  /// snapshot; see LogCheckpointType.
   bool Checkpoint(void(*index_persistence_callback)(Status result),
                   void(*hybrid_log_persistence_callback)(Status result,
-                      uint64_t persistent_serial_num), Guid& token);
-  bool CheckpointIndex(void(*index_persistence_callback)(Status result), Guid& token);
+                      uint64_t persistent_serial_num), Guid& token,
+                  bool incremental_index = false,
+                  LogCheckpointType log_checkpoint_type = LogCheckpointType::FoldOver);
+  bool CheckpointIndex(void(*index_persistence_callback)(Status result), Guid& token,
+                       bool incremental = false);
   bool CheckpointHybridLog(void(*hybrid_log_persistence_callback)(Status result,
-                           uint64_t persistent_serial_num), Guid& token);
+                           uint64_t persistent_serial_num), Guid& token,
+                           LogCheckpointType log_checkpoint_type = LogCheckpointType::FoldOver);
+  /// Group commit: makes the calling session's requests so far durable, without a checkpoint.
+  /// The session's pending requests are completed first. Then the log is made read-only up to
+  /// its tail, and flushed (the partially filled tail page included); once the flush is done,
+  /// "callback" runs on the session's thread (from Refresh() or CompletePending()) with the
+  /// serial number the session is durable up to. Sessions whose commits the same flush covers
+  /// share it, and the write that records it. Recovering from a checkpoint replays the log up to
+  /// the latest commit, and a session that committed continues from its committed serial number;
+  /// unlike a checkpoint, a commit doesn't cut the other sessions' requests at a consistent point.
+  /// Returns false if the session is already waiting for a commit.
+  typedef void(*commit_callback_t)(Status result, uint64_t persistent_serial_num);
+  bool Commit(commit_callback_t callback);
+  /// Deletes obsolete index and hybrid-log checkpoints (snapshot files included) as newer ones
+  /// complete; see CheckpointRetention. Takes effect from the next checkpoint to complete.
+  void SetCheckpointRetention(const CheckpointRetention& retention) {
+    checkpoint_retention_ = retention;
+  }
+  /// Recovery replays the part of the log that the index checkpoint may have missed on
+  /// "num_threads" threads (0: one per hardware thread), a page at a time. With "lazy" set, and
+  /// a full (fold-over) checkpoint that recorded which hash buckets that part of the log touched,
+  /// Recover() returns as soon as the index is loaded and the log's tail page is restored, and the
+  /// replay runs in the background: requests for keys in the touched buckets go pending (and
+  /// complete through CompletePending()) until it finishes; requests for all other keys are
+  /// served right away. Otherwise, recovery replays the log before returning. The index
+  /// checkpoint is loaded as "index_load_mode" says: read, or mapped into memory (see
+  /// IndexLoadMode). It may be older than the hybrid-log checkpoint (when the checkpoints since
+  /// were of the log alone), but not newer. With "table_size" set (a power of two), the loaded
+  /// index is rehashed into a table of that many buckets, on the same threads; see RehashIndex().
+  /// Shrinking can stop short of that size, though: where it would merge two entries with the
+  /// same tag, the table is kept twice as large instead (at most the checkpoint's size). Check
+  /// IndexSize() for the size the index got. Without "table_size", the index keeps the
+  /// checkpoint's size. Fails with Status::Corruption if the checkpoint's keys were hashed with
+  /// another function than the store's keys are (see KeyHashId).
   Status Recover(const Guid& index_token, const Guid& hybrid_log_token, uint32_t& version,
-                 std::vector<Guid>& session_ids);
-
-  /// Log compaction entry method.
-  bool Compact(uint64_t untilAddress);
+                 std::vector<Guid>& session_ids, uint32_t num_threads = 0, bool lazy = false,
+                 IndexLoadMode index_load_mode = IndexLoadMode::Read, uint64_t table_size = 0);
+  /// Status::Pending while a lazy recovery is still replaying the log; else the result of the
+  /// replay (Status::Ok if there was none). Checkpoints, compaction, log truncation and index
+  /// growth can't start until the replay is done.
+  Status CompleteRecovery(bool wait = false);
+
+  /// Log compaction entry method. The filter sees each live record that compaction copies
+  /// forward, and may drop it or rewrite its value (see CompactionAction). Lookup compaction
+  /// (the default) decides liveness by probing the index; see CompactionType. It splits the range
+  /// by pages across "num_threads" threads (the calling thread, which must have started a
+  /// session, and num_threads - 1 more, each with its own session), and reports its progress
+  /// to, and can be cancelled through, "progress". (If a checkpoint or index growth starts before
+  /// one of the other threads has started its session, that thread can't start it; compaction
+  /// then fails as if it had been cancelled.) Scan compaction always runs on the calling thread
+  /// alone, and can't be cancelled. If the store has a cold log, compaction is always
+  /// generational: it probes the index as lookup compaction does, but moves the live records (and
+  /// the tombstones that shadow older versions) to the cold log, instead of to the tail.
+  template <class F = CompactionKeepAll>
+  bool Compact(uint64_t untilAddress, F filter = F{},
+               CompactionType type = CompactionType::Lookup, uint32_t num_threads = 1,
+               CompactionProgress* progress = nullptr);
+
+  /// Estimates the fraction of the records in [begin address, untilAddress) that are still live,
+  /// by sampling "num_samples" windows of records at random pages of the range and probing the
+  /// index for each record, the way lookup compaction does (but without copying anything).
+  /// Tombstones and expired records count as dead. The calling thread must have started a
+  /// session. Returns 1 if there was nothing to sample.
+  double EstimateLiveFraction(uint64_t untilAddress, uint32_t num_samples);
 
   /// Truncating the head of the log.
   bool ShiftBeginAddress(Address address, GcState::truncate_callback_t truncate_callback,
                          GcState::complete_callback_t complete_callback);
 
+  /// Cold log compaction: moves each key's latest record in [the cold log's begin address,
+  /// untilAddress) to the cold log's tail, unless it is a tombstone or has expired (every older
+  /// version of its key is in the range, too). The cold log can then be truncated at
+  /// "untilAddress". The calling thread must have started a session. Returns false if the store
+  /// has no cold log, or if a read or write failed; the range mustn't be truncated then.
+  bool CompactColdLog(uint64_t untilAddress);
+  /// Truncating the head of the cold log, as ShiftBeginAddress() truncates the hybrid log.
+  bool ShiftColdLogBeginAddress(Address address, GcState::truncate_callback_t truncate_callback,
+                                GcState::complete_callback_t complete_callback);
+
   /// Make the hash table larger.
   bool GrowIndex(GrowState::callback_t caller_callback);
 
@@ -165,15 +343,36 @@ class FasterKv {
   inline uint64_t Size() const {
     return hlog.GetTailAddress().control();
   }
+  /// Number of hash buckets in the index (not counting overflow buckets).
+  inline uint64_t IndexSize() const {
+    return state_[resize_info_.version].size();
+  }
   inline void DumpDistribution() {
     state_[resize_info_.version].DumpDistribution(
       overflow_buckets_allocator_[resize_info_.version]);
   }
+  /// Hops taken by reads that walked a hash chain on disk (one per record whose key didn't
+  /// match), and how many of those found the next record in a buffer that was already read.
+  inline uint64_t DiskChainHops() const {
+    return disk_chain_hops_.load();
+  }
+  inline uint64_t BufferedDiskChainHops() const {
+    return buffered_disk_chain_hops_.load();
+  }
+  /// Bytes appended to the cold log, and not yet truncated (0 if the store has none).
+  inline uint64_t ColdLogSize() const {
+    return cold_log_.tail_address.load().control() - cold_log_.begin_address.load().control();
+  }
+  /// The address that the cold log's next append starts at (see CompactColdLog()).
+  inline Address ColdLogTailAddress() const {
+    return cold_log_.tail_address.load();
+  }
 
  private:
   typedef Record<key_t, value_t> record_t;
 
   typedef PendingContext<key_t> pending_context_t;
+  typedef ColdLogRecord<key_t, value_t> cold_log_record_t;
 
   template <class C>
   inline OperationStatus InternalRead(C& pending_context) const;
@@ -194,13 +393,28 @@ class FasterKv {
   OperationStatus InternalContinuePendingRmw(ExecutionContext& ctx,
       AsyncIOContext& io_context);
 
-  // Find the hash bucket entry, if any, corresponding to the specified hash.
-  // The caller can use the "expected_entry" to CAS its desired address into the entry.
-  inline const AtomicHashBucketEntry* FindEntry(KeyHash hash, HashBucketEntry& expected_entry) const;
+  // Find the hash bucket entry, if any, corresponding to the specified hash (and inline key; see
+  // KeyIndexTraits). The caller can use the "expected_entry" to CAS its desired address into the
+  // entry.
+  // (With "cold" set, finds the entry for the cold log instead; see ColdLog.)
+  inline const AtomicHashBucketEntry* FindEntry(KeyHash hash, uint64_t inline_key,
+      HashBucketEntry& expected_entry, bool cold = false) const;
   // If a hash bucket entry corresponding to the specified hash exists, return it; otherwise,
   // create a new entry. The caller can use the "expected_entry" to CAS its desired address into
   // the entry.
-  inline AtomicHashBucketEntry* FindOrCreateEntry(KeyHash hash, HashBucketEntry& expected_entry);
+  inline AtomicHashBucketEntry* FindOrCreateEntry(KeyHash hash, uint64_t inline_key,
+      HashBucketEntry& expected_entry, bool cold = false);
+  // Called after changing the entry for the specified hash, so that the next incremental index
+  // checkpoint stores its bucket.
+  inline void MarkIndexDirty(KeyHash hash) {
+    state_[resize_info_.version].MarkDirty(hash);
+  }
+  // Finds the cold log's entry for the specified hash, if the store has a cold log, and the entry
+  // leads to a record.
+  inline bool FindColdEntry(KeyHash hash, uint64_t inline_key, HashBucketEntry& entry) const;
+  // Once the hybrid log has no record for the key: goes to the cold log, if it may have one.
+  template <class C>
+  inline OperationStatus ReadFromColdLog(C& pending_context) const;
   template<class C>
   inline Address TraceBackForKeyMatchCtxt(const C& ctxt, Address from_address,
                                       Address min_offset) const;
@@ -208,16 +422,26 @@ class FasterKv {
                                       Address min_offset) const;
   Address TraceBackForOtherChainStart(uint64_t old_size,  uint64_t new_size, Address from_address,
                                       Address min_address, uint8_t side);
+  // Synchronously reads the cold log's record at "address" into "buffer".
+  Status ReadColdRecord(Address address, SectorAlignedMemory& buffer, const record_t*& record);
+  // Whether the cold log's record at "address" is the latest one for its key in the cold log.
+  Status IsLatestColdRecord(const record_t* record, Address address, bool& latest);
 
   // If a hash bucket entry corresponding to the specified hash exists, return it; otherwise,
   // return an unused bucket entry.
-  inline AtomicHashBucketEntry* FindTentativeEntry(KeyHash hash, HashBucket* bucket,
-      uint8_t version, HashBucketEntry& expected_entry);
+  inline AtomicHashBucketEntry* FindTentativeEntry(KeyHash hash, fingerprint_t fingerprint,
+      hash_bucket_t* bucket, uint8_t version, hash_bucket_t*& entry_bucket, uint32_t& entry_idx,
+      HashBucketEntry& expected_entry, bool cold);
   // Looks for an entry that has the same
-  inline bool HasConflictingEntry(KeyHash hash, const HashBucket* bucket, uint8_t version,
-                                  const AtomicHashBucketEntry* atomic_entry) const;
-
-  inline Address BlockAllocate(uint32_t record_size);
+  inline bool HasConflictingEntry(fingerprint_t fingerprint, const hash_bucket_t* bucket,
+                                  uint8_t version, const AtomicHashBucketEntry* atomic_entry) const;
+
+  inline Address BlockAllocate(uint32_t record_size, KeyHash hash);
+  // Whether the key's bucket is still being replayed by a lazy recovery.
+  inline bool IsRecovering(KeyHash hash) const {
+    return lazy_recovery_.load() &&
+           recovering_buckets_.Contains(hash.idx(recovering_buckets_.size()));
+  }
 
   inline Status HandleOperationStatus(ExecutionContext& ctx,
                                       pending_context_t& pending_context,
@@ -227,13 +451,22 @@ class FasterKv {
   inline Status RetryLater(ExecutionContext& ctx, pending_context_t& pending_context,
                            bool& async);
   inline constexpr uint32_t MinIoRequestSize() const;
+  /// The size of the first read for a record on disk: at least MinIoRequestSize(), and enough to
+  /// cover most of the records that reads have found on disk so far.
+  inline uint32_t FirstIoRequestSize() const {
+    return disk_record_sizes_.read_size();
+  }
   inline Status IssueAsyncIoRequest(ExecutionContext& ctx, pending_context_t& pending_context,
                                     bool& async);
 
   void AsyncGetFromDisk(Address address, uint32_t num_records, AsyncIOCallback callback,
-                        AsyncIOContext& context);
+                        AsyncIOContext& context, uint32_t read_ahead_bytes = 0);
   static void AsyncGetFromDiskCallback(IAsyncContext* ctxt, Status result,
                                        size_t bytes_transferred);
+  void IssueMultiReadIoRequests(std::vector<AsyncIOContext*>& reads);
+  void AsyncGetRangeFromDisk(Address begin_address, Address end_address,
+                             MultiReadIoContext& context);
+  static void MultiReadCallback(IAsyncContext* ctxt, Status result, size_t bytes_transferred);
 
   void CompleteIoPendingRequests(ExecutionContext& context);
   void CompleteRetryRequests(ExecutionContext& context);
@@ -242,32 +475,91 @@ class FasterKv {
 
   /// Checkpoint/recovery methods.
   void HandleSpecialPhases();
+  SystemState ContextState(SystemState final_state, const ExecutionContext& context) const;
   bool GlobalMoveToNextState(SystemState current_state);
+  bool TryMoveToNextState();
+  void AdvanceParkedSessions();
+  void AdvanceParkedSession(uint32_t thread_id, std::vector<uint64_t>& callback_serial_nums);
+  void CompleteCommit();
+  Status WriteCommitMetadata(Address flushed_until_address);
+  bool ApplyCommit();
 
   Status CheckpointFuzzyIndex();
+  /// The chunks of overflow buckets that hang off the hash table chunks that the current index
+  /// checkpoint stores.
+  std::vector<bool> DirtyOverflowChunks(uint32_t version) const;
   Status CheckpointFuzzyIndexComplete();
-  Status RecoverFuzzyIndex();
+  Status RecoverFuzzyIndex(IndexLoadMode load_mode);
   Status RecoverFuzzyIndexComplete(bool wait);
+  Status RehashIndex(uint64_t new_size, uint32_t num_threads);
 
   Status WriteIndexMetadata();
   Status ReadIndexMetadata(const Guid& token);
+  Status ReadIndexMetadata(const Guid& token, IndexMetadata& metadata);
   Status WriteCprMetadata();
   Status ReadCprMetadata(const Guid& token);
-  Status WriteCprContext();
+  Status ReadCprMetadata(const Guid& token, LogMetadata& metadata);
+  void PruneCheckpoints(Action action);
+  void RemoveObsoleteCheckpoints(const CheckpointRetention& retention,
+                                 std::vector<Guid> kept_index, std::vector<Guid> kept_log);
+  Status WriteSnapshotPages(const std::vector<uint32_t>& pages);
+  Status ReadSnapshotPages(const Guid& token, std::vector<uint32_t>& pages);
+  Status WriteCprContext(const ExecutionContext& context);
   Status ReadCprContexts(const Guid& token, const Guid* guids);
 
-  Status RecoverHybridLog();
-  Status RecoverHybridLogFromSnapshotFile();
-  Status RecoverFromPage(Address from_address, Address to_address);
+  Status RecoverHybridLog(uint32_t num_threads);
+  Status RecoverHybridLogFromSnapshotFile(uint32_t num_threads);
+  void ResetFuzzyIndexEntries(uint32_t num_threads);
+  template <class F>
+  Status RecoverPages(uint32_t start_page, uint32_t end_page, uint32_t num_threads,
+                      const F& recover_page);
+  Status RecoverFromPage(Address from_address, Address to_address,
+                         uint8_t* page_buffer = nullptr);
   Status RestoreHybridLog();
+  Status RestoreTailPage();
+  Status RecoverPageOnDisk(uint32_t page, Address from_address);
+  void FinishLazyRecovery(uint32_t num_threads);
+  Status RebuildColdLogIndex();
 
   void MarkAllPendingRequests();
 
+  bool StartGc(Address address, bool cold_log, GcState::truncate_callback_t truncate_callback,
+               GcState::complete_callback_t complete_callback);
+
   inline void HeavyEnter();
   bool CleanHashTableBuckets();
+  bool SplitHashTableChunk();
+  void SplitColdHashEntry(HashBucketEntry old_entry, fingerprint_t fingerprint, uint64_t old_size,
+                          uint64_t new_size, hash_bucket_t*& new_bucket0,
+                          uint32_t& new_entry_idx0, hash_bucket_t*& new_bucket1,
+                          uint32_t& new_entry_idx1);
   void SplitHashTableBuckets();
-  void AddHashEntry(HashBucket*& bucket, uint32_t& next_idx, uint8_t version,
-                    HashBucketEntry entry);
+  void StartMaintenanceWorkers(Phase phase);
+  template <class F>
+  void RunOnThreads(uint32_t num_threads, const F& task);
+  void AddHashEntry(hash_bucket_t*& bucket, uint32_t& next_idx, uint8_t version,
+                    HashBucketEntry entry, fingerprint_t fingerprint);
+
+  template <class F>
+  bool CompactWithScan(uint64_t untilAddress, F filter);
+  template <class W>
+  void RunCompactionThreads(uint32_t num_threads, CompactionProgress& progress, const W& work);
+  template <class F>
+  bool CompactWithLookup(uint64_t untilAddress, F filter, uint32_t num_threads,
+                         CompactionProgress& progress);
+  template <class F>
+  void CompactPagesWithLookup(Address begin, Address until, std::atomic<uint32_t>& next_page,
+                              const F& filter, CompactionProgress& progress);
+  template <class CC>
+  inline Status ConditionalCopyToTail(CC& context, AsyncCallback callback);
+  template <class F>
+  bool CompactToColdLog(uint64_t untilAddress, F filter, uint32_t num_threads,
+                        CompactionProgress& progress);
+  template <class F>
+  void CompactPagesToColdLog(Address begin, Address until, std::atomic<uint32_t>& next_page,
+                             const F& filter, CompactionProgress& progress);
+  Status AppendToColdLog(const std::vector<cold_log_record_t>& batch);
+  void SampleLiveRecords(Address from, Address until, uint64_t& sampled, uint64_t& live);
 
   Address LogScanForValidity(Address from, faster_t* temp);
   bool ContainsKeyInMemory(key_t key, Address offset);
@@ -294,17 +586,24 @@ class FasterKv {
   static constexpr bool kCopyReadsToTail = false;
   static constexpr uint64_t kGcHashTableChunkSize = 16384;
   static constexpr uint64_t kGrowHashTableChunkSize = 16384;
+  /// Upper bound on a single coalesced MultiRead() I/O.
+  static constexpr uint64_t kMaxMultiReadIoSize = 65536;
+  /// When a disk chain walk hops back by at most this many bytes, the next read also fetches
+  /// this many bytes below the next record, hoping to find the hop after it there too.
+  static constexpr uint32_t kDiskChainReadAheadSize = 16384;
 
-  bool fold_over_snapshot = true;
+  /// The cold log, if the store has one (else unused).
+  bool use_cold_log_;
+  cold_log_t cold_log_;
 
   /// Initial size of the table
   uint64_t min_table_size_;
 
   // Allocator for the hash buckets that don't fit in the hash table.
-  MallocFixedPageSize<HashBucket, disk_t> overflow_buckets_allocator_[2];
+  MallocFixedPageSize<hash_bucket_t, disk_t> overflow_buckets_allocator_[2];
 
   // An array of size two, that contains the old and new versions of the hash-table
-  InternalHashTable<disk_t> state_[2];
+  InternalHashTable<disk_t, hash_bucket_t> state_[2];
 
   CheckpointLocks checkpoint_locks_;
 
@@ -314,21 +613,64 @@ class FasterKv {
 
   /// Checkpoint/recovery state.
   CheckpointState<file_t> checkpoint_;
+  /// The most recent index checkpoint, if it succeeded (else empty); incremental index
+  /// checkpoints build on it.
+  Guid last_index_token_;
+  /// Likewise, the most recent snapshot of the log, and its version; delta snapshots build on it.
+  Guid last_snapshot_token_;
+  uint32_t last_snapshot_version_;
+  /// Which old checkpoints to delete; see SetCheckpointRetention().
+  CheckpointRetention checkpoint_retention_;
   /// Garbage collection state.
   GcState gc_;
   /// Grow (hash table) state.
   GrowState grow_;
+  /// Parked sessions (see ParkSession()), by thread ID. Parking and unparking a session, and
+  /// advancing parked sessions, hold "parked_mutex_".
+  std::mutex parked_mutex_;
+  bool parked_[Thread::kMaxNumThreads];
+  std::atomic<uint32_t> num_parked_;
+  /// Sessions waiting for a commit (see Commit()), by thread ID: the callback, the serial number
+  /// that the commit makes durable, the log address that it flushes up to, and (once the flush is
+  /// recorded) the result.
+  commit_callback_t commit_callbacks_[Thread::kMaxNumThreads];
+  uint64_t commit_serial_nums_[Thread::kMaxNumThreads];
+  Address commit_addresses_[Thread::kMaxNumThreads];
+  Status commit_results_[Thread::kMaxNumThreads];
+  /// What the commits so far have made durable, as last written to the commit files (which are
+  /// written in turn), and the number of writes. The waiting sessions' state above is guarded by
+  /// "commit_mutex_", too.
+  std::mutex commit_mutex_;
+  LogMetadata commit_metadata_;
+  uint64_t num_commit_writes_;
 
   /// Global count of pending I/Os, used for throttling.
   std::atomic<uint64_t> num_pending_ios;
+  /// Disk chain-walk statistics.
+  std::atomic<uint64_t> disk_chain_hops_;
+  std::atomic<uint64_t> buffered_disk_chain_hops_;
+  /// Sizes of the records that reads found on disk; see FirstIoRequestSize().
+  RecordSizeHistogram disk_record_sizes_;
+
+  /// While a full checkpoint runs, the buckets that records appended to the log belong to; lazy
+  /// recovery from the checkpoint has to replay only those.
+  std::atomic<bool> track_fuzzy_buckets_;
+  FuzzyBucketSet fuzzy_buckets_;
+  /// Lazy recovery state: the buckets still being replayed, by "recovery_thread_".
+  std::atomic<bool> lazy_recovery_;
+  FuzzyBucketSet recovering_buckets_;
+  Status lazy_recovery_status_;
+  std::thread recovery_thread_;
+  /// Threads for chunked maintenance work, if any.
+  MaintenancePool maintenance_pool_;
 
   /// Space for two contexts per thread, stored inline.
   ThreadContext thread_contexts_[Thread::kMaxNumThreads];
 };
 
 // Implementations.
-template <class K, class V, class D>
-inline Guid FasterKv<K, V, D>::StartSession() {
+template <class K, class V, class D, class B>
+inline Guid FasterKv<K, V, D, B>::StartSession() {
   SystemState state = system_state_.load();
   if(state.phase != Phase::REST) {
     throw std::runtime_error{ "Can acquire only in REST phase!" };
@@ -338,8 +680,8 @@ inline Guid FasterKv<K, V, D>::StartSession() {
   return thread_ctx().guid;
 }
 
-template <class K, class V, class D>
-inline uint64_t FasterKv<K, V, D>::ContinueSession(const Guid& session_id) {
+template <class K, class V, class D, class B>
+inline uint64_t FasterKv<K, V, D, B>::ContinueSession(const Guid& session_id) {
   auto iter = checkpoint_.continue_tokens.find(session_id);
   if(iter == checkpoint_.continue_tokens.end()) {
     throw std::invalid_argument{ "Unknown session ID" };
@@ -354,9 +696,12 @@ inline uint64_t FasterKv<K, V, D>::ContinueSession(const Guid& session_id) {
   return iter->second;
 }
 
-template <class K, class V, class D>
-inline void FasterKv<K, V, D>::Refresh() {
+template <class K, class V, class D, class B>
+inline void FasterKv<K, V, D, B>::Refresh() {
   epoch_.ProtectAndDrain();
+  if(commit_callbacks_[Thread::id()]) {
+    CompleteCommit();
+  }
   // We check if we are in normal mode
   SystemState new_state = system_state_.load();
   if(thread_ctx().phase == Phase::REST && new_state.phase == Phase::REST) {
@@ -365,12 +710,17 @@ inline void FasterKv<K, V, D>::Refresh() {
   HandleSpecialPhases();
 }
 
-template <class K, class V, class D>
-inline void FasterKv<K, V, D>::StopSession() {
-  // If this thread is still involved in some activity, wait until it finishes.
+template <class K, class V, class D, class B>
+inline void FasterKv<K, V, D, B>::StopSession() {
+  if(parked_[Thread::id()]) {
+    UnparkSession();
+  }
+  // If this thread is still involved in some activity (or waiting for a commit), wait until it
+  // finishes.
   while(thread_ctx().phase != Phase::REST ||
         !thread_ctx().pending_ios.empty() ||
-        !thread_ctx().retry_requests.empty()) {
+        !thread_ctx().retry_requests.empty() ||
+        commit_callbacks_[Thread::id()]) {
     CompletePending(false);
     std::this_thread::yield();
   }
@@ -388,26 +738,105 @@ inline void FasterKv<K, V, D>::StopSession() {
   epoch_.Unprotect();
 }
 
-template <class K, class V, class D>
-inline const AtomicHashBucketEntry* FasterKv<K, V, D>::FindEntry(KeyHash hash,
-    HashBucketEntry& expected_entry) const {
+template <class K, class V, class D, class B>
+void FasterKv<K, V, D, B>::ParkSession() {
+  assert(!parked_[Thread::id()]);
+  // A parked session has no requests in flight, and isn't waiting for a commit.
+  while(!thread_ctx().pending_ios.empty() || !thread_ctx().retry_requests.empty() ||
+        !prev_thread_ctx().pending_ios.empty() || !prev_thread_ctx().retry_requests.empty() ||
+        commit_callbacks_[Thread::id()]) {
+    CompletePending(false);
+    std::this_thread::yield();
+  }
+  // Splitting the hash table reads records in memory, so needs an active session: a session that
+  // parks while the index grows helps split it first.
+  do {
+    Refresh();
+  } while(thread_ctx().phase == Phase::GROW_PREPARE);
+
+  std::vector<uint64_t> callback_serial_nums;
+  typename CheckpointState<file_t>::hybrid_log_persistence_callback_t callback;
+  {
+    std::lock_guard<std::mutex> lock{ parked_mutex_ };
+    Phase phase = thread_ctx().phase;
+    if(phase == Phase::WAIT_FLUSH && !epoch_.HasThreadFinishedPhase(phase)) {
+      // Write the session's context now; from here on, other threads will advance it.
+      WriteCprContext(prev_thread_ctx());
+    }
+    parked_[Thread::id()] = true;
+    ++num_parked_;
+    epoch_.Unprotect();
+    epoch_.MarkThreadPhaseFinished(Thread::id(), phase);
+    // The state machine may have moved on since this thread's Refresh().
+    callback = checkpoint_.hybrid_log_persistence_callback;
+    AdvanceParkedSession(Thread::id(), callback_serial_nums);
+  }
+  for(uint64_t serial_num : callback_serial_nums) {
+    callback(Status::Ok, serial_num);
+  }
+  // The current phase may have been waiting only on this session.
+  TryMoveToNextState();
+}
+
+template <class K, class V, class D, class B>
+void FasterKv<K, V, D, B>::UnparkSession() {
+  {
+    std::lock_guard<std::mutex> lock{ parked_mutex_ };
+    assert(parked_[Thread::id()]);
+    parked_[Thread::id()] = false;
+    --num_parked_;
+    // Once other threads stop advancing the session, the state machine has to wait for it again.
+    epoch_.Protect();
+  }
+  // Take part in whatever phase the state machine has moved into since the session was last
+  // advanced.
+  Refresh();
+}
+
+template <class K, class V, class D, class B>
+bool FasterKv<K, V, D, B>::CompleteAction(bool wait) {
+  while(true) {
+    // Let completed I/Os, and epoch actions (such as flushing pages that have just become
+    // read-only), run.
+    disk.TryComplete();
+    epoch_.BumpCurrentEpoch();
+    if(system_state_.load().phase == Phase::GC_IN_PROGRESS) {
+      while(CleanHashTableBuckets()) {
+      }
+    }
+    TryMoveToNextState();
+    if(system_state_.load().action == Action::None) {
+      return true;
+    }
+    if(!wait) {
+      return false;
+    }
+    std::this_thread::yield();
+  }
+}
+
+template <class K, class V, class D, class B>
+inline const AtomicHashBucketEntry* FasterKv<K, V, D, B>::FindEntry(KeyHash hash,
+    uint64_t inline_key, HashBucketEntry& expected_entry, bool cold) const {
   expected_entry = HashBucketEntry::kInvalidEntry;
   // Truncate the hash to get a bucket page_index < state[version].size.
   uint32_t version = resize_info_.version;
-  const HashBucket* bucket = &state_[version].bucket(hash);
+  const hash_bucket_t* bucket = &state_[version].bucket(hash);
   assert(reinterpret_cast<size_t>(bucket) % Constants::kCacheLineBytes == 0);
+  const fingerprint_t fingerprint = hash_bucket_t::Fingerprint(hash, inline_key);
 
   while(true) {
     // Search through the bucket looking for our key. Last entry is reserved
     // for the overflow pointer.
-    for(uint32_t entry_idx = 0; entry_idx < HashBucket::kNumEntries; ++entry_idx) {
+    for(uint32_t entry_idx = 0; entry_idx < hash_bucket_t::kNumEntries; ++entry_idx) {
       HashBucketEntry entry = bucket->entries[entry_idx].load();
       if(entry.unused()) {
         continue;
       }
-      if(hash.tag() == entry.tag()) {
+      if(hash.tag() == entry.tag() && entry.cold() == cold &&
+          bucket->HasFingerprint(entry_idx, fingerprint)) {
         // Found a matching tag. (So, the input hash matches the entry on 14 tag bits +
-        // log_2(table size) address bits.)
+        // fingerprint bits + log_2(table size) address bits.)
         if(!entry.tentative()) {
           // If (final key, return immediately)
           expected_entry = entry;
@@ -429,29 +858,35 @@ inline const AtomicHashBucketEntry* FasterKv<K, V, D>::FindEntry(KeyHash hash,
   return nullptr; // NOT REACHED
 }
 
-template <class K, class V, class D>
-inline AtomicHashBucketEntry* FasterKv<K, V, D>::FindTentativeEntry(KeyHash hash,
-    HashBucket* bucket,
-    uint8_t version, HashBucketEntry& expected_entry) {
+template <class K, class V, class D, class B>
+inline AtomicHashBucketEntry* FasterKv<K, V, D, B>::FindTentativeEntry(KeyHash hash,
+    fingerprint_t fingerprint, hash_bucket_t* bucket,
+    uint8_t version, hash_bucket_t*& entry_bucket, uint32_t& entry_idx_out,
+    HashBucketEntry& expected_entry, bool cold) {
   expected_entry = HashBucketEntry::kInvalidEntry;
   AtomicHashBucketEntry* atomic_entry = nullptr;
   // Try to find a slot that contains the right tag or that's free.
   while(true) {
     // Search through the bucket looking for our key. Last entry is reserved
     // for the overflow pointer.
-    for(uint32_t entry_idx = 0; entry_idx < HashBucket::kNumEntries; ++entry_idx) {
+    for(uint32_t entry_idx = 0; entry_idx < hash_bucket_t::kNumEntries; ++entry_idx) {
       HashBucketEntry entry = bucket->entries[entry_idx].load();
       if(entry.unused()) {
         if(!atomic_entry) {
           // Found a free slot; keep track of it, and continue looking for a match.
           atomic_entry = &bucket->entries[entry_idx];
+          entry_bucket = bucket;
+          entry_idx_out = entry_idx;
         }
         continue;
       }
-      if(hash.tag() == entry.tag() && !entry.tentative()) {
+      if(hash.tag() == entry.tag() && entry.cold() == cold && !entry.tentative() &&
+          bucket->HasFingerprint(entry_idx, fingerprint)) {
         // Found a match. (So, the input hash matches the entry on 14 tag bits +
-        // log_2(table size) address bits.) Return it to caller.
+        // fingerprint bits + log_2(table size) address bits.) Return it to caller.
         expected_entry = entry;
+        entry_bucket = bucket;
+        entry_idx_out = entry_idx;
         return &bucket->entries[entry_idx];
       }
     }
@@ -477,8 +912,11 @@ inline AtomicHashBucketEntry* FasterKv<K, V, D>::FindTentativeEntry(KeyHash hash
         overflow_buckets_allocator_[version].FreeAtEpoch(new_bucket_addr, 0);
       } else {
         // Install succeeded; we have a new bucket on the chain. Return its first slot.
+        state_[version].MarkDirty(hash);
         bucket = &overflow_buckets_allocator_[version].Get(new_bucket_addr);
         assert(expected_entry == HashBucketEntry::kInvalidEntry);
+        entry_bucket = bucket;
+        entry_idx_out = 0;
         return &bucket->entries[0];
       }
     }
@@ -490,16 +928,19 @@ inline AtomicHashBucketEntry* FasterKv<K, V, D>::FindTentativeEntry(KeyHash hash
   return nullptr; // NOT REACHED
 }
 
-template <class K, class V, class D>
-bool FasterKv<K, V, D>::HasConflictingEntry(KeyHash hash, const HashBucket* bucket, uint8_t version,
+template <class K, class V, class D, class B>
+bool FasterKv<K, V, D, B>::HasConflictingEntry(fingerprint_t fingerprint,
+    const hash_bucket_t* bucket, uint8_t version,
     const AtomicHashBucketEntry* atomic_entry) const {
   uint16_t tag = atomic_entry->load().tag();
+  bool cold = atomic_entry->load().cold();
   while(true) {
-    for(uint32_t entry_idx = 0; entry_idx < HashBucket::kNumEntries; ++entry_idx) {
+    for(uint32_t entry_idx = 0; entry_idx < hash_bucket_t::kNumEntries; ++entry_idx) {
       HashBucketEntry entry = bucket->entries[entry_idx].load();
       if(entry != HashBucketEntry::kInvalidEntry &&
-          entry.tag() == tag &&
-          atomic_entry != &bucket->entries[entry_idx]) {
+          entry.tag() == tag && entry.cold() == cold &&
+          atomic_entry != &bucket->entries[entry_idx] &&
+          bucket->HasFingerprint(entry_idx, fingerprint)) {
         // Found a conflict.
         return true;
       }
@@ -516,19 +957,22 @@ bool FasterKv<K, V, D>::HasConflictingEntry(KeyHash hash, const HashBucket* buck
   }
 }
 
-template <class K, class V, class D>
-inline AtomicHashBucketEntry* FasterKv<K, V, D>::FindOrCreateEntry(KeyHash hash,
-    HashBucketEntry& expected_entry) {
+template <class K, class V, class D, class B>
+inline AtomicHashBucketEntry* FasterKv<K, V, D, B>::FindOrCreateEntry(KeyHash hash,
+    uint64_t inline_key, HashBucketEntry& expected_entry, bool cold) {
   // Truncate the hash to get a bucket page_index < state[version].size.
   const uint32_t version = resize_info_.version;
   assert(version <= 1);
+  const fingerprint_t fingerprint = hash_bucket_t::Fingerprint(hash, inline_key);
 
   while(true) {
-    HashBucket* bucket = &state_[version].bucket(hash);
+    hash_bucket_t* bucket = &state_[version].bucket(hash);
     assert(reinterpret_cast<size_t>(bucket) % Constants::kCacheLineBytes == 0);
 
-    AtomicHashBucketEntry* atomic_entry = FindTentativeEntry(hash, bucket, version,
-                                          expected_entry);
+    hash_bucket_t* entry_bucket;
+    uint32_t entry_idx;
+    AtomicHashBucketEntry* atomic_entry = FindTentativeEntry(hash, fingerprint, bucket, version,
+                                          entry_bucket, entry_idx, expected_entry, cold);
     if(expected_entry != HashBucketEntry::kInvalidEntry) {
       // Found an existing hash bucket entry; nothing further to check.
       return atomic_entry;
@@ -537,17 +981,20 @@ inline AtomicHashBucketEntry* FasterKv<K, V, D>::FindOrCreateEntry(KeyHash hash,
     assert(atomic_entry);
     assert(expected_entry == HashBucketEntry::kInvalidEntry);
     // Try to install tentative tag in free slot.
-    HashBucketEntry entry{ Address::kInvalidAddress, hash.tag(), true };
+    HashBucketEntry entry{ Address::kInvalidAddress, hash.tag(), true, cold };
     if(atomic_entry->compare_exchange_strong(expected_entry, entry)) {
+      // The slot is ours; publish its fingerprint before it stops being tentative.
+      entry_bucket->set_fingerprint(entry_idx, fingerprint);
       // See if some other thread is also trying to install this tag.
-      if(HasConflictingEntry(hash, bucket, version, atomic_entry)) {
+      if(HasConflictingEntry(fingerprint, bucket, version, atomic_entry)) {
         // Back off and try again.
         atomic_entry->store(HashBucketEntry::kInvalidEntry);
       } else {
         // No other thread was trying to install this tag, so we can clear our entry's "tentative"
         // bit.
-        expected_entry = HashBucketEntry{ Address::kInvalidAddress, hash.tag(), false };
+        expected_entry = HashBucketEntry{ Address::kInvalidAddress, hash.tag(), false, cold };
         atomic_entry->store(expected_entry);
+        state_[version].MarkDirty(hash);
         return atomic_entry;
       }
     }
@@ -556,9 +1003,30 @@ inline AtomicHashBucketEntry* FasterKv<K, V, D>::FindOrCreateEntry(KeyHash hash,
   return nullptr; // NOT REACHED
 }
 
-template <class K, class V, class D>
+template <class K, class V, class D, class B>
+inline bool FasterKv<K, V, D, B>::FindColdEntry(KeyHash hash, uint64_t inline_key,
+    HashBucketEntry& entry) const {
+  // (An entry that the cold log's appender has just created doesn't lead anywhere, yet.)
+  return use_cold_log_ && FindEntry(hash, inline_key, entry, true) != nullptr &&
+         entry.address() >= cold_log_.begin_address.load();
+}
+
+template <class K, class V, class D, class B>
+template <class C>
+inline OperationStatus FasterKv<K, V, D, B>::ReadFromColdLog(C& pending_context) const {
+  HashBucketEntry cold_entry;
+  if(!FindColdEntry(pending_context.get_key_hash(), pending_context.get_inline_key(),
+                    cold_entry)) {
+    return OperationStatus::NOT_FOUND;
+  }
+  pending_context.go_async(thread_ctx().phase, thread_ctx().version, cold_entry.address(),
+                           HashBucketEntry::kInvalidEntry, true);
+  return OperationStatus::RECORD_ON_DISK;
+}
+
+template <class K, class V, class D, class B>
 template <class RC>
-inline Status FasterKv<K, V, D>::Read(RC& context, AsyncCallback callback,
+inline Status FasterKv<K, V, D, B>::Read(RC& context, AsyncCallback callback,
                                       uint64_t monotonic_serial_num) {
   typedef RC read_context_t;
   typedef PendingReadContext<RC> pending_read_context_t;
@@ -575,7 +1043,8 @@ inline Status FasterKv<K, V, D>::Read(RC& context, AsyncCallback callback,
   } else if(internal_status == OperationStatus::NOT_FOUND) {
     status = Status::NotFound;
   } else {
-    assert(internal_status == OperationStatus::RECORD_ON_DISK);
+    assert(internal_status == OperationStatus::RECORD_ON_DISK ||
+           internal_status == OperationStatus::RETRY_LATER);
     bool async;
     status = HandleOperationStatus(thread_ctx(), pending_context, internal_status, async);
   }
@@ -583,9 +1052,64 @@ inline Status FasterKv<K, V, D>::Read(RC& context, AsyncCallback callback,
   return status;
 }
 
-template <class K, class V, class D>
+template <class K, class V, class D, class B>
+template <class F>
+inline Status FasterKv<K, V, D, B>::ReadInPlace(const key_t& key, const F& visitor,
+    AsyncCallback callback, uint64_t monotonic_serial_num) {
+  InPlaceReadContext<key_t, value_t, F> context{ key, visitor };
+  return Read(context, callback, monotonic_serial_num);
+}
+
+template <class K, class V, class D, class B>
+template <class RC>
+inline Status FasterKv<K, V, D, B>::MultiRead(RC* contexts, size_t num_contexts, Status* results,
+    AsyncCallback callback, uint64_t monotonic_serial_num) {
+  typedef RC read_context_t;
+  typedef PendingReadContext<RC> pending_read_context_t;
+  static_assert(std::is_base_of<value_t, typename read_context_t::value_t>::value,
+                "value_t is not a base class of read_context_t::value_t");
+  static_assert(alignof(value_t) == alignof(typename read_context_t::value_t),
+                "alignof(value_t) != alignof(typename read_context_t::value_t)");
+
+  Status status = Status::Ok;
+  std::vector<AsyncIOContext*> reads;
+  for(size_t idx = 0; idx < num_contexts; ++idx) {
+    pending_read_context_t pending_context{ contexts[idx], callback };
+    OperationStatus internal_status = InternalRead(pending_context);
+    if(internal_status == OperationStatus::SUCCESS) {
+      results[idx] = Status::Ok;
+    } else if(internal_status == OperationStatus::NOT_FOUND) {
+      results[idx] = Status::NotFound;
+    } else if(internal_status == OperationStatus::RECORD_ON_DISK &&
+              thread_ctx().phase == Phase::REST && !pending_context.cold) {
+      // Hold the I/O back, so it can be merged with its neighbors'. (Outside of REST, the read
+      // might need a checkpoint lock, so it takes the usual path, below.)
+      uint64_t io_id = thread_ctx().io_id++;
+      AsyncIOContext io_request{ this, pending_context.address, &pending_context,
+                                 &thread_ctx().io_responses, io_id };
+      IAsyncContext* io_request_copy;
+      results[idx] = io_request.DeepCopy(io_request_copy);
+      if(results[idx] == Status::Ok) {
+        thread_ctx().pending_ios.insert({ io_id, pending_context.get_key_hash() });
+        reads.push_back(static_cast<AsyncIOContext*>(io_request_copy));
+        results[idx] = Status::Pending;
+      }
+    } else {
+      bool async;
+      results[idx] = HandleOperationStatus(thread_ctx(), pending_context, internal_status, async);
+    }
+    if(results[idx] == Status::Pending) {
+      status = Status::Pending;
+    }
+  }
+  IssueMultiReadIoRequests(reads);
+  thread_ctx().serial_num = monotonic_serial_num;
+  return status;
+}
+
+template <class K, class V, class D, class B>
 template <class UC>
-inline Status FasterKv<K, V, D>::Upsert(UC& context, AsyncCallback callback,
+inline Status FasterKv<K, V, D, B>::Upsert(UC& context, AsyncCallback callback,
                                         uint64_t monotonic_serial_num) {
   typedef UC upsert_context_t;
   typedef PendingUpsertContext<UC> pending_upsert_context_t;
@@ -608,9 +1132,9 @@ inline Status FasterKv<K, V, D>::Upsert(UC& context, AsyncCallback callback,
   return status;
 }
 
-template <class K, class V, class D>
+template <class K, class V, class D, class B>
 template <class MC>
-inline Status FasterKv<K, V, D>::Rmw(MC& context, AsyncCallback callback,
+inline Status FasterKv<K, V, D, B>::Rmw(MC& context, AsyncCallback callback,
                                      uint64_t monotonic_serial_num) {
   typedef MC rmw_context_t;
   typedef PendingRmwContext<MC> pending_rmw_context_t;
@@ -632,9 +1156,33 @@ inline Status FasterKv<K, V, D>::Rmw(MC& context, AsyncCallback callback,
   return status;
 }
 
-template <class K, class V, class D>
+template <class K, class V, class D, class B>
+template <class CC>
+inline Status FasterKv<K, V, D, B>::ConditionalUpsert(CC& context, AsyncCallback callback,
+    uint64_t monotonic_serial_num) {
+  typedef CC conditional_upsert_context_t;
+  typedef PendingConditionalUpsertContext<CC> pending_conditional_upsert_context_t;
+  static_assert(std::is_base_of<value_t, typename conditional_upsert_context_t::value_t>::value,
+                "value_t is not a base class of conditional_upsert_context_t::value_t");
+  static_assert(alignof(value_t) == alignof(typename conditional_upsert_context_t::value_t),
+                "alignof(value_t) != alignof(typename conditional_upsert_context_t::value_t)");
+
+  pending_conditional_upsert_context_t pending_context{ context, callback };
+  OperationStatus internal_status = InternalRmw(pending_context, false);
+  Status status;
+  if(internal_status == OperationStatus::SUCCESS) {
+    status = Status::Ok;
+  } else {
+    bool async;
+    status = HandleOperationStatus(thread_ctx(), pending_context, internal_status, async);
+  }
+  thread_ctx().serial_num = monotonic_serial_num;
+  return status;
+}
+
+template <class K, class V, class D, class B>
 template <class DC>
-inline Status FasterKv<K, V, D>::Delete(DC& context, AsyncCallback callback,
+inline Status FasterKv<K, V, D, B>::Delete(DC& context, AsyncCallback callback,
                                         uint64_t monotonic_serial_num) {
   typedef DC delete_context_t;
   typedef PendingDeleteContext<DC> pending_delete_context_t;
@@ -658,8 +1206,8 @@ inline Status FasterKv<K, V, D>::Delete(DC& context, AsyncCallback callback,
   return status;
 }
 
-template <class K, class V, class D>
-inline bool FasterKv<K, V, D>::CompletePending(bool wait) {
+template <class K, class V, class D, class B>
+inline bool FasterKv<K, V, D, B>::CompletePending(bool wait) {
   do {
     disk.TryComplete();
 
@@ -685,8 +1233,8 @@ inline bool FasterKv<K, V, D>::CompletePending(bool wait) {
   return false;
 }
 
-template <class K, class V, class D>
-inline void FasterKv<K, V, D>::CompleteIoPendingRequests(ExecutionContext& context) {
+template <class K, class V, class D, class B>
+inline void FasterKv<K, V, D, B>::CompleteIoPendingRequests(ExecutionContext& context) {
   AsyncIOContext* ctxt;
   // Clear this thread's I/O response queue. (Does not clear I/Os issued by this thread that have
   // not yet completed.)
@@ -721,8 +1269,8 @@ inline void FasterKv<K, V, D>::CompleteIoPendingRequests(ExecutionContext& conte
   }
 }
 
-template <class K, class V, class D>
-inline void FasterKv<K, V, D>::CompleteRetryRequests(ExecutionContext& context) {
+template <class K, class V, class D, class B>
+inline void FasterKv<K, V, D, B>::CompleteRetryRequests(ExecutionContext& context) {
   // If we can't complete a request, it will be pushed back onto the deque. Retry each request
   // only once.
   size_t size = context.retry_requests.size();
@@ -732,6 +1280,11 @@ inline void FasterKv<K, V, D>::CompleteRetryRequests(ExecutionContext& context)
     // Issue retry command
     OperationStatus internal_status;
     switch(pending_context->type) {
+    case OperationType::Read:
+      // (Only lazy recovery puts off reads and deletes.)
+      internal_status = InternalRead(
+                          *static_cast<async_pending_read_context_t*>(pending_context.get()));
+      break;
     case OperationType::RMW:
       internal_status = InternalRetryPendingRmw(
                           *static_cast<async_pending_rmw_context_t*>(pending_context.get()));
@@ -740,6 +1293,10 @@ inline void FasterKv<K, V, D>::CompleteRetryRequests(ExecutionContext& context)
       internal_status = InternalUpsert(
                           *static_cast<async_pending_upsert_context_t*>(pending_context.get()));
       break;
+    case OperationType::Delete:
+      internal_status = InternalDelete(
+                          *static_cast<async_pending_delete_context_t*>(pending_context.get()));
+      break;
     default:
       assert(false);
       throw std::runtime_error{ "Cannot happen!" };
@@ -748,6 +1305,8 @@ inline void FasterKv<K, V, D>::CompleteRetryRequests(ExecutionContext& context)
     Status result;
     if(internal_status == OperationStatus::SUCCESS) {
       result = Status::Ok;
+    } else if(internal_status == OperationStatus::NOT_FOUND) {
+      result = Status::NotFound;
     } else {
       result = HandleOperationStatus(context, *pending_context.get(), internal_status,
                                      pending_context.async);
@@ -760,9 +1319,9 @@ inline void FasterKv<K, V, D>::CompleteRetryRequests(ExecutionContext& context)
   }
 }
 
-template <class K, class V, class D>
+template <class K, class V, class D, class B>
 template <class C>
-inline OperationStatus FasterKv<K, V, D>::InternalRead(C& pending_context) const {
+inline OperationStatus FasterKv<K, V, D, B>::InternalRead(C& pending_context) const {
   typedef C pending_read_context_t;
 
   if(thread_ctx().phase != Phase::REST) {
@@ -770,11 +1329,15 @@ inline OperationStatus FasterKv<K, V, D>::InternalRead(C& pending_context) const
   }
 
   KeyHash hash = pending_context.get_key_hash();
+  if(IsRecovering(hash)) {
+    return OperationStatus::RETRY_LATER;
+  }
   HashBucketEntry entry;
-  const AtomicHashBucketEntry* atomic_entry = FindEntry(hash, entry);
+  const AtomicHashBucketEntry* atomic_entry = FindEntry(hash, pending_context.get_inline_key(),
+      entry);
   if(!atomic_entry) {
-    // no record found
-    return OperationStatus::NOT_FOUND;
+    // no record found (in the hybrid log)
+    return ReadFromColdLog(pending_context);
   }
 
   Address address = entry.address();
@@ -811,7 +1374,8 @@ inline OperationStatus FasterKv<K, V, D>::InternalRead(C& pending_context) const
   if(address >= safe_read_only_address) {
     // Mutable or fuzzy region
     // concurrent read
-    if (reinterpret_cast<const record_t*>(hlog.Get(address))->header.tombstone) {
+    const record_t* record = reinterpret_cast<const record_t*>(hlog.Get(address));
+    if(record->header.tombstone || record->expired()) {
       return OperationStatus::NOT_FOUND;
     }
     pending_context.GetAtomic(hlog.Get(address));
@@ -819,7 +1383,8 @@ inline OperationStatus FasterKv<K, V, D>::InternalRead(C& pending_context) const
   } else if(address >= head_address) {
     // Immutable region
     // single-thread read
-    if (reinterpret_cast<const record_t*>(hlog.Get(address))->header.tombstone) {
+    const record_t* record = reinterpret_cast<const record_t*>(hlog.Get(address));
+    if(record->header.tombstone || record->expired()) {
       return OperationStatus::NOT_FOUND;
     }
     pending_context.Get(hlog.Get(address));
@@ -829,14 +1394,14 @@ inline OperationStatus FasterKv<K, V, D>::InternalRead(C& pending_context) const
     pending_context.go_async(thread_ctx().phase, thread_ctx().version, address, entry);
     return OperationStatus::RECORD_ON_DISK;
   } else {
-    // No record found
-    return OperationStatus::NOT_FOUND;
+    // No record found (in the hybrid log)
+    return ReadFromColdLog(pending_context);
   }
 }
 
-template <class K, class V, class D>
+template <class K, class V, class D, class B>
 template <class C>
-inline OperationStatus FasterKv<K, V, D>::InternalUpsert(C& pending_context) {
+inline OperationStatus FasterKv<K, V, D, B>::InternalUpsert(C& pending_context) {
   typedef C pending_upsert_context_t;
 
   if(thread_ctx().phase != Phase::REST) {
@@ -844,8 +1409,12 @@ inline OperationStatus FasterKv<K, V, D>::InternalUpsert(C& pending_context) {
   }
 
   KeyHash hash = pending_context.get_key_hash();
+  if(IsRecovering(hash)) {
+    return OperationStatus::RETRY_LATER;
+  }
   HashBucketEntry expected_entry;
-  AtomicHashBucketEntry* atomic_entry = FindOrCreateEntry(hash, expected_entry);
+  AtomicHashBucketEntry* atomic_entry = FindOrCreateEntry(hash,
+                                        pending_context.get_inline_key(), expected_entry);
 
   // (Note that address will be Address::kInvalidAddress, if the atomic_entry was created.)
   Address address = expected_entry.address();
@@ -869,6 +1438,7 @@ inline OperationStatus FasterKv<K, V, D>::InternalUpsert(C& pending_context) {
   if(thread_ctx().phase == Phase::REST && address >= read_only_address) {
     record_t* record = reinterpret_cast<record_t*>(hlog.Get(address));
     if(!record->header.tombstone && pending_context.PutAtomic(record)) {
+      hlog.MarkPageModified(address.page(), thread_ctx().version);
       return OperationStatus::SUCCESS;
     } else {
       // Must retry as RCU.
@@ -940,6 +1510,7 @@ inline OperationStatus FasterKv<K, V, D>::InternalUpsert(C& pending_context) {
     record_t* record = reinterpret_cast<record_t*>(hlog.Get(address));
     if(!record->header.tombstone && pending_context.PutAtomic(record)) {
       // Host successfully replaced record, atomically.
+      hlog.MarkPageModified(address.page(), thread_ctx().version);
       return OperationStatus::SUCCESS;
     } else {
       // Must retry as RCU.
@@ -950,7 +1521,7 @@ inline OperationStatus FasterKv<K, V, D>::InternalUpsert(C& pending_context) {
   // Create a record and attempt RCU.
 create_record:
   uint32_t record_size = record_t::size(pending_context.key_size(), pending_context.value_size());
-  Address new_address = BlockAllocate(record_size);
+  Address new_address = BlockAllocate(record_size, hash);
   record_t* record = reinterpret_cast<record_t*>(hlog.Get(new_address));
   new(record) record_t{
     RecordInfo{
@@ -964,6 +1535,7 @@ create_record:
 
   if(atomic_entry->compare_exchange_strong(expected_entry, updated_entry)) {
     // Installed the new record in the hash table.
+    MarkIndexDirty(hash);
     return OperationStatus::SUCCESS;
   } else {
     // Try again.
@@ -972,9 +1544,9 @@ create_record:
   }
 }
 
-template <class K, class V, class D>
+template <class K, class V, class D, class B>
 template <class C>
-inline OperationStatus FasterKv<K, V, D>::InternalRmw(C& pending_context, bool retrying) {
+inline OperationStatus FasterKv<K, V, D, B>::InternalRmw(C& pending_context, bool retrying) {
   typedef C pending_rmw_context_t;
 
   Phase phase = retrying ? pending_context.phase : thread_ctx().phase;
@@ -985,8 +1557,17 @@ inline OperationStatus FasterKv<K, V, D>::InternalRmw(C& pending_context, bool r
   }
 
   KeyHash hash = pending_context.get_key_hash();
+  if(IsRecovering(hash)) {
+    if(!retrying) {
+      // (The retry runs as of this phase and version.)
+      pending_context.go_async(phase, version, Address::kInvalidAddress,
+                               HashBucketEntry::kInvalidEntry);
+    }
+    return OperationStatus::RETRY_LATER;
+  }
   HashBucketEntry expected_entry;
-  AtomicHashBucketEntry* atomic_entry = FindOrCreateEntry(hash, expected_entry);
+  AtomicHashBucketEntry* atomic_entry = FindOrCreateEntry(hash,
+                                        pending_context.get_inline_key(), expected_entry);
 
   // (Note that address will be Address::kInvalidAddress, if the atomic_entry was created.)
   Address address = expected_entry.address();
@@ -1011,9 +1592,11 @@ inline OperationStatus FasterKv<K, V, D>::InternalRmw(C& pending_context, bool r
   // The common case.
   if(phase == Phase::REST && address >= read_only_address) {
     record_t* record = reinterpret_cast<record_t*>(hlog.Get(address));
-    if(!record->header.tombstone && pending_context.RmwAtomic(record)) {
+    if(!record->header.tombstone && !record->expired() && pending_context.RmwAtomic(record)) {
       // In-place RMW succeeded.
-      return OperationStatus::SUCCESS;
+      hlog.MarkPageModified(address.page(), thread_ctx().version);
+      return pending_context.condition_failed ? OperationStatus::CONDITION_FAILED :
+             OperationStatus::SUCCESS;
     } else {
       // Must retry as RCU.
       goto create_record;
@@ -1092,9 +1675,11 @@ inline OperationStatus FasterKv<K, V, D>::InternalRmw(C& pending_context, bool r
     }
     // We acquired the necessary locks, so so we can update the record's bucket atomically.
     record_t* record = reinterpret_cast<record_t*>(hlog.Get(address));
-    if(!record->header.tombstone && pending_context.RmwAtomic(record)) {
+    if(!record->header.tombstone && !record->expired() && pending_context.RmwAtomic(record)) {
       // In-place RMW succeeded.
-      return OperationStatus::SUCCESS;
+      hlog.MarkPageModified(address.page(), thread_ctx().version);
+      return pending_context.condition_failed ? OperationStatus::CONDITION_FAILED :
+             OperationStatus::SUCCESS;
     } else {
       // Must retry as RCU.
       goto create_record;
@@ -1124,18 +1709,43 @@ inline OperationStatus FasterKv<K, V, D>::InternalRmw(C& pending_context, bool r
 
   // Create a record and attempt RCU.
 create_record:
+  if(address >= begin_address && address < head_address) {
+    // (The checkpoint phases, above, can get here with the latest record still on disk.) Need to
+    // obtain old record from disk.
+    if(!retrying) {
+      pending_context.go_async(phase, version, address, expected_entry);
+    } else {
+      pending_context.continue_async(address, expected_entry);
+    }
+    return OperationStatus::RECORD_ON_DISK;
+  }
+  HashBucketEntry cold_entry;
+  if(address < begin_address &&
+      FindColdEntry(hash, pending_context.get_inline_key(), cold_entry)) {
+    // The hybrid log has no record for the key; the cold log may.
+    if(!retrying) {
+      pending_context.go_async(phase, version, cold_entry.address(), expected_entry, true);
+    } else {
+      pending_context.continue_async(cold_entry.address(), expected_entry, true);
+    }
+    return OperationStatus::RECORD_ON_DISK;
+  }
   const record_t* old_record = nullptr;
   if(address >= head_address) {
     old_record = reinterpret_cast<const record_t*>(hlog.Get(address));
-    if(old_record->header.tombstone) {
+    if(old_record->header.tombstone || old_record->expired()) {
       old_record = nullptr;
     }
   }
+  if(!pending_context.RmwCheck(old_record, address)) {
+    // A conditional update that doesn't apply; the record stays as it is.
+    return OperationStatus::CONDITION_FAILED;
+  }
   uint32_t record_size = old_record != nullptr ?
     record_t::size(pending_context.key_size(), pending_context.value_size(old_record)) :
     record_t::size(pending_context.key_size(), pending_context.value_size());
 
-  Address new_address = BlockAllocate(record_size);
+  Address new_address = BlockAllocate(record_size, hash);
   record_t* new_record = reinterpret_cast<record_t*>(hlog.Get(new_address));
 
   // Allocating a block may have the side effect of advancing the head address.
@@ -1172,6 +1782,7 @@ create_record:
 
   HashBucketEntry updated_entry{ new_address, hash.tag(), false };
   if(atomic_entry->compare_exchange_strong(expected_entry, updated_entry)) {
+    MarkIndexDirty(hash);
     return OperationStatus::SUCCESS;
   } else {
     // CAS failed; try again.
@@ -1185,19 +1796,22 @@ create_record:
   }
 }
 
-template <class K, class V, class D>
-inline OperationStatus FasterKv<K, V, D>::InternalRetryPendingRmw(
+template <class K, class V, class D, class B>
+inline OperationStatus FasterKv<K, V, D, B>::InternalRetryPendingRmw(
   async_pending_rmw_context_t& pending_context) {
   OperationStatus status = InternalRmw(pending_context, true);
   if(status == OperationStatus::SUCCESS && pending_context.version != thread_ctx().version) {
     status = OperationStatus::SUCCESS_UNMARK;
+  } else if(status == OperationStatus::CONDITION_FAILED &&
+            pending_context.version != thread_ctx().version) {
+    status = OperationStatus::CONDITION_FAILED_UNMARK;
   }
   return status;
 }
 
-template <class K, class V, class D>
+template <class K, class V, class D, class B>
 template<class C>
-inline OperationStatus FasterKv<K, V, D>::InternalDelete(C& pending_context) {
+inline OperationStatus FasterKv<K, V, D, B>::InternalDelete(C& pending_context) {
   typedef C pending_delete_context_t;
 
   if(thread_ctx().phase != Phase::REST) {
@@ -1205,11 +1819,21 @@ inline OperationStatus FasterKv<K, V, D>::InternalDelete(C& pending_context) {
   }
 
   KeyHash hash = pending_context.get_key_hash();
+  if(IsRecovering(hash)) {
+    return OperationStatus::RETRY_LATER;
+  }
   HashBucketEntry expected_entry;
-  AtomicHashBucketEntry* atomic_entry = const_cast<AtomicHashBucketEntry*>(FindEntry(hash, expected_entry));
+  AtomicHashBucketEntry* atomic_entry = const_cast<AtomicHashBucketEntry*>(FindEntry(hash,
+                                        pending_context.get_inline_key(), expected_entry));
+  HashBucketEntry cold_entry;
+  bool in_cold_log = FindColdEntry(hash, pending_context.get_inline_key(), cold_entry);
   if(!atomic_entry) {
-    // no record found
-    return OperationStatus::NOT_FOUND;
+    if(!in_cold_log) {
+      // no record found
+      return OperationStatus::NOT_FOUND;
+    }
+    // The key may be in the cold log; shadow it with a tombstone in the hybrid log.
+    atomic_entry = FindOrCreateEntry(hash, pending_context.get_inline_key(), expected_entry);
   }
 
   Address address = expected_entry.address();
@@ -1283,20 +1907,23 @@ inline OperationStatus FasterKv<K, V, D>::InternalDelete(C& pending_context) {
   if(address >= read_only_address) {
     record_t* record = reinterpret_cast<record_t*>(hlog.Get(address));
     // If the record is the head of the hash chain, try to update the hash chain and completely
-    // elide record only if the previous address points to invalid address
-    if(expected_entry.address() == address) {
+    // elide record only if the previous address points to invalid address (and there's no older
+    // version in the cold log for the tombstone to shadow)
+    if(expected_entry.address() == address && !in_cold_log) {
       Address previous_address = record->header.previous_address();
-      if (previous_address < begin_address) {
-        atomic_entry->compare_exchange_strong(expected_entry, HashBucketEntry::kInvalidEntry);
+      if (previous_address < begin_address &&
+          atomic_entry->compare_exchange_strong(expected_entry, HashBucketEntry::kInvalidEntry)) {
+        MarkIndexDirty(hash);
       }
     }
     record->header.tombstone = true;
+    hlog.MarkPageModified(address.page(), thread_ctx().version);
     return OperationStatus::SUCCESS;
   }
 
 create_record:
   uint32_t record_size = record_t::size(pending_context.key_size(), pending_context.value_size());
-  Address new_address = BlockAllocate(record_size);
+  Address new_address = BlockAllocate(record_size, hash);
   record_t* record = reinterpret_cast<record_t*>(hlog.Get(new_address));
   new(record) record_t{
     RecordInfo{
@@ -1309,6 +1936,7 @@ create_record:
 
   if(atomic_entry->compare_exchange_strong(expected_entry, updated_entry)) {
     // Installed the new record in the hash table.
+    MarkIndexDirty(hash);
     return OperationStatus::SUCCESS;
   } else {
     // Try again.
@@ -1317,9 +1945,9 @@ create_record:
   }
 }
 
-template <class K, class V, class D>
+template <class K, class V, class D, class B>
 template<class C>
-inline Address FasterKv<K, V, D>::TraceBackForKeyMatchCtxt(const C& ctxt, Address from_address,
+inline Address FasterKv<K, V, D, B>::TraceBackForKeyMatchCtxt(const C& ctxt, Address from_address,
     Address min_offset) const {
   while(from_address >= min_offset) {
     const record_t* record = reinterpret_cast<const record_t*>(hlog.Get(from_address));
@@ -1333,8 +1961,8 @@ inline Address FasterKv<K, V, D>::TraceBackForKeyMatchCtxt(const C& ctxt, Addres
   return from_address;
 }
 
-template <class K, class V, class D>
-inline Address FasterKv<K, V, D>::TraceBackForKeyMatch(const key_t& key, Address from_address,
+template <class K, class V, class D, class B>
+inline Address FasterKv<K, V, D, B>::TraceBackForKeyMatch(const key_t& key, Address from_address,
                                                        Address min_offset) const {
   while(from_address >= min_offset) {
     const record_t* record = reinterpret_cast<const record_t*>(hlog.Get(from_address));
@@ -1348,8 +1976,8 @@ inline Address FasterKv<K, V, D>::TraceBackForKeyMatch(const key_t& key, Address
   return from_address;
 }
 
-template <class K, class V, class D>
-inline Status FasterKv<K, V, D>::HandleOperationStatus(ExecutionContext& ctx,
+template <class K, class V, class D, class B>
+inline Status FasterKv<K, V, D, B>::HandleOperationStatus(ExecutionContext& ctx,
     pending_context_t& pending_context, OperationStatus internal_status, bool& async) {
   async = false;
   switch(internal_status) {
@@ -1415,14 +2043,19 @@ inline Status FasterKv<K, V, D>::HandleOperationStatus(ExecutionContext& ctx,
     return Status::NotFound;
   case OperationStatus::CPR_SHIFT_DETECTED:
     return PivotAndRetry(ctx, pending_context, async);
+  case OperationStatus::CONDITION_FAILED:
+    return Status::Aborted;
+  case OperationStatus::CONDITION_FAILED_UNMARK:
+    checkpoint_locks_.get_lock(pending_context.get_key_hash()).unlock_old();
+    return Status::Aborted;
   }
   // not reached
   assert(false);
   return Status::Corruption;
 }
 
-template <class K, class V, class D>
-inline Status FasterKv<K, V, D>::PivotAndRetry(ExecutionContext& ctx,
+template <class K, class V, class D, class B>
+inline Status FasterKv<K, V, D, B>::PivotAndRetry(ExecutionContext& ctx,
     pending_context_t& pending_context, bool& async) {
   // Some invariants
   assert(ctx.version == thread_ctx().version);
@@ -1436,8 +2069,8 @@ inline Status FasterKv<K, V, D>::PivotAndRetry(ExecutionContext& ctx,
   return HandleOperationStatus(thread_ctx(), pending_context, OperationStatus::RETRY_NOW, async);
 }
 
-template <class K, class V, class D>
-inline Status FasterKv<K, V, D>::RetryLater(ExecutionContext& ctx,
+template <class K, class V, class D, class B>
+inline Status FasterKv<K, V, D, B>::RetryLater(ExecutionContext& ctx,
     pending_context_t& pending_context, bool& async) {
   IAsyncContext* context_copy;
   Status result = pending_context.DeepCopy(context_copy);
@@ -1451,15 +2084,15 @@ inline Status FasterKv<K, V, D>::RetryLater(ExecutionContext& ctx,
   }
 }
 
-template <class K, class V, class D>
-inline constexpr uint32_t FasterKv<K, V, D>::MinIoRequestSize() const {
+template <class K, class V, class D, class B>
+inline constexpr uint32_t FasterKv<K, V, D, B>::MinIoRequestSize() const {
   return static_cast<uint32_t>(
            sizeof(value_t) + pad_alignment(record_t::min_disk_key_size(),
                alignof(value_t)));
 }
 
-template <class K, class V, class D>
-inline Status FasterKv<K, V, D>::IssueAsyncIoRequest(ExecutionContext& ctx,
+template <class K, class V, class D, class B>
+inline Status FasterKv<K, V, D, B>::IssueAsyncIoRequest(ExecutionContext& ctx,
     pending_context_t& pending_context, bool& async) {
   // Issue asynchronous I/O request
   uint64_t io_id = thread_ctx().io_id++;
@@ -1467,13 +2100,14 @@ inline Status FasterKv<K, V, D>::IssueAsyncIoRequest(ExecutionContext& ctx,
   async = true;
   AsyncIOContext io_request{ this, pending_context.address, &pending_context,
                              &thread_ctx().io_responses, io_id };
-  AsyncGetFromDisk(pending_context.address, MinIoRequestSize(), AsyncGetFromDiskCallback,
+  io_request.cold = pending_context.cold;
+  AsyncGetFromDisk(pending_context.address, FirstIoRequestSize(), AsyncGetFromDiskCallback,
                    io_request);
   return Status::Pending;
 }
 
-template <class K, class V, class D>
-inline Address FasterKv<K, V, D>::BlockAllocate(uint32_t record_size) {
+template <class K, class V, class D, class B>
+inline Address FasterKv<K, V, D, B>::BlockAllocate(uint32_t record_size, KeyHash hash) {
   uint32_t page;
   Address retval = hlog.Allocate(record_size, page);
   while(retval < hlog.read_only_address.load()) {
@@ -1486,12 +2120,16 @@ inline Address FasterKv<K, V, D>::BlockAllocate(uint32_t record_size) {
     }
     retval = hlog.Allocate(record_size, page);
   }
+  hlog.MarkPageModified(retval.page(), thread_ctx().version);
+  if(track_fuzzy_buckets_.load()) {
+    fuzzy_buckets_.Mark(hash.idx(fuzzy_buckets_.size()));
+  }
   return retval;
 }
 
-template <class K, class V, class D>
-void FasterKv<K, V, D>::AsyncGetFromDisk(Address address, uint32_t num_records,
-    AsyncIOCallback callback, AsyncIOContext& context) {
+template <class K, class V, class D, class B>
+void FasterKv<K, V, D, B>::AsyncGetFromDisk(Address address, uint32_t num_records,
+    AsyncIOCallback callback, AsyncIOContext& context, uint32_t read_ahead_bytes) {
   if(epoch_.IsProtected()) {
     /// Throttling. (Thread pool, unprotected threads are not throttled.)
     while(num_pending_ios.load() > 120) {
@@ -1501,11 +2139,15 @@ void FasterKv<K, V, D>::AsyncGetFromDisk(Address address, uint32_t num_records,
     }
   }
   ++num_pending_ios;
-  hlog.AsyncGetFromDisk(address, num_records, callback, context);
+  if(context.cold) {
+    cold_log_.AsyncGetFromDisk(address, num_records, callback, context, read_ahead_bytes);
+  } else {
+    hlog.AsyncGetFromDisk(address, num_records, callback, context, read_ahead_bytes);
+  }
 }
 
-template <class K, class V, class D>
-void FasterKv<K, V, D>::AsyncGetFromDiskCallback(IAsyncContext* ctxt, Status result,
+template <class K, class V, class D, class B>
+void FasterKv<K, V, D, B>::AsyncGetFromDiskCallback(IAsyncContext* ctxt, Status result,
     size_t bytes_transferred) {
   CallbackContext<AsyncIOContext> context{ ctxt };
   faster_t* faster = reinterpret_cast<faster_t*>(context->faster);
@@ -1519,7 +2161,10 @@ void FasterKv<K, V, D>::AsyncGetFromDiskCallback(IAsyncContext* ctxt, Status res
   context.async = true;
 
   pending_context->result = result;
-  if(result == Status::Ok) {
+  if(result != Status::Ok) {
+    return;
+  }
+  while(true) {
     record_t* record = reinterpret_cast<record_t*>(context->record.GetValidPointer());
     // Size of the record we read from disk (might not have read the entire record, yet).
     size_t record_size = context->record.available_bytes;
@@ -1540,30 +2185,166 @@ void FasterKv<K, V, D>::AsyncGetFromDiskCallback(IAsyncContext* ctxt, Status res
       context.async = true;
     } else if(pending_context->is_key_equal(record->key())) {
       //The keys are same, so I/O is complete
+      faster->disk_record_sizes_.Add(record->disk_size());
       context->thread_io_responses->push(context.get());
     } else {
       //keys are not same. I/O is not complete
+      ++faster->disk_chain_hops_;
+      Address address = context->address;
       context->address = record->header.previous_address();
-      if(context->address >= faster->hlog.begin_address.load()) {
-        faster->AsyncGetFromDisk(context->address, faster->MinIoRequestSize(),
-                                 AsyncGetFromDiskCallback, *context.get());
-        context.async = true;
-      } else {
+      if(context->address < (context->cold ? faster->cold_log_.begin_address.load() :
+                             faster->hlog.begin_address.load())) {
         // Record not found, so I/O is complete.
         context->thread_io_responses->push(context.get());
+        return;
+      }
+      // The buffer holds log addresses [buffer_begin, buffer_end).
+      uint64_t buffer_begin = address.control() - context->record.valid_offset;
+      uint64_t buffer_end = address.control() + context->record.available_bytes;
+      if(context->address.control() >= buffer_begin &&
+          context->address.control() + faster->MinIoRequestSize() <= buffer_end) {
+        // The previous record is (at least partly) in the buffer we already have.
+        ++faster->buffered_disk_chain_hops_;
+        context->record.valid_offset = static_cast<uint32_t>(context->address.control() -
+                                       buffer_begin);
+        context->record.available_bytes = static_cast<uint32_t>(buffer_end -
+                                          context->address.control());
+        continue;
+      }
+      uint32_t read_ahead_bytes = 0;
+      if(address.control() - context->address.control() <= kDiskChainReadAheadSize) {
+        // A short hop suggests a chain of records written close together: read ahead, in the
+        // direction of the walk.
+        read_ahead_bytes = kDiskChainReadAheadSize;
+      }
+      faster->AsyncGetFromDisk(context->address, faster->FirstIoRequestSize(),
+                               AsyncGetFromDiskCallback, *context.get(), read_ahead_bytes);
+      context.async = true;
+    }
+    return;
+  }
+}
+
+template <class K, class V, class D, class B>
+void FasterKv<K, V, D, B>::IssueMultiReadIoRequests(std::vector<AsyncIOContext*>& reads) {
+  std::sort(reads.begin(), reads.end(), [](const AsyncIOContext* lhs, const AsyncIOContext* rhs) {
+    return lhs->address < rhs->address;
+  });
+  const uint64_t alignment_mask = hlog.sector_size - 1;
+  const uint32_t io_size = FirstIoRequestSize();
+  // Where the read for a record would end. (Records never span pages, so neither does the read.)
+  auto get_end_read = [alignment_mask, io_size](Address address) {
+    uint64_t end_of_page = Address{ address.page() + 1, 0 }.control();
+    return (std::min(address.control() + io_size, end_of_page) + alignment_mask) &
+           ~alignment_mask;
+  };
+  size_t begin = 0;
+  while(begin < reads.size()) {
+    // Grow the group while the next record starts inside the group's read, or in the sector
+    // right after it. (Groups stay within a page, so a read never spans two log segments.)
+    Address first_address = reads[begin]->address;
+    uint64_t begin_read = first_address.control() & ~alignment_mask;
+    uint64_t end_read = get_end_read(first_address);
+    size_t end = begin + 1;
+    for(; end < reads.size(); ++end) {
+      Address address = reads[end]->address;
+      uint64_t next_end_read = get_end_read(address);
+      if(address.page() != first_address.page() ||
+          (address.control() & ~alignment_mask) > end_read ||
+          next_end_read - begin_read > kMaxMultiReadIoSize) {
+        break;
+      }
+      end_read = std::max(end_read, next_end_read);
+    }
+
+    if(end - begin == 1) {
+      AsyncGetFromDisk(first_address, io_size, AsyncGetFromDiskCallback, *reads[begin]);
+    } else {
+      std::vector<AsyncIOContext*> group{ reads.begin() + begin, reads.begin() + end };
+      MultiReadIoContext context{ this, begin_read, std::move(group) };
+      AsyncGetRangeFromDisk(begin_read, end_read, context);
+    }
+    begin = end;
+  }
+}
+
+template <class K, class V, class D, class B>
+void FasterKv<K, V, D, B>::AsyncGetRangeFromDisk(Address begin_address, Address end_address,
+    MultiReadIoContext& context) {
+  if(epoch_.IsProtected()) {
+    /// Throttling. (Thread pool, unprotected threads are not throttled.)
+    while(num_pending_ios.load() > 120) {
+      disk.TryComplete();
+      std::this_thread::yield();
+      epoch_.ProtectAndDrain();
+    }
+  }
+  // Each record counts as a pending I/O, until its own callback runs.
+  num_pending_ios += context.reads.size();
+  hlog.AsyncGetRangeFromDisk(begin_address, end_address, MultiReadCallback, context,
+                             context.buffer);
+}
+
+template <class K, class V, class D, class B>
+void FasterKv<K, V, D, B>::MultiReadCallback(IAsyncContext* ctxt, Status result,
+    size_t bytes_transferred) {
+  CallbackContext<MultiReadIoContext> context{ ctxt };
+  faster_t* faster = reinterpret_cast<faster_t*>(context->faster);
+  const uint64_t alignment_mask = faster->hlog.sector_size - 1;
+  // (The read may have come up short of the group's span.)
+  const uint64_t end_read = context->begin_address.control() +
+                            std::min<uint64_t>(context->buffer.available_bytes, bytes_transferred);
+
+  for(AsyncIOContext* read : context->reads) {
+    size_t record_bytes = 0;
+    if(result == Status::Ok && read->address.control() + faster->MinIoRequestSize() > end_read) {
+      // The short read didn't reach this record's header; read the record by itself.
+      --faster->num_pending_ios;
+      faster->AsyncGetFromDisk(read->address, faster->FirstIoRequestSize(),
+                               AsyncGetFromDiskCallback, *read);
+      continue;
+    }
+    if(result == Status::Ok) {
+      // Copy out just the sectors that this record needs, as far as the shared read covers them.
+      uint64_t address = read->address.control();
+      const uint8_t* sectors = context->buffer.buffer() +
+                               ((address & ~alignment_mask) - context->begin_address.control());
+      uint32_t offset = static_cast<uint32_t>(address & alignment_mask);
+      uint32_t available = static_cast<uint32_t>(end_read - address);
+      const record_t* record = reinterpret_cast<const record_t*>(sectors + offset);
+      uint32_t needed = std::min(available, faster->MinIoRequestSize());
+      if(needed == faster->MinIoRequestSize() && record->min_disk_key_size() <= available) {
+        needed = std::max(needed, record->min_disk_key_size());
+        if(record->min_disk_value_size() <= available) {
+          needed = std::max(needed, record->min_disk_value_size());
+          if(record->disk_size() <= available) {
+            needed = std::max(needed, record->disk_size());
+          }
+        }
       }
+      uint32_t length = static_cast<uint32_t>(pad_alignment(offset + needed,
+                                              faster->hlog.sector_size));
+      read->record = faster->hlog.read_buffer_pool.Get(length);
+      std::memcpy(read->record.buffer(), sectors, length);
+      read->record.valid_offset = offset;
+      read->record.available_bytes = length - offset;
+      read->record.required_bytes = needed;
+      record_bytes = length;
     }
+    AsyncGetFromDiskCallback(read, result, record_bytes);
   }
 }
 
-template <class K, class V, class D>
-OperationStatus FasterKv<K, V, D>::InternalContinuePendingRead(ExecutionContext& context,
+template <class K, class V, class D, class B>
+OperationStatus FasterKv<K, V, D, B>::InternalContinuePendingRead(ExecutionContext& context,
     AsyncIOContext& io_context) {
-  if(io_context.address >= hlog.begin_address.load()) {
-    async_pending_read_context_t* pending_context = static_cast<async_pending_read_context_t*>(
-          io_context.caller_context);
+  async_pending_read_context_t* pending_context = static_cast<async_pending_read_context_t*>(
+        io_context.caller_context);
+  HashBucketEntry cold_entry;
+  if(io_context.address >= (io_context.cold ? cold_log_.begin_address.load() :
+                            hlog.begin_address.load())) {
     record_t* record = reinterpret_cast<record_t*>(io_context.record.GetValidPointer());
-    if(record->header.tombstone) {
+    if(record->header.tombstone || record->expired()) {
       return (thread_ctx().version > context.version) ? OperationStatus::NOT_FOUND_UNMARK :
              OperationStatus::NOT_FOUND;
     }
@@ -1571,14 +2352,19 @@ OperationStatus FasterKv<K, V, D>::InternalContinuePendingRead(ExecutionContext&
     assert(!kCopyReadsToTail);
     return (thread_ctx().version > context.version) ? OperationStatus::SUCCESS_UNMARK :
            OperationStatus::SUCCESS;
+  } else if(!io_context.cold && FindColdEntry(pending_context->get_key_hash(),
+            pending_context->get_inline_key(), cold_entry)) {
+    // The hybrid log's chain ended without a match; the key may be in the cold log.
+    pending_context->continue_async(cold_entry.address(), pending_context->entry, true);
+    return OperationStatus::RECORD_ON_DISK;
   } else {
     return (thread_ctx().version > context.version) ? OperationStatus::NOT_FOUND_UNMARK :
            OperationStatus::NOT_FOUND;
   }
 }
 
-template <class K, class V, class D>
-OperationStatus FasterKv<K, V, D>::InternalContinuePendingRmw(ExecutionContext& context,
+template <class K, class V, class D, class B>
+OperationStatus FasterKv<K, V, D, B>::InternalContinuePendingRmw(ExecutionContext& context,
     AsyncIOContext& io_context) {
   async_pending_rmw_context_t* pending_context = static_cast<async_pending_rmw_context_t*>(
         io_context.caller_context);
@@ -1586,7 +2372,8 @@ OperationStatus FasterKv<K, V, D>::InternalContinuePendingRmw(ExecutionContext&
   // Find a hash bucket entry to store the updated value in.
   KeyHash hash = pending_context->get_key_hash();
   HashBucketEntry expected_entry;
-  AtomicHashBucketEntry* atomic_entry = FindOrCreateEntry(hash, expected_entry);
+  AtomicHashBucketEntry* atomic_entry = FindOrCreateEntry(hash,
+                                        pending_context->get_inline_key(), expected_entry);
 
   // (Note that address will be Address::kInvalidAddress, if the atomic_entry was created.)
   Address address = expected_entry.address();
@@ -1605,15 +2392,41 @@ OperationStatus FasterKv<K, V, D>::InternalContinuePendingRmw(ExecutionContext&
     pending_context->continue_async(address, expected_entry);
     return OperationStatus::RETRY_NOW;
   }
-  assert(address < hlog.begin_address.load() || address == pending_context->entry.address());
+  // (Otherwise, no record for this key has been added since we went to disk. The entry we saw
+  // then may still head the chain with another key's record, so "address" can be older.)
+
+  bool found = io_context.address >= (io_context.cold ? cold_log_.begin_address.load() :
+                                      hlog.begin_address.load());
+  HashBucketEntry cold_entry;
+  if(!found && !io_context.cold &&
+      FindColdEntry(hash, pending_context->get_inline_key(), cold_entry)) {
+    // The hybrid log's chain ended without a match; the key may be in the cold log.
+    pending_context->continue_async(cold_entry.address(), pending_context->entry, true);
+    return OperationStatus::RECORD_ON_DISK;
+  }
+
+  const record_t* old_record = nullptr;
+  if(found) {
+    old_record = reinterpret_cast<const record_t*>(io_context.record.GetValidPointer());
+    if(old_record->header.tombstone || old_record->expired()) {
+      old_record = nullptr;
+    }
+  }
+  // (A record in the cold log is never one that compaction is looking for.)
+  if(!pending_context->RmwCheck(old_record, io_context.cold ? Address::kInvalidAddress :
+                                io_context.address)) {
+    // A conditional update that doesn't apply; the record stays as it is.
+    return (thread_ctx().version > context.version) ? OperationStatus::CONDITION_FAILED_UNMARK :
+           OperationStatus::CONDITION_FAILED;
+  }
 
   // We have to do copy-on-write/RCU and write the updated value to the tail of the log.
   Address new_address;
   record_t* new_record;
-  if(io_context.address < hlog.begin_address.load()) {
+  if(!found) {
     // The on-disk trace back failed to find a key match.
     uint32_t record_size = record_t::size(pending_context->key_size(), pending_context->value_size());
-    new_address = BlockAllocate(record_size);
+    new_address = BlockAllocate(record_size, hash);
     new_record = reinterpret_cast<record_t*>(hlog.Get(new_address));
 
     new(new_record) record_t{
@@ -1624,12 +2437,11 @@ OperationStatus FasterKv<K, V, D>::InternalContinuePendingRmw(ExecutionContext&
     pending_context->write_deep_key_at(const_cast<key_t*>(&new_record->key()));
     pending_context->RmwInitial(new_record);
   } else {
-    // The record we read from disk.
-    const record_t* disk_record = reinterpret_cast<const record_t*>(
-                                    io_context.record.GetValidPointer());
-    bool is_tombstone = disk_record->header.tombstone;
-    uint32_t record_size = record_t::size(pending_context->key_size(), pending_context->value_size(disk_record));
-    new_address = BlockAllocate(record_size);
+    // The record we read from disk; old_record is null if it was a tombstone, or has expired.
+    uint32_t record_size = old_record != nullptr ?
+      record_t::size(pending_context->key_size(), pending_context->value_size(old_record)) :
+      record_t::size(pending_context->key_size(), pending_context->value_size());
+    new_address = BlockAllocate(record_size, hash);
     new_record = reinterpret_cast<record_t*>(hlog.Get(new_address));
 
     new(new_record) record_t{
@@ -1638,8 +2450,8 @@ OperationStatus FasterKv<K, V, D>::InternalContinuePendingRmw(ExecutionContext&
         expected_entry.address() },
     };
     pending_context->write_deep_key_at(const_cast<key_t*>(&new_record->key()));
-    if (!is_tombstone) {
-      pending_context->RmwCopy(disk_record, new_record);
+    if(old_record != nullptr) {
+      pending_context->RmwCopy(old_record, new_record);
     } else {
       pending_context->RmwInitial(new_record);
     }
@@ -1647,6 +2459,7 @@ OperationStatus FasterKv<K, V, D>::InternalContinuePendingRmw(ExecutionContext&
 
   HashBucketEntry updated_entry{ new_address, hash.tag(), false };
   if(atomic_entry->compare_exchange_strong(expected_entry, updated_entry)) {
+    MarkIndexDirty(hash);
     assert(thread_ctx().version >= context.version);
     return (thread_ctx().version == context.version) ? OperationStatus::SUCCESS :
            OperationStatus::SUCCESS_UNMARK;
@@ -1658,61 +2471,170 @@ OperationStatus FasterKv<K, V, D>::InternalContinuePendingRmw(ExecutionContext&
   }
 }
 
-template <class K, class V, class D>
-void FasterKv<K, V, D>::InitializeCheckpointLocks() {
+template <class K, class V, class D, class B>
+void FasterKv<K, V, D, B>::InitializeCheckpointLocks() {
   uint32_t table_version = resize_info_.version;
   uint64_t size = state_[table_version].size();
   checkpoint_locks_.Initialize(size);
 }
 
-template <class K, class V, class D>
-Status FasterKv<K, V, D>::WriteIndexMetadata() {
-  std::string filename = disk.index_checkpoint_path(checkpoint_.index_token) + "info.dat";
-  // (This code will need to be refactored into the disk_t interface, if we want to support
-  // unformatted disks.)
-  std::FILE* file = std::fopen(filename.c_str(), "wb");
-  if(!file) {
-    return Status::IOError;
+template <class K, class V, class D, class B>
+Status FasterKv<K, V, D, B>::WriteIndexMetadata() {
+  checkpoint_.index_metadata.key_hash_id = KeyHashId<key_t>::value;
+  return WriteCheckpointMetadata(disk.index_checkpoint_path(checkpoint_.index_token) + "info.dat",
+                                 checkpoint_.index_metadata);
+}
+
+template <class K, class V, class D, class B>
+Status FasterKv<K, V, D, B>::ReadIndexMetadata(const Guid& token) {
+  return ReadIndexMetadata(token, checkpoint_.index_metadata);
+}
+
+template <class K, class V, class D, class B>
+Status FasterKv<K, V, D, B>::ReadIndexMetadata(const Guid& token, IndexMetadata& metadata) {
+  return ReadCheckpointMetadata(disk.index_checkpoint_path(token) + "info.dat", metadata);
+}
+
+template <class K, class V, class D, class B>
+Status FasterKv<K, V, D, B>::WriteCprMetadata() {
+  return WriteCheckpointMetadata(disk.cpr_checkpoint_path(checkpoint_.hybrid_log_token) +
+                                 "info.dat", checkpoint_.log_metadata);
+}
+
+template <class K, class V, class D, class B>
+Status FasterKv<K, V, D, B>::ReadCprMetadata(const Guid& token) {
+  return ReadCprMetadata(token, checkpoint_.log_metadata);
+}
+
+template <class K, class V, class D, class B>
+Status FasterKv<K, V, D, B>::ReadCprMetadata(const Guid& token, LogMetadata& metadata) {
+  return ReadCheckpointMetadata(disk.cpr_checkpoint_path(token) + "info.dat", metadata);
+}
+
+template <class K, class V, class D, class B>
+void FasterKv<K, V, D, B>::PruneCheckpoints(Action action) {
+  // Runs as a checkpoint completes. Besides what the retention rules keep, keep the checkpoint
+  // just taken, and the bases of the next incremental index checkpoint and delta snapshot.
+  std::vector<Guid> kept_index{ last_index_token_ };
+  std::vector<Guid> kept_log{ last_snapshot_token_ };
+  if(action != Action::CheckpointHybridLog) {
+    kept_index.push_back(checkpoint_.index_token);
   }
-  if(std::fwrite(&checkpoint_.index_metadata, sizeof(checkpoint_.index_metadata), 1, file) != 1) {
-    std::fclose(file);
-    return Status::IOError;
+  if(action != Action::CheckpointIndex) {
+    kept_log.push_back(checkpoint_.hybrid_log_token);
   }
-  if(std::fclose(file) != 0) {
-    return Status::IOError;
+  // Reading every checkpoint's metadata and deleting directories needn't hold up the next
+  // checkpoint.
+  auto remove = [this, retention = checkpoint_retention_, kept_index, kept_log]() {
+    RemoveObsoleteCheckpoints(retention, kept_index, kept_log);
+  };
+  if(maintenance_pool_.empty()) {
+    remove();
+  } else {
+    maintenance_pool_.Submit(remove);
   }
-  return Status::Ok;
 }
 
-template <class K, class V, class D>
-Status FasterKv<K, V, D>::ReadIndexMetadata(const Guid& token) {
-  std::string filename = disk.index_checkpoint_path(token) + "info.dat";
-  // (This code will need to be refactored into the disk_t interface, if we want to support
-  // unformatted disks.)
-  std::FILE* file = std::fopen(filename.c_str(), "rb");
-  if(!file) {
-    return Status::IOError;
+template <class K, class V, class D, class B>
+void FasterKv<K, V, D, B>::RemoveObsoleteCheckpoints(const CheckpointRetention& retention,
+    std::vector<Guid> kept_index, std::vector<Guid> kept_log) {
+  // Besides "kept_index" and "kept_log", keep what the retention rules keep; the newest
+  // hybrid-log checkpoint, and an index checkpoint that it can be recovered with; and the bases
+  // of everything kept. Checkpoints are ordered by version, and by when they were written within
+  // a version. A directory whose metadata can't be read (say, a checkpoint still being taken) is
+  // left alone.
+  std::unordered_map<Guid, IndexMetadata> index_metadata;
+  std::vector<CheckpointDirectory> index_dirs;
+  for(CheckpointDirectory& index_dir : disk.ListIndexCheckpoints()) {
+    IndexMetadata& metadata = index_metadata[index_dir.token];
+    if(ReadIndexMetadata(index_dir.token, metadata) == Status::Ok) {
+      index_dir.version = metadata.version;
+      index_dirs.push_back(index_dir);
+    } else {
+      index_metadata.erase(index_dir.token);
+    }
   }
-  if(std::fread(&checkpoint_.index_metadata, sizeof(checkpoint_.index_metadata), 1, file) != 1) {
-    std::fclose(file);
-    return Status::IOError;
+  std::unordered_map<Guid, LogMetadata> log_metadata;
+  std::vector<CheckpointDirectory> log_dirs;
+  for(CheckpointDirectory& log_dir : disk.ListCprCheckpoints()) {
+    LogMetadata& metadata = log_metadata[log_dir.token];
+    if(ReadCprMetadata(log_dir.token, metadata) == Status::Ok) {
+      log_dir.version = metadata.version;
+      log_dirs.push_back(log_dir);
+    } else {
+      log_metadata.erase(log_dir.token);
+    }
   }
-  if(std::fclose(file) != 0) {
-    return Status::IOError;
+  for(const Guid& token : retention.Select(index_dirs)) {
+    kept_index.push_back(token);
+  }
+  for(const Guid& token : retention.Select(log_dirs)) {
+    kept_log.push_back(token);
+  }
+
+  // (Directories are sorted newest first.)
+  if(!log_dirs.empty()) {
+    kept_log.push_back(log_dirs.front().token);
+    uint32_t log_version = log_dirs.front().version;
+    for(const CheckpointDirectory& index_dir : index_dirs) {
+      if(index_dir.version <= log_version) {
+        kept_index.push_back(index_dir.token);
+        break;
+      }
+    }
+  }
+
+  std::unordered_set<Guid> keep_index;
+  while(!kept_index.empty()) {
+    Guid token = kept_index.back();
+    kept_index.pop_back();
+    if(token == Guid{} || !keep_index.insert(token).second) {
+      continue;
+    }
+    auto metadata = index_metadata.find(token);
+    if(metadata != index_metadata.end() && metadata->second.incremental()) {
+      kept_index.push_back(metadata->second.base_index_token);
+    }
+  }
+  std::unordered_set<Guid> keep_log;
+  while(!kept_log.empty()) {
+    Guid token = kept_log.back();
+    kept_log.pop_back();
+    if(token == Guid{} || !keep_log.insert(token).second) {
+      continue;
+    }
+    auto metadata = log_metadata.find(token);
+    if(metadata != log_metadata.end() && metadata->second.delta()) {
+      kept_log.push_back(metadata->second.base_log_token);
+    }
+  }
+
+  for(const CheckpointDirectory& index_dir : index_dirs) {
+    if(keep_index.find(index_dir.token) == keep_index.end()) {
+      disk.RemoveIndexCheckpoint(index_dir.token);
+    }
+  }
+  for(const CheckpointDirectory& log_dir : log_dirs) {
+    if(keep_log.find(log_dir.token) == keep_log.end()) {
+      disk.RemoveCprCheckpoint(log_dir.token);
+    }
   }
-  return Status::Ok;
 }
 
-template <class K, class V, class D>
-Status FasterKv<K, V, D>::WriteCprMetadata() {
-  std::string filename = disk.cpr_checkpoint_path(checkpoint_.hybrid_log_token) + "info.dat";
+template <class K, class V, class D, class B>
+Status FasterKv<K, V, D, B>::WriteSnapshotPages(const std::vector<uint32_t>& pages) {
+  // A delta snapshot's file holds just the listed pages, in order.
+  std::string filename = disk.cpr_checkpoint_path(checkpoint_.hybrid_log_token) +
+                         "snapshot_pages.dat";
   // (This code will need to be refactored into the disk_t interface, if we want to support
   // unformatted disks.)
   std::FILE* file = std::fopen(filename.c_str(), "wb");
   if(!file) {
     return Status::IOError;
   }
-  if(std::fwrite(&checkpoint_.log_metadata, sizeof(checkpoint_.log_metadata), 1, file) != 1) {
+  uint32_t num_pages = static_cast<uint32_t>(pages.size());
+  if(std::fwrite(&num_pages, sizeof(num_pages), 1, file) != 1 ||
+      std::fwrite(pages.data(), sizeof(uint32_t), num_pages, file) != num_pages) {
     std::fclose(file);
     return Status::IOError;
   }
@@ -1722,16 +2644,22 @@ Status FasterKv<K, V, D>::WriteCprMetadata() {
   return Status::Ok;
 }
 
-template <class K, class V, class D>
-Status FasterKv<K, V, D>::ReadCprMetadata(const Guid& token) {
-  std::string filename = disk.cpr_checkpoint_path(token) + "info.dat";
+template <class K, class V, class D, class B>
+Status FasterKv<K, V, D, B>::ReadSnapshotPages(const Guid& token, std::vector<uint32_t>& pages) {
+  std::string filename = disk.cpr_checkpoint_path(token) + "snapshot_pages.dat";
   // (This code will need to be refactored into the disk_t interface, if we want to support
   // unformatted disks.)
   std::FILE* file = std::fopen(filename.c_str(), "rb");
   if(!file) {
     return Status::IOError;
   }
-  if(std::fread(&checkpoint_.log_metadata, sizeof(checkpoint_.log_metadata), 1, file) != 1) {
+  uint32_t num_pages;
+  if(std::fread(&num_pages, sizeof(num_pages), 1, file) != 1) {
+    std::fclose(file);
+    return Status::IOError;
+  }
+  pages.resize(num_pages);
+  if(std::fread(pages.data(), sizeof(uint32_t), num_pages, file) != num_pages) {
     std::fclose(file);
     return Status::IOError;
   }
@@ -1741,10 +2669,10 @@ Status FasterKv<K, V, D>::ReadCprMetadata(const Guid& token) {
   return Status::Ok;
 }
 
-template <class K, class V, class D>
-Status FasterKv<K, V, D>::WriteCprContext() {
+template <class K, class V, class D, class B>
+Status FasterKv<K, V, D, B>::WriteCprContext(const ExecutionContext& context) {
   std::string filename = disk.cpr_checkpoint_path(checkpoint_.hybrid_log_token);
-  const Guid& guid = prev_thread_ctx().guid;
+  const Guid& guid = context.guid;
   filename += guid.ToString();
   filename += ".dat";
   // (This code will need to be refactored into the disk_t interface, if we want to support
@@ -1753,7 +2681,7 @@ Status FasterKv<K, V, D>::WriteCprContext() {
   if(!file) {
     return Status::IOError;
   }
-  if(std::fwrite(static_cast<PersistentExecContext*>(&prev_thread_ctx()),
+  if(std::fwrite(static_cast<const PersistentExecContext*>(&context),
                  sizeof(PersistentExecContext), 1, file) != 1) {
     std::fclose(file);
     return Status::IOError;
@@ -1764,8 +2692,8 @@ Status FasterKv<K, V, D>::WriteCprContext() {
   return Status::Ok;
 }
 
-template <class K, class V, class D>
-Status FasterKv<K, V, D>::ReadCprContexts(const Guid& token, const Guid* guids) {
+template <class K, class V, class D, class B>
+Status FasterKv<K, V, D, B>::ReadCprContexts(const Guid& token, const Guid* guids) {
   for(size_t idx = 0; idx < Thread::kMaxNumThreads; ++idx) {
     const Guid& guid = guids[idx];
     if(guid == Guid{}) {
@@ -1798,32 +2726,78 @@ Status FasterKv<K, V, D>::ReadCprContexts(const Guid& token, const Guid* guids)
   }
 }
 
-template <class K, class V, class D>
-Status FasterKv<K, V, D>::CheckpointFuzzyIndex() {
+template <class K, class V, class D, class B>
+Status FasterKv<K, V, D, B>::CheckpointFuzzyIndex() {
   uint32_t hash_table_version = resize_info_.version;
+  // Can only build on the previous index checkpoint if it succeeded, and if both the table and
+  // the overflow buckets remember it.
+  bool incremental = checkpoint_.incremental_index && !(last_index_token_ == Guid{}) &&
+                     state_[hash_table_version].CanCheckpointIncrementally() &&
+                     overflow_buckets_allocator_[hash_table_version].CanCheckpointIncrementally();
+  if(incremental) {
+    checkpoint_.index_metadata.base_index_token = last_index_token_;
+  }
+  // Until this checkpoint succeeds, the next one can't be incremental.
+  last_index_token_ = Guid{};
   // Checkpoint the main hash table.
   file_t ht_file = disk.NewFile(disk.relative_index_checkpoint_path(checkpoint_.index_token) +
                                 "ht.dat");
   RETURN_NOT_OK(ht_file.Open(&disk.handler()));
   RETURN_NOT_OK(state_[hash_table_version].Checkpoint(disk, std::move(ht_file),
-                checkpoint_.index_metadata.num_ht_bytes));
-  // Checkpoint the hash table's overflow buckets.
+                checkpoint_.index_metadata.num_ht_bytes, incremental));
+  // Checkpoint the hash table's overflow buckets. (Writers mark only the hash table's buckets;
+  // an overflow bucket has changed only if its chain's bucket has.)
+  std::vector<bool> changed_overflow_chunks;
+  if(incremental) {
+    changed_overflow_chunks = DirtyOverflowChunks(hash_table_version);
+  }
   file_t ofb_file = disk.NewFile(disk.relative_index_checkpoint_path(checkpoint_.index_token) +
                                  "ofb.dat");
   RETURN_NOT_OK(ofb_file.Open(&disk.handler()));
   RETURN_NOT_OK(overflow_buckets_allocator_[hash_table_version].Checkpoint(disk,
-                std::move(ofb_file), checkpoint_.index_metadata.num_ofb_bytes));
+                std::move(ofb_file), checkpoint_.index_metadata.num_ofb_bytes, incremental,
+                std::move(changed_overflow_chunks)));
   checkpoint_.index_checkpoint_started = true;
   return Status::Ok;
 }
 
-template <class K, class V, class D>
-Status FasterKv<K, V, D>::CheckpointFuzzyIndexComplete() {
-  if(!checkpoint_.index_checkpoint_started) {
-    return Status::Pending;
-  }
-  uint32_t hash_table_version = resize_info_.version;
-  Status result = state_[hash_table_version].CheckpointComplete(false);
+template <class K, class V, class D, class B>
+std::vector<bool> FasterKv<K, V, D, B>::DirtyOverflowChunks(uint32_t version) const {
+  constexpr uint64_t kOverflowBucketsPerChunk =
+    SparseCheckpointFile<hash_bucket_t, disk_t>::kMaxItemsPerChunk;
+  const auto& table = state_[version];
+  const auto& allocator = overflow_buckets_allocator_[version];
+  uint64_t num_overflow_buckets = allocator.count().control();
+  std::vector<bool> dirty((num_overflow_buckets + kOverflowBucketsPerChunk - 1) /
+                          kOverflowBucketsPerChunk, false);
+  for(uint64_t chunk = 0; chunk < table.num_chunks(); ++chunk) {
+    if(!table.checkpointing_dirty_chunk(chunk)) {
+      continue;
+    }
+    uint64_t end_idx = std::min((chunk + 1) * table.kBucketsPerChunk, table.size());
+    for(uint64_t bucket_idx = chunk * table.kBucketsPerChunk; bucket_idx < end_idx;
+        ++bucket_idx) {
+      HashBucketOverflowEntry overflow_entry = table.bucket(bucket_idx).overflow_entry.load();
+      while(!overflow_entry.unused()) {
+        uint64_t idx = overflow_entry.address().control();
+        // (Buckets allocated since the count was taken are stored anyway, as new.)
+        if(idx < num_overflow_buckets) {
+          dirty[idx / kOverflowBucketsPerChunk] = true;
+        }
+        overflow_entry = allocator.Get(overflow_entry.address()).overflow_entry.load();
+      }
+    }
+  }
+  return dirty;
+}
+
+template <class K, class V, class D, class B>
+Status FasterKv<K, V, D, B>::CheckpointFuzzyIndexComplete() {
+  if(!checkpoint_.index_checkpoint_started) {
+    return Status::Pending;
+  }
+  uint32_t hash_table_version = resize_info_.version;
+  Status result = state_[hash_table_version].CheckpointComplete(false);
   if(result == Status::Pending) {
     return Status::Pending;
   } else if(result != Status::Ok) {
@@ -1833,27 +2807,48 @@ Status FasterKv<K, V, D>::CheckpointFuzzyIndexComplete() {
   }
 }
 
-template <class K, class V, class D>
-Status FasterKv<K, V, D>::RecoverFuzzyIndex() {
+template <class K, class V, class D, class B>
+Status FasterKv<K, V, D, B>::RecoverFuzzyIndex(IndexLoadMode load_mode) {
   uint8_t hash_table_version = resize_info_.version;
-  assert(state_[hash_table_version].size() == checkpoint_.index_metadata.table_size);
 
-  // Recover the main hash table.
-  file_t ht_file = disk.NewFile(disk.relative_index_checkpoint_path(checkpoint_.index_token) +
-                                "ht.dat");
-  RETURN_NOT_OK(ht_file.Open(&disk.handler()));
-  RETURN_NOT_OK(state_[hash_table_version].Recover(disk, std::move(ht_file),
-                checkpoint_.index_metadata.num_ht_bytes));
-  // Recover the hash table's overflow buckets.
-  file_t ofb_file = disk.NewFile(disk.relative_index_checkpoint_path(checkpoint_.index_token) +
-                                 "ofb.dat");
-  RETURN_NOT_OK(ofb_file.Open(&disk.handler()));
-  return overflow_buckets_allocator_[hash_table_version].Recover(disk, std::move(ofb_file),
-         checkpoint_.index_metadata.num_ofb_bytes, checkpoint_.index_metadata.ofb_count);
+  // An incremental checkpoint is applied on top of its base, so start from the most recent full
+  // checkpoint and work forward.
+  std::vector<std::pair<Guid, IndexMetadata>> chain;
+  chain.emplace_back(checkpoint_.index_token, checkpoint_.index_metadata);
+  while(chain.back().second.incremental()) {
+    IndexMetadata base_metadata;
+    Guid base_token = chain.back().second.base_index_token;
+    RETURN_NOT_OK(ReadIndexMetadata(base_token, base_metadata));
+    if(base_metadata.table_size != checkpoint_.index_metadata.table_size) {
+      return Status::Corruption;
+    }
+    chain.emplace_back(base_token, base_metadata);
+  }
+  for(auto it = chain.rbegin(); it != chain.rend(); ++it) {
+    if(it != chain.rbegin()) {
+      // (The last checkpoint's recovery is completed by RecoverFuzzyIndexComplete().)
+      RETURN_NOT_OK(state_[hash_table_version].RecoverComplete(true));
+      RETURN_NOT_OK(overflow_buckets_allocator_[hash_table_version].RecoverComplete(true));
+    }
+    const Guid& token = it->first;
+    const IndexMetadata& metadata = it->second;
+    // Recover the main hash table.
+    file_t ht_file = disk.NewFile(disk.relative_index_checkpoint_path(token) + "ht.dat");
+    RETURN_NOT_OK(ht_file.Open(&disk.handler()));
+    RETURN_NOT_OK(state_[hash_table_version].Recover(disk, std::move(ht_file),
+                  metadata.num_ht_bytes, metadata.incremental(), load_mode));
+    // Recover the hash table's overflow buckets.
+    file_t ofb_file = disk.NewFile(disk.relative_index_checkpoint_path(token) + "ofb.dat");
+    RETURN_NOT_OK(ofb_file.Open(&disk.handler()));
+    RETURN_NOT_OK(overflow_buckets_allocator_[hash_table_version].Recover(disk,
+                  std::move(ofb_file), metadata.num_ofb_bytes, metadata.ofb_count,
+                  metadata.incremental(), load_mode));
+  }
+  return Status::Ok;
 }
 
-template <class K, class V, class D>
-Status FasterKv<K, V, D>::RecoverFuzzyIndexComplete(bool wait) {
+template <class K, class V, class D, class B>
+Status FasterKv<K, V, D, B>::RecoverFuzzyIndexComplete(bool wait) {
   uint8_t hash_table_version = resize_info_.version;
   Status result = state_[hash_table_version].RecoverComplete(true);
   if(result != Status::Ok) {
@@ -1866,9 +2861,9 @@ Status FasterKv<K, V, D>::RecoverFuzzyIndexComplete(bool wait) {
 
   // Clear all tentative entries.
   for(uint64_t bucket_idx = 0; bucket_idx < state_[hash_table_version].size(); ++bucket_idx) {
-    HashBucket* bucket = &state_[hash_table_version].bucket(bucket_idx);
+    hash_bucket_t* bucket = &state_[hash_table_version].bucket(bucket_idx);
     while(true) {
-      for(uint32_t entry_idx = 0; entry_idx < HashBucket::kNumEntries; ++entry_idx) {
+      for(uint32_t entry_idx = 0; entry_idx < hash_bucket_t::kNumEntries; ++entry_idx) {
         if(bucket->entries[entry_idx].load().tentative()) {
           bucket->entries[entry_idx].store(HashBucketEntry::kInvalidEntry);
         }
@@ -1886,8 +2881,8 @@ Status FasterKv<K, V, D>::RecoverFuzzyIndexComplete(bool wait) {
   return Status::Ok;
 }
 
-template <class K, class V, class D>
-Status FasterKv<K, V, D>::RecoverHybridLog() {
+template <class K, class V, class D, class B>
+Status FasterKv<K, V, D, B>::RecoverHybridLog(uint32_t num_threads) {
   class Context : public IAsyncContext {
    public:
     Context(hlog_t& hlog_, uint32_t page_, RecoveryStatus& recovery_status_)
@@ -1928,10 +2923,10 @@ Status FasterKv<K, V, D>::RecoverHybridLog() {
   uint32_t pages_to_read_first = std::min(capacity, total_pages_to_read);
   RETURN_NOT_OK(hlog.AsyncReadPagesFromLog(start_page, pages_to_read_first, recovery_status));
 
-  for(uint32_t page = start_page; page < end_page; ++page) {
+  auto recover_page = [&](uint32_t page) {
     while(recovery_status.page_status(page) != PageRecoveryStatus::ReadDone) {
       disk.TryComplete();
-      std::this_thread::sleep_for(10ms);
+      std::this_thread::yield();
     }
 
     // handle start and end at non-page boundaries
@@ -1939,26 +2934,27 @@ Status FasterKv<K, V, D>::RecoverHybridLog() {
                                   page + 1 == end_page ? to_address :
                                   Address{ page, Address::kMaxOffset }));
 
-    // OS thread flushes current page and issues a read request if necessary
+    // Flush the current page, and issue a read request for the page that replaces it, if any
     if(page + capacity < end_page) {
       Context context{ hlog, page + capacity, recovery_status };
-      RETURN_NOT_OK(hlog.AsyncFlushPage(page, recovery_status, callback, &context));
+      return hlog.AsyncFlushPage(page, recovery_status, callback, &context);
     } else {
-      RETURN_NOT_OK(hlog.AsyncFlushPage(page, recovery_status, nullptr, nullptr));
+      return hlog.AsyncFlushPage(page, recovery_status, nullptr, nullptr);
     }
-  }
+  };
+  RETURN_NOT_OK(RecoverPages(start_page, end_page, num_threads, recover_page));
   // Wait until all pages have been flushed
   for(uint32_t page = start_page; page < end_page; ++page) {
     while(recovery_status.page_status(page) != PageRecoveryStatus::FlushDone) {
       disk.TryComplete();
-      std::this_thread::sleep_for(10ms);
+      std::this_thread::yield();
     }
   }
   return Status::Ok;
 }
 
-template <class K, class V, class D>
-Status FasterKv<K, V, D>::RecoverHybridLogFromSnapshotFile() {
+template <class K, class V, class D, class B>
+Status FasterKv<K, V, D, B>::RecoverHybridLogFromSnapshotFile(uint32_t num_threads) {
   class Context : public IAsyncContext {
    public:
     Context(hlog_t& hlog_, file_t& file_, uint32_t file_start_page_, uint32_t page_,
@@ -1995,6 +2991,13 @@ Status FasterKv<K, V, D>::RecoverHybridLogFromSnapshotFile() {
              context->file_start_page, context->page, 1, *context->recovery_status);
   };
 
+  /// Where a page's image is: in which snapshot file (counting from 1; 0 means nowhere yet), and
+  /// which page that file starts with (as though the file held a contiguous range of pages).
+  struct PageSource {
+    uint32_t file_idx;
+    uint32_t file_start_page;
+  };
+
   Address file_start_address = checkpoint_.log_metadata.flushed_address;
   Address from_address = checkpoint_.index_metadata.checkpoint_start_address;
   Address to_address = checkpoint_.log_metadata.final_address;
@@ -2003,20 +3006,69 @@ Status FasterKv<K, V, D>::RecoverHybridLogFromSnapshotFile() {
   uint32_t end_page = to_address.offset() > 0 ? to_address.page() + 1 : to_address.page();
   uint32_t capacity = hlog.buffer_size();
   RecoveryStatus recovery_status{ start_page, end_page };
-  checkpoint_.snapshot_file = disk.NewFile(disk.relative_cpr_checkpoint_path(
-                                checkpoint_.hybrid_log_token) + "snapshot.dat");
-  RETURN_NOT_OK(checkpoint_.snapshot_file.Open(&disk.handler()));
+
+  // A delta snapshot holds only the pages modified since the snapshot it is a delta to; so walk
+  // the chain back to a full snapshot, taking each page from the newest snapshot that holds it.
+  std::vector<PageSource> sources(end_page - start_page, PageSource{ 0, 0 });
+  std::vector<file_t> files;
+  Guid token = checkpoint_.hybrid_log_token;
+  while(true) {
+    LogMetadata metadata;
+    RETURN_NOT_OK(ReadCprMetadata(token, metadata));
+    if(!metadata.use_snapshot_file) {
+      return Status::Corruption;
+    }
+    files.emplace_back(disk.NewFile(disk.relative_cpr_checkpoint_path(token) + "snapshot.dat"));
+    RETURN_NOT_OK(files.back().Open(&disk.handler()));
+    uint32_t file_idx = static_cast<uint32_t>(files.size());
+    if(metadata.delta()) {
+      std::vector<uint32_t> pages;
+      RETURN_NOT_OK(ReadSnapshotPages(token, pages));
+      for(uint32_t idx = 0; idx < pages.size(); ++idx) {
+        if(pages[idx] >= start_page && pages[idx] < end_page &&
+            sources[pages[idx] - start_page].file_idx == 0) {
+          sources[pages[idx] - start_page] = PageSource{ file_idx, pages[idx] - idx };
+        }
+      }
+      token = metadata.base_log_token;
+    } else {
+      // A full snapshot holds a contiguous range of pages.
+      uint32_t file_start_page = metadata.flushed_address.page();
+      uint32_t file_end_page = metadata.final_address.offset() > 0 ?
+                               metadata.final_address.page() + 1 : metadata.final_address.page();
+      for(uint32_t page = std::max(start_page, file_start_page);
+          page < std::min(end_page, file_end_page); ++page) {
+        if(sources[page - start_page].file_idx == 0) {
+          sources[page - start_page] = PageSource{ file_idx, file_start_page };
+        }
+      }
+      break;
+    }
+  }
+  for(const PageSource& source : sources) {
+    if(source.file_idx == 0) {
+      // No snapshot in the chain holds this page.
+      return Status::Corruption;
+    }
+  }
+
+  auto read_page = [&](uint32_t page) {
+    const PageSource& source = sources[page - start_page];
+    return hlog.AsyncReadPagesFromSnapshot(files[source.file_idx - 1], source.file_start_page,
+                                           page, 1, recovery_status);
+  };
 
   // Initially issue read request for all pages that can be held in memory
   uint32_t total_pages_to_read = end_page - start_page;
   uint32_t pages_to_read_first = std::min(capacity, total_pages_to_read);
-  RETURN_NOT_OK(hlog.AsyncReadPagesFromSnapshot(checkpoint_.snapshot_file, start_page, start_page,
-                pages_to_read_first, recovery_status));
+  for(uint32_t page = start_page; page < start_page + pages_to_read_first; ++page) {
+    RETURN_NOT_OK(read_page(page));
+  }
 
-  for(uint32_t page = start_page; page < end_page; ++page) {
+  auto recover_page = [&](uint32_t page) {
     while(recovery_status.page_status(page) != PageRecoveryStatus::ReadDone) {
       disk.TryComplete();
-      std::this_thread::sleep_for(10ms);
+      std::this_thread::yield();
     }
 
     // Perform recovery if page in fuzzy portion of the log
@@ -2028,30 +3080,120 @@ Status FasterKv<K, V, D>::RecoverHybridLogFromSnapshotFile() {
                                     Address{ page, Address::kMaxOffset }));
     }
 
-    // OS thread flushes current page and issues a read request if necessary
+    // Flush the current page, and issue a read request for the page that replaces it, if any
     if(page + capacity < end_page) {
-      Context context{ hlog, checkpoint_.snapshot_file, start_page, page + capacity,
+      const PageSource& source = sources[page + capacity - start_page];
+      Context context{ hlog, files[source.file_idx - 1], source.file_start_page, page + capacity,
                        recovery_status };
-      RETURN_NOT_OK(hlog.AsyncFlushPage(page, recovery_status, callback, &context));
+      return hlog.AsyncFlushPage(page, recovery_status, callback, &context);
     } else {
-      RETURN_NOT_OK(hlog.AsyncFlushPage(page, recovery_status, nullptr, nullptr));
+      return hlog.AsyncFlushPage(page, recovery_status, nullptr, nullptr);
     }
-  }
+  };
+  RETURN_NOT_OK(RecoverPages(start_page, end_page, num_threads, recover_page));
   // Wait until all pages have been flushed
   for(uint32_t page = start_page; page < end_page; ++page) {
     while(recovery_status.page_status(page) != PageRecoveryStatus::FlushDone) {
       disk.TryComplete();
-      std::this_thread::sleep_for(10ms);
+      std::this_thread::yield();
     }
   }
   return Status::Ok;
 }
 
-template <class K, class V, class D>
-Status FasterKv<K, V, D>::RecoverFromPage(Address from_address, Address to_address) {
+template <class K, class V, class D, class B>
+void FasterKv<K, V, D, B>::ResetFuzzyIndexEntries(uint32_t num_threads) {
+  // The fuzzy index checkpoint can hold any address that the log had while it was being taken.
+  // Replay decides the entries for the tags that have records past the checkpoint's start
+  // address, and any entry pointing there has such a record; so let replay start them over
+  // (keeping their tags). See RecoverFromPage().
+  Address start_address = checkpoint_.index_metadata.checkpoint_start_address;
+  uint8_t version = resize_info_.version;
+  uint64_t table_size = state_[version].size();
+  uint64_t chunk_size = (table_size + num_threads - 1) / num_threads;
+  std::atomic<uint64_t> next_idx{ 0 };
+  auto reset_buckets = [&]() {
+    // (Fewer threads than chunks may run, with a maintenance pool.)
+    for(uint64_t begin_idx = next_idx.fetch_add(chunk_size); begin_idx < table_size;
+        begin_idx = next_idx.fetch_add(chunk_size)) {
+      uint64_t end_idx = std::min(begin_idx + chunk_size, table_size);
+      for(uint64_t bucket_idx = begin_idx; bucket_idx < end_idx; ++bucket_idx) {
+        hash_bucket_t* bucket = &state_[version].bucket(bucket_idx);
+        while(true) {
+          for(uint32_t entry_idx = 0; entry_idx < hash_bucket_t::kNumEntries; ++entry_idx) {
+            HashBucketEntry entry = bucket->entries[entry_idx].load();
+            if(!entry.unused() && !entry.cold() && entry.address() >= start_address) {
+              bucket->entries[entry_idx].store(HashBucketEntry{ Address::kInvalidAddress,
+                                               entry.tag(), false });
+            }
+          }
+          HashBucketOverflowEntry overflow_entry = bucket->overflow_entry.load();
+          if(overflow_entry.unused()) {
+            break;
+          }
+          bucket = &overflow_buckets_allocator_[version].Get(overflow_entry.address());
+        }
+      }
+    }
+  };
+
+  RunOnThreads(num_threads, reset_buckets);
+}
+
+template <class K, class V, class D, class B>
+template <class F>
+Status FasterKv<K, V, D, B>::RecoverPages(uint32_t start_page, uint32_t end_page,
+    uint32_t num_threads, const F& recover_page) {
+  // Threads take pages in order, so the pages being replayed are the ones whose reads were
+  // issued first; each thread polls for I/O completions while it waits for its page, which keeps
+  // the reads (and the flushes that issue them) flowing.
+  std::atomic<uint32_t> next_page{ start_page };
+  std::atomic<Status> result{ Status::Ok };
+  auto recover_pages = [&]() {
+    while(result.load() == Status::Ok) {
+      uint32_t page = next_page++;
+      if(page >= end_page) {
+        break;
+      }
+      Status status = recover_page(page);
+      if(status != Status::Ok) {
+        Status expected = Status::Ok;
+        result.compare_exchange_strong(expected, status);
+      }
+    }
+  };
+
+  RunOnThreads(num_threads, recover_pages);
+  return result.load();
+}
+
+template <class K, class V, class D, class B>
+template <class F>
+void FasterKv<K, V, D, B>::RunOnThreads(uint32_t num_threads, const F& task) {
+  // Runs the task on this thread and "num_threads - 1" others: the maintenance pool's, if there
+  // is one (up to its size), or threads started for it.
+  if(!maintenance_pool_.empty()) {
+    maintenance_pool_.RunAndWait(num_threads - 1, task);
+    return;
+  }
+  std::vector<std::thread> threads;
+  for(uint32_t idx = 1; idx < num_threads; ++idx) {
+    threads.emplace_back(task);
+  }
+  task();
+  for(auto& thread : threads) {
+    thread.join();
+  }
+}
+
+template <class K, class V, class D, class B>
+Status FasterKv<K, V, D, B>::RecoverFromPage(Address from_address, Address to_address,
+    uint8_t* page_buffer) {
+  // (With "page_buffer" set, the page has been read into it, instead of into the log's memory.)
   assert(from_address.page() == to_address.page());
   for(Address address = from_address; address < to_address;) {
-    record_t* record = reinterpret_cast<record_t*>(hlog.Get(address));
+    record_t* record = reinterpret_cast<record_t*>(page_buffer ?
+                       page_buffer + address.offset() : hlog.Get(address));
     if(record->header.IsNull()) {
       address += sizeof(record->header);
       continue;
@@ -2060,29 +3202,39 @@ Status FasterKv<K, V, D>::RecoverFromPage(Address from_address, Address to_addre
       address += record->size();
       continue;
     }
-    const key_t& key = record->key();
-    KeyHash hash = key.GetHash();
-    HashBucketEntry expected_entry;
-    AtomicHashBucketEntry* atomic_entry = FindOrCreateEntry(hash, expected_entry);
-
+    // The record's entry should end up pointing to it, if it's in the checkpoint's version;
+    // otherwise, to the record that it replaced, if that one precedes the replayed region.
+    Address new_address;
     if(record->header.checkpoint_version <= checkpoint_.log_metadata.version) {
-      HashBucketEntry new_entry{ address, hash.tag(), false };
-      atomic_entry->store(new_entry);
+      new_address = address;
     } else {
       record->header.invalid = true;
-      if(record->header.previous_address() < checkpoint_.index_metadata.checkpoint_start_address) {
-        HashBucketEntry new_entry{ record->header.previous_address(), hash.tag(), false };
-        atomic_entry->store(new_entry);
+      new_address = record->header.previous_address();
+      if(new_address >= checkpoint_.index_metadata.checkpoint_start_address) {
+        address += record->size();
+        continue;
       }
     }
+    const key_t& key = record->key();
+    KeyHash hash = key.GetHash();
+    HashBucketEntry expected_entry;
+    AtomicHashBucketEntry* atomic_entry = FindOrCreateEntry(hash,
+                                          KeyIndexTraits<key_t>::inline_key(key), expected_entry);
+    // Pages are replayed concurrently, so keep the highest address: that's where a sequential
+    // replay would leave the entry. (A record that replaced one preceding the region is the
+    // first of its tag in the region; any valid record of the tag in the region is newer.)
+    HashBucketEntry new_entry{ new_address, hash.tag(), false };
+    while(expected_entry.address() < new_address &&
+          !atomic_entry->compare_exchange_strong(expected_entry, new_entry)) {
+    }
     address += record->size();
   }
 
   return Status::Ok;
 }
 
-template <class K, class V, class D>
-Status FasterKv<K, V, D>::RestoreHybridLog() {
+template <class K, class V, class D, class B>
+Status FasterKv<K, V, D, B>::RestoreHybridLog() {
   Address tail_address = checkpoint_.log_metadata.final_address;
   uint32_t end_page = tail_address.offset() > 0 ? tail_address.page() + 1 : tail_address.page();
   uint32_t capacity = hlog.buffer_size();
@@ -2102,7 +3254,7 @@ Status FasterKv<K, V, D>::RestoreHybridLog() {
   for(uint32_t page = start_page; page < end_page; ++page) {
     while(recovery_status.page_status(page) != PageRecoveryStatus::ReadDone) {
       disk.TryComplete();
-      std::this_thread::sleep_for(10ms);
+      std::this_thread::yield();
     }
   }
   // Skip the null page.
@@ -2112,10 +3264,196 @@ Status FasterKv<K, V, D>::RestoreHybridLog() {
   return Status::Ok;
 }
 
-template <class K, class V, class D>
-void FasterKv<K, V, D>::HeavyEnter() {
+template <class K, class V, class D, class B>
+Status FasterKv<K, V, D, B>::RestoreTailPage() {
+  // Lazy recovery restores just the page that new records will be appended to, and replays the
+  // fuzzy region's part of it right away; the rest of the region is replayed on disk, in the
+  // background. (See FinishLazyRecovery().)
+  Address from_address = checkpoint_.index_metadata.checkpoint_start_address;
+  Address tail_address = checkpoint_.log_metadata.final_address;
+  uint32_t tail_page = tail_address.page();
+  Address head_address = tail_address;
+  if(tail_address.offset() > 0) {
+    RecoveryStatus recovery_status{ tail_page, tail_page + 1 };
+    RETURN_NOT_OK(hlog.AsyncReadPagesFromLog(tail_page, 1, recovery_status));
+    while(recovery_status.page_status(tail_page) != PageRecoveryStatus::ReadDone) {
+      disk.TryComplete();
+      std::this_thread::yield();
+    }
+    Address page_address{ tail_page, 0 };
+    RETURN_NOT_OK(RecoverFromPage(std::max(from_address, page_address), tail_address));
+    RETURN_NOT_OK(hlog.AsyncFlushPage(tail_page, recovery_status, nullptr, nullptr));
+    while(recovery_status.page_status(tail_page) != PageRecoveryStatus::FlushDone) {
+      disk.TryComplete();
+      std::this_thread::yield();
+    }
+    // Skip the null page.
+    head_address = tail_page == 0 ? Address{ 0, Constants::kCacheLineBytes } : page_address;
+  }
+  hlog.RecoveryReset(checkpoint_.index_metadata.log_begin_address, head_address, tail_address);
+  return Status::Ok;
+}
+
+template <class K, class V, class D, class B>
+Status FasterKv<K, V, D, B>::RecoverPageOnDisk(uint32_t page, Address from_address) {
+  class Context : public IAsyncContext {
+   public:
+    Context(std::atomic<bool>& done_, Status& result_)
+      : done{ &done_ }
+      , result{ &result_ } {
+    }
+    /// The deep-copy constructor
+    Context(const Context& other)
+      : done{ other.done }
+      , result{ other.result } {
+    }
+   protected:
+    Status DeepCopy_Internal(IAsyncContext*& context_copy) final {
+      return IAsyncContext::DeepCopy_Internal(*this, context_copy);
+    }
+   public:
+    std::atomic<bool>* done;
+    Status* result;
+  };
+
+  auto callback = [](IAsyncContext* ctxt, Status result, size_t bytes_transferred) {
+    CallbackContext<Context> context{ ctxt };
+    *context->result = result;
+    context->done->store(true);
+  };
+
+  // The page is no longer in memory, and the log will never flush it again: read it into a
+  // private buffer, replay it there, and write it back in place (with any records from later
+  // versions marked invalid).
+  constexpr uint32_t page_size = static_cast<uint32_t>(hlog_t::kPageSize);
+  uint8_t* buffer = reinterpret_cast<uint8_t*>(aligned_alloc(hlog.sector_size, page_size));
+  std::atomic<bool> done{ false };
+  Status io_result = Status::Ok;
+  Context context{ done, io_result };
+  auto wait = [&]() {
+    while(!done.load()) {
+      disk.TryComplete();
+      std::this_thread::yield();
+    }
+    done.store(false);
+    return io_result;
+  };
+  Status result = disk.log().ReadAsync(uint64_t{ page } * page_size, buffer, page_size, callback,
+                                       context);
+  if(result == Status::Ok) {
+    result = wait();
+  }
+  if(result == Status::Ok) {
+    result = RecoverFromPage(std::max(from_address, Address{ page, 0 }),
+                             Address{ page, Address::kMaxOffset }, buffer);
+  }
+  if(result == Status::Ok) {
+    result = disk.log().WriteAsync(buffer, uint64_t{ page } * page_size, page_size, callback,
+                                   context);
+  }
+  if(result == Status::Ok) {
+    result = wait();
+  }
+  aligned_free(buffer);
+  return result;
+}
+
+template <class K, class V, class D, class B>
+void FasterKv<K, V, D, B>::FinishLazyRecovery(uint32_t num_threads) {
+  // Only the buckets in "recovering_buckets_" have chains through the pages being replayed, and
+  // requests for those keys are held back; so the replay can update their entries, while the
+  // store serves all the others.
+  Address from_address = checkpoint_.index_metadata.checkpoint_start_address;
+  uint32_t end_page = checkpoint_.log_metadata.final_address.page();
+  uint32_t version = checkpoint_.log_metadata.version;
+  lazy_recovery_status_ = RecoverPages(from_address.page(), end_page, num_threads,
+  [&](uint32_t page) {
+    return RecoverPageOnDisk(page, from_address);
+  });
+  checkpoint_.RecoverDone();
+  // (Even if the replay failed: CompleteRecovery() reports it, and held-back requests complete.)
+  lazy_recovery_.store(false);
+  system_state_.store(SystemState{ Action::None, Phase::REST, version + 1 });
+}
+
+template <class K, class V, class D, class B>
+Status FasterKv<K, V, D, B>::CompleteRecovery(bool wait) {
+  while(system_state_.load().action == Action::Recover) {
+    if(!wait) {
+      return Status::Pending;
+    }
+    std::this_thread::yield();
+  }
+  return lazy_recovery_status_;
+}
+
+template <class K, class V, class D, class B>
+Status FasterKv<K, V, D, B>::RebuildColdLogIndex() {
+  // The index checkpoint can miss records appended to the cold log after it was taken, and can
+  // point at records appended after the log checkpoint; so drop the cold log's entries, and
+  // rebuild them by scanning the cold log up to its checkpointed tail.
+  uint8_t version = resize_info_.version;
+  for(uint64_t bucket_idx = 0; bucket_idx < state_[version].size(); ++bucket_idx) {
+    hash_bucket_t* bucket = &state_[version].bucket(bucket_idx);
+    while(true) {
+      for(uint32_t entry_idx = 0; entry_idx < hash_bucket_t::kNumEntries; ++entry_idx) {
+        if(bucket->entries[entry_idx].load().cold()) {
+          bucket->entries[entry_idx].store(HashBucketEntry::kInvalidEntry);
+        }
+      }
+      // Go to next bucket in the chain
+      HashBucketOverflowEntry entry = bucket->overflow_entry.load();
+      if(entry.unused()) {
+        // No more buckets in the chain.
+        break;
+      }
+      bucket = &overflow_buckets_allocator_[version].Get(entry.address());
+    }
+  }
+
+  Address tail_address = cold_log_.tail_address.load();
+  uint8_t* buffer = reinterpret_cast<uint8_t*>(aligned_alloc(cold_log_.sector_size,
+                    cold_log_t::kPageSize));
+  Status result = Status::Ok;
+  for(uint32_t page = cold_log_.begin_address.load().page(); Address{ page, 0 } < tail_address;
+      ++page) {
+    Address page_address{ page, 0 };
+    Address end_address = std::min(Address{ page + 1, 0 }, tail_address);
+    result = cold_log_.Read(page_address, buffer, static_cast<uint32_t>(
+                              cold_log_.SectorAlign(end_address).control() -
+                              page_address.control()));
+    if(result != Status::Ok) {
+      break;
+    }
+    Address address = std::max(page_address, cold_log_.begin_address.load());
+    while(address < end_address) {
+      const record_t* record = reinterpret_cast<const record_t*>(buffer + address.offset());
+      if(record->header.IsNull()) {
+        // Padding, at the end of an appended batch (or of the page).
+        address = cold_log_.SectorAlign(Address{ address.control() + 1 });
+        continue;
+      }
+      // Records were appended in order, so the last one for each entry heads its chain.
+      const key_t& key = record->key();
+      KeyHash hash = key.GetHash();
+      HashBucketEntry expected_entry;
+      AtomicHashBucketEntry* atomic_entry = FindOrCreateEntry(hash,
+                                            KeyIndexTraits<key_t>::inline_key(key),
+                                            expected_entry, true);
+      atomic_entry->store(HashBucketEntry{ address, hash.tag(), false, true });
+      address += record->size();
+    }
+  }
+  aligned_free(buffer);
+  return result;
+}
+
+template <class K, class V, class D, class B>
+void FasterKv<K, V, D, B>::HeavyEnter() {
   if(thread_ctx().phase == Phase::GC_IO_PENDING || thread_ctx().phase == Phase::GC_IN_PROGRESS) {
-    CleanHashTableBuckets();
+    if(maintenance_pool_.empty()) {
+      CleanHashTableBuckets();
+    }
     return;
   }
   while(thread_ctx().phase == Phase::GROW_PREPARE) {
@@ -2129,8 +3467,8 @@ void FasterKv<K, V, D>::HeavyEnter() {
   }
 }
 
-template <class K, class V, class D>
-bool FasterKv<K, V, D>::CleanHashTableBuckets() {
+template <class K, class V, class D, class B>
+bool FasterKv<K, V, D, B>::CleanHashTableBuckets() {
   uint64_t chunk = gc_.next_chunk++;
   if(chunk >= gc_.num_chunks) {
     // No chunk left to clean.
@@ -2138,6 +3476,7 @@ bool FasterKv<K, V, D>::CleanHashTableBuckets() {
   }
   uint8_t version = resize_info_.version;
   Address begin_address = hlog.begin_address.load();
+  Address cold_begin_address = cold_log_.begin_address.load();
   uint64_t upper_bound;
   if(chunk + 1 < grow_.num_chunks) {
     // All chunks but the last chunk contain kGrowHashTableChunkSize elements.
@@ -2147,15 +3486,20 @@ bool FasterKv<K, V, D>::CleanHashTableBuckets() {
     upper_bound = state_[version].size() - (chunk * kGcHashTableChunkSize);
   }
   for(uint64_t idx = 0; idx < upper_bound; ++idx) {
-    HashBucket* bucket = &state_[version].bucket(chunk * kGcHashTableChunkSize + idx);
+    hash_bucket_t* bucket = &state_[version].bucket(chunk * kGcHashTableChunkSize + idx);
     while(true) {
-      for(uint32_t entry_idx = 0; entry_idx < HashBucket::kNumEntries; ++entry_idx) {
+      for(uint32_t entry_idx = 0; entry_idx < hash_bucket_t::kNumEntries; ++entry_idx) {
         AtomicHashBucketEntry& atomic_entry = bucket->entries[entry_idx];
         HashBucketEntry expected_entry = atomic_entry.load();
+        // (A cold log entry points into the cold log, which has a begin address of its own.)
         if(!expected_entry.unused() && expected_entry.address() != Address::kInvalidAddress &&
-            expected_entry.address() < begin_address) {
+            expected_entry.address() < (expected_entry.cold() ? cold_begin_address :
+                                        begin_address)) {
           // The record that this entry points to was truncated; try to delete the entry.
-          atomic_entry.compare_exchange_strong(expected_entry, HashBucketEntry::kInvalidEntry);
+          if(atomic_entry.compare_exchange_strong(expected_entry,
+                                                  HashBucketEntry::kInvalidEntry)) {
+            state_[version].MarkDirty(chunk * kGcHashTableChunkSize + idx);
+          }
           // If deletion failed, then some other thread must have added a new record to the entry.
         }
       }
@@ -2169,13 +3513,15 @@ bool FasterKv<K, V, D>::CleanHashTableBuckets() {
     }
   }
   // Done with this chunk--did some work.
+  --gc_.num_pending_chunks;
   return true;
 }
 
-template <class K, class V, class D>
-void FasterKv<K, V, D>::AddHashEntry(HashBucket*& bucket, uint32_t& next_idx, uint8_t version,
-                                     HashBucketEntry entry) {
-  if(next_idx == HashBucket::kNumEntries) {
+template <class K, class V, class D, class B>
+void FasterKv<K, V, D, B>::AddHashEntry(hash_bucket_t*& bucket, uint32_t& next_idx,
+                                        uint8_t version, HashBucketEntry entry,
+                                        fingerprint_t fingerprint) {
+  if(next_idx == hash_bucket_t::kNumEntries) {
     // Need to allocate a new bucket, first.
     FixedPageAddress new_bucket_addr = overflow_buckets_allocator_[version].Allocate();
     HashBucketOverflowEntry new_bucket_entry{ new_bucket_addr };
@@ -2183,12 +3529,13 @@ void FasterKv<K, V, D>::AddHashEntry(HashBucket*& bucket, uint32_t& next_idx, ui
     bucket = &overflow_buckets_allocator_[version].Get(new_bucket_addr);
     next_idx = 0;
   }
+  bucket->set_fingerprint(next_idx, fingerprint);
   bucket->entries[next_idx].store(entry);
   ++next_idx;
 }
 
-template <class K, class V, class D>
-Address FasterKv<K, V, D>::TraceBackForOtherChainStart(uint64_t old_size, uint64_t new_size,
+template <class K, class V, class D, class B>
+Address FasterKv<K, V, D, B>::TraceBackForOtherChainStart(uint64_t old_size, uint64_t new_size,
     Address from_address, Address min_address, uint8_t side) {
   assert(side == 0 || side == 1);
   // Search back as far as min_address.
@@ -2204,12 +3551,57 @@ Address FasterKv<K, V, D>::TraceBackForOtherChainStart(uint64_t old_size, uint64
   return from_address;
 }
 
-template <class K, class V, class D>
-void FasterKv<K, V, D>::SplitHashTableBuckets() {
-  // This thread won't exit until all hash table buckets have been split.
+template <class K, class V, class D, class B>
+void FasterKv<K, V, D, B>::SplitColdHashEntry(HashBucketEntry old_entry,
+    fingerprint_t fingerprint, uint64_t old_size, uint64_t new_size, hash_bucket_t*& new_bucket0,
+    uint32_t& new_entry_idx0, hash_bucket_t*& new_bucket1, uint32_t& new_entry_idx1) {
+  // Walk the chain in the cold log until the latest record for each side of the new hash table
+  // turns up, so that each side's entry can start there.
+  Address begin_address = cold_log_.begin_address.load();
+  Address side_address[2] = { Address::kInvalidAddress, Address::kInvalidAddress };
+  SectorAlignedMemory buffer;
+  Status result = Status::Ok;
+  for(Address address = old_entry.address(); address >= begin_address &&
+      (side_address[0] == Address::kInvalidAddress ||
+       side_address[1] == Address::kInvalidAddress);) {
+    const record_t* record;
+    result = ReadColdRecord(address, buffer, record);
+    if(result != Status::Ok) {
+      break;
+    }
+    uint8_t side = record->key().GetHash().idx(new_size) < old_size ? 0 : 1;
+    if(side_address[side] == Address::kInvalidAddress) {
+      side_address[side] = address;
+    }
+    address = record->header.previous_address();
+  }
+  if(result != Status::Ok || old_entry.address() < begin_address) {
+    // Can't tell which new bucket the entry should go into (or, if it was just created, it doesn't
+    // lead anywhere yet); put it in both.
+    AddHashEntry(new_bucket0, new_entry_idx0, grow_.new_version, old_entry, fingerprint);
+    AddHashEntry(new_bucket1, new_entry_idx1, grow_.new_version, old_entry, fingerprint);
+    return;
+  }
+  if(side_address[0] != Address::kInvalidAddress) {
+    AddHashEntry(new_bucket0, new_entry_idx0, grow_.new_version,
+                 HashBucketEntry{ side_address[0], old_entry.tag(), false, true }, fingerprint);
+  }
+  if(side_address[1] != Address::kInvalidAddress) {
+    AddHashEntry(new_bucket1, new_entry_idx1, grow_.new_version,
+                 HashBucketEntry{ side_address[1], old_entry.tag(), false, true }, fingerprint);
+  }
+}
+
+template <class K, class V, class D, class B>
+bool FasterKv<K, V, D, B>::SplitHashTableChunk() {
+  uint64_t chunk = grow_.next_chunk++;
+  if(chunk >= grow_.num_chunks) {
+    // No chunk left to split.
+    return false;
+  }
   Address head_address = hlog.head_address.load();
   Address begin_address = hlog.begin_address.load();
-  for(uint64_t chunk = grow_.next_chunk++; chunk < grow_.num_chunks; chunk = grow_.next_chunk++) {
+  {
     uint64_t old_size = state_[grow_.old_version].size();
     uint64_t new_size = state_[grow_.new_version].size();
     assert(new_size == old_size * 2);
@@ -2225,24 +3617,33 @@ void FasterKv<K, V, D>::SplitHashTableBuckets() {
     for(uint64_t idx = 0; idx < upper_bound; ++idx) {
 
       // Split this (chain of) bucket(s).
-      HashBucket* old_bucket = &state_[grow_.old_version].bucket(
-                                 chunk * kGrowHashTableChunkSize + idx);
-      HashBucket* new_bucket0 = &state_[grow_.new_version].bucket(
+      hash_bucket_t* old_bucket = &state_[grow_.old_version].bucket(
+                                       chunk * kGrowHashTableChunkSize + idx);
+      hash_bucket_t* new_bucket0 = &state_[grow_.new_version].bucket(
                                   chunk * kGrowHashTableChunkSize + idx);
-      HashBucket* new_bucket1 = &state_[grow_.new_version].bucket(
-                                  old_size + chunk * kGrowHashTableChunkSize + idx);
+      hash_bucket_t* new_bucket1 = &state_[grow_.new_version].bucket(
+                                     old_size + chunk * kGrowHashTableChunkSize + idx);
       uint32_t new_entry_idx0 = 0;
       uint32_t new_entry_idx1 = 0;
       while(true) {
-        for(uint32_t old_entry_idx = 0; old_entry_idx < HashBucket::kNumEntries; ++old_entry_idx) {
+        for(uint32_t old_entry_idx = 0; old_entry_idx < hash_bucket_t::kNumEntries; ++old_entry_idx) {
           HashBucketEntry old_entry = old_bucket->entries[old_entry_idx].load();
+          // All records on an entry's chain share its fingerprint.
+          fingerprint_t fingerprint = old_bucket->fingerprint(old_entry_idx);
           if(old_entry.unused()) {
             // Nothing to do.
             continue;
+          } else if(old_entry.cold()) {
+            // The entry's records are in the cold log; split the entry by their keys.
+            SplitColdHashEntry(old_entry, fingerprint, old_size, new_size, new_bucket0,
+                               new_entry_idx0, new_bucket1, new_entry_idx1);
+            continue;
           } else if(old_entry.address() < head_address) {
             // Can't tell which new bucket the entry should go into; put it in both.
-            AddHashEntry(new_bucket0, new_entry_idx0, grow_.new_version, old_entry);
-            AddHashEntry(new_bucket1, new_entry_idx1, grow_.new_version, old_entry);
+            AddHashEntry(new_bucket0, new_entry_idx0, grow_.new_version, old_entry,
+                         fingerprint);
+            AddHashEntry(new_bucket1, new_entry_idx1, grow_.new_version, old_entry,
+                         fingerprint);
             continue;
           }
 
@@ -2251,25 +3652,27 @@ void FasterKv<K, V, D>::SplitHashTableBuckets() {
           KeyHash hash = record->key().GetHash();
           if(hash.idx(new_size) < old_size) {
             // Record's key hashes to the 0 side of the new hash table.
-            AddHashEntry(new_bucket0, new_entry_idx0, grow_.new_version, old_entry);
+            AddHashEntry(new_bucket0, new_entry_idx0, grow_.new_version, old_entry,
+                         fingerprint);
             Address other_address = TraceBackForOtherChainStart(old_size, new_size,
                                     record->header.previous_address(), head_address, 0);
             if(other_address >= begin_address) {
               // We found a record that either is on disk or has a key that hashes to the 1 side of
               // the new hash table.
               AddHashEntry(new_bucket1, new_entry_idx1, grow_.new_version,
-                           HashBucketEntry{ other_address, old_entry.tag(), false });
+                           HashBucketEntry{ other_address, old_entry.tag(), false }, fingerprint);
             }
           } else {
             // Record's key hashes to the 1 side of the new hash table.
-            AddHashEntry(new_bucket1, new_entry_idx1, grow_.new_version, old_entry);
+            AddHashEntry(new_bucket1, new_entry_idx1, grow_.new_version, old_entry,
+                         fingerprint);
             Address other_address = TraceBackForOtherChainStart(old_size, new_size,
                                     record->header.previous_address(), head_address, 1);
             if(other_address >= begin_address) {
               // We found a record that either is on disk or has a key that hashes to the 0 side of
               // the new hash table.
               AddHashEntry(new_bucket0, new_entry_idx0, grow_.new_version,
-                           HashBucketEntry{ other_address, old_entry.tag(), false });
+                           HashBucketEntry{ other_address, old_entry.tag(), false }, fingerprint);
             }
           }
         }
@@ -2287,13 +3690,46 @@ void FasterKv<K, V, D>::SplitHashTableBuckets() {
       // Free the old hash table.
       state_[grow_.old_version].Uninitialize();
       overflow_buckets_allocator_[grow_.old_version].Uninitialize();
-      break;
+    }
+  }
+  return true;
+}
+
+template <class K, class V, class D, class B>
+void FasterKv<K, V, D, B>::StartMaintenanceWorkers(Phase phase) {
+  // The pool's threads take the chunks, so that the sessions needn't. (A pool thread marks the
+  // phase finished up front; the phase moves on only once no chunks are pending, anyway.)
+  for(uint32_t idx = 0; idx < maintenance_pool_.size(); ++idx) {
+    maintenance_pool_.Submit([this, phase]() {
+      epoch_.MarkThreadPhaseFinished(Thread::id(), phase);
+      bool more;
+      do {
+        epoch_.Protect();
+        // (A task that starts late finds the phase over.)
+        more = system_state_.load().phase == phase &&
+               (phase == Phase::GC_IN_PROGRESS ? CleanHashTableBuckets() : SplitHashTableChunk());
+        epoch_.Unprotect();
+      } while(more);
+      // A session that acked a phase while this thread was protected may have left the state for
+      // this thread to move on.
+      TryMoveToNextState();
+    });
+  }
+}
+
+template <class K, class V, class D, class B>
+void FasterKv<K, V, D, B>::SplitHashTableBuckets() {
+  // This thread won't exit until all hash table buckets have been split (by it and the other
+  // threads, or by the maintenance pool).
+  if(maintenance_pool_.empty()) {
+    while(SplitHashTableChunk()) {
     }
   }
   // Thread has finished growing its part of the hash table.
   thread_ctx().phase = Phase::REST;
   // Thread ack that it has finished growing the hash table.
-  if(epoch_.FinishThreadPhase(Phase::GROW_IN_PROGRESS)) {
+  if(epoch_.FinishThreadPhase(Phase::GROW_IN_PROGRESS) &&
+      grow_.num_pending_chunks.load() == 0) {
     // Let other threads know that they can use the new hash table now.
     GlobalMoveToNextState(SystemState{ Action::GrowIndex, Phase::GROW_IN_PROGRESS,
                                        thread_ctx().version });
@@ -2305,12 +3741,14 @@ void FasterKv<K, V, D>::SplitHashTableBuckets() {
   }
 }
 
-template <class K, class V, class D>
-bool FasterKv<K, V, D>::GlobalMoveToNextState(SystemState current_state) {
+template <class K, class V, class D, class B>
+bool FasterKv<K, V, D, B>::GlobalMoveToNextState(SystemState current_state) {
   SystemState next_state = current_state.GetNextState();
   if(!system_state_.compare_exchange_strong(current_state, next_state)) {
     return false;
   }
+  // Parked sessions take part in the new phase before its global work is done.
+  AdvanceParkedSessions();
 
   switch(next_state.action) {
   case Action::CheckpointFull:
@@ -2342,6 +3780,9 @@ bool FasterKv<K, V, D>::GlobalMoveToNextState(SystemState current_state) {
       if(WriteIndexMetadata() != Status::Ok) {
         checkpoint_.failed = true;
       }
+      if(!checkpoint_.failed) {
+        last_index_token_ = checkpoint_.index_token;
+      }
       if(checkpoint_.index_persistence_callback) {
         // Notify the host that the index checkpoint has completed.
         checkpoint_.index_persistence_callback(Status::Ok);
@@ -2361,7 +3802,12 @@ bool FasterKv<K, V, D>::GlobalMoveToNextState(SystemState current_state) {
     case Phase::WAIT_FLUSH:
       assert(next_state.action != Action::CheckpointIndex);
       // WAIT_PENDING -> WAIT_FLUSH
-      if(fold_over_snapshot) {
+      if(use_cold_log_) {
+        // Everything below the cold log's tail is already durable.
+        checkpoint_.log_metadata.cold_log_begin = cold_log_.begin_address.load();
+        checkpoint_.log_metadata.cold_log_tail = cold_log_.tail_address.load();
+      }
+      if(!checkpoint_.log_metadata.use_snapshot_file) {
         // Move read-only to tail
         Address tail_address = hlog.ShiftReadOnlyToTail();
         // Get final address for CPR
@@ -2370,15 +3816,40 @@ bool FasterKv<K, V, D>::GlobalMoveToNextState(SystemState current_state) {
         Address tail_address = hlog.GetTailAddress();
         // Get final address for CPR
         checkpoint_.log_metadata.final_address = tail_address;
+        // Every thread has moved past the previous snapshot's version, so a page that none has
+        // modified since then is the same as in that snapshot (or in the one it is a delta to).
+        bool delta = checkpoint_.delta_snapshot && !(last_snapshot_token_ == Guid{});
+        uint32_t base_version = last_snapshot_version_;
+        if(delta) {
+          checkpoint_.log_metadata.base_log_token = last_snapshot_token_;
+        }
+        // Until this snapshot succeeds, the next one can't be a delta.
+        last_snapshot_token_ = Guid{};
         checkpoint_.snapshot_file = disk.NewFile(disk.relative_cpr_checkpoint_path(
                                       checkpoint_.hybrid_log_token) + "snapshot.dat");
         if(checkpoint_.snapshot_file.Open(&disk.handler()) != Status::Ok) {
           checkpoint_.failed = true;
         }
         // Flush the log to a snapshot.
-        hlog.AsyncFlushPagesToFile(checkpoint_.log_metadata.flushed_address.page(),
-                                   checkpoint_.log_metadata.final_address, checkpoint_.snapshot_file,
-                                   checkpoint_.flush_pending);
+        if(delta) {
+          std::vector<uint32_t> pages;
+          uint32_t end_page = tail_address.offset() > 0 ? tail_address.page() + 1 :
+                              tail_address.page();
+          for(uint32_t page = checkpoint_.log_metadata.flushed_address.page(); page < end_page;
+              ++page) {
+            if(hlog.PageModifiedVersion(page) > base_version) {
+              pages.push_back(page);
+            }
+          }
+          if(WriteSnapshotPages(pages) != Status::Ok) {
+            checkpoint_.failed = true;
+          }
+          hlog.AsyncFlushPagesToFile(pages, checkpoint_.snapshot_file, checkpoint_.flush_pending);
+        } else {
+          hlog.AsyncFlushPagesToFile(checkpoint_.log_metadata.flushed_address.page(),
+                                     checkpoint_.log_metadata.final_address,
+                                     checkpoint_.snapshot_file, checkpoint_.flush_pending);
+        }
       }
       // Write CPR meta data file
       if(WriteCprMetadata() != Status::Ok) {
@@ -2388,10 +3859,27 @@ bool FasterKv<K, V, D>::GlobalMoveToNextState(SystemState current_state) {
     case Phase::PERSISTENCE_CALLBACK:
       assert(next_state.action != Action::CheckpointIndex);
       // WAIT_FLUSH -> PERSISTENCE_CALLBACK
+      if(track_fuzzy_buckets_.load()) {
+        // Every thread has acked WAIT_FLUSH, so every record below the final address has had its
+        // bucket recorded.
+        track_fuzzy_buckets_.store(false);
+        if(!checkpoint_.failed) {
+          // (The file is optional: without it, recovery just can't be lazy.)
+          fuzzy_buckets_.Write(disk.cpr_checkpoint_path(checkpoint_.hybrid_log_token) +
+                               "fuzzy_buckets.dat");
+        }
+      }
+      if(checkpoint_.log_metadata.use_snapshot_file && !checkpoint_.failed) {
+        last_snapshot_token_ = checkpoint_.hybrid_log_token;
+        last_snapshot_version_ = checkpoint_.log_metadata.version;
+      }
       break;
     case Phase::REST:
       // PERSISTENCE_CALLBACK -> REST or INDEX_CHKPT -> REST
       if(next_state.action != Action::CheckpointIndex) {
+        if(checkpoint_retention_.enabled() && !checkpoint_.failed) {
+          PruneCheckpoints(next_state.action);
+        }
         // The checkpoint is done; we can reset the contexts now. (Have to reset contexts before
         // another checkpoint can be started.)
         checkpoint_.CheckpointDone();
@@ -2408,6 +3896,12 @@ bool FasterKv<K, V, D>::GlobalMoveToNextState(SystemState current_state) {
         if(WriteIndexMetadata() != Status::Ok) {
           checkpoint_.failed = true;
         }
+        if(!checkpoint_.failed) {
+          last_index_token_ = checkpoint_.index_token;
+          if(checkpoint_retention_.enabled()) {
+            PruneCheckpoints(next_state.action);
+          }
+        }
         auto index_persistence_callback = checkpoint_.index_persistence_callback;
         // The checkpoint is done; we can reset the contexts now. (Have to reset contexts before
         // another checkpoint can be started.)
@@ -2435,7 +3929,14 @@ bool FasterKv<K, V, D>::GlobalMoveToNextState(SystemState current_state) {
     case Phase::GC_IN_PROGRESS:
       // GC_IO_PENDING -> GC_IN_PROGRESS
       // Tell the disk to truncate the log.
-      hlog.Truncate(gc_.truncate_callback);
+      if(gc_.cold_log) {
+        cold_log_.Truncate(gc_.truncate_callback);
+      } else {
+        hlog.Truncate(gc_.truncate_callback);
+      }
+      if(!maintenance_pool_.empty()) {
+        StartMaintenanceWorkers(Phase::GC_IN_PROGRESS);
+      }
       break;
     case Phase::REST:
       // GC_IN_PROGRESS -> REST
@@ -2460,6 +3961,9 @@ bool FasterKv<K, V, D>::GlobalMoveToNextState(SystemState current_state) {
     case Phase::GROW_IN_PROGRESS:
       // Swap hash table versions so that all threads will use the new version after populating it.
       resize_info_.version = grow_.new_version;
+      if(!maintenance_pool_.empty()) {
+        StartMaintenanceWorkers(Phase::GROW_IN_PROGRESS);
+      }
       break;
     case Phase::REST:
       if(grow_.callback) {
@@ -2481,8 +3985,143 @@ bool FasterKv<K, V, D>::GlobalMoveToNextState(SystemState current_state) {
   return true;
 }
 
-template <class K, class V, class D>
-void FasterKv<K, V, D>::MarkAllPendingRequests() {
+template <class K, class V, class D, class B>
+bool FasterKv<K, V, D, B>::TryMoveToNextState() {
+  // Moves on as the last thread to finish the phase would have, were it not that the threads
+  // still taking part have all finished it, and the rest are parked.
+  SystemState current_state = system_state_.load();
+  switch(current_state.phase) {
+  case Phase::REST:
+    // No action in progress (or it hasn't started yet).
+    return false;
+  case Phase::INDEX_CHKPT: {
+    Status result = CheckpointFuzzyIndexComplete();
+    if(result == Status::Pending) {
+      return false;
+    }
+    if(result != Status::Ok) {
+      checkpoint_.failed = true;
+    }
+    if(current_state.action != Action::CheckpointIndex) {
+      // Index checkpoint is done; move on to PREPARE phase.
+      return GlobalMoveToNextState(current_state);
+    }
+    break;
+  }
+  case Phase::WAIT_FLUSH: {
+    bool flushed;
+    if(!checkpoint_.log_metadata.use_snapshot_file) {
+      flushed = hlog.flushed_until_address.load() >= checkpoint_.log_metadata.final_address;
+    } else {
+      flushed = checkpoint_.flush_pending.load() == 0;
+    }
+    if(!flushed) {
+      return false;
+    }
+    break;
+  }
+  case Phase::GC_IN_PROGRESS:
+    if(gc_.num_pending_chunks.load() > 0) {
+      return false;
+    }
+    break;
+  case Phase::GROW_IN_PROGRESS:
+    if(grow_.num_pending_chunks.load() > 0) {
+      return false;
+    }
+    break;
+  default:
+    break;
+  }
+  if(!epoch_.HaveThreadsFinishedPhase(current_state.phase)) {
+    return false;
+  }
+  return GlobalMoveToNextState(current_state);
+}
+
+template <class K, class V, class D, class B>
+SystemState FasterKv<K, V, D, B>::ContextState(SystemState final_state,
+    const ExecutionContext& context) const {
+  // A context that finished the last phase of some other kind of action (it acked the phase,
+  // but hasn't refreshed since the action ended) is at rest.
+  SystemState state{ final_state.action, Phase::REST, context.version };
+  for(SystemState next_state = state.GetNextState(); next_state.phase != Phase::REST;
+      next_state = next_state.GetNextState()) {
+    if(next_state.phase == context.phase) {
+      state.phase = next_state.phase;
+      break;
+    }
+  }
+  return state;
+}
+
+template <class K, class V, class D, class B>
+void FasterKv<K, V, D, B>::AdvanceParkedSessions() {
+  if(num_parked_.load() == 0) {
+    return;
+  }
+  std::vector<uint64_t> callback_serial_nums;
+  typename CheckpointState<file_t>::hybrid_log_persistence_callback_t callback;
+  {
+    std::lock_guard<std::mutex> lock{ parked_mutex_ };
+    callback = checkpoint_.hybrid_log_persistence_callback;
+    for(uint32_t thread_id = 0; thread_id < Thread::kMaxNumThreads; ++thread_id) {
+      if(parked_[thread_id]) {
+        AdvanceParkedSession(thread_id, callback_serial_nums);
+      }
+    }
+  }
+  // (Outside the lock, so that a callback can park or unpark its own session.)
+  for(uint64_t serial_num : callback_serial_nums) {
+    callback(Status::Ok, serial_num);
+  }
+}
+
+template <class K, class V, class D, class B>
+void FasterKv<K, V, D, B>::AdvanceParkedSession(uint32_t thread_id,
+    std::vector<uint64_t>& callback_serial_nums) {
+  // Does what HandleSpecialPhases() would do for the session, on each phase it steps through. The
+  // session has no requests in flight, so there is nothing to mark or wait for.
+  ThreadContext& contexts = thread_contexts_[thread_id];
+  SystemState final_state = system_state_.load();
+  if(final_state.action == Action::None || final_state.action == Action::Recover) {
+    contexts.cur().phase = Phase::REST;
+    contexts.cur().version = final_state.version;
+    return;
+  }
+  SystemState state = ContextState(final_state, contexts.cur());
+  while(state != final_state) {
+    state = state.GetNextState();
+    switch(state.phase) {
+    case Phase::PREPARE:
+      ++checkpoint_.log_metadata.num_threads;
+      checkpoint_.log_metadata.guids[thread_id] = contexts.cur().guid;
+      break;
+    case Phase::IN_PROGRESS:
+    case Phase::GC_IO_PENDING:
+      contexts.swap();
+      contexts.cur().Initialize(state.phase, state.version, contexts.prev().guid,
+                                contexts.prev().serial_num);
+      break;
+    case Phase::WAIT_FLUSH:
+      WriteCprContext(contexts.prev());
+      break;
+    case Phase::PERSISTENCE_CALLBACK:
+      if(checkpoint_.hybrid_log_persistence_callback) {
+        callback_serial_nums.push_back(contexts.prev().serial_num);
+      }
+      break;
+    default:
+      break;
+    }
+    epoch_.MarkThreadPhaseFinished(thread_id, state.phase);
+    contexts.cur().phase = state.phase;
+    contexts.cur().version = state.version;
+  }
+}
+
+template <class K, class V, class D, class B>
+void FasterKv<K, V, D, B>::MarkAllPendingRequests() {
   uint32_t table_version = resize_info_.version;
   uint64_t table_size = state_[table_version].size();
 
@@ -2501,8 +4140,8 @@ void FasterKv<K, V, D>::MarkAllPendingRequests() {
   }
 }
 
-template <class K, class V, class D>
-void FasterKv<K, V, D>::HandleSpecialPhases() {
+template <class K, class V, class D, class B>
+void FasterKv<K, V, D, B>::HandleSpecialPhases() {
   SystemState final_state = system_state_.load();
   if(final_state.phase == Phase::REST) {
     // Nothing to do; just reset thread context.
@@ -2510,7 +4149,7 @@ void FasterKv<K, V, D>::HandleSpecialPhases() {
     thread_ctx().version = final_state.version;
     return;
   }
-  SystemState previous_state{ final_state.action, thread_ctx().phase, thread_ctx().version };
+  SystemState previous_state = ContextState(final_state, thread_ctx());
   do {
     // Identify the transition (currentState -> nextState)
     SystemState current_state = (previous_state == final_state) ? final_state :
@@ -2605,14 +4244,14 @@ void FasterKv<K, V, D>::HandleSpecialPhases() {
         // Handle WAIT_PENDING -> WAIT_FLUSH and WAIT_FLUSH -> WAIT_FLUSH
         if(!epoch_.HasThreadFinishedPhase(Phase::WAIT_FLUSH)) {
           bool flushed;
-          if(fold_over_snapshot) {
+          if(!checkpoint_.log_metadata.use_snapshot_file) {
             flushed = hlog.flushed_until_address.load() >= checkpoint_.log_metadata.final_address;
           } else {
             flushed = checkpoint_.flush_pending.load() == 0;
           }
           if(flushed) {
             // write context info
-            WriteCprContext();
+            WriteCprContext(prev_thread_ctx());
             // Thread ack that it has written its CPU context.
             if(epoch_.FinishThreadPhase(Phase::WAIT_FLUSH)) {
               GlobalMoveToNextState(current_state);
@@ -2670,11 +4309,13 @@ void FasterKv<K, V, D>::HandleSpecialPhases() {
       case Phase::GC_IN_PROGRESS:
         // Handle GC_IO_PENDING -> GC_IN_PROGRESS and GC_IN_PROGRESS -> GC_IN_PROGRESS.
         if(!epoch_.HasThreadFinishedPhase(Phase::GC_IN_PROGRESS)) {
-          if(!CleanHashTableBuckets()) {
+          // (With a maintenance pool, the pool cleans the buckets.)
+          if(!maintenance_pool_.empty() || !CleanHashTableBuckets()) {
             // No more buckets for this thread to clean; thread has finished GC.
             thread_ctx().phase = Phase::REST;
             // Thread ack that it has finished GC.
-            if(epoch_.FinishThreadPhase(Phase::GC_IN_PROGRESS)) {
+            if(epoch_.FinishThreadPhase(Phase::GC_IN_PROGRESS) &&
+                gc_.num_pending_chunks.load() == 0) {
               GlobalMoveToNextState(current_state);
             }
           }
@@ -2709,12 +4350,18 @@ void FasterKv<K, V, D>::HandleSpecialPhases() {
     thread_ctx().version = current_state.version;
     previous_state = current_state;
   } while(previous_state != final_state);
+  if(num_parked_.load() > 0) {
+    // The phase may be waiting only on sessions that have since parked.
+    TryMoveToNextState();
+  }
 }
 
-template <class K, class V, class D>
-bool FasterKv<K, V, D>::Checkpoint(void(*index_persistence_callback)(Status result),
+template <class K, class V, class D, class B>
+bool FasterKv<K, V, D, B>::Checkpoint(void(*index_persistence_callback)(Status result),
                                    void(*hybrid_log_persistence_callback)(Status result,
-                                       uint64_t persistent_serial_num), Guid& token) {
+                                       uint64_t persistent_serial_num), Guid& token,
+                                   bool incremental_index,
+                                   LogCheckpointType log_checkpoint_type) {
   // Only one thread can initiate a checkpoint at a time.
   SystemState expected{ Action::None, Phase::REST, system_state_.load().version };
   SystemState desired{ Action::CheckpointFull, Phase::REST, expected.version };
@@ -2729,28 +4376,36 @@ bool FasterKv<K, V, D>::Checkpoint(void(*index_persistence_callback)(Status resu
   disk.CreateIndexCheckpointDirectory(token);
   disk.CreateCprCheckpointDirectory(token);
   // Obtain tail address for fuzzy index checkpoint
-  if(!fold_over_snapshot) {
+  if(log_checkpoint_type != LogCheckpointType::FoldOver) {
     checkpoint_.InitializeCheckpoint(token, desired.version, state_[resize_info_.version].size(),
-                                     hlog.begin_address.load(),  hlog.GetTailAddress(), true,
+                                     hlog.begin_address.load(),  hlog.GetTailAddress(),
+                                     incremental_index, log_checkpoint_type,
                                      hlog.flushed_until_address.load(),
                                      index_persistence_callback,
                                      hybrid_log_persistence_callback);
   } else {
+    // Start recording the buckets that the fuzzy region touches before reading its start address,
+    // so that no record in the region goes unrecorded.
+    fuzzy_buckets_.Initialize(state_[resize_info_.version].size());
+    track_fuzzy_buckets_.store(true);
     checkpoint_.InitializeCheckpoint(token, desired.version, state_[resize_info_.version].size(),
-                                     hlog.begin_address.load(),  hlog.GetTailAddress(), false,
-                                     Address::kInvalidAddress, index_persistence_callback,
+                                     hlog.begin_address.load(),  hlog.GetTailAddress(),
+                                     incremental_index, log_checkpoint_type,
+                                     Address::kInvalidAddress,
+                                     index_persistence_callback,
                                      hybrid_log_persistence_callback);
 
   }
   InitializeCheckpointLocks();
   // Let other threads know that the checkpoint has started.
   system_state_.store(desired.GetNextState());
+  AdvanceParkedSessions();
   return true;
 }
 
-template <class K, class V, class D>
-bool FasterKv<K, V, D>::CheckpointIndex(void(*index_persistence_callback)(Status result),
-                                        Guid& token) {
+template <class K, class V, class D, class B>
+bool FasterKv<K, V, D, B>::CheckpointIndex(void(*index_persistence_callback)(Status result),
+                                        Guid& token, bool incremental) {
   // Only one thread can initiate a checkpoint at a time.
   SystemState expected{ Action::None, Phase::REST, system_state_.load().version };
   SystemState desired{ Action::CheckpointIndex, Phase::REST, expected.version };
@@ -2766,15 +4421,16 @@ bool FasterKv<K, V, D>::CheckpointIndex(void(*index_persistence_callback)(Status
   checkpoint_.InitializeIndexCheckpoint(token, desired.version,
                                         state_[resize_info_.version].size(),
                                         hlog.begin_address.load(), hlog.GetTailAddress(),
-                                        index_persistence_callback);
+                                        incremental, index_persistence_callback);
   // Let other threads know that the checkpoint has started.
   system_state_.store(desired.GetNextState());
+  AdvanceParkedSessions();
   return true;
 }
 
-template <class K, class V, class D>
-bool FasterKv<K, V, D>::CheckpointHybridLog(void(*hybrid_log_persistence_callback)(Status result,
-    uint64_t persistent_serial_num), Guid& token) {
+template <class K, class V, class D, class B>
+bool FasterKv<K, V, D, B>::CheckpointHybridLog(void(*hybrid_log_persistence_callback)(Status result,
+    uint64_t persistent_serial_num), Guid& token, LogCheckpointType log_checkpoint_type) {
   // Only one thread can initiate a checkpoint at a time.
   SystemState expected{ Action::None, Phase::REST, system_state_.load().version };
   SystemState desired{ Action::CheckpointHybridLog, Phase::REST, expected.version };
@@ -2788,23 +4444,213 @@ bool FasterKv<K, V, D>::CheckpointHybridLog(void(*hybrid_log_persistence_callbac
   token = Guid::Create();
   disk.CreateCprCheckpointDirectory(token);
   // Obtain tail address for fuzzy index checkpoint
-  if(!fold_over_snapshot) {
-    checkpoint_.InitializeHybridLogCheckpoint(token, desired.version, true,
+  if(log_checkpoint_type != LogCheckpointType::FoldOver) {
+    checkpoint_.InitializeHybridLogCheckpoint(token, desired.version, log_checkpoint_type,
         hlog.flushed_until_address.load(), hybrid_log_persistence_callback);
   } else {
-    checkpoint_.InitializeHybridLogCheckpoint(token, desired.version, false,
+    checkpoint_.InitializeHybridLogCheckpoint(token, desired.version, log_checkpoint_type,
         Address::kInvalidAddress, hybrid_log_persistence_callback);
   }
   InitializeCheckpointLocks();
   // Let other threads know that the checkpoint has started.
   system_state_.store(desired.GetNextState());
+  AdvanceParkedSessions();
+  return true;
+}
+
+template <class K, class V, class D, class B>
+bool FasterKv<K, V, D, B>::Commit(commit_callback_t callback) {
+  uint32_t thread_id = Thread::id();
+  if(commit_callbacks_[thread_id]) {
+    // Already waiting for a commit.
+    return false;
+  }
+  // A pending request reaches the log only once it completes.
+  while(!thread_ctx().pending_ios.empty() || !thread_ctx().retry_requests.empty() ||
+        !prev_thread_ctx().pending_ios.empty() || !prev_thread_ctx().retry_requests.empty()) {
+    CompletePending(false);
+    std::this_thread::yield();
+  }
+  std::lock_guard<std::mutex> lock{ commit_mutex_ };
+  commit_serial_nums_[thread_id] = thread_ctx().serial_num;
+  // The log is flushed up to the tail once every thread has seen it become read-only, so once
+  // no thread is still updating a record below the tail in place.
+  commit_addresses_[thread_id] = hlog.ShiftReadOnlyToTail();
+  commit_results_[thread_id] = Status::Pending;
+  commit_callbacks_[thread_id] = callback;
   return true;
 }
 
-template <class K, class V, class D>
-Status FasterKv<K, V, D>::Recover(const Guid& index_token, const Guid& hybrid_log_token,
+template <class K, class V, class D, class B>
+void FasterKv<K, V, D, B>::CompleteCommit() {
+  uint32_t thread_id = Thread::id();
+  Address flushed_until_address = hlog.flushed_until_address.load();
+  if(flushed_until_address < commit_addresses_[thread_id]) {
+    // Still flushing.
+    return;
+  }
+  commit_callback_t callback;
+  Status result;
+  {
+    std::lock_guard<std::mutex> lock{ commit_mutex_ };
+    if(commit_results_[thread_id] == Status::Pending) {
+      WriteCommitMetadata(flushed_until_address);
+    }
+    callback = commit_callbacks_[thread_id];
+    result = commit_results_[thread_id];
+    commit_callbacks_[thread_id] = nullptr;
+  }
+  callback(result, commit_serial_nums_[thread_id]);
+}
+
+template <class K, class V, class D, class B>
+Status FasterKv<K, V, D, B>::WriteCommitMetadata(Address flushed_until_address) {
+  // (Called with "commit_mutex_" held.) Records every waiting session whose commit the flush
+  // covers, with one write. The commit metadata is laid out as a hybrid-log checkpoint's is; each
+  // write goes to the other commit file, so that a torn write leaves the previous commit intact.
+  bool recorded[Thread::kMaxNumThreads] = {};
+  uint32_t num_sessions = 0;
+  for(uint32_t thread_id = 0; thread_id < Thread::kMaxNumThreads; ++thread_id) {
+    if(commit_callbacks_[thread_id] && commit_results_[thread_id] == Status::Pending &&
+        commit_addresses_[thread_id] <= flushed_until_address) {
+      commit_metadata_.guids[thread_id] = thread_contexts_[thread_id].cur().guid;
+      commit_metadata_.monotonic_serial_nums[thread_id] = commit_serial_nums_[thread_id];
+      recorded[thread_id] = true;
+    }
+    if(!(commit_metadata_.guids[thread_id] == Guid{})) {
+      ++num_sessions;
+    }
+  }
+  commit_metadata_.num_threads = num_sessions;
+  commit_metadata_.version = system_state_.load().version;
+  commit_metadata_.flushed_address = std::max(commit_metadata_.flushed_address,
+                                              flushed_until_address);
+  commit_metadata_.final_address = commit_metadata_.flushed_address;
+  Status result = WriteCheckpointMetadata(disk.commit_path(num_commit_writes_++ % 2),
+                                          commit_metadata_);
+  for(uint32_t thread_id = 0; thread_id < Thread::kMaxNumThreads; ++thread_id) {
+    if(recorded[thread_id]) {
+      commit_results_[thread_id] = result;
+    }
+  }
+  return result;
+}
+
+template <class K, class V, class D, class B>
+bool FasterKv<K, V, D, B>::ApplyCommit() {
+  // The latest commit is in the commit file with the furthest address (that is intact).
+  LogMetadata commits[2];
+  int latest = -1;
+  for(uint32_t idx = 0; idx < 2; ++idx) {
+    if(ReadCheckpointMetadata(disk.commit_path(idx), commits[idx]) == Status::Ok &&
+        (latest < 0 || commits[idx].final_address > commits[latest].final_address)) {
+      latest = idx;
+    }
+  }
+  LogMetadata& log_metadata = checkpoint_.log_metadata;
+  if(latest < 0 || commits[latest].final_address <= log_metadata.final_address) {
+    return false;
+  }
+  // Replay up to where the commit flushed the log. The log itself holds everything before that
+  // address, so no snapshot is needed.
+  const LogMetadata& commit = commits[latest];
+  log_metadata.final_address = commit.final_address;
+  log_metadata.version = std::max(log_metadata.version, commit.version);
+  log_metadata.use_snapshot_file = false;
+  for(uint32_t idx = 0; idx < Thread::kMaxNumThreads; ++idx) {
+    if(commit.guids[idx] == Guid{}) {
+      continue;
+    }
+    uint64_t& serial_num = checkpoint_.continue_tokens[commit.guids[idx]];
+    serial_num = std::max(serial_num, commit.monotonic_serial_nums[idx]);
+  }
+  return true;
+}
+
+template <class K, class V, class D, class B>
+Status FasterKv<K, V, D, B>::RehashIndex(uint64_t new_size, uint32_t num_threads) {
+  // Builds the other version of the hash table at the new size, a chunk of new buckets per task;
+  // each new bucket takes the entries of the old buckets that map to it. The records are still
+  // on disk, so (as GrowIndex() does with records on disk) growing copies each entry into every
+  // new bucket that its keys may now hash to. Shrinking merges old buckets, but can't merge two
+  // entries' chains; if two merged entries have the same tag (and fingerprint), it backs off to
+  // twice the size and tries again.
+  uint8_t old_version = resize_info_.version;
+  uint8_t new_version = 1 - old_version;
+  uint64_t old_size = state_[old_version].size();
+  while(new_size != old_size) {
+    state_[new_version].Initialize(new_size, disk.log().alignment());
+    overflow_buckets_allocator_[new_version].Initialize(disk.log().alignment(), epoch_);
+    uint64_t num_sources = std::max(old_size / new_size, (uint64_t)1);
+    uint64_t num_chunks = std::max(new_size / kGrowHashTableChunkSize, (uint64_t)1);
+    uint64_t chunk_size = new_size / num_chunks;
+    std::atomic<uint64_t> next_chunk{ 0 };
+    std::atomic<bool> conflict{ false };
+    auto rehash_buckets = [&]() {
+      for(uint64_t chunk = next_chunk++; chunk < num_chunks && !conflict.load();
+          chunk = next_chunk++) {
+        for(uint64_t new_idx = chunk * chunk_size; new_idx < (chunk + 1) * chunk_size; ++new_idx) {
+          hash_bucket_t* new_bucket = &state_[new_version].bucket(new_idx);
+          hash_bucket_t* tail_bucket = new_bucket;
+          uint32_t new_entry_idx = 0;
+          for(uint64_t source = 0; source < num_sources; ++source) {
+            const hash_bucket_t* old_bucket = &state_[old_version].bucket(
+                                                (new_idx & (old_size - 1)) + source * new_size);
+            while(true) {
+              for(uint32_t entry_idx = 0; entry_idx < hash_bucket_t::kNumEntries; ++entry_idx) {
+                HashBucketEntry entry = old_bucket->entries[entry_idx].load();
+                if(entry.unused()) {
+                  continue;
+                }
+                fingerprint_t fingerprint = old_bucket->fingerprint(entry_idx);
+                AddHashEntry(tail_bucket, new_entry_idx, new_version, entry, fingerprint);
+                if(source > 0 && HasConflictingEntry(fingerprint, new_bucket, new_version,
+                                                     &tail_bucket->entries[new_entry_idx - 1])) {
+                  conflict.store(true);
+                  return;
+                }
+              }
+              HashBucketOverflowEntry overflow_entry = old_bucket->overflow_entry.load();
+              if(overflow_entry.unused()) {
+                break;
+              }
+              old_bucket = &overflow_buckets_allocator_[old_version].Get(overflow_entry.address());
+            }
+          }
+        }
+      }
+    };
+
+    RunOnThreads(num_threads, rehash_buckets);
+    if(!conflict.load()) {
+      state_[old_version].Uninitialize();
+      overflow_buckets_allocator_[old_version].Uninitialize();
+      resize_info_.version = new_version;
+      return Status::Ok;
+    }
+    state_[new_version].Uninitialize();
+    overflow_buckets_allocator_[new_version].Uninitialize();
+    new_size *= 2;
+  }
+  // Couldn't shrink at all.
+  return Status::Ok;
+}
+
+template <class K, class V, class D, class B>
+Status FasterKv<K, V, D, B>::Recover(const Guid& index_token, const Guid& hybrid_log_token,
                                   uint32_t& version,
-                                  std::vector<Guid>& session_ids) {
+                                  std::vector<Guid>& session_ids, uint32_t num_threads,
+                                  bool lazy, IndexLoadMode index_load_mode,
+                                  uint64_t table_size) {
+  if(table_size != 0 && !Utility::IsPowerOfTwo(table_size)) {
+    throw std::invalid_argument{ " Size is not a power of 2" };
+  }
+  if(table_size > INT32_MAX) {
+    throw std::invalid_argument{ " Cannot allocate such a large hash table " };
+  }
+  if(num_threads == 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
   version = 0;
   session_ids.clear();
   SystemState expected = SystemState{ Action::None, Phase::REST, system_state_.load().version };
@@ -2813,6 +4659,10 @@ Status FasterKv<K, V, D>::Recover(const Guid& index_token, const Guid& hybrid_lo
     return Status::Aborted;
   }
   checkpoint_.InitializeRecover(index_token, hybrid_log_token);
+  lazy_recovery_status_ = Status::Ok;
+  // The recovered log doesn't know which of its pages were modified since the snapshot, so the
+  // next snapshot can't be a delta.
+  last_snapshot_token_ = Guid{};
   Status status;
 #define BREAK_NOT_OK(s) \
     status = (s); \
@@ -2822,32 +4672,71 @@ Status FasterKv<K, V, D>::Recover(const Guid& index_token, const Guid& hybrid_lo
     // Index and log metadata.
     BREAK_NOT_OK(ReadIndexMetadata(index_token));
     BREAK_NOT_OK(ReadCprMetadata(hybrid_log_token));
-    if(checkpoint_.index_metadata.version != checkpoint_.log_metadata.version) {
-      // Index and hybrid-log checkpoints should have the same version.
+    if(checkpoint_.index_metadata.key_hash_id != KeyHashId<key_t>::value) {
+      // The index was built with another hash function; no lookup would find its keys.
       status = Status::Corruption;
       break;
     }
+    if(checkpoint_.index_metadata.version > checkpoint_.log_metadata.version) {
+      // The hybrid-log checkpoint can't precede the index checkpoint. (It can follow it: replay
+      // then starts from where the index checkpoint did.)
+      status = Status::Corruption;
+      break;
+    }
+
+    BREAK_NOT_OK(ReadCprContexts(hybrid_log_token, checkpoint_.log_metadata.guids));
+    // A commit since the hybrid-log checkpoint extends it.
+    bool committed = ApplyCommit();
 
     system_state_.store(SystemState{ Action::Recover, Phase::REST,
                                      checkpoint_.log_metadata.version + 1 });
-
-    BREAK_NOT_OK(ReadCprContexts(hybrid_log_token, checkpoint_.log_metadata.guids));
     // The index itself (including overflow buckets).
-    BREAK_NOT_OK(RecoverFuzzyIndex());
+    BREAK_NOT_OK(RecoverFuzzyIndex(index_load_mode));
     BREAK_NOT_OK(RecoverFuzzyIndexComplete(true));
+    if(table_size != 0 && table_size != state_[resize_info_.version].size()) {
+      BREAK_NOT_OK(RehashIndex(table_size, num_threads));
+    }
     // Any changes made to the log while the index was being fuzzy-checkpointed.
-    if(fold_over_snapshot) {
-      BREAK_NOT_OK(RecoverHybridLog());
+    ResetFuzzyIndexEntries(num_threads);
+    // Lazy recovery needs the buckets that the fuzzy region touched, which only a full fold-over
+    // checkpoint records. (They're the checkpointed index's buckets: a rehashed index keeps every
+    // key of a touched bucket out of the other buckets' entries.)
+    lazy = lazy && !checkpoint_.log_metadata.use_snapshot_file && !committed &&
+           index_token == hybrid_log_token &&
+           recovering_buckets_.Read(disk.cpr_checkpoint_path(hybrid_log_token) +
+                                    "fuzzy_buckets.dat",
+                                    checkpoint_.index_metadata.table_size) == Status::Ok;
+    if(lazy) {
+      BREAK_NOT_OK(RestoreTailPage());
     } else {
-      BREAK_NOT_OK(RecoverHybridLogFromSnapshotFile());
+      if(!checkpoint_.log_metadata.use_snapshot_file) {
+        BREAK_NOT_OK(RecoverHybridLog(num_threads));
+      } else {
+        BREAK_NOT_OK(RecoverHybridLogFromSnapshotFile(num_threads));
+      }
+      BREAK_NOT_OK(RestoreHybridLog());
+    }
+    if(use_cold_log_ && checkpoint_.log_metadata.cold_log_tail != Address::kInvalidAddress) {
+      cold_log_.RecoveryReset(checkpoint_.log_metadata.cold_log_begin,
+                              checkpoint_.log_metadata.cold_log_tail);
+      BREAK_NOT_OK(RebuildColdLogIndex());
     }
-    BREAK_NOT_OK(RestoreHybridLog());
   } while(false);
   if(status == Status::Ok) {
     for(const auto& token : checkpoint_.continue_tokens) {
       session_ids.push_back(token.first);
     }
     version = checkpoint_.log_metadata.version;
+    if(lazy) {
+      // The store stays in recovery (so no checkpoint etc. can start) until the background
+      // replay is done.
+      lazy_recovery_.store(true);
+      if(recovery_thread_.joinable()) {
+        recovery_thread_.join();
+      }
+      recovery_thread_ = std::thread{ &faster_t::FinishLazyRecovery, this, num_threads };
+      return status;
+    }
   }
   checkpoint_.RecoverDone();
   system_state_.store(SystemState{ Action::None, Phase::REST,
@@ -2856,29 +4745,51 @@ Status FasterKv<K, V, D>::Recover(const Guid& index_token, const Guid& hybrid_lo
 #undef BREAK_NOT_OK
 }
 
-template <class K, class V, class D>
-bool FasterKv<K, V, D>::ShiftBeginAddress(Address address,
+template <class K, class V, class D, class B>
+bool FasterKv<K, V, D, B>::ShiftBeginAddress(Address address,
+    GcState::truncate_callback_t truncate_callback,
+    GcState::complete_callback_t complete_callback) {
+  return StartGc(address, false, truncate_callback, complete_callback);
+}
+
+template <class K, class V, class D, class B>
+bool FasterKv<K, V, D, B>::ShiftColdLogBeginAddress(Address address,
     GcState::truncate_callback_t truncate_callback,
     GcState::complete_callback_t complete_callback) {
+  if(!use_cold_log_) {
+    return false;
+  }
+  return StartGc(address, true, truncate_callback, complete_callback);
+}
+
+template <class K, class V, class D, class B>
+bool FasterKv<K, V, D, B>::StartGc(Address address, bool cold_log,
+                                   GcState::truncate_callback_t truncate_callback,
+                                   GcState::complete_callback_t complete_callback) {
   SystemState expected = SystemState{ Action::None, Phase::REST, system_state_.load().version };
   if(!system_state_.compare_exchange_strong(expected,
       SystemState{ Action::GC, Phase::REST, expected.version })) {
     // Can't start a GC while an action is already in progress.
     return false;
   }
-  hlog.begin_address.store(address);
+  if(cold_log) {
+    cold_log_.begin_address.store(address);
+  } else {
+    hlog.begin_address.store(address);
+  }
   // Each active thread will notify the epoch when all pending I/Os have completed.
   epoch_.ResetPhaseFinished();
   uint64_t num_chunks = std::max(state_[resize_info_.version].size() / kGcHashTableChunkSize,
                                  (uint64_t)1);
-  gc_.Initialize(truncate_callback, complete_callback, num_chunks);
+  gc_.Initialize(truncate_callback, complete_callback, cold_log, num_chunks);
   // Let other threads know to complete their pending I/Os, so that the log can be truncated.
   system_state_.store(SystemState{ Action::GC, Phase::GC_IO_PENDING, expected.version });
+  AdvanceParkedSessions();
   return true;
 }
 
-template <class K, class V, class D>
-bool FasterKv<K, V, D>::GrowIndex(GrowState::callback_t caller_callback) {
+template <class K, class V, class D, class B>
+bool FasterKv<K, V, D, B>::GrowIndex(GrowState::callback_t caller_callback) {
   SystemState expected = SystemState{ Action::None, Phase::REST, system_state_.load().version };
   if(!system_state_.compare_exchange_strong(expected,
       SystemState{ Action::GrowIndex, Phase::REST, expected.version })) {
@@ -2898,6 +4809,7 @@ bool FasterKv<K, V, D>::GrowIndex(GrowState::callback_t caller_callback) {
 
   SystemState next = SystemState{ Action::GrowIndex, Phase::GROW_PREPARE, expected.version };
   system_state_.store(next);
+  AdvanceParkedSessions();
 
   // Let this thread know it should be growing the index.
   Refresh();
@@ -2918,9 +4830,41 @@ inline std::ostream& operator << (std::ostream& out, const FixedPageAddress addr
 }
 
 /// When invoked, compacts the hybrid-log between the begin address and a
-/// passed in offset (`untilAddress`).
-template <class K, class V, class D>
-bool FasterKv<K, V, D>::Compact(uint64_t untilAddress)
+/// passed in offset (`untilAddress`). Each live record is passed through
+/// `filter` before it is copied forward.
+template <class K, class V, class D, class B>
+template <class F>
+bool FasterKv<K, V, D, B>::Compact(uint64_t untilAddress, F filter, CompactionType type,
+                                   uint32_t num_threads, CompactionProgress* progress)
+{
+  if (lazy_recovery_.load()) {
+    // Can't move records around while a lazy recovery is still replaying the log.
+    return false;
+  }
+  if (use_cold_log_) {
+    CompactionProgress own_progress;
+    return CompactToColdLog(untilAddress, filter, std::max(num_threads, 1u),
+                            progress ? *progress : own_progress);
+  }
+  switch (type) {
+  case CompactionType::Scan:
+    return CompactWithScan(untilAddress, filter);
+  case CompactionType::Lookup: {
+    CompactionProgress own_progress;
+    return CompactWithLookup(untilAddress, filter, std::max(num_threads, 1u),
+                             progress ? *progress : own_progress);
+  }
+  }
+  // not reached
+  assert(false);
+  return false;
+}
+
+/// Compacts by replaying [beginAddress, untilAddress) into a temporary
+/// FASTER instance, and removing from it every key found later in the log.
+template <class K, class V, class D, class B>
+template <class F>
+bool FasterKv<K, V, D, B>::CompactWithScan(uint64_t untilAddress, F filter)
 {
   // First, initialize a mini FASTER that will store all live records in
   // the range [beginAddress, untilAddress).
@@ -2939,7 +4883,8 @@ bool FasterKv<K, V, D>::Compact(uint64_t untilAddress)
   // In the first phase of compaction, scan the hybrid-log between addresses
   // [beginAddress, untilAddress), adding all live records to the mini FASTER.
   // On encountering a tombstone, we try to delete the record from the mini
-  // instance of FASTER.
+  // instance of FASTER. An expired record is treated like a tombstone: it
+  // shadows any older versions of its key, and is itself dropped.
   int numOps = 0;
   ScanIterator<faster_t> iter(&hlog, Buffering::DOUBLE_PAGE, begin,
                               Address(untilAddress), &disk);
@@ -2947,7 +4892,7 @@ bool FasterKv<K, V, D>::Compact(uint64_t untilAddress)
     auto r = iter.GetNext();
     if (r == nullptr) break;
 
-    if (!r->header.tombstone) {
+    if (!r->header.tombstone && !r->expired()) {
       CompactionUpsert<K, V> ctxt(r);
       auto cb = [](IAsyncContext* ctxt, Status result) {
         CallbackContext<CompactionUpsert<K, V>> context(ctxt);
@@ -2974,7 +4919,9 @@ bool FasterKv<K, V, D>::Compact(uint64_t untilAddress)
   auto upto = LogScanForValidity(Address(untilAddress), &tempKv);
 
   // Finally, scan through all records within the temporary FASTER instance,
-  // inserting those that don't already exist within FASTER's mutable region.
+  // inserting those that don't already exist within FASTER's mutable region,
+  // and that the filter keeps. (Records that expired since the first phase
+  // are dropped, too.)
   numOps = 0;
   ScanIterator<faster_t> iter2(&tempKv.hlog, Buffering::DOUBLE_PAGE,
                                tempKv.hlog.begin_address.load(),
@@ -2983,14 +4930,17 @@ bool FasterKv<K, V, D>::Compact(uint64_t untilAddress)
     auto r = iter2.GetNext();
     if (r == nullptr) break;
 
-    if (!r->header.tombstone && !ContainsKeyInMemory(r->key(), upto)) {
+    if (!r->header.tombstone && !r->expired() &&
+        !ContainsKeyInMemory(r->key(), upto)) {
       CompactionUpsert<K, V> ctxt(r);
       auto cb = [](IAsyncContext* ctxt, Status result) {
         CallbackContext<CompactionUpsert<K, V>> context(ctxt);
         assert(result == Status::Ok);
       };
 
-      Upsert(ctxt, cb, 0);
+      if (filter(ctxt.key(), ctxt.value()) == CompactionAction::Keep) {
+        Upsert(ctxt, cb, 0);
+      }
     }
 
     if (++numOps % 1000 == 0) {
@@ -3009,6 +4959,604 @@ bool FasterKv<K, V, D>::Compact(uint64_t untilAddress)
   return true;
 }
 
+/// Compacts by scanning [beginAddress, untilAddress) and, for each record,
+/// probing the main index: a record is live if its key's hash chain leads
+/// back to it without passing a newer record for the same key. Live records
+/// are copied to the tail with a conditional RMW (see ConditionalCopyToTail),
+/// so a record that is overwritten while compaction runs is never copied over
+/// its newer version. The chain walk goes to disk, when need be, through the
+/// usual pending-I/O path; compaction completes those I/Os as it goes.
+///
+/// Since every check and copy is a self-contained, concurrent operation, the
+/// range can be split by pages across threads: each thread takes the next
+/// page that nobody has scanned yet, until none is left.
+template <class K, class V, class D, class B>
+template <class F>
+bool FasterKv<K, V, D, B>::CompactWithLookup(uint64_t untilAddress, F filter,
+                                             uint32_t num_threads,
+                                             CompactionProgress& progress)
+{
+  Address begin = hlog.begin_address.load();
+  Address until{ untilAddress };
+  if (until <= begin) return false;
+
+  uint32_t end_page = until.offset() == 0 ? until.page() : until.page() + 1;
+  progress.pages_total.store(end_page - begin.page());
+  std::atomic<uint32_t> next_page{ begin.page() };
+
+  RunCompactionThreads(num_threads, progress, [&]() {
+    CompactPagesWithLookup(begin, until, next_page, filter, progress);
+  });
+  return !progress.cancelled();
+}
+
+/// Runs "work", one thread's share of a compaction, on this thread (which has a session) and on
+/// "num_threads - 1" others, each in a session of its own. A session can start only in the REST
+/// phase, so this thread first waits out--and takes part in--any checkpoint or index growth that
+/// is under way. One may still start before a thread has started its session; that thread then
+/// does no work, and cancels the compaction, rather than leave this thread waiting for it.
+template <class K, class V, class D, class B>
+template <class W>
+void FasterKv<K, V, D, B>::RunCompactionThreads(uint32_t num_threads,
+    CompactionProgress& progress, const W& work)
+{
+  while (num_threads > 1 && system_state_.load().phase != Phase::REST) {
+    CompletePending(false);
+    std::this_thread::yield();
+  }
+
+  std::atomic<uint32_t> num_active{ num_threads - 1 };
+  std::vector<std::thread> threads;
+  for (uint32_t idx = 1; idx < num_threads; ++idx) {
+    threads.emplace_back([&]() {
+      bool started = true;
+      try {
+        StartSession();
+      } catch (const std::runtime_error&) {
+        started = false;
+        progress.Cancel();
+      }
+      if (started) {
+        work();
+        StopSession();
+      }
+      --num_active;
+    });
+  }
+
+  work();
+  // The other threads' copies may need this thread's session to move forward
+  // (e.g., to flush and evict pages), so keep refreshing it until they're done.
+  while (num_active.load() > 0) {
+    CompletePending(false);
+    std::this_thread::yield();
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+/// One thread's share of lookup compaction: scans pages of [begin, until),
+/// taking each from "next_page", and completes its pending copies.
+template <class K, class V, class D, class B>
+template <class F>
+void FasterKv<K, V, D, B>::CompactPagesWithLookup(Address begin, Address until,
+    std::atomic<uint32_t>& next_page, const F& filter, CompactionProgress& progress)
+{
+  auto cb = [](IAsyncContext* ctxt, Status result) {
+    CallbackContext<CompactionCopyToTail<K, V, F>> context(ctxt);
+    assert(result == Status::Ok || result == Status::Aborted);
+  };
+
+  int numOps = 0;
+  while (!progress.cancelled()) {
+    uint32_t page = next_page++;
+    if (Address(page, 0) >= until) break;
+
+    Address from = std::max(begin, Address(page, 0));
+    Address to = std::min(until, Address(page + 1, 0));
+    ScanIterator<faster_t> iter(&hlog, Buffering::UN_BUFFERED, from, to, &disk);
+    while (!progress.cancelled()) {
+      Address address;
+      auto r = iter.GetNext(address);
+      if (r == nullptr) {
+        ++progress.pages_done;
+        break;
+      }
+      ++progress.records_scanned;
+
+      // Tombstones and expired records are never copied; neither are records
+      // that were never linked into a hash chain.
+      if (!r->header.tombstone && !r->header.invalid && !r->expired()) {
+        CompactionCopyToTail<K, V, F> ctxt(r, address, filter);
+        ConditionalCopyToTail(ctxt, cb);
+      }
+
+      if (++numOps % 1000 == 0) {
+        CompletePending(false);
+      }
+    }
+  }
+
+  CompletePending(true);
+}
+
+/// Copies a record that compaction found at the context's address to the
+/// tail of the log, if it is still its key's latest record (and the filter
+/// keeps it). Returns Status::Aborted if it isn't, and Status::Pending if
+/// the check had to go to disk.
+template <class K, class V, class D, class B>
+template <class CC>
+inline Status FasterKv<K, V, D, B>::ConditionalCopyToTail(CC& context, AsyncCallback callback) {
+  typedef PendingCopyToTailContext<CC> pending_copy_context_t;
+
+  pending_copy_context_t pending_context{ context, callback };
+  OperationStatus internal_status = InternalRmw(pending_context, false);
+  if(internal_status == OperationStatus::SUCCESS) {
+    return Status::Ok;
+  }
+  bool async;
+  return HandleOperationStatus(thread_ctx(), pending_context, internal_status, async);
+}
+
+/// Generational compaction: moves the live records in [beginAddress,
+/// untilAddress) to the cold log, so that the hybrid log can be truncated
+/// past them and hold only recent data. It decides liveness as lookup
+/// compaction does, and splits the range across threads the same way; but
+/// a live record is appended to the cold log (in batches, per thread),
+/// rather than copied to the tail. The latest record of a key that may have
+/// an older version in the cold log--a tombstone, an expired record, or one
+/// that the filter drops--is moved as a tombstone, so that the older version
+/// stays shadowed once the range is truncated.
+///
+/// Reads, RMWs, and deletes that find no record for a key in the hybrid log
+/// go on to the cold log's hash chain; any newer record in the hybrid log
+/// shadows the cold log.
+template <class K, class V, class D, class B>
+template <class F>
+bool FasterKv<K, V, D, B>::CompactToColdLog(uint64_t untilAddress, F filter,
+                                            uint32_t num_threads,
+                                            CompactionProgress& progress)
+{
+  Address begin = hlog.begin_address.load();
+  Address until{ untilAddress };
+  if (until <= begin) return false;
+
+  uint32_t end_page = until.offset() == 0 ? until.page() : until.page() + 1;
+  progress.pages_total.store(end_page - begin.page());
+  std::atomic<uint32_t> next_page{ begin.page() };
+
+  RunCompactionThreads(num_threads, progress, [&]() {
+    CompactPagesToColdLog(begin, until, next_page, filter, progress);
+  });
+  return !progress.cancelled();
+}
+
+/// One thread's share of generational compaction: checks the records of
+/// each page it takes, and appends the page's live records to the cold log.
+template <class K, class V, class D, class B>
+template <class F>
+void FasterKv<K, V, D, B>::CompactPagesToColdLog(Address begin, Address until,
+    std::atomic<uint32_t>& next_page, const F& filter, CompactionProgress& progress)
+{
+  auto cb = [](IAsyncContext* ctxt, Status result) {
+    CallbackContext<CompactionCopyToCold<K, V, F>> context(ctxt);
+    assert(result == Status::Aborted);
+  };
+
+  std::vector<cold_log_record_t> batch;
+  int numOps = 0;
+  while (!progress.cancelled()) {
+    uint32_t page = next_page++;
+    if (Address(page, 0) >= until) break;
+
+    Address from = std::max(begin, Address(page, 0));
+    Address to = std::min(until, Address(page + 1, 0));
+    ScanIterator<faster_t> iter(&hlog, Buffering::UN_BUFFERED, from, to, &disk);
+    while (!progress.cancelled()) {
+      Address address;
+      auto r = iter.GetNext(address);
+      if (r == nullptr) {
+        break;
+      }
+      ++progress.records_scanned;
+
+      // Tombstones are checked, too: one may have to shadow the cold log.
+      if (!r->header.invalid) {
+        CompactionCopyToCold<K, V, F> ctxt(r, address, filter, &batch);
+        ConditionalCopyToTail(ctxt, cb);
+      }
+
+      if (++numOps % 1000 == 0) {
+        CompletePending(false);
+      }
+    }
+    // The batch is complete once its pending checks are. If it can't be appended, the range
+    // mustn't be truncated; fail the compaction as if it had been cancelled.
+    CompletePending(true);
+    Status result;
+    {
+      std::lock_guard<std::mutex> lock{ cold_log_.append_mutex };
+      result = AppendToColdLog(batch);
+    }
+    if (result != Status::Ok) {
+      progress.Cancel();
+    }
+    batch.clear();
+    if (!progress.cancelled()) {
+      ++progress.pages_done;
+    }
+  }
+}
+
+/// Appends a batch of records to the cold log, and points the index at
+/// them. Appends are serialized (the caller holds the cold log's append
+/// mutex), and each chunk of the batch is durable before any index entry
+/// points into it, so the cold log is never read beyond what has been
+/// written. An entry is moved forward with a CAS, since truncating the cold
+/// log can drop it meanwhile (see CleanHashTableBuckets()); the record is
+/// then linked to the truncated chain, which ends there, anyway.
+template <class K, class V, class D, class B>
+Status FasterKv<K, V, D, B>::AppendToColdLog(const std::vector<cold_log_record_t>& batch)
+{
+  /// Upper bound on a single write to the cold log (unless a record is larger).
+  constexpr uint32_t kMaxWriteSize = 1024 * 1024;
+  struct Placement {
+    const cold_log_record_t* record;
+    Address address;
+    Address previous_address;
+    AtomicHashBucketEntry* atomic_entry;
+    KeyHash hash;
+    uint64_t inline_key;
+  };
+  if (batch.empty()) return Status::Ok;
+
+  // The latest address, in this batch, of each entry's records; the index doesn't have it until
+  // the record's chunk has been written.
+  std::unordered_map<AtomicHashBucketEntry*, Address> latest;
+  std::vector<Placement> chunk;
+  size_t idx = 0;
+  while (idx < batch.size()) {
+    // Lay out a chunk of records, within one page.
+    Address chunk_begin = cold_log_.tail_address.load();
+    Address chunk_end = chunk_begin;
+    chunk.clear();
+    for (; idx < batch.size(); ++idx) {
+      const cold_log_record_t& record = batch[idx];
+      uint32_t record_size = record_t::size(record.key.size(), value_t::size());
+      Address address = cold_log_t::NextRecordAddress(chunk_end, record_size);
+      if (!chunk.empty() &&
+          (address.page() != chunk_begin.page() ||
+           address.control() + record_size - chunk_begin.control() > kMaxWriteSize)) {
+        break;
+      }
+      KeyHash hash = record.key.GetHash();
+      uint64_t inline_key = KeyIndexTraits<key_t>::inline_key(record.key);
+      HashBucketEntry expected_entry;
+      AtomicHashBucketEntry* atomic_entry;
+      if (record.tombstone) {
+        // A tombstone has nothing to shadow unless the cold log has the key's tag.
+        atomic_entry = const_cast<AtomicHashBucketEntry*>(FindEntry(hash, inline_key,
+                       expected_entry, true));
+        if (atomic_entry == nullptr) continue;
+      } else {
+        atomic_entry = FindOrCreateEntry(hash, inline_key, expected_entry, true);
+      }
+      if (chunk.empty()) {
+        chunk_begin = address;
+      }
+      auto prev = latest.find(atomic_entry);
+      Address previous_address = prev != latest.end() ? prev->second : expected_entry.address();
+      latest[atomic_entry] = address;
+      chunk.push_back(Placement{ &record, address, previous_address, atomic_entry, hash,
+                                 inline_key });
+      chunk_end = Address{ address.control() + record_size };
+    }
+    if (chunk.empty()) break;
+
+    // Write the chunk...
+    uint32_t length = static_cast<uint32_t>(cold_log_.SectorAlign(chunk_end).control() -
+                                            chunk_begin.control());
+    uint8_t* buffer = reinterpret_cast<uint8_t*>(aligned_alloc(cold_log_.sector_size, length));
+    std::memset(buffer, 0, length);
+    for (const Placement& placement : chunk) {
+      record_t* record = reinterpret_cast<record_t*>(buffer + (placement.address.control() -
+                         chunk_begin.control()));
+      new(record) record_t{
+        RecordInfo{
+          static_cast<uint16_t>(thread_ctx().version), true, placement.record->tombstone, false,
+          placement.previous_address }
+      };
+      write_deep_key_at_helper<false>::execute(placement.record->key,
+          const_cast<key_t*>(&record->key()));
+      new(&record->value()) value_t(placement.record->value);
+    }
+    Status result = cold_log_.Write(chunk_begin, buffer, length);
+    aligned_free(buffer);
+    if (result != Status::Ok) {
+      // Nothing points at the chunk, so its records are only in the hybrid log.
+      return result;
+    }
+
+    // ...and then point the index at it.
+    for (const Placement& placement : chunk) {
+      HashBucketEntry new_entry{ placement.address, placement.hash.tag(), false, true };
+      AtomicHashBucketEntry* atomic_entry = placement.atomic_entry;
+      HashBucketEntry expected_entry = atomic_entry->load();
+      while (true) {
+        if (expected_entry.unused() || !expected_entry.cold() ||
+            expected_entry.tag() != placement.hash.tag()) {
+          // The entry was dropped, and its slot may have been reused; find it again.
+          atomic_entry = FindOrCreateEntry(placement.hash, placement.inline_key, expected_entry,
+                                           true);
+          continue;
+        }
+        if (expected_entry.address() >= placement.address) {
+          // (A later record already heads the chain.)
+          break;
+        }
+        if (atomic_entry->compare_exchange_strong(expected_entry, new_entry)) {
+          MarkIndexDirty(placement.hash);
+          break;
+        }
+      }
+    }
+    cold_log_.tail_address.store(cold_log_.SectorAlign(chunk_end));
+  }
+  return Status::Ok;
+}
+
+/// Reads the cold log's record at "address" (which the caller knows to hold
+/// one): a few sectors, at first, and then the rest of the record, if it is
+/// longer.
+template <class K, class V, class D, class B>
+Status FasterKv<K, V, D, B>::ReadColdRecord(Address address, SectorAlignedMemory& buffer,
+    const record_t*& record)
+{
+  constexpr uint32_t kMinReadSize = 4096;
+  uint64_t alignment_mask = cold_log_.sector_size - 1;
+  Address read_address{ address.control() & ~alignment_mask };
+  uint32_t offset = static_cast<uint32_t>(address.control() - read_address.control());
+  // (Records never span pages.)
+  uint32_t max_length = static_cast<uint32_t>(cold_log_t::kPageSize - read_address.offset());
+  uint32_t available = 0;
+  uint32_t needed = record_t::min_disk_key_size();
+  while (true) {
+    if (needed > available) {
+      uint32_t length = static_cast<uint32_t>(std::min<uint64_t>(max_length,
+                        (offset + std::max(needed, kMinReadSize) + alignment_mask) &
+                        ~alignment_mask));
+      if (offset + needed > length) {
+        return Status::Corruption;
+      }
+      buffer = cold_log_.read_buffer_pool.Get(length);
+      Status result = cold_log_.Read(read_address, buffer.buffer(), length);
+      if (result != Status::Ok) {
+        return result;
+      }
+      available = length - offset;
+    }
+    record = reinterpret_cast<const record_t*>(buffer.buffer() + offset);
+    if (available < record->min_disk_value_size()) {
+      needed = record->min_disk_value_size();
+    } else if (available < record->disk_size()) {
+      needed = record->disk_size();
+    } else {
+      return Status::Ok;
+    }
+  }
+}
+
+/// Walks the key's hash chain in the cold log down to "address": the record
+/// there is the latest one for its key, unless the walk finds another record
+/// for the key first. (The caller holds the append mutex, so the chain
+/// can't grow meanwhile.)
+template <class K, class V, class D, class B>
+Status FasterKv<K, V, D, B>::IsLatestColdRecord(const record_t* record, Address address,
+    bool& latest)
+{
+  latest = false;
+  const key_t& key = record->key();
+  HashBucketEntry entry;
+  if (FindEntry(key.GetHash(), KeyIndexTraits<key_t>::inline_key(key), entry, true) ==
+      nullptr) {
+    return Status::Ok;
+  }
+  SectorAlignedMemory buffer;
+  Address chain_address = entry.address();
+  while (chain_address > address) {
+    const record_t* chain_record;
+    Status result = ReadColdRecord(chain_address, buffer, chain_record);
+    if (result != Status::Ok) {
+      return result;
+    }
+    if (chain_record->key() == key) {
+      return Status::Ok;
+    }
+    chain_address = chain_record->header.previous_address();
+  }
+  latest = chain_address == address;
+  return Status::Ok;
+}
+
+/// Reads the range a page at a time, as RebuildColdLogIndex() does, and
+/// appends each page's live records to the tail. A page's liveness checks
+/// and its append hold the append mutex, so that generational compaction
+/// can't append a newer record for one of its keys in between.
+template <class K, class V, class D, class B>
+bool FasterKv<K, V, D, B>::CompactColdLog(uint64_t untilAddress)
+{
+  if (!use_cold_log_) return false;
+  Address begin = cold_log_.begin_address.load();
+  Address tail = cold_log_.tail_address.load();
+  Address until = std::min(Address{ untilAddress }, tail);
+  if (until <= begin) return true;
+
+  uint8_t* buffer = reinterpret_cast<uint8_t*>(aligned_alloc(cold_log_.sector_size,
+                    cold_log_t::kPageSize));
+  std::vector<cold_log_record_t> batch;
+  Status result = Status::Ok;
+  for (uint32_t page = begin.page(); result == Status::Ok && Address{ page, 0 } < until;
+       ++page) {
+    Address page_address{ page, 0 };
+    Address end_address = std::min(Address{ page + 1, 0 }, until);
+    {
+      std::lock_guard<std::mutex> lock{ cold_log_.append_mutex };
+      // (Read up to the tail, to get all of the range's last record.)
+      Address read_end = cold_log_.SectorAlign(std::min(Address{ page + 1, 0 }, tail));
+      result = cold_log_.Read(page_address, buffer, static_cast<uint32_t>(
+                                read_end.control() - page_address.control()));
+      Address address = std::max(page_address, begin);
+      while (result == Status::Ok && address < end_address) {
+        const record_t* record = reinterpret_cast<const record_t*>(buffer + address.offset());
+        if (record->header.IsNull()) {
+          // Padding, at the end of an appended batch (or of the page).
+          address = cold_log_.SectorAlign(Address{ address.control() + 1 });
+          continue;
+        }
+        if (!record->header.tombstone && !record->expired()) {
+          bool latest;
+          result = IsLatestColdRecord(record, address, latest);
+          if (result == Status::Ok && latest) {
+            batch.emplace_back(record->key(), record->value(), false);
+          }
+        }
+        address += record->size();
+      }
+      if (result == Status::Ok) {
+        result = AppendToColdLog(batch);
+      }
+    }
+    batch.clear();
+    Refresh();
+  }
+  aligned_free(buffer);
+  return result == Status::Ok;
+}
+
+/// Samples the records in random windows of [beginAddress, untilAddress).
+/// A window starts at a page boundary (or at the begin address), since those
+/// are the only addresses known to hold a record header without scanning.
+template <class K, class V, class D, class B>
+double FasterKv<K, V, D, B>::EstimateLiveFraction(uint64_t untilAddress, uint32_t num_samples)
+{
+  Address begin = hlog.begin_address.load();
+  Address until{ untilAddress };
+  if (until <= begin) return 1.0;
+
+  std::mt19937_64 rng{ static_cast<uint64_t>(
+                         std::chrono::steady_clock::now().time_since_epoch().count()) };
+  uint32_t last_page = Address(until.control() - 1).page();
+  std::uniform_int_distribution<uint32_t> pages{ begin.page(), last_page };
+
+  uint64_t sampled = 0;
+  uint64_t live = 0;
+  for (uint32_t idx = 0; idx < num_samples; ++idx) {
+    uint32_t page = pages(rng);
+    Address from = std::max(begin, Address(page, 0));
+    Address to = std::min(until, Address(page + 1, 0));
+    SampleLiveRecords(from, to, sampled, live);
+  }
+
+  return sampled == 0 ? 1.0 : static_cast<double>(live) / sampled;
+}
+
+/// Probes the index for the records in the first kSampleBytes of [from,
+/// until), which lie in a single page. Pages below the head address are read
+/// from disk (only the sampled bytes, not the whole page); if that read fails, the window isn't
+/// sampled.
+template <class K, class V, class D, class B>
+void FasterKv<K, V, D, B>::SampleLiveRecords(Address from, Address until, uint64_t& sampled,
+    uint64_t& live)
+{
+  constexpr uint32_t kSampleBytes = 64 * 1024;
+  auto cb = [](IAsyncContext* ctxt, Status result) {
+    CallbackContext<CompactionCopyToTail<K, V, CompactionCountLive>> context(ctxt);
+    assert(result == Status::Aborted);
+  };
+
+  // Only bytes that are in memory, or that have been flushed, are valid.
+  uint8_t* read_buffer = nullptr;
+  Address buffer_start;
+  Address end;
+  if (from >= hlog.head_address.load()) {
+    end = std::min(until, Address(from.control() + kSampleBytes));
+  } else {
+    uint64_t alignment_mask = hlog.sector_size - 1;
+    buffer_start = Address(from.control() & ~alignment_mask);
+    uint32_t length = std::min<uint32_t>(kSampleBytes,
+                                         hlog_t::kPageSize - buffer_start.offset());
+    end = std::min({ until, Address(buffer_start.control() + length),
+                     hlog.flushed_until_address.load() });
+    if (end <= from) return;
+
+    read_buffer = reinterpret_cast<uint8_t*>(aligned_alloc(hlog.sector_size, length));
+    std::atomic<bool> done{ false };
+    Status read_result = Status::Ok;
+    size_t bytes_read = 0;
+    auto read_cb = [](IAsyncContext* ctxt, Status result, size_t bytes) {
+      CallbackContext<LogSampleReadContext> context(ctxt);
+      *context->result = result;
+      *context->bytes = bytes;
+      context->done->store(true);
+    };
+    LogSampleReadContext context{ &done, &read_result, &bytes_read };
+    if (hlog.file->ReadAsync(buffer_start.control(), read_buffer, length, read_cb,
+                             context) == Status::Ok) {
+      while (!done.load()) {
+        disk.TryComplete();
+        std::this_thread::yield();
+      }
+    } else {
+      read_result = Status::IOError;
+    }
+    // A failed read leaves nothing to sample; a short one, only the bytes that it did read.
+    if (read_result != Status::Ok) {
+      aligned_free(read_buffer);
+      return;
+    }
+    end = std::min(end, Address(buffer_start.control() + bytes_read));
+  }
+
+  uint64_t live_records = 0;
+  CompactionCountLive filter{ &live_records };
+  Address address = from;
+  while (address < end) {
+    const record_t* record;
+    if (read_buffer) {
+      record = reinterpret_cast<const record_t*>(read_buffer +
+               (address.control() - buffer_start.control()));
+    } else {
+      // The previous probe may have refreshed this thread's epoch, and so let the page be evicted;
+      // stop once it may have been.
+      if (address < hlog.head_address.load()) break;
+      record = reinterpret_cast<const record_t*>(hlog.Get(address));
+    }
+    // Stop at the first record that isn't entirely within the window.
+    if (address.control() + record_t::min_disk_key_size() > end.control() ||
+        record->header.IsNull() ||
+        address.control() + record->min_disk_value_size() > end.control() ||
+        address.control() + record->size() > end.control()) {
+      break;
+    }
+    ++sampled;
+    // (The probe copies the record's key and value, before it can refresh the epoch.)
+    uint32_t record_size = record->size();
+    if (!record->header.tombstone && !record->header.invalid && !record->expired()) {
+      CompactionCopyToTail<K, V, CompactionCountLive> ctxt(record, address, filter);
+      ConditionalCopyToTail(ctxt, cb);
+    }
+    address += record_size;
+  }
+
+  if (read_buffer) {
+    aligned_free(read_buffer);
+  }
+  // The filter counts into "live_records", which outlives any pending probe.
+  CompletePending(true);
+  live += live_records;
+}
+
 /// Scans the hybrid log starting at `from` until the safe-read-only address,
 /// deleting all encountered records from within a passed in temporary FASTER
 /// instance.
@@ -3019,8 +5567,8 @@ bool FasterKv<K, V, D>::Compact(uint64_t untilAddress)
 /// in the safe-read-only region of the main FASTER instance.
 ///
 /// Returns the address upto which the scan was performed.
-template <class K, class V, class D>
-Address FasterKv<K, V, D>::LogScanForValidity(Address from, faster_t* temp)
+template <class K, class V, class D, class B>
+Address FasterKv<K, V, D, B>::LogScanForValidity(Address from, faster_t* temp)
 {
   // Scan upto the safe read only region of the log, deleting all encountered
   // records from the temporary instance of FASTER. Since the safe-read-only
@@ -3060,13 +5608,14 @@ Address FasterKv<K, V, D>::LogScanForValidity(Address from, faster_t* temp)
 
 /// Checks if a key exists between a passed in address (`offset`) and the
 /// current tail of the hybrid log.
-template <class K, class V, class D>
-bool FasterKv<K, V, D>::ContainsKeyInMemory(key_t key, Address offset)
+template <class K, class V, class D, class B>
+bool FasterKv<K, V, D, B>::ContainsKeyInMemory(key_t key, Address offset)
 {
   // First, retrieve the hash table entry corresponding to this key.
   KeyHash hash = key.GetHash();
   HashBucketEntry _entry;
-  const AtomicHashBucketEntry* atomic_entry = FindEntry(hash, _entry);
+  const AtomicHashBucketEntry* atomic_entry = FindEntry(hash,
+      KeyIndexTraits<key_t>::inline_key(key), _entry);
   if (!atomic_entry) return false;
 
   HashBucketEntry entry = atomic_entry->load();
@@ -0,0 +1,130 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "status.h"
+#include "utility.h"
+
+namespace FASTER {
+namespace core {
+
+/// A set of hash buckets, one bit per bucket. A full checkpoint records in one the buckets that
+/// its fuzzy region of the log (the records appended between the start of the index checkpoint
+/// and the end of the log checkpoint) touched; lazy recovery (see FasterKv::Recover()) then
+/// serves requests for all the other buckets while it replays the region in the background.
+class FuzzyBucketSet {
+ public:
+  FuzzyBucketSet()
+    : size_{ 0 } {
+  }
+
+  /// Disallow copy and copy-assign constructors.
+  FuzzyBucketSet(const FuzzyBucketSet& other) = delete;
+  FuzzyBucketSet& operator=(const FuzzyBucketSet& other) = delete;
+
+  /// An empty set, for a hash table of "size" buckets. (Reuses the set's memory, if it was
+  /// already for a table of that size: a thread may still be marking a bucket in a set that has
+  /// just stopped being tracked, which is harmless, since a set may hold extra buckets.)
+  void Initialize(uint64_t size) {
+    assert(Utility::IsPowerOfTwo(size));
+    if(size != size_) {
+      size_ = size;
+      words_.reset(new std::atomic<uint64_t>[num_words()]);
+    }
+    for(uint64_t idx = 0; idx < num_words(); ++idx) {
+      words_[idx].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  void Free() {
+    words_.reset();
+    size_ = 0;
+  }
+
+  inline uint64_t size() const {
+    return size_;
+  }
+
+  inline void Mark(uint64_t bucket_idx) {
+    std::atomic<uint64_t>& word = words_[bucket_idx / 64];
+    uint64_t bit = uint64_t{ 1 } << (bucket_idx % 64);
+    // (Most buckets get marked over and over; don't take the cache line away from other threads
+    // unless this is the first time.)
+    if((word.load(std::memory_order_relaxed) & bit) == 0) {
+      word.fetch_or(bit);
+    }
+  }
+
+  inline bool Contains(uint64_t bucket_idx) const {
+    return (words_[bucket_idx / 64].load(std::memory_order_relaxed) &
+            (uint64_t{ 1 } << (bucket_idx % 64))) != 0;
+  }
+
+  /// The file holds the table size, followed by the bits.
+  Status Write(const std::string& filename) const {
+    // (This code will need to be refactored into the disk_t interface, if we want to support
+    // unformatted disks.)
+    std::vector<uint64_t> buffer(num_words() + 1);
+    buffer[0] = size_;
+    for(uint64_t idx = 0; idx < num_words(); ++idx) {
+      buffer[idx + 1] = words_[idx].load();
+    }
+    std::FILE* file = std::fopen(filename.c_str(), "wb");
+    if(!file) {
+      return Status::IOError;
+    }
+    if(std::fwrite(buffer.data(), sizeof(uint64_t), buffer.size(), file) != buffer.size()) {
+      std::fclose(file);
+      return Status::IOError;
+    }
+    if(std::fclose(file) != 0) {
+      return Status::IOError;
+    }
+    return Status::Ok;
+  }
+
+  /// Fails if the file is missing or truncated, or is for a table of some other size.
+  Status Read(const std::string& filename, uint64_t size) {
+    std::FILE* file = std::fopen(filename.c_str(), "rb");
+    if(!file) {
+      return Status::IOError;
+    }
+    uint64_t file_size;
+    if(std::fread(&file_size, sizeof(file_size), 1, file) != 1 || file_size != size) {
+      std::fclose(file);
+      return Status::Corruption;
+    }
+    Initialize(size);
+    std::vector<uint64_t> buffer(num_words());
+    if(std::fread(buffer.data(), sizeof(uint64_t), buffer.size(), file) != buffer.size()) {
+      std::fclose(file);
+      Free();
+      return Status::Corruption;
+    }
+    std::fclose(file);
+    for(uint64_t idx = 0; idx < num_words(); ++idx) {
+      words_[idx].store(buffer[idx], std::memory_order_relaxed);
+    }
+    return Status::Ok;
+  }
+
+ private:
+  inline uint64_t num_words() const {
+    return (size_ + 63) / 64;
+  }
+
+  uint64_t size_;
+  std::unique_ptr<std::atomic<uint64_t>[]> words_;
+};
+
+}
+} // namespace FASTER::core
@@ -18,21 +18,28 @@ class GcState {
   GcState()
     : truncate_callback{ nullptr }
     , complete_callback{ nullptr }
+    , cold_log{ false }
     , num_chunks{ 0 }
+    , num_pending_chunks{ 0 }
     , next_chunk{ 0 } {
   }
 
   void Initialize(truncate_callback_t truncate_callback_, complete_callback_t complete_callback_,
-                  uint64_t num_chunks_) {
+                  bool cold_log_, uint64_t num_chunks_) {
     truncate_callback = truncate_callback_;
     complete_callback = complete_callback_;
+    cold_log = cold_log_;
     num_chunks = num_chunks_;
+    num_pending_chunks = num_chunks_;
     next_chunk = 0;
   }
 
   truncate_callback_t truncate_callback;
   complete_callback_t complete_callback;
+  /// Whether the cold log (see ColdLog) is being truncated, rather than the hybrid log.
+  bool cold_log;
   uint64_t num_chunks;
+  std::atomic<uint64_t> num_pending_chunks;
   std::atomic<uint64_t> next_chunk;
 };
 
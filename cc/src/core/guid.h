@@ -76,6 +76,27 @@ class Guid {
 #endif
   }
 
+  /// Like Parse(), but returns false (instead of asserting) if "str" isn't a GUID. (Used to skip
+  /// foreign entries when listing checkpoint directories.)
+  static bool TryParse(const std::string& str, Guid& guid) {
+#ifdef _WIN32
+    GUID guid_;
+    auto result = ::UuidFromString(reinterpret_cast<uint8_t*>(const_cast<char*>(str.c_str())),
+                                   &guid_);
+    if(result != RPC_S_OK) {
+      return false;
+    }
+    guid = guid_;
+#else
+    uuid_t uuid;
+    if(str.size() != 36 || uuid_parse(const_cast<char*>(str.c_str()), uuid) != 0) {
+      return false;
+    }
+    guid = uuid;
+#endif
+    return true;
+  }
+
   std::string ToString() const {
     char buffer[37];
 #ifdef _WIN32
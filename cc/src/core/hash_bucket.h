@@ -7,9 +7,11 @@
 #include <cassert>
 #include <cstdint>
 #include <thread>
+#include <type_traits>
 
 #include "address.h"
 #include "constants.h"
+#include "key_hash.h"
 #include "malloc_fixed_page_size.h"
 
 namespace FASTER {
@@ -25,10 +27,10 @@ struct HashBucketEntry {
   HashBucketEntry()
     : control_{ 0 } {
   }
-  HashBucketEntry(Address address, uint16_t tag, bool tentative)
+  HashBucketEntry(Address address, uint16_t tag, bool tentative, bool cold = false)
     : address_{ address.control() }
     , tag_{ tag }
-    , reserved_{ 0 }
+    , cold_{ cold }
     , tentative_{ tentative } {
   }
   HashBucketEntry(uint64_t code)
@@ -63,12 +65,17 @@ struct HashBucketEntry {
   inline void set_tentative(bool desired) {
     tentative_ = desired;
   }
+  /// Whether the entry's address is in the cold log (see ColdLog), rather than in the hybrid log.
+  /// A tag can have one entry of each kind.
+  inline bool cold() const {
+    return static_cast<bool>(cold_);
+  }
 
   union {
       struct {
         uint64_t address_ : 48; // corresponds to logical address
         uint64_t tag_ : 14;
-        uint64_t reserved_ : 1;
+        uint64_t cold_ : 1;
         uint64_t tentative_ : 1;
       };
       uint64_t control_;
@@ -187,8 +194,25 @@ class AtomicHashBucketOverflowEntry {
 /// A bucket consisting of 7 hash bucket entries, plus one hash bucket overflow entry. Fits in
 /// a cache line.
 struct alignas(Constants::kCacheLineBytes) HashBucket {
+  /// This layout keeps no fingerprint beyond the entry's 14-bit tag.
+  typedef uint8_t fingerprint_t;
+  static constexpr uint8_t kFingerprintBits = 0;
+
   /// Number of entries per bucket (excluding overflow entry).
   static constexpr uint32_t kNumEntries = 7;
+
+  static inline fingerprint_t Fingerprint(KeyHash hash, uint64_t inline_key) {
+    return 0;
+  }
+  inline bool HasFingerprint(uint32_t entry_idx, fingerprint_t fingerprint) const {
+    return true;
+  }
+  inline fingerprint_t fingerprint(uint32_t entry_idx) const {
+    return 0;
+  }
+  inline void set_fingerprint(uint32_t entry_idx, fingerprint_t fingerprint) {
+  }
+
   /// The entries.
   AtomicHashBucketEntry entries[kNumEntries];
   /// Overflow entry points to next overflow bucket, if any.
@@ -197,5 +221,113 @@ struct alignas(Constants::kCacheLineBytes) HashBucket {
 static_assert(sizeof(HashBucket) == Constants::kCacheLineBytes,
               "sizeof(HashBucket) != Constants::kCacheLineBytes");
 
+/// Alternative bucket layout, spanning a pair of cache lines: an array of 8- or 16-bit key
+/// fingerprints, followed by the entries and one overflow entry. The fingerprint comes from key
+/// hash bits that neither the bucket index nor the tag use, so an entry matches a key only if
+/// both its tag and its fingerprint match; this cuts the number of records fetched (often from
+/// disk) just to find that the key differs. Selected via FasterKv's bucket template parameter.
+///
+/// An entry's fingerprint is written while the entry is still tentative, so any reader that sees
+/// a non-tentative entry also sees its fingerprint.
+template <class F>
+struct alignas(Constants::kCacheLineBytes) FingerprintHashBucket {
+  typedef F fingerprint_t;
+  static constexpr uint8_t kFingerprintBits = 8 * sizeof(fingerprint_t);
+  static_assert(kFingerprintBits == 8 || kFingerprintBits == 16,
+                "FingerprintHashBucket supports 8- and 16-bit fingerprints");
+
+  /// Number of entries per bucket (excluding overflow entry): 13 for 8-bit and 12 for 16-bit
+  /// fingerprints.
+  static constexpr uint32_t kNumEntries = static_cast<uint32_t>(
+      (2 * Constants::kCacheLineBytes - sizeof(AtomicHashBucketOverflowEntry)) /
+      (sizeof(AtomicHashBucketEntry) + sizeof(fingerprint_t)));
+
+  static inline fingerprint_t Fingerprint(KeyHash hash, uint64_t inline_key) {
+    return static_cast<fingerprint_t>(hash.fingerprint(kFingerprintBits));
+  }
+  inline bool HasFingerprint(uint32_t entry_idx, fingerprint_t fingerprint) const {
+    return fingerprints[entry_idx].load() == fingerprint;
+  }
+  inline fingerprint_t fingerprint(uint32_t entry_idx) const {
+    return fingerprints[entry_idx].load();
+  }
+  inline void set_fingerprint(uint32_t entry_idx, fingerprint_t fingerprint) {
+    fingerprints[entry_idx].store(fingerprint);
+  }
+
+  /// The fingerprints, one per entry.
+  std::atomic<fingerprint_t> fingerprints[kNumEntries];
+  /// The entries.
+  AtomicHashBucketEntry entries[kNumEntries];
+  /// Overflow entry points to next overflow bucket, if any.
+  AtomicHashBucketOverflowEntry overflow_entry;
+};
+static_assert(sizeof(FingerprintHashBucket<uint8_t>) == 2 * Constants::kCacheLineBytes,
+              "sizeof(FingerprintHashBucket<uint8_t>) != 2 * Constants::kCacheLineBytes");
+static_assert(sizeof(FingerprintHashBucket<uint16_t>) == 2 * Constants::kCacheLineBytes,
+              "sizeof(FingerprintHashBucket<uint16_t>) != 2 * Constants::kCacheLineBytes");
+
+/// Bucket layout for 8-byte keys, spanning a pair of cache lines: each entry has a companion slot
+/// holding the entire key, and matches only that key. So every entry's chain holds records for a
+/// single key, and the index answers lookups of absent keys (and tells apart keys whose tags
+/// collide) without reading the log, or issuing disk I/O. Selected via KeyIndexTraits.
+///
+/// As with FingerprintHashBucket, the key is written while the entry is still tentative.
+struct alignas(Constants::kCacheLineBytes) InlineKeyHashBucket {
+  typedef uint64_t fingerprint_t;
+  static constexpr uint8_t kFingerprintBits = 64;
+
+  /// Number of entries per bucket (excluding overflow entry).
+  static constexpr uint32_t kNumEntries = 7;
+
+  static inline fingerprint_t Fingerprint(KeyHash hash, uint64_t inline_key) {
+    return inline_key;
+  }
+  inline bool HasFingerprint(uint32_t entry_idx, fingerprint_t fingerprint) const {
+    return keys[entry_idx].load() == fingerprint;
+  }
+  inline fingerprint_t fingerprint(uint32_t entry_idx) const {
+    return keys[entry_idx].load();
+  }
+  inline void set_fingerprint(uint32_t entry_idx, fingerprint_t fingerprint) {
+    keys[entry_idx].store(fingerprint);
+  }
+
+  /// The keys, one per entry.
+  std::atomic<uint64_t> keys[kNumEntries];
+  /// The entries.
+  AtomicHashBucketEntry entries[kNumEntries];
+  /// Overflow entry points to next overflow bucket, if any.
+  AtomicHashBucketOverflowEntry overflow_entry;
+};
+static_assert(sizeof(InlineKeyHashBucket) == 2 * Constants::kCacheLineBytes,
+              "sizeof(InlineKeyHashBucket) != 2 * Constants::kCacheLineBytes");
+
+/// Selects the index's default hash-bucket layout for key type K: HashBucket, unless K is an
+/// 8-byte key that opts in to InlineKeyHashBucket by declaring
+///   static constexpr bool kInlineKey = true;
+///   inline uint64_t inline_key() const;
+/// where inline_key() is unique per key. (A shallow key used in K's contexts must provide
+/// inline_key(), too.)
+template <class K, class Enable = void>
+struct KeyIndexTraits {
+  typedef HashBucket hash_bucket_t;
+
+  template <class T>
+  static inline uint64_t inline_key(const T& key) {
+    return 0;
+  }
+};
+
+template <class K>
+struct KeyIndexTraits<K, typename std::enable_if<K::kInlineKey>::type> {
+  typedef InlineKeyHashBucket hash_bucket_t;
+
+  template <class T>
+  static inline uint64_t inline_key(const T& key) {
+    return key.inline_key();
+  }
+};
+
 }
 } // namespace FASTER::core
@@ -6,30 +6,32 @@
 #include <atomic>
 #include <cinttypes>
 #include <cstdint>
+#include <memory>
+#include <vector>
 
 #include "hash_bucket.h"
 #include "key_hash.h"
+#include "sparse_checkpoint.h"
 
 namespace FASTER {
 namespace core {
 
-/// The hash table itself: a sized array of HashBuckets.
-template <class D>
+/// The hash table itself: a sized array of hash buckets. (B is the bucket layout: HashBucket,
+/// FingerprintHashBucket, or InlineKeyHashBucket.)
+template <class D, class B = HashBucket>
 class InternalHashTable {
  public:
   typedef D disk_t;
   typedef typename D::file_t file_t;
+  typedef B bucket_t;
+
+  /// Checkpoints store (and track changes to) buckets in chunks of this many.
+  static constexpr uint64_t kBucketsPerChunk =
+    SparseCheckpointFile<bucket_t, disk_t>::kMaxItemsPerChunk;
 
   InternalHashTable()
     : size_{ 0 }
-    , buckets_{ nullptr }
-    , disk_{ nullptr }
-    , pending_checkpoint_writes_{ 0 }
-    , pending_recover_reads_{ 0 }
-    , checkpoint_pending_{ false }
-    , checkpoint_failed_{ false }
-    , recover_pending_{ false }
-    , recover_failed_{ false } {
+    , buckets_{ nullptr } {
   }
 
   ~InternalHashTable() {
@@ -48,16 +50,15 @@ class InternalHashTable {
       if(buckets_) {
         aligned_free(buckets_);
       }
-      buckets_ = reinterpret_cast<HashBucket*>(aligned_alloc(alignment,
-                 size_ * sizeof(HashBucket)));
+      buckets_ = reinterpret_cast<bucket_t*>(aligned_alloc(alignment,
+                 size_ * sizeof(bucket_t)));
+      dirty_chunks_.reset(new std::atomic<bool>[num_chunks()]);
+    }
+    std::memset(buckets_, 0, size_ * sizeof(bucket_t));
+    for(uint64_t chunk = 0; chunk < num_chunks(); ++chunk) {
+      dirty_chunks_[chunk].store(false, std::memory_order_relaxed);
     }
-    std::memset(buckets_, 0, size_ * sizeof(HashBucket));
-    assert(pending_checkpoint_writes_ == 0);
-    assert(pending_recover_reads_ == 0);
-    assert(checkpoint_pending_ == false);
-    assert(checkpoint_failed_ == false);
-    assert(recover_pending_ == false);
-    assert(recover_failed_ == false);
+    checkpoint_file_.ResetIncremental();
   }
 
   inline void Uninitialize() {
@@ -65,30 +66,30 @@ class InternalHashTable {
       aligned_free(buckets_);
       buckets_ = nullptr;
     }
+    dirty_chunks_.reset();
     size_ = 0;
-    assert(pending_checkpoint_writes_ == 0);
-    assert(pending_recover_reads_ == 0);
-    assert(checkpoint_pending_ == false);
-    assert(checkpoint_failed_ == false);
-    assert(recover_pending_ == false);
-    assert(recover_failed_ == false);
+    checkpoint_file_.ResetIncremental();
+  }
+
+  void set_maintenance_pool(MaintenancePool* pool) {
+    checkpoint_file_.set_maintenance_pool(pool);
   }
 
   /// Get the bucket specified by the hash.
-  inline const HashBucket& bucket(KeyHash hash) const {
+  inline const bucket_t& bucket(KeyHash hash) const {
     return buckets_[hash.idx(size_)];
   }
-  inline HashBucket& bucket(KeyHash hash) {
+  inline bucket_t& bucket(KeyHash hash) {
     return buckets_[hash.idx(size_)];
   }
 
   /// Get the bucket specified by the index. (Used by checkpoint/recovery.)
-  inline const HashBucket& bucket(uint64_t idx) const {
+  inline const bucket_t& bucket(uint64_t idx) const {
     assert(idx < size_);
     return buckets_[idx];
   }
   /// (Used by GC and called by unit tests.)
-  inline HashBucket& bucket(uint64_t idx) {
+  inline bucket_t& bucket(uint64_t idx) {
     assert(idx < size_);
     return buckets_[idx];
   }
@@ -97,171 +98,118 @@ class InternalHashTable {
     return size_;
   }
 
-  // Checkpointing and recovery.
-  Status Checkpoint(disk_t& disk, file_t&& file, uint64_t& checkpoint_size);
+  /// Writers call this after changing a bucket (or any bucket in its overflow chain), so that the
+  /// next incremental checkpoint stores it. (It must come after the change: a checkpoint takes
+  /// the marks before it copies the buckets, so a change marked early could land after the copy,
+  /// and then be missed by the next checkpoint too.)
+  inline void MarkDirty(uint64_t idx) {
+    assert(idx < size_);
+    std::atomic<bool>& dirty = dirty_chunks_[idx / kBucketsPerChunk];
+    // (Most chunks get marked over and over; don't take the cache line away from other threads
+    // unless this is the first time.)
+    if(!dirty.load()) {
+      dirty.store(true);
+    }
+  }
+  inline void MarkDirty(KeyHash hash) {
+    MarkDirty(hash.idx(size_));
+  }
+  /// Whether the current checkpoint stores the specified chunk of buckets because it changed.
+  /// (Valid from Checkpoint() until the next one.)
+  inline bool checkpointing_dirty_chunk(uint64_t chunk) const {
+    return chunk < checkpoint_dirty_chunks_.size() && checkpoint_dirty_chunks_[chunk];
+  }
+  inline uint64_t num_chunks() const {
+    return (size_ + kBucketsPerChunk - 1) / kBucketsPerChunk;
+  }
+
+  // Checkpointing and recovery. An incremental checkpoint stores only the buckets that changed
+  // since the previous (successful) checkpoint; recovering from it requires recovering from its
+  // predecessors first.
+  Status Checkpoint(disk_t& disk, file_t&& file, uint64_t& checkpoint_size,
+                    bool incremental = false);
   inline Status CheckpointComplete(bool wait);
+  inline bool CanCheckpointIncrementally() const {
+    return checkpoint_file_.can_checkpoint_incrementally(size_);
+  }
 
-  Status Recover(disk_t& disk, file_t&& file, uint64_t checkpoint_size);
+  Status Recover(disk_t& disk, file_t&& file, uint64_t checkpoint_size,
+                 bool incremental = false, IndexLoadMode load_mode = IndexLoadMode::Read);
   inline Status RecoverComplete(bool wait);
 
-  void DumpDistribution(MallocFixedPageSize<HashBucket, disk_t>& overflow_buckets_allocator);
-
- private:
-  // Checkpointing and recovery.
-  class AsyncIoContext : public IAsyncContext {
-   public:
-    AsyncIoContext(InternalHashTable* table_)
-      : table{ table_ } {
-    }
-    /// The deep-copy constructor
-    AsyncIoContext(AsyncIoContext& other)
-      : table{ other.table } {
-    }
-   protected:
-    Status DeepCopy_Internal(IAsyncContext*& context_copy) final {
-      return IAsyncContext::DeepCopy_Internal(*this, context_copy);
-    }
-   public:
-    InternalHashTable* table;
-  };
+  void DumpDistribution(MallocFixedPageSize<bucket_t, disk_t>& overflow_buckets_allocator);
 
  private:
   uint64_t size_;
-  HashBucket* buckets_;
+  bucket_t* buckets_;
+
+  /// Which chunks changed since the last checkpoint; and which ones had, as of the current one.
+  std::unique_ptr<std::atomic<bool>[]> dirty_chunks_;
+  std::vector<bool> checkpoint_dirty_chunks_;
 
   /// State for ongoing checkpoint/recovery.
-  disk_t* disk_;
-  file_t file_;
-  std::atomic<uint64_t> pending_checkpoint_writes_;
-  std::atomic<uint64_t> pending_recover_reads_;
-  std::atomic<bool> checkpoint_pending_;
-  std::atomic<bool> checkpoint_failed_;
-  std::atomic<bool> recover_pending_;
-  std::atomic<bool> recover_failed_;
+  SparseCheckpointFile<bucket_t, disk_t> checkpoint_file_;
 };
 
 /// Implementations.
-template <class D>
-Status InternalHashTable<D>::Checkpoint(disk_t& disk, file_t&& file, uint64_t& checkpoint_size) {
-  auto callback = [](IAsyncContext* ctxt, Status result, size_t bytes_transferred) {
-    CallbackContext<AsyncIoContext> context{ ctxt };
-    if(result != Status::Ok) {
-      context->table->checkpoint_failed_ = true;
-    }
-    if(--context->table->pending_checkpoint_writes_ == 0) {
-      result = context->table->file_.Close();
-      if(result != Status::Ok) {
-        context->table->checkpoint_failed_ = true;
-      }
-      context->table->checkpoint_pending_ = false;
-    }
-  };
-
-  assert(size_ % Constants::kNumMergeChunks == 0);
-  disk_ = &disk;
-  file_ = std::move(file);
-
+template <class D, class B>
+Status InternalHashTable<D, B>::Checkpoint(disk_t& disk, file_t&& file,
+                                           uint64_t& checkpoint_size, bool incremental) {
+  // The checkpoint size is that of the (logical) bucket array; the file itself stores only
+  // non-empty buckets.
   checkpoint_size = 0;
-  checkpoint_failed_ = false;
-  uint32_t chunk_size = static_cast<uint32_t>(size_ / Constants::kNumMergeChunks);
-  uint32_t write_size = static_cast<uint32_t>(chunk_size * sizeof(HashBucket));
-  assert(write_size % file_.alignment() == 0);
-  assert(!checkpoint_pending_);
-  assert(pending_checkpoint_writes_ == 0);
-  checkpoint_pending_ = true;
-  pending_checkpoint_writes_ = Constants::kNumMergeChunks;
-  for(uint32_t idx = 0; idx < Constants::kNumMergeChunks; ++idx) {
-    AsyncIoContext context{ this };
-    RETURN_NOT_OK(file_.WriteAsync(&bucket(idx * chunk_size), idx * write_size, write_size,
-                                   callback, context));
-  }
-  checkpoint_size = size_ * sizeof(HashBucket);
+  // Take the marks, whether or not this checkpoint is incremental: the next one will build on it.
+  checkpoint_dirty_chunks_.assign(num_chunks(), false);
+  for(uint64_t chunk = 0; chunk < num_chunks(); ++chunk) {
+    checkpoint_dirty_chunks_[chunk] = dirty_chunks_[chunk].exchange(false);
+  }
+  RETURN_NOT_OK(checkpoint_file_.Checkpoint(disk, std::move(file), size_,
+  [this](uint64_t idx) {
+    return buckets_ + idx;
+  }, incremental, checkpoint_dirty_chunks_));
+  checkpoint_size = size_ * sizeof(bucket_t);
   return Status::Ok;
 }
 
-template <class D>
-inline Status InternalHashTable<D>::CheckpointComplete(bool wait) {
-  disk_->TryComplete();
-  bool complete = !checkpoint_pending_.load();
-  while(wait && !complete) {
-    disk_->TryComplete();
-    complete = !checkpoint_pending_.load();
-    std::this_thread::yield();
-  }
-  if(!complete) {
-    return Status::Pending;
-  } else {
-    return checkpoint_failed_ ? Status::IOError : Status::Ok;
-  }
+template <class D, class B>
+inline Status InternalHashTable<D, B>::CheckpointComplete(bool wait) {
+  return checkpoint_file_.CheckpointComplete(wait);
 }
 
-template <class D>
-Status InternalHashTable<D>::Recover(disk_t& disk, file_t&& file, uint64_t checkpoint_size) {
-  auto callback = [](IAsyncContext* ctxt, Status result, size_t bytes_transferred) {
-    CallbackContext<AsyncIoContext> context{ ctxt };
-    if(result != Status::Ok) {
-      context->table->recover_failed_ = true;
-    }
-    if(--context->table->pending_recover_reads_ == 0) {
-      result = context->table->file_.Close();
-      if(result != Status::Ok) {
-        context->table->recover_failed_ = true;
-      }
-      context->table->recover_pending_ = false;
-    }
-  };
-
+template <class D, class B>
+Status InternalHashTable<D, B>::Recover(disk_t& disk, file_t&& file, uint64_t checkpoint_size,
+                                        bool incremental, IndexLoadMode load_mode) {
   assert(checkpoint_size > 0);
-  assert(checkpoint_size % sizeof(HashBucket) == 0);
-  assert(checkpoint_size % Constants::kNumMergeChunks == 0);
-  disk_ = &disk;
-  file_ = std::move(file);
-
-  recover_failed_ = false;
-  uint32_t read_size = static_cast<uint32_t>(checkpoint_size / Constants::kNumMergeChunks);
-  uint32_t chunk_size = static_cast<uint32_t>(read_size / sizeof(HashBucket));
-  assert(read_size % file_.alignment() == 0);
-
-  Initialize(checkpoint_size / sizeof(HashBucket), file_.alignment());
-  assert(!recover_pending_);
-  assert(pending_recover_reads_.load() == 0);
-  recover_pending_ = true;
-  pending_recover_reads_ = Constants::kNumMergeChunks;
-  for(uint32_t idx = 0; idx < Constants::kNumMergeChunks; ++idx) {
-    AsyncIoContext context{ this };
-    RETURN_NOT_OK(file_.ReadAsync(idx * read_size, &bucket(idx * chunk_size), read_size,
-                                  callback, context));
+  assert(checkpoint_size % sizeof(bucket_t) == 0);
+  if(incremental) {
+    // Apply the changes on top of the buckets already recovered.
+    if(checkpoint_size != size_ * sizeof(bucket_t)) {
+      return Status::Corruption;
+    }
+  } else {
+    Initialize(checkpoint_size / sizeof(bucket_t), file.alignment());
   }
-  return Status::Ok;
+  return checkpoint_file_.Recover(disk, std::move(file), size_, [this](uint64_t idx) {
+    return buckets_ + idx;
+  }, incremental, load_mode);
 }
 
-template <class D>
-inline Status InternalHashTable<D>::RecoverComplete(bool wait) {
-  disk_->TryComplete();
-  bool complete = !recover_pending_.load();
-  while(wait && !complete) {
-    disk_->TryComplete();
-    complete = !recover_pending_.load();
-    std::this_thread::yield();
-  }
-  if(!complete) {
-    return Status::Pending;
-  } else {
-    return recover_failed_ ? Status::IOError : Status::Ok;
-  }
+template <class D, class B>
+inline Status InternalHashTable<D, B>::RecoverComplete(bool wait) {
+  return checkpoint_file_.RecoverComplete(wait);
 }
 
-template <class D>
-inline void InternalHashTable<D>::DumpDistribution(
-  MallocFixedPageSize<HashBucket, disk_t>& overflow_buckets_allocator) {
+template <class D, class B>
+inline void InternalHashTable<D, B>::DumpDistribution(
+  MallocFixedPageSize<bucket_t, disk_t>& overflow_buckets_allocator) {
   uint64_t table_size = size();
   uint64_t total_record_count = 0;
   uint64_t histogram[16] = { 0 };
   for(uint64_t bucket_idx = 0; bucket_idx < table_size; ++bucket_idx) {
-    const HashBucket* bucket = &buckets_[bucket_idx];
+    const bucket_t* bucket = &buckets_[bucket_idx];
     uint64_t count = 0;
     while(bucket) {
-      for(uint32_t entry_idx = 0; entry_idx < HashBucket::kNumEntries; ++entry_idx) {
+      for(uint32_t entry_idx = 0; entry_idx < bucket_t::kNumEntries; ++entry_idx) {
         if(!bucket->entries[entry_idx].load().unused()) {
           ++count;
           ++total_record_count;
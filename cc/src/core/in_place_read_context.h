@@ -0,0 +1,61 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include "async.h"
+
+namespace FASTER {
+namespace core {
+
+/// The Read() context behind FasterKv::ReadInPlace(): rather than copying the value out, it hands
+/// the caller's visitor a reference to the value, where it lies. If the read goes async, the
+/// context (key and visitor) is deep copied; the completion callback gets the copy, and can reach
+/// the visitor through visitor().
+template <class K, class V, class F>
+class InPlaceReadContext : public IAsyncContext {
+ public:
+  typedef K key_t;
+  typedef V value_t;
+  typedef F visitor_t;
+
+  InPlaceReadContext(const key_t& key, const visitor_t& visitor)
+    : key_{ key }
+    , visitor_{ visitor } {
+  }
+
+  /// Copy (and deep-copy) constructor.
+  InPlaceReadContext(const InPlaceReadContext& other)
+    : key_{ other.key_ }
+    , visitor_{ other.visitor_ } {
+  }
+
+  /// The implicit and explicit interfaces require a key() accessor.
+  inline const key_t& key() const {
+    return key_;
+  }
+
+  inline void Get(const value_t& value) {
+    visitor_(value, false);
+  }
+  inline void GetAtomic(const value_t& value) {
+    visitor_(value, true);
+  }
+
+  inline visitor_t& visitor() {
+    return visitor_;
+  }
+
+ protected:
+  /// The explicit interface requires a DeepCopy_Internal() implementation.
+  Status DeepCopy_Internal(IAsyncContext*& context_copy) {
+    return IAsyncContext::DeepCopy_Internal(*this, context_copy);
+  }
+
+ private:
+  key_t key_;
+  visitor_t visitor_;
+};
+
+}
+} // namespace FASTER::core
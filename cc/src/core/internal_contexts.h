@@ -40,7 +40,9 @@ enum class OperationStatus : uint8_t {
   RECORD_ON_DISK,
   SUCCESS_UNMARK,
   NOT_FOUND_UNMARK,
-  CPR_SHIFT_DETECTED
+  CPR_SHIFT_DETECTED,
+  CONDITION_FAILED,
+  CONDITION_FAILED_UNMARK
 };
 
 /// Internal FASTER context.
@@ -59,7 +61,8 @@ class PendingContext : public IAsyncContext {
     , phase{ Phase::INVALID }
     , result{ Status::Pending }
     , address{ Address::kInvalidAddress }
-    , entry{ HashBucketEntry::kInvalidEntry } {
+    , entry{ HashBucketEntry::kInvalidEntry }
+    , cold{ false } {
   }
 
  public:
@@ -72,27 +75,33 @@ class PendingContext : public IAsyncContext {
     , phase{ other.phase }
     , result{ other.result }
     , address{ other.address }
-    , entry{ other.entry } {
+    , entry{ other.entry }
+    , cold{ other.cold } {
   }
 
  public:
   /// Go async, for the first time.
-  void go_async(Phase phase_, uint32_t version_, Address address_, HashBucketEntry entry_) {
+  void go_async(Phase phase_, uint32_t version_, Address address_, HashBucketEntry entry_,
+                bool cold_ = false) {
     phase = phase_;
     version = version_;
     address = address_;
     entry = entry_;
+    cold = cold_;
   }
 
   /// Go async, again.
-  void continue_async(Address address_, HashBucketEntry entry_) {
+  void continue_async(Address address_, HashBucketEntry entry_, bool cold_ = false) {
     address = address_;
     entry = entry_;
+    cold = cold_;
   }
 
   virtual uint32_t key_size() const = 0;
   virtual void write_deep_key_at(key_t* dst) const = 0;
   virtual KeyHash get_key_hash() const = 0;
+  /// The key, for indexes that store it inline (see KeyIndexTraits); otherwise, 0.
+  virtual uint64_t get_inline_key() const = 0;
   virtual bool is_key_equal(const key_t& other) const = 0;
 
   /// Caller context.
@@ -111,6 +120,8 @@ class PendingContext : public IAsyncContext {
   Address address;
   /// Hash table entry that (indirectly) leads to the record being read or modified.
   HashBucketEntry entry;
+  /// Whether "address" is in the cold log (see ColdLog). "entry" is always the hybrid log's.
+  bool cold;
 };
 
 // A helper class to copy the key into FASTER log.
@@ -203,6 +214,9 @@ class PendingReadContext : public AsyncPendingReadContext<typename RC::key_t> {
   inline KeyHash get_key_hash() const final {
     return read_context().key().GetHash();
   }
+  inline uint64_t get_inline_key() const final {
+    return KeyIndexTraits<key_t>::inline_key(read_context().key());
+  }
   inline bool is_key_equal(const key_t& other) const final {
     return read_context().key() == other;
   }
@@ -282,6 +296,9 @@ class PendingUpsertContext : public AsyncPendingUpsertContext<typename UC::key_t
   inline KeyHash get_key_hash() const final {
     return upsert_context().key().GetHash();
   }
+  inline uint64_t get_inline_key() const final {
+    return KeyIndexTraits<key_t>::inline_key(upsert_context().key());
+  }
   inline bool is_key_equal(const key_t& other) const final {
     return upsert_context().key() == other;
   }
@@ -306,13 +323,19 @@ class AsyncPendingRmwContext : public PendingContext<K> {
   typedef K key_t;
  protected:
   AsyncPendingRmwContext(IAsyncContext& caller_context_, AsyncCallback caller_callback_)
-    : PendingContext<key_t>(OperationType::RMW, caller_context_, caller_callback_) {
+    : PendingContext<key_t>(OperationType::RMW, caller_context_, caller_callback_)
+    , condition_failed{ false } {
   }
   /// The deep copy constructor.
   AsyncPendingRmwContext(AsyncPendingRmwContext& other, IAsyncContext* caller_context)
-    : PendingContext<key_t>(other, caller_context) {
+    : PendingContext<key_t>(other, caller_context)
+    , condition_failed{ other.condition_failed } {
   }
  public:
+  /// Whether the update applies to the current value (old_rec, found at old_address), or to no
+  /// value (nullptr). Only conditional updates (FasterKv::ConditionalUpsert(), and compaction's
+  /// copies to the tail) ever decline.
+  virtual bool RmwCheck(const void* old_rec, Address old_address) = 0;
   /// Set initial value.
   virtual void RmwInitial(void* rec) = 0;
   /// RCU.
@@ -323,6 +346,10 @@ class AsyncPendingRmwContext : public PendingContext<K> {
   virtual uint32_t value_size() const = 0;
   /// Get value size for RCU
   virtual uint32_t value_size(const void* old_rec) const = 0;
+
+  /// Set by RmwAtomic(), when a conditional update's condition didn't hold (so the value was
+  /// left as it was).
+  bool condition_failed;
 };
 
 /// A synchronous Rmw() context preserves its type information.
@@ -369,9 +396,15 @@ class PendingRmwContext : public AsyncPendingRmwContext<typename MC::key_t> {
   inline KeyHash get_key_hash() const final {
     return rmw_context().key().GetHash();
   }
+  inline uint64_t get_inline_key() const final {
+    return KeyIndexTraits<key_t>::inline_key(rmw_context().key());
+  }
   inline bool is_key_equal(const key_t& other) const final {
     return rmw_context().key() == other;
   }
+  inline bool RmwCheck(const void* old_rec, Address old_address) final {
+    return true;
+  }
   /// Set initial value.
   inline void RmwInitial(void* rec) final {
     record_t* record = reinterpret_cast<record_t*>(rec);
@@ -399,6 +432,170 @@ class PendingRmwContext : public AsyncPendingRmwContext<typename MC::key_t> {
   }
 };
 
+/// FASTER's internal ConditionalUpsert() context: an RMW whose update is a blind Put(), guarded
+/// by the caller's Compare() on the current value.
+template <class CC>
+class PendingConditionalUpsertContext : public AsyncPendingRmwContext<typename CC::key_t> {
+ public:
+  typedef CC conditional_upsert_context_t;
+  typedef typename conditional_upsert_context_t::key_t key_t;
+  typedef typename conditional_upsert_context_t::value_t value_t;
+  using key_or_shallow_key_t = std::remove_const_t<std::remove_reference_t<std::result_of_t<decltype(&CC::key)(CC)>>>;
+  typedef Record<key_t, value_t> record_t;
+  constexpr static const bool kIsShallowKey = !std::is_same<key_or_shallow_key_t, key_t>::value;
+
+  PendingConditionalUpsertContext(conditional_upsert_context_t& caller_context_,
+                                  AsyncCallback caller_callback_)
+    : AsyncPendingRmwContext<key_t>(caller_context_, caller_callback_) {
+  }
+  /// The deep copy constructor.
+  PendingConditionalUpsertContext(PendingConditionalUpsertContext& other,
+                                  IAsyncContext* caller_context_)
+    : AsyncPendingRmwContext<key_t>(other, caller_context_) {
+  }
+ protected:
+  Status DeepCopy_Internal(IAsyncContext*& context_copy) final {
+    return IAsyncContext::DeepCopy_Internal(*this, PendingContext<key_t>::caller_context,
+                                            context_copy);
+  }
+ private:
+  const conditional_upsert_context_t& upsert_context() const {
+    return *static_cast<const conditional_upsert_context_t*>(
+             PendingContext<key_t>::caller_context);
+  }
+  conditional_upsert_context_t& upsert_context() {
+    return *static_cast<conditional_upsert_context_t*>(PendingContext<key_t>::caller_context);
+  }
+ public:
+  /// Accessors.
+  inline const key_or_shallow_key_t& get_key_or_shallow_key() const {
+    return upsert_context().key();
+  }
+  inline uint32_t key_size() const final {
+    return upsert_context().key().size();
+  }
+  inline void write_deep_key_at(key_t* dst) const final {
+    write_deep_key_at_helper<kIsShallowKey>::execute(upsert_context().key(), dst);
+  }
+  inline KeyHash get_key_hash() const final {
+    return upsert_context().key().GetHash();
+  }
+  inline uint64_t get_inline_key() const final {
+    return KeyIndexTraits<key_t>::inline_key(upsert_context().key());
+  }
+  inline bool is_key_equal(const key_t& other) const final {
+    return upsert_context().key() == other;
+  }
+  inline bool RmwCheck(const void* old_rec, Address old_address) final {
+    if(old_rec == nullptr) {
+      return upsert_context().CompareNotFound();
+    }
+    const record_t* old_record = reinterpret_cast<const record_t*>(old_rec);
+    return upsert_context().Compare(old_record->value());
+  }
+  inline void RmwInitial(void* rec) final {
+    record_t* record = reinterpret_cast<record_t*>(rec);
+    upsert_context().Put(record->value());
+  }
+  inline void RmwCopy(const void* old_rec, void* rec) final {
+    record_t* record = reinterpret_cast<record_t*>(rec);
+    upsert_context().Put(record->value());
+  }
+  inline bool RmwAtomic(void* rec) final {
+    record_t* record = reinterpret_cast<record_t*>(rec);
+    bool swapped;
+    if(!upsert_context().CompareAndPutAtomic(record->value(), swapped)) {
+      return false;
+    }
+    this->condition_failed = !swapped;
+    return true;
+  }
+  inline constexpr uint32_t value_size() const final {
+    return upsert_context().value_size();
+  }
+  inline constexpr uint32_t value_size(const void* old_rec) const final {
+    return upsert_context().value_size();
+  }
+};
+
+/// FASTER's internal context for compaction's copies to the tail: an RMW that writes the caller's
+/// value only if the key's latest record is the one the caller found (see the caller's Check()).
+/// Generational compaction runs its liveness checks through it, too, with a Check() that never
+/// lets the copy happen.
+template <class CC>
+class PendingCopyToTailContext : public AsyncPendingRmwContext<typename CC::key_t> {
+ public:
+  typedef CC copy_context_t;
+  typedef typename copy_context_t::key_t key_t;
+  typedef typename copy_context_t::value_t value_t;
+  typedef Record<key_t, value_t> record_t;
+
+  PendingCopyToTailContext(copy_context_t& caller_context_, AsyncCallback caller_callback_)
+    : AsyncPendingRmwContext<key_t>(caller_context_, caller_callback_) {
+  }
+  /// The deep copy constructor.
+  PendingCopyToTailContext(PendingCopyToTailContext& other, IAsyncContext* caller_context_)
+    : AsyncPendingRmwContext<key_t>(other, caller_context_) {
+  }
+ protected:
+  Status DeepCopy_Internal(IAsyncContext*& context_copy) final {
+    return IAsyncContext::DeepCopy_Internal(*this, PendingContext<key_t>::caller_context,
+                                            context_copy);
+  }
+ private:
+  const copy_context_t& copy_context() const {
+    return *static_cast<const copy_context_t*>(PendingContext<key_t>::caller_context);
+  }
+  copy_context_t& copy_context() {
+    return *static_cast<copy_context_t*>(PendingContext<key_t>::caller_context);
+  }
+ public:
+  /// Accessors.
+  inline const key_t& get_key_or_shallow_key() const {
+    return copy_context().key();
+  }
+  inline uint32_t key_size() const final {
+    return copy_context().key().size();
+  }
+  inline void write_deep_key_at(key_t* dst) const final {
+    write_deep_key_at_helper<false>::execute(copy_context().key(), dst);
+  }
+  inline KeyHash get_key_hash() const final {
+    return copy_context().key().GetHash();
+  }
+  inline uint64_t get_inline_key() const final {
+    return KeyIndexTraits<key_t>::inline_key(copy_context().key());
+  }
+  inline bool is_key_equal(const key_t& other) const final {
+    return copy_context().key() == other;
+  }
+  inline bool RmwCheck(const void* old_rec, Address old_address) final {
+    // (old_rec is nullptr for a tombstone or an expired record.)
+    return copy_context().Check(old_rec != nullptr, old_address);
+  }
+  inline void RmwInitial(void* rec) final {
+    // Not reached: RmwCheck() declines when there's no current value.
+    assert(false);
+  }
+  inline void RmwCopy(const void* old_rec, void* rec) final {
+    record_t* record = reinterpret_cast<record_t*>(rec);
+    copy_context().Put(record->value());
+  }
+  inline bool RmwAtomic(void* rec) final {
+    // The latest record is in the mutable region, so it is either newer than the one being
+    // copied, or (when compacting past the read-only address) that record itself, which then
+    // stays where it is.
+    this->condition_failed = true;
+    return true;
+  }
+  inline constexpr uint32_t value_size() const final {
+    return copy_context().value_size();
+  }
+  inline constexpr uint32_t value_size(const void* old_rec) const final {
+    return copy_context().value_size();
+  }
+};
+
 /// FASTER's internal Delete() context.
 
 /// An internal Delete() context that has gone async and lost its type information.
@@ -463,6 +660,9 @@ class PendingDeleteContext : public AsyncPendingDeleteContext<typename MC::key_t
   inline KeyHash get_key_hash() const final {
     return delete_context().key().GetHash();
   }
+  inline uint64_t get_inline_key() const final {
+    return KeyIndexTraits<key_t>::inline_key(delete_context().key());
+  }
   inline bool is_key_equal(const key_t& other) const final {
     return delete_context().key() == other;
   }
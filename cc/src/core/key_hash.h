@@ -3,7 +3,9 @@
 
 #pragma once
 
+#include <cassert>
 #include <cstdint>
+#include <type_traits>
 #include "utility.h"
 
 namespace FASTER {
@@ -39,6 +41,14 @@ struct KeyHash {
     return static_cast<uint16_t>(tag_);
   }
 
+  /// The top num_bits (<= 16) of the address bits, for bucket layouts that keep a fingerprint
+  /// next to the tag. Hash tables never grow past 2^31 buckets, so these bits are never part of
+  /// the bucket index.
+  inline uint16_t fingerprint(uint8_t num_bits) const {
+    assert(num_bits <= 16);
+    return num_bits == 0 ? 0 : static_cast<uint16_t>(address_ >> (48 - num_bits));
+  }
+
  private:
   union {
       struct {
@@ -51,5 +61,38 @@ struct KeyHash {
 };
 static_assert(sizeof(KeyHash) == 8, "sizeof(KeyHash) != 8");
 
+/// Hash functions for variable-length (byte-string) keys. A key type selects one by declaring it
+/// as its "key_hash_t", and calling it in GetHash(), e.g.:
+/// "return KeyHash{ key_hash_t{}(buffer(), length()) };". A store's checkpoints can be recovered
+/// only by keys that hash the same way: index checkpoints record the hash's ID (see KeyHashId),
+/// and recovery checks it.
+struct DefaultBytesHash {
+  static constexpr uint32_t kId = 0;
+
+  inline uint64_t operator()(const uint8_t* str, size_t len) const {
+    return Utility::Hash8BitBytes(str, len);
+  }
+};
+
+struct FastBytesHash {
+  static constexpr uint32_t kId = 1;
+
+  inline uint64_t operator()(const uint8_t* str, size_t len) const {
+    return Utility::FastHashBytes(str, len);
+  }
+};
+
+/// The ID of a key type's hash function: that of its "key_hash_t", if it declares one; else 0, the
+/// same as DefaultBytesHash's (which is what keys hashed with before there was a choice).
+template <class K, class Enable = void>
+struct KeyHashId {
+  static constexpr uint32_t value = 0;
+};
+
+template <class K>
+struct KeyHashId<K, typename std::enable_if<std::is_class<typename K::key_hash_t>::value>::type> {
+  static constexpr uint32_t value = K::key_hash_t::kId;
+};
+
 }
 } // namespace FASTER::core
@@ -272,7 +272,7 @@ class LightEpoch {
   /// Compute latest epoch that is safe to reclaim, by scanning the epoch table
   uint64_t ComputeNewSafeToReclaimEpoch(uint64_t current_epoch_) {
     uint64_t oldest_ongoing_call = current_epoch_;
-    for(uint32_t index = 1; index <= num_entries_; ++index) {
+    for(uint32_t index = 0; index <= num_entries_; ++index) {
       uint64_t entry_epoch = table_[index].local_current_epoch;
       if(entry_epoch != kUnprotected && entry_epoch < oldest_ongoing_call) {
         oldest_ongoing_call = entry_epoch;
@@ -294,7 +294,7 @@ class LightEpoch {
 
   /// CPR checkpoint functions.
   inline void ResetPhaseFinished() {
-    for(uint32_t idx = 1; idx <= num_entries_; ++idx) {
+    for(uint32_t idx = 0; idx <= num_entries_; ++idx) {
       assert(table_[idx].phase_finished.load() == Phase::REST ||
              table_[idx].phase_finished.load() == Phase::INDEX_CHKPT ||
              table_[idx].phase_finished.load() == Phase::PERSISTENCE_CALLBACK ||
@@ -308,7 +308,11 @@ class LightEpoch {
     uint32_t entry = Thread::id();
     table_[entry].phase_finished = phase;
     // Check if other threads have reported complete.
-    for(uint32_t idx = 1; idx <= num_entries_; ++idx) {
+    return HaveThreadsFinishedPhase(phase);
+  }
+  /// Has every protected thread completed the specified phase? (Thread IDs start at 0.)
+  inline bool HaveThreadsFinishedPhase(Phase phase) const {
+    for(uint32_t idx = 0; idx <= num_entries_; ++idx) {
       Phase entry_phase = table_[idx].phase_finished.load();
       uint64_t entry_epoch = table_[idx].local_current_epoch;
       if(entry_epoch != 0 && entry_phase != phase) {
@@ -317,6 +321,12 @@ class LightEpoch {
     }
     return true;
   }
+  /// Records that the specified thread, which is unprotected, has completed the phase. (Used for
+  /// a parked session, whose part of the phase another thread has done on its behalf.)
+  inline void MarkThreadPhaseFinished(uint32_t thread_id, Phase phase) {
+    assert(table_[thread_id].local_current_epoch == kUnprotected);
+    table_[thread_id].phase_finished = phase;
+  }
   /// Has this thread completed the specified phase (i.e., is it waiting for other threads to
   /// finish the specified phase, before it can advance the global phase)?
   inline bool HasThreadFinishedPhase(Phase phase) const {
@@ -3,6 +3,7 @@
 
 #pragma once
 
+#include <algorithm>
 #include <atomic>
 
 #include "alloc.h"
@@ -63,7 +64,7 @@ class ScanIterator {
    , start(begin)
    , until(end)
    , current(start)
-   , currentFrame(0)
+   , framesPage(Address::kMaxPage + 1)
    , completedIOs(0)
    , disk(disk)
   {
@@ -106,29 +107,49 @@ class ScanIterator {
 
   /// Returns a pointer to the next record.
   record_t* GetNext() {
-    // We've exceeded the range over which we had to perform our scan.
-    // No work to do over here other than returning a nullptr.
-    if (current >= until) return nullptr;
-
-    // If we're within the in-memory region, then just lookup the address,
-    // increment it and return a pointer to the record.
-    if (current >= hLog->head_address.load()) {
-      auto record = reinterpret_cast<record_t*>(hLog->Get(current));
+    Address address;
+    return GetNext(address);
+  }
+
+  /// Returns a pointer to the next record, and its logical address.
+  record_t* GetNext(Address& address) {
+    while (true) {
+      // We've exceeded the range over which we had to perform our scan.
+      // No work to do over here other than returning a nullptr.
+      if (current >= until) return nullptr;
+
+      // If we're within the in-memory region, then just lookup the address.
+      // Otherwise, we need to issue reads to persistent storage.
+      record_t* record;
+      if (current >= hLog->head_address.load()) {
+        record = reinterpret_cast<record_t*>(hLog->Get(current));
+      } else {
+        record = blockAndLoad();
+      }
+
+      // A null header is the unused end of a page (records never span
+      // pages); the next record is at the start of the next page.
+      if (record->header.IsNull()) {
+        current = Address(current.page() + 1, 0);
+        continue;
+      }
+
+      // Increment the current address and return a pointer to the record.
+      address = current;
       current += record->size();
       return record;
     }
-
-    // If we're over here then we need to issue reads to persistent storage.
-    return blockAndLoad();
   }
 
  private:
   /// Loads pages from persistent storage if needed, and returns a pointer
-  /// to the next record in the log.
+  /// to the record at the current address.
   record_t* blockAndLoad() {
-    // We are at the first address of the first frame in the buffer. Issue
-    // an IO to the persistent layer and then wait for it to complete.
-    if (currentFrame == 0 && current.offset() == 0) {
+    // The page we're scanning isn't in the buffer (we're just starting, or
+    // have scanned past the last frame). Issue IOs for it and the pages that
+    // follow, up to the end of the scan or the first page that hasn't been
+    // flushed, and then wait for them to complete.
+    if (current.page() < framesPage || current.page() >= framesPage + numFrames) {
       auto cb = [](IAsyncContext* ctxt, Status result, size_t bytes) {
         assert(result == Status::Ok);
         assert(bytes == hlog_t::kPageSize);
@@ -137,27 +158,29 @@ class ScanIterator {
         context->counter->fetch_add(1);
       };
 
+      framesPage = current.page();
+      uint32_t untilPage = until.offset() == 0 ? until.page() : until.page() + 1;
+      uint32_t endPage = std::min({ framesPage + numFrames, untilPage,
+                                    hLog->head_address.load().page() });
+      int numReads = std::max(1, static_cast<int>(endPage - framesPage));
+
       // Issue reads to fill up the buffer and wait for them to complete.
-      for (auto i = 0; i < numFrames; i++) {
+      for (auto i = 0; i < numReads; i++) {
         auto ctxt = Context(&completedIOs);
-        auto addr = current.control() + (i * hlog_t::kPageSize);
+        auto addr = Address(framesPage + i, 0).control();
         hLog->file->ReadAsync(addr,
                               reinterpret_cast<void*>(frames[i]),
                               hlog_t::kPageSize, cb, ctxt);
       }
 
-      while (completedIOs.load() < numFrames) disk->TryComplete();
+      while (completedIOs.load() < numReads) disk->TryComplete();
       completedIOs.store(0);
     }
 
-    // We have the corresponding page in our buffer. Look it up, increment
-    // the current address and current frame (if necessary), return a
+    // We have the corresponding page in our buffer. Look it up and return a
     // pointer to the record.
-    auto record = reinterpret_cast<record_t*>(frames[currentFrame] +
-                                              current.offset());
-    current += record->size();
-    if (current.offset() == 0) currentFrame = (currentFrame + 1) % numFrames;
-    return record;
+    return reinterpret_cast<record_t*>(frames[current.page() - framesPage] +
+                                       current.offset());
   }
 
   /// Passed in to the persistent layer when reading pages. Contains a pointer
@@ -205,9 +228,9 @@ class ScanIterator {
   /// Logical address within the log at which we are currently scanning.
   Address current;
 
-  /// Current frame within the buffer we're scanning through for records
-  /// on persistent storage.
-  uint64_t currentFrame;
+  /// The page held by the first frame within the buffer; the other frames
+  /// hold the pages that follow it. No page is buffered until the first read.
+  uint32_t framesPage;
 
   /// The number of read requests to the persistent storage layer that
   /// have completed so far. Refreshed every numFrames.
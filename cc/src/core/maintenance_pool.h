@@ -0,0 +1,119 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace FASTER {
+namespace core {
+
+/// An optional pool of threads for the store's own chunked work: splitting and cleaning the hash
+/// table, while the index grows or the log is truncated, and reading and writing index checkpoints
+/// and replaying the log, during checkpoints and recovery. Without one (the default), that work
+/// falls to the application threads that refresh their sessions, or to threads spawned for it.
+/// Pool threads hold no sessions; a task that reads the log protects the epoch itself.
+class MaintenancePool {
+ public:
+  typedef std::function<void()> task_t;
+
+  MaintenancePool()
+    : stop_{ false } {
+  }
+
+  ~MaintenancePool() {
+    Stop();
+  }
+
+  /// Disallow copy and copy-assign constructors.
+  MaintenancePool(const MaintenancePool& other) = delete;
+  MaintenancePool& operator=(const MaintenancePool& other) = delete;
+
+  void Start(uint32_t num_threads) {
+    for(uint32_t idx = 0; idx < num_threads; ++idx) {
+      threads_.emplace_back(&MaintenancePool::Run, this);
+    }
+  }
+
+  /// Runs the tasks already submitted, then stops the threads.
+  void Stop() {
+    {
+      std::lock_guard<std::mutex> lock{ mutex_ };
+      stop_ = true;
+    }
+    cv_.notify_all();
+    for(auto& thread : threads_) {
+      thread.join();
+    }
+    threads_.clear();
+  }
+
+  inline bool empty() const {
+    return threads_.empty();
+  }
+  inline uint32_t size() const {
+    return static_cast<uint32_t>(threads_.size());
+  }
+
+  void Submit(task_t task) {
+    {
+      std::lock_guard<std::mutex> lock{ mutex_ };
+      tasks_.push_back(std::move(task));
+    }
+    cv_.notify_one();
+  }
+
+  /// Runs "task" on the calling thread, and on up to "num_helpers" pool threads; returns once all
+  /// of them are done. (The pool mustn't be busy with tasks that wait on the caller.)
+  void RunAndWait(uint32_t num_helpers, const task_t& task) {
+    num_helpers = std::min(num_helpers, size());
+    std::atomic<uint32_t> num_active{ num_helpers };
+    for(uint32_t idx = 0; idx < num_helpers; ++idx) {
+      Submit([&task, &num_active]() {
+        task();
+        --num_active;
+      });
+    }
+    task();
+    while(num_active.load() > 0) {
+      std::this_thread::yield();
+    }
+  }
+
+ private:
+  void Run() {
+    while(true) {
+      task_t task;
+      {
+        std::unique_lock<std::mutex> lock{ mutex_ };
+        cv_.wait(lock, [this]() {
+          return stop_ || !tasks_.empty();
+        });
+        if(tasks_.empty()) {
+          // Stopped.
+          return;
+        }
+        task = std::move(tasks_.front());
+        tasks_.pop_front();
+      }
+      task();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_;
+  std::deque<task_t> tasks_;
+  std::vector<std::thread> threads_;
+};
+
+}
+} // namespace FASTER::core
@@ -9,9 +9,11 @@
 #include <cstring>
 #include <deque>
 #include <thread>
+#include <vector>
 
 #include "alloc.h"
 #include "light_epoch.h"
+#include "sparse_checkpoint.h"
 
 namespace FASTER {
 namespace core {
@@ -259,14 +261,7 @@ class MallocFixedPageSize {
     : alignment_{ UINT64_MAX }
     , count_{ 0 }
     , epoch_{ nullptr }
-    , page_array_{ nullptr }
-    , disk_{ nullptr }
-    , pending_checkpoint_writes_{ 0 }
-    , pending_recover_reads_{ 0 }
-    , checkpoint_pending_{ false }
-    , checkpoint_failed_{ false }
-    , recover_pending_{ false }
-    , recover_failed_{ false } {
+    , page_array_{ nullptr } {
   }
 
   ~MallocFixedPageSize() {
@@ -282,13 +277,7 @@ class MallocFixedPageSize {
     alignment_ = alignment;
     count_.store(0);
     epoch_ = &epoch;
-    disk_ = nullptr;
-    pending_checkpoint_writes_ = 0;
-    pending_recover_reads_ = 0;
-    checkpoint_pending_ = false;
-    checkpoint_failed_ = false;
-    recover_pending_ = false;
-    recover_failed_ = false;
+    checkpoint_file_.ResetIncremental();
 
     array_t* page_array = array_t::Create(alignment, 2, nullptr);
     page_array->AddPage(0);
@@ -304,6 +293,10 @@ class MallocFixedPageSize {
     }
   }
 
+  void set_maintenance_pool(MaintenancePool* pool) {
+    checkpoint_file_.set_maintenance_pool(pool);
+  }
+
   inline item_t& Get(FixedPageAddress address) {
     page_t* page = page_array_.load(std::memory_order_acquire)->Get(address.page());
     assert(page);
@@ -322,10 +315,18 @@ class MallocFixedPageSize {
   }
 
   /// Checkpointing and recovery.
-  Status Checkpoint(disk_t& disk, file_t&& file, uint64_t& size);
+  /// An incremental checkpoint stores only the items allocated since the previous checkpoint,
+  /// and the chunks of items (SparseCheckpointFile::kMaxItemsPerChunk each) that the caller
+  /// flags as changed.
+  Status Checkpoint(disk_t& disk, file_t&& file, uint64_t& size, bool incremental = false,
+                    std::vector<bool> changed_chunks = {});
   Status CheckpointComplete(bool wait);
+  bool CanCheckpointIncrementally() const {
+    return checkpoint_file_.can_checkpoint_incrementally(count_.load().control());
+  }
 
-  Status Recover(disk_t& disk, file_t&& file, uint64_t file_size, FixedPageAddress count);
+  Status Recover(disk_t& disk, file_t&& file, uint64_t file_size, FixedPageAddress count,
+                 bool incremental = false, IndexLoadMode load_mode = IndexLoadMode::Read);
   Status RecoverComplete(bool wait);
 
   std::deque<FreeAddress>& free_list() {
@@ -340,26 +341,18 @@ class MallocFixedPageSize {
   }
 
  private:
-  /// Checkpointing and recovery.
-  class AsyncIoContext : public IAsyncContext {
-   public:
-    AsyncIoContext(alloc_t* allocator_)
-      : allocator{ allocator_ } {
+  /// Checkpointing and recovery number items consecutively, across the specified pages. (The
+  /// page array may be replaced while a checkpoint is in progress, but the pages won't be.)
+  static std::function<item_t*(uint64_t)> items(array_t* page_array, uint64_t num_levels) {
+    std::vector<page_t*> pages;
+    for(uint64_t idx = 0; idx < num_levels; ++idx) {
+      pages.push_back(page_array->GetOrAdd(idx));
     }
-
-    /// The deep-copy constructor
-    AsyncIoContext(AsyncIoContext& other)
-      : allocator{ other.allocator } {
-    }
-
-   protected:
-    Status DeepCopy_Internal(IAsyncContext*& context_copy) final {
-      return IAsyncContext::DeepCopy_Internal(*this, context_copy);
-    }
-
-   public:
-    alloc_t* allocator;
-  };
+    return [pages](uint64_t idx) {
+      FixedPageAddress address{ idx };
+      return &pages[address.page()]->element(address.offset());
+    };
+  }
 
   array_t* ExpandArray(array_t* expected, uint64_t new_size);
 
@@ -374,97 +367,36 @@ class MallocFixedPageSize {
   LightEpoch* epoch_;
 
   /// State for ongoing checkpoint/recovery.
-  disk_t* disk_;
-  file_t file_;
-  std::atomic<uint64_t> pending_checkpoint_writes_;
-  std::atomic<uint64_t> pending_recover_reads_;
-  std::atomic<bool> checkpoint_pending_;
-  std::atomic<bool> checkpoint_failed_;
-  std::atomic<bool> recover_pending_;
-  std::atomic<bool> recover_failed_;
+  SparseCheckpointFile<item_t, disk_t> checkpoint_file_;
 
   FreeList free_list_[Thread::kMaxNumThreads];
 };
 
 /// Implementations.
 template <typename T, class F>
-Status MallocFixedPageSize<T, F>::Checkpoint(disk_t& disk, file_t&& file, uint64_t& size) {
-  constexpr uint32_t kWriteSize = page_t::kPageSize * sizeof(item_t);
-
-  auto callback = [](IAsyncContext* ctxt, Status result, size_t bytes_transferred) {
-    CallbackContext<AsyncIoContext> context{ ctxt };
-    if(result != Status::Ok) {
-      context->allocator->checkpoint_failed_ = true;
-    }
-    if(--context->allocator->pending_checkpoint_writes_ == 0) {
-      result = context->allocator->file_.Close();
-      if(result != Status::Ok) {
-        context->allocator->checkpoint_failed_ = true;
-      }
-      context->allocator->checkpoint_pending_ = false;
-    }
-  };
-
-  disk_ = &disk;
-  file_ = std::move(file);
+Status MallocFixedPageSize<T, F>::Checkpoint(disk_t& disk, file_t&& file, uint64_t& size,
+    bool incremental, std::vector<bool> changed_chunks) {
+  static_assert(page_t::kPageSize % SparseCheckpointFile<item_t, disk_t>::kMaxItemsPerChunk == 0,
+                "checkpoint chunks would span pages");
   size = 0;
-  checkpoint_failed_ = false;
   array_t* page_array = page_array_.load();
   FixedPageAddress count = count_.load();
-
   uint64_t num_levels = count.page() + (count.offset() > 0 ? 1 : 0);
-  assert(!checkpoint_pending_);
-  assert(pending_checkpoint_writes_ == 0);
-  checkpoint_pending_ = true;
-  pending_checkpoint_writes_ = num_levels;
-  for(uint64_t idx = 0; idx < num_levels; ++idx) {
-    AsyncIoContext context{ this };
-    RETURN_NOT_OK(file_.WriteAsync(page_array->Get(idx), idx * kWriteSize, kWriteSize, callback,
-                                   context));
-  }
-  size = count.control_ * sizeof(item_t);
+  RETURN_NOT_OK(checkpoint_file_.Checkpoint(disk, std::move(file), count.control(),
+                items(page_array, num_levels), incremental, std::move(changed_chunks)));
+  size = count.control() * sizeof(item_t);
   return Status::Ok;
 }
 
 template <typename T, class F>
 Status MallocFixedPageSize<T, F>::CheckpointComplete(bool wait) {
-  disk_->TryComplete();
-  bool complete = !checkpoint_pending_.load();
-  while(wait && !complete) {
-    disk_->TryComplete();
-    complete = !checkpoint_pending_.load();
-    std::this_thread::yield();
-  }
-  if(!complete) {
-    return Status::Pending;
-  } else {
-    return checkpoint_failed_ ? Status::IOError : Status::Ok;
-  }
+  return checkpoint_file_.CheckpointComplete(wait);
 }
 
 template <typename T, class F>
 Status MallocFixedPageSize<T, F>::Recover(disk_t& disk, file_t&& file, uint64_t file_size,
-    FixedPageAddress count) {
-  constexpr uint64_t kReadSize = page_t::kPageSize * sizeof(item_t);
-
-  auto callback = [](IAsyncContext* ctxt, Status result, size_t bytes_transferred) {
-    CallbackContext<AsyncIoContext> context{ ctxt };
-    if(result != Status::Ok) {
-      context->allocator->recover_failed_ = true;
-    }
-    if(--context->allocator->pending_recover_reads_ == 0) {
-      result = context->allocator->file_.Close();
-      if(result != Status::Ok) {
-        context->allocator->recover_failed_ = true;
-      }
-      context->allocator->recover_pending_ = false;
-    }
-  };
-
+    FixedPageAddress count, bool incremental, IndexLoadMode load_mode) {
   assert(file_size % sizeof(item_t) == 0);
-  disk_ = &disk;
-  file_ = std::move(file);
-  recover_failed_ = false;
 
   // The size reserved by recovery is >= the size checkpointed to disk.
   FixedPageAddress file_end_addr{ file_size / sizeof(item_t) };
@@ -481,33 +413,16 @@ Status MallocFixedPageSize<T, F>::Recover(disk_t& disk, file_t&& file, uint64_t
     page_array = ExpandArray(page_array, new_size);
   }
   count_.store(count);
-  assert(!recover_pending_);
-  assert(pending_recover_reads_.load() == 0);
-  recover_pending_ = true;
-  pending_recover_reads_ = num_file_levels;
   for(uint64_t idx = 0; idx < num_file_levels; ++idx) {
-    //read a full page
-    AsyncIoContext context{ this };
-    RETURN_NOT_OK(file_.ReadAsync(idx * kReadSize, page_array->GetOrAdd(idx), kReadSize, callback,
-                                  context));
+    page_array->GetOrAdd(idx);
   }
-  return Status::Ok;
+  return checkpoint_file_.Recover(disk, std::move(file), file_end_addr.control(),
+                                  items(page_array, num_file_levels), incremental, load_mode);
 }
 
 template <typename T, class F>
 Status MallocFixedPageSize<T, F>::RecoverComplete(bool wait) {
-  disk_->TryComplete();
-  bool complete = !recover_pending_.load();
-  while(wait && !complete) {
-    disk_->TryComplete();
-    complete = !recover_pending_.load();
-    std::this_thread::yield();
-  }
-  if(!complete) {
-    return Status::Pending;
-  } else {
-    return recover_failed_ ? Status::IOError : Status::Ok;
-  }
+  return checkpoint_file_.RecoverComplete(wait);
 }
 
 template <typename T, class F>
@@ -9,6 +9,7 @@
 #include <cstring>
 #include <mutex>
 #include <thread>
+#include <vector>
 
 #include "device/file_system_disk.h"
 #include "address.h"
@@ -112,13 +113,21 @@ static_assert(sizeof(AtomicFlushCloseStatus) == 2, "sizeof(FlushCloseStatus) !=
 struct FullPageStatus {
   FullPageStatus()
     : LastFlushedUntilAddress{ 0 }
-    , status{} {
+    , status{}
+    , modified_version{ 0 }
+    , flush_requested_until{ 0 } {
   }
 
   AtomicAddress LastFlushedUntilAddress;
   AtomicFlushCloseStatus status;
+  /// The latest checkpoint version that modified the page (or whatever page last used the same
+  /// frame, which can only be older); see PersistentMemoryMalloc::MarkPageModified().
+  std::atomic<uint32_t> modified_version;
+  /// The furthest address that the page has been asked to be flushed up to (see
+  /// PersistentMemoryMalloc::FlushPage()).
+  AtomicAddress flush_requested_until;
 };
-static_assert(sizeof(FullPageStatus) == 16, "sizeof(FullPageStatus) != 16");
+static_assert(sizeof(FullPageStatus) == 24, "sizeof(FullPageStatus) != 24");
 
 /// Page and offset of the tail of the log. Can reserve space within the current page or move to a
 /// new page.
@@ -316,13 +325,15 @@ class PersistentMemoryMalloc {
     uint32_t discard;
     Allocate(Constants::kCacheLineBytes, discard);
     assert(discard == UINT32_MAX);
-    /// Move the head and read-only address past the invalid page.
+    /// Move the head, read-only and flushed-until address past the invalid page. (Otherwise a
+    /// flush of the empty log would wait for the invalid page.)
     Address tail_address = tail_page_offset_.load();
     begin_address.store(tail_address);
     read_only_address.store(tail_address);
     safe_read_only_address.store(tail_address);
     head_address.store(tail_address);
     safe_head_address.store(tail_address);
+    flushed_until_address.store(tail_address);
   }
 
   ~PersistentMemoryMalloc() {
@@ -361,6 +372,19 @@ class PersistentMemoryMalloc {
     return buffer_size_;
   }
 
+  /// Delta snapshot checkpoints write only the pages that threads in a version later than the
+  /// previous snapshot's have modified (by appending to them, or by updating records in place).
+  inline void MarkPageModified(uint32_t page, uint32_t version) {
+    std::atomic<uint32_t>& modified_version = PageStatus(page).modified_version;
+    uint32_t current_version = modified_version.load();
+    while(current_version < version &&
+          !modified_version.compare_exchange_weak(current_version, version)) {
+    }
+  }
+  inline uint32_t PageModifiedVersion(uint32_t page) const {
+    return PageStatus(page).modified_version.load();
+  }
+
   /// Read the tail page + offset, atomically, and convert it to an address.
   inline Address GetTailAddress() const {
     PageOffset tail_page_offset = tail_page_offset_.load();
@@ -386,9 +410,15 @@ class PersistentMemoryMalloc {
   inline bool NewPage(uint32_t old_page);
 
   /// Invoked by users to obtain a record from disk. It uses sector aligned memory to read
-  /// the record efficiently into memory.
+  /// the record efficiently into memory. The read also covers up to "read_ahead_bytes" of the log
+  /// below the record (within its page), for hash chain walks that are likely to hop there next.
   inline void AsyncGetFromDisk(Address address, uint32_t num_records, AsyncIOCallback callback,
-                               AsyncIOContext& context);
+                               AsyncIOContext& context, uint32_t read_ahead_bytes = 0);
+  /// Reads the (sector-aligned) log range [begin_address, end_address) into "buffer", with one
+  /// I/O.
+  inline void AsyncGetRangeFromDisk(Address begin_address, Address end_address,
+                                    AsyncIOCallback callback, IAsyncContext& context,
+                                    SectorAlignedMemory& buffer);
 
   /// Used by applications to make the current state of the database immutable quickly
   Address ShiftReadOnlyToTail();
@@ -493,10 +523,19 @@ class PersistentMemoryMalloc {
 
   Status AsyncFlushPages(uint32_t start_page, Address until_address,
                          bool serialize_objects = false);
+  /// Flushes the page up to "until_address". A page is written by one flush at a time, so that an
+  /// older image of it can't land on disk after a newer one: a flush asked for while the page is
+  /// being written is issued when that write completes, up to the furthest address asked for in
+  /// the meantime.
+  Status FlushPage(uint32_t page, Address until_address);
+  Status WritePage(uint32_t page);
 
  public:
   Status AsyncFlushPagesToFile(uint32_t start_page, Address until_address, file_t& file,
                                std::atomic<uint32_t>& flush_pending);
+  /// Writes the listed pages to the file, one after the other (for a delta snapshot).
+  Status AsyncFlushPagesToFile(const std::vector<uint32_t>& pages, file_t& file,
+                               std::atomic<uint32_t>& flush_pending);
 
   /// Recovery.
   Status AsyncReadPagesFromLog(uint32_t start_page, uint32_t num_pages,
@@ -654,10 +693,15 @@ inline bool PersistentMemoryMalloc<D>::NewPage(uint32_t old_page) {
 
 template <class D>
 inline void PersistentMemoryMalloc<D>::AsyncGetFromDisk(Address address, uint32_t num_records,
-    AsyncIOCallback callback, AsyncIOContext& context) {
+    AsyncIOCallback callback, AsyncIOContext& context, uint32_t read_ahead_bytes) {
   uint64_t begin_read, end_read;
   uint32_t offset, length;
-  GetFileReadBoundaries(address, num_records, begin_read, end_read, offset, length);
+  // Records never span pages, so there's no point reading past the end of this one.
+  num_records = std::min(num_records, Address::kMaxOffset + 1 - address.offset());
+  uint32_t read_ahead = std::min(read_ahead_bytes, address.offset());
+  GetFileReadBoundaries(Address{ address.control() - read_ahead }, read_ahead + num_records,
+                        begin_read, end_read, offset, length);
+  offset += read_ahead;
   context.record = read_buffer_pool.Get(length);
   context.record.valid_offset = offset;
   context.record.available_bytes = length - offset;
@@ -666,6 +710,22 @@ inline void PersistentMemoryMalloc<D>::AsyncGetFromDisk(Address address, uint32_
   file->ReadAsync(begin_read, context.record.buffer(), length, callback, context);
 }
 
+template <class D>
+inline void PersistentMemoryMalloc<D>::AsyncGetRangeFromDisk(Address begin_address,
+    Address end_address, AsyncIOCallback callback, IAsyncContext& context,
+    SectorAlignedMemory& buffer) {
+  assert(begin_address.control() % sector_size == 0);
+  assert(end_address.control() % sector_size == 0);
+  assert(end_address.control() - begin_address.control() <= UINT32_MAX);
+  uint32_t length = static_cast<uint32_t>(end_address.control() - begin_address.control());
+  buffer = read_buffer_pool.Get(length);
+  buffer.valid_offset = 0;
+  buffer.available_bytes = length;
+  buffer.required_bytes = length;
+
+  file->ReadAsync(begin_address.control(), buffer.buffer(), length, callback, context);
+}
+
 template <class D>
 Address PersistentMemoryMalloc<D>::ShiftReadOnlyToTail() {
   Address tail_address = GetTailAddress();
@@ -732,6 +792,40 @@ void PersistentMemoryMalloc<D>::OnPagesMarkedReadOnly(IAsyncContext* ctxt) {
 template <class D>
 Status PersistentMemoryMalloc<D>::AsyncFlushPages(uint32_t start_page, Address until_address,
     bool serialize_objects) {
+  uint32_t num_pages = until_address.page() - start_page;
+  if(until_address.offset() > 0) {
+    ++num_pages;
+  }
+  assert(num_pages > 0);
+
+  for(uint32_t flush_page = start_page; flush_page < start_page + num_pages; ++flush_page) {
+    Address page_end_address{ flush_page + 1, 0 };
+    RETURN_NOT_OK(FlushPage(flush_page, std::min(page_end_address, until_address)));
+  }
+  return Status::Ok;
+}
+
+template <class D>
+Status PersistentMemoryMalloc<D>::FlushPage(uint32_t page, Address until_address) {
+  FullPageStatus& page_status = PageStatus(page);
+  Address discard;
+  MonotonicUpdate(page_status.flush_requested_until, until_address, discard);
+  //Set status to in-progress
+  FlushCloseStatus old_status = page_status.status.load();
+  FlushCloseStatus new_status;
+  do {
+    if(old_status.flush == FlushStatus::InProgress) {
+      // The write in progress will see the request when it completes.
+      return Status::Ok;
+    }
+    new_status = FlushCloseStatus{ FlushStatus::InProgress, old_status.close };
+  } while(!page_status.status.compare_exchange_weak(old_status, new_status));
+  page_status.LastFlushedUntilAddress.store(0);
+  return WritePage(page);
+}
+
+template <class D>
+Status PersistentMemoryMalloc<D>::WritePage(uint32_t page) {
   class Context : public IAsyncContext {
    public:
     Context(alloc_t* allocator_, uint32_t page_, Address until_address_)
@@ -760,53 +854,55 @@ Status PersistentMemoryMalloc<D>::AsyncFlushPages(uint32_t start_page, Address u
     if(result != Status::Ok) {
       fprintf(stderr, "AsyncFlushPages(), error: %u\n", static_cast<uint8_t>(result));
     }
-    context->allocator->PageStatus(context->page).LastFlushedUntilAddress.store(
-      context->until_address);
+    alloc_t* allocator = context->allocator;
+    FullPageStatus& page_status = allocator->PageStatus(context->page);
+    page_status.LastFlushedUntilAddress.store(context->until_address);
+    if(page_status.flush_requested_until.load() > context->until_address) {
+      // More of the page was asked for while it was being written; write it again.
+      allocator->WritePage(context->page);
+      allocator->ShiftFlushedUntilAddress();
+      return;
+    }
     //Set the page status to flushed
-    FlushCloseStatus old_status = context->allocator->PageStatus(context->page).status.load();
+    FlushCloseStatus old_status = page_status.status.load();
     FlushCloseStatus new_status;
     do {
       new_status = FlushCloseStatus{ FlushStatus::Flushed, old_status.close };
-    } while(!context->allocator->PageStatus(context->page).status.compare_exchange_weak(
-              old_status, new_status));
+    } while(!page_status.status.compare_exchange_weak(old_status, new_status));
     if(old_status.close == CloseStatus::Closed) {
       // We finished flushing the page after it was closed, so we are responsible for clearing and
       // reopening it.
-      std::memset(context->allocator->Page(context->page), 0, kPageSize);
-      context->allocator->PageStatus(context->page).status.store(FlushStatus::Flushed,
-          CloseStatus::Open);
+      std::memset(allocator->Page(context->page), 0, kPageSize);
+      page_status.status.store(FlushStatus::Flushed, CloseStatus::Open);
+    } else if(page_status.flush_requested_until.load() > context->until_address) {
+      // Asked for after the check above, by a thread that saw this write still in progress.
+      allocator->FlushPage(context->page, context->until_address);
     }
-    context->allocator->ShiftFlushedUntilAddress();
+    allocator->ShiftFlushedUntilAddress();
   };
 
+  Address until_address = PageStatus(page).flush_requested_until.load();
+  Context context{ this, page, until_address };
+  return file->WriteAsync(Page(page), kPageSize * page, kPageSize, callback, context);
+}
+
+template <class D>
+Status PersistentMemoryMalloc<D>::AsyncFlushPagesToFile(uint32_t start_page, Address until_address,
+    file_t& file, std::atomic<uint32_t>& flush_pending) {
   uint32_t num_pages = until_address.page() - start_page;
   if(until_address.offset() > 0) {
     ++num_pages;
   }
   assert(num_pages > 0);
-
-  for(uint32_t flush_page = start_page; flush_page < start_page + num_pages; ++flush_page) {
-    Address page_start_address{ flush_page, 0 };
-    Address page_end_address{ flush_page + 1, 0 };
-
-    Context context{ this, flush_page, std::min(page_end_address, until_address) };
-
-    //Set status to in-progress
-    FlushCloseStatus old_status = PageStatus(flush_page).status.load();
-    FlushCloseStatus new_status;
-    do {
-      new_status = FlushCloseStatus{ FlushStatus::InProgress, old_status.close };
-    } while(!PageStatus(flush_page).status.compare_exchange_weak(old_status, new_status));
-    PageStatus(flush_page).LastFlushedUntilAddress.store(0);
-
-    RETURN_NOT_OK(file->WriteAsync(Page(flush_page), kPageSize * flush_page, kPageSize, callback,
-                                   context));
+  std::vector<uint32_t> pages(num_pages);
+  for(uint32_t idx = 0; idx < num_pages; ++idx) {
+    pages[idx] = start_page + idx;
   }
-  return Status::Ok;
+  return AsyncFlushPagesToFile(pages, file, flush_pending);
 }
 
 template <class D>
-Status PersistentMemoryMalloc<D>::AsyncFlushPagesToFile(uint32_t start_page, Address until_address,
+Status PersistentMemoryMalloc<D>::AsyncFlushPagesToFile(const std::vector<uint32_t>& pages,
     file_t& file, std::atomic<uint32_t>& flush_pending) {
   class Context : public IAsyncContext {
    public:
@@ -834,19 +930,12 @@ Status PersistentMemoryMalloc<D>::AsyncFlushPagesToFile(uint32_t start_page, Add
     --context->flush_pending;
   };
 
-  uint32_t num_pages = until_address.page() - start_page;
-  if(until_address.offset() > 0) {
-    ++num_pages;
-  }
-  assert(num_pages > 0);
-  flush_pending = num_pages;
+  flush_pending = static_cast<uint32_t>(pages.size());
 
-  for(uint32_t flush_page = start_page; flush_page < start_page + num_pages; ++flush_page) {
-    Address page_start_address{ flush_page, 0 };
-    Address page_end_address{ flush_page + 1, 0 };
+  for(uint32_t idx = 0; idx < pages.size(); ++idx) {
     Context context{ flush_pending };
-    RETURN_NOT_OK(file.WriteAsync(Page(flush_page), kPageSize * (flush_page - start_page),
-                                  kPageSize, callback, context));
+    RETURN_NOT_OK(file.WriteAsync(Page(pages[idx]), kPageSize * idx, kPageSize, callback,
+                                  context));
   }
   return Status::Ok;
 }
@@ -4,7 +4,9 @@
 #pragma once
 
 #include <cassert>
+#include <chrono>
 #include <cstdint>
+#include <type_traits>
 #include "address.h"
 #include "auto_ptr.h"
 
@@ -48,6 +50,37 @@ class RecordInfo {
 };
 static_assert(sizeof(RecordInfo) == 8, "sizeof(RecordInfo) != 8");
 
+/// Per-record expiration (TTL). The record header has no spare bits, so the expiration time lives
+/// in the value: a value type opts in by declaring
+///   static constexpr bool kHasExpiration = true;
+///   inline uint64_t expiration() const;
+/// where expiration() is an absolute time, in milliseconds since the system clock's epoch (0 means
+/// the record never expires). Expired records read as NotFound, and compaction drops them.
+template <class V, class Enable = void>
+struct ValueExpiryTraits {
+  static constexpr bool kHasExpiration = false;
+
+  static inline bool expired(const V& value) {
+    return false;
+  }
+};
+
+template <class V>
+struct ValueExpiryTraits<V, typename std::enable_if<V::kHasExpiration>::type> {
+  static constexpr bool kHasExpiration = true;
+
+  /// The current time, on the same scale as expiration().
+  static inline uint64_t now() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::system_clock::now().time_since_epoch()).count();
+  }
+
+  static inline bool expired(const V& value) {
+    uint64_t expiration = value.expiration();
+    return expiration != 0 && expiration <= now();
+  }
+};
+
 /// A record stored in the log. The log starts at 0 (mod 64), and consists of Records, one after
 /// the other. Each record's header is 8 bytes.
 template <class key_t, class value_t>
@@ -97,6 +130,11 @@ struct Record {
     return *reinterpret_cast<value_t*>(head + offset);
   }
 
+  /// Whether the record's value has passed its expiration time (see ValueExpiryTraits).
+  inline bool expired() const {
+    return ValueExpiryTraits<value_t>::expired(value());
+  }
+
   /// Size of a record to be created, in memory. (Includes padding, if any, after the value, so
   /// that the next record stored in the log is properly aligned.)
   static inline constexpr uint32_t size(uint32_t key_size, uint32_t value_size) {
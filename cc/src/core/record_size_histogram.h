@@ -0,0 +1,87 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+namespace FASTER {
+namespace core {
+
+/// Learns the sizes of the records that reads find on disk, so that a disk read can start with a
+/// size that usually covers the whole record, rather than reading the record's header first and
+/// then issuing a follow-up read for the rest of it.
+class RecordSizeHistogram {
+ public:
+  /// Record sizes are counted in 512-byte buckets, up to 32 KB; larger records land in the last
+  /// bucket (and still need a follow-up read).
+  static constexpr uint32_t kBucketSize = 512;
+  static constexpr uint32_t kNumBuckets = 64;
+  /// The read size is recomputed after every kRecomputeInterval samples, to cover
+  /// kCoveragePercent percent of the samples.
+  static constexpr uint64_t kRecomputeInterval = 1024;
+  static constexpr uint64_t kCoveragePercent = 90;
+  /// Past this many samples, the counts are halved, so the histogram tracks recent reads.
+  static constexpr uint64_t kMaxSamples = 1 << 20;
+
+  RecordSizeHistogram(uint32_t min_read_size)
+    : min_read_size_{ min_read_size }
+    , num_samples_{ 0 }
+    , read_size_{ min_read_size } {
+    for(uint32_t idx = 0; idx < kNumBuckets; ++idx) {
+      buckets_[idx].store(0);
+    }
+  }
+
+  /// Counts a record that a read found on disk.
+  inline void Add(uint32_t record_size) {
+    uint32_t bucket = std::min(record_size == 0 ? 0 : (record_size - 1) / kBucketSize,
+                               kNumBuckets - 1);
+    buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+    if(++num_samples_ % kRecomputeInterval == 0) {
+      Recompute();
+    }
+  }
+
+  /// How many bytes the first read of a record should fetch.
+  inline uint32_t read_size() const {
+    return read_size_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  void Recompute() {
+    uint64_t counts[kNumBuckets];
+    uint64_t total = 0;
+    for(uint32_t idx = 0; idx < kNumBuckets; ++idx) {
+      counts[idx] = buckets_[idx].load(std::memory_order_relaxed);
+      total += counts[idx];
+    }
+    uint64_t covered = 0;
+    uint32_t bucket = 0;
+    for(; bucket < kNumBuckets - 1; ++bucket) {
+      covered += counts[bucket];
+      if(covered * 100 >= total * kCoveragePercent) {
+        break;
+      }
+    }
+    read_size_.store(std::max(min_read_size_, (bucket + 1) * kBucketSize),
+                     std::memory_order_relaxed);
+
+    if(total > kMaxSamples) {
+      // (Racing threads may lose a few counts; that's fine for a histogram.)
+      for(uint32_t idx = 0; idx < kNumBuckets; ++idx) {
+        buckets_[idx].fetch_sub(counts[idx] / 2, std::memory_order_relaxed);
+      }
+    }
+  }
+
+  const uint32_t min_read_size_;
+  std::atomic<uint64_t> buckets_[kNumBuckets];
+  std::atomic<uint64_t> num_samples_;
+  std::atomic<uint32_t> read_size_;
+};
+
+}
+} // namespace FASTER::core
@@ -0,0 +1,672 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "environment/file.h"
+
+#include "alloc.h"
+#include "async.h"
+#include "maintenance_pool.h"
+#include "status.h"
+#include "utility.h"
+
+namespace FASTER {
+namespace core {
+
+/// Index checkpoints (the hash table and its overflow buckets) are mostly empty buckets, so they
+/// are written sparsely. The items are split into fixed-size chunks; each non-empty chunk is
+/// stored as a bitmap of its non-empty items, followed by those items, padded to the file's
+/// alignment. A directory at the start of the file gives each chunk's offset and size; a chunk
+/// with size 0 holds only empty items and is not stored at all.
+///
+/// An incremental checkpoint stores only the chunks that changed since the previous checkpoint
+/// (of the same items), as tracked by the items' owner; it is applied on top of that checkpoint
+/// during recovery.
+///
+/// Files written before this format were dense: just the items, back to back. They are still
+/// recovered; they are told apart by the magic number at the start of the header, which no dense
+/// file can start with (its first item is either empty, or a bucket entry that points at an
+/// 8-byte aligned record address).
+struct SparseCheckpointHeader {
+  /// "SPCK", followed by a (misaligned) address of 1.
+  static constexpr uint64_t kMagic = 0x5350434B00000001ull;
+  static constexpr uint64_t kVersion = 1;
+
+  uint64_t magic;
+  uint64_t version;
+  uint64_t num_items;
+  uint64_t item_size;
+  uint64_t items_per_chunk;
+  uint64_t num_chunks;
+  uint64_t incremental;
+};
+static_assert(sizeof(SparseCheckpointHeader) == 56, "sizeof(SparseCheckpointHeader) != 56");
+
+struct SparseCheckpointChunk {
+  /// (Marks a chunk that an incremental checkpoint did not store.)
+  static constexpr uint64_t kUnchangedOffset = UINT64_MAX;
+
+  uint64_t offset;
+  uint64_t size;
+};
+static_assert(sizeof(SparseCheckpointChunk) == 16, "sizeof(SparseCheckpointChunk) != 16");
+
+/// How recovery loads a checkpoint file: by reading each chunk into a buffer; or by mapping the file
+/// into memory and decoding the chunks straight out of the mapping, whose pages either fault in as
+/// the workers (in parallel) first touch them, or are all read in when the file is mapped.
+enum class IndexLoadMode : uint8_t {
+  Read,
+  Map,
+  MapPopulate
+};
+
+/// Writes an array of (trivially copyable) items to a checkpoint file in the sparse format, and
+/// reads it back. Chunks are encoded and written--or read and decoded--by a small pool of worker
+/// threads, each claiming the next chunk until none remain. Checkpoint() and Recover() return as
+/// soon as the workers start; CheckpointComplete() and RecoverComplete() poll for them to finish.
+///
+/// An incremental checkpoint skips, without encoding them, the chunks that its caller says
+/// haven't changed. (Chunks that have grown since the previous checkpoint are always stored.)
+template <class T, class D>
+class SparseCheckpointFile {
+ public:
+  typedef T item_t;
+  typedef D disk_t;
+  typedef typename D::file_t file_t;
+  /// Returns a pointer to the (contiguous) chunk of items that starts at the specified item.
+  typedef std::function<item_t*(uint64_t)> get_items_t;
+
+  /// Chunks are small enough to buffer one per worker, and evenly divide a FixedPage.
+  static constexpr uint64_t kMaxItemsPerChunk = 1 << 16;
+  static constexpr uint32_t kMaxNumWorkers = 8;
+
+  static_assert(sizeof(item_t) % sizeof(uint64_t) == 0,
+                "sizeof(item_t) is not a multiple of sizeof(uint64_t)");
+
+  SparseCheckpointFile()
+    : disk_{ nullptr }
+    , alignment_{ 0 }
+    , directory_{ nullptr }
+    , next_chunk_{ 0 }
+    , next_offset_{ 0 }
+    , active_workers_{ 0 }
+    , checkpoint_{ false }
+    , pending_{ false }
+    , failed_{ false }
+    , dense_{ false }
+    , has_base_{ false }
+    , base_num_items_{ 0 }
+    , maintenance_pool_{ nullptr } {
+  }
+
+  ~SparseCheckpointFile() {
+    JoinWorkers();
+    if(directory_) {
+      aligned_free(directory_);
+    }
+  }
+
+  /// For an incremental checkpoint, "changed_chunks" flags the chunks that changed since the
+  /// previous one (missing entries count as unchanged).
+  Status Checkpoint(disk_t& disk, file_t&& file, uint64_t num_items, get_items_t get_items,
+                    bool incremental, std::vector<bool> changed_chunks = {});
+  Status CheckpointComplete(bool wait) {
+    return Complete(wait);
+  }
+
+  Status Recover(disk_t& disk, file_t&& file, uint64_t num_items, get_items_t get_items,
+                 bool incremental, IndexLoadMode load_mode = IndexLoadMode::Read);
+  Status RecoverComplete(bool wait) {
+    return Complete(wait);
+  }
+
+  /// Whether the next checkpoint, of num_items items, can be incremental: the previous one must
+  /// have succeeded, and the items can only have grown since.
+  bool can_checkpoint_incrementally(uint64_t num_items) const {
+    return has_base_ && num_items >= base_num_items_;
+  }
+  /// Called when the items are replaced wholesale; the next checkpoint will be a full one.
+  void ResetIncremental() {
+    assert(!pending_);
+    has_base_ = false;
+    base_num_items_ = 0;
+  }
+
+  bool pending() const {
+    return pending_.load();
+  }
+
+  /// With a pool set, the workers are pool tasks, instead of threads of their own.
+  void set_maintenance_pool(MaintenancePool* pool) {
+    maintenance_pool_ = pool;
+  }
+
+  /// Bytes of the most recent checkpoint file (directory and chunks), once it has completed.
+  uint64_t file_size() const {
+    return next_offset_.load();
+  }
+
+  /// Encodes count items into dst, which must hold at least max_encoded_size(count) bytes.
+  /// Returns the encoded size, or 0 if every item is empty.
+  static uint64_t Encode(const item_t* items, uint64_t count, uint8_t* dst);
+  /// Decodes size bytes from src into count items, zeroing the empty ones.
+  static Status Decode(const uint8_t* src, uint64_t size, item_t* items, uint64_t count);
+
+  static constexpr uint64_t bitmap_size(uint64_t count) {
+    return ((count + 63) / 64) * sizeof(uint64_t);
+  }
+  static constexpr uint64_t max_encoded_size(uint64_t count) {
+    return bitmap_size(count) + count * sizeof(item_t);
+  }
+
+ private:
+  /// Lets a worker wait for its own I/O, while driving completions for all of them.
+  class IoContext : public IAsyncContext {
+   public:
+    IoContext(std::atomic<bool>* done_, std::atomic<bool>* failed_, uint64_t length_)
+      : done{ done_ }
+      , failed{ failed_ }
+      , length{ length_ } {
+    }
+    /// The deep-copy constructor
+    IoContext(IoContext& other)
+      : done{ other.done }
+      , failed{ other.failed }
+      , length{ other.length } {
+    }
+   protected:
+    Status DeepCopy_Internal(IAsyncContext*& context_copy) final {
+      return IAsyncContext::DeepCopy_Internal(*this, context_copy);
+    }
+   public:
+    std::atomic<bool>* done;
+    std::atomic<bool>* failed;
+    /// The I/O fails if it transfers fewer bytes than this.
+    uint64_t length;
+  };
+
+  static bool IsEmpty(const item_t& item) {
+    const uint64_t* words = reinterpret_cast<const uint64_t*>(&item);
+    for(size_t idx = 0; idx < sizeof(item_t) / sizeof(uint64_t); ++idx) {
+      if(words[idx] != 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  uint64_t pad(uint64_t size) const {
+    return (size + alignment_ - 1) & ~(alignment_ - 1);
+  }
+  SparseCheckpointHeader& header() {
+    return *reinterpret_cast<SparseCheckpointHeader*>(directory_);
+  }
+  SparseCheckpointChunk* chunks() {
+    return reinterpret_cast<SparseCheckpointChunk*>(directory_ + sizeof(SparseCheckpointHeader));
+  }
+  uint64_t directory_size(uint64_t num_chunks) const {
+    return pad(sizeof(SparseCheckpointHeader) + num_chunks * sizeof(SparseCheckpointChunk));
+  }
+  uint64_t chunk_items(uint64_t chunk) {
+    uint64_t first = chunk * header().items_per_chunk;
+    return std::min(header().items_per_chunk, header().num_items - first);
+  }
+
+  void Start(disk_t& disk, file_t&& file, uint64_t num_items, bool incremental);
+  void StartWorkers(void (SparseCheckpointFile::*worker)());
+  void JoinWorkers();
+  Status Complete(bool wait);
+  /// Synchronous I/O, for use by the workers and by Recover(). A read may come up short of its
+  /// (padded) length at the end of the file, but must return at least min_length bytes.
+  Status Write(const uint8_t* src, uint64_t offset, uint64_t length);
+  Status Read(uint64_t offset, uint8_t* dst, uint64_t length, uint64_t min_length);
+  Status Wait(std::atomic<bool>& done, std::atomic<bool>& failed);
+  /// Drives I/O completions until done() holds. While no I/O completes, it yields and then
+  /// sleeps, rather than spinning on the completion queue.
+  template <class F>
+  void PollUntil(F done);
+
+  /// Validates the header just loaded against the expected one; on finding a dense file instead,
+  /// sets "dense_" and restores the expected header.
+  Status CheckHeader(const SparseCheckpointHeader& expected);
+  void CheckpointWorker();
+  void RecoverWorker();
+  /// Copies one chunk of a dense file straight into the items.
+  void RecoverDenseChunk(uint64_t chunk, uint8_t* buffer);
+  void FinishWorker();
+
+  disk_t* disk_;
+  file_t file_;
+  uint64_t alignment_;
+  get_items_t get_items_;
+
+  /// Header, followed by one entry per chunk; padded to the file's alignment.
+  uint8_t* directory_;
+  std::atomic<uint64_t> next_chunk_;
+  std::atomic<uint64_t> next_offset_;
+  std::atomic<uint32_t> active_workers_;
+  /// Whether the workers are writing a checkpoint (vs. recovering from one).
+  bool checkpoint_;
+  std::atomic<bool> pending_;
+  std::atomic<bool> failed_;
+  /// Whether the file being recovered is in the (pre-sparse) dense format.
+  bool dense_;
+
+  /// Whether the last checkpoint (of base_num_items_ items) succeeded; and the chunks that the
+  /// current one stores, if it is incremental.
+  bool has_base_;
+  uint64_t base_num_items_;
+  std::vector<bool> changed_chunks_;
+
+  /// While recovering from a mapped file.
+  environment::FileMapping mapping_;
+
+  std::mutex workers_mutex_;
+  std::vector<std::thread> workers_;
+  MaintenancePool* maintenance_pool_;
+};
+
+/// Implementations.
+template <class T, class D>
+uint64_t SparseCheckpointFile<T, D>::Encode(const item_t* items, uint64_t count, uint8_t* dst) {
+  uint64_t* bitmap = reinterpret_cast<uint64_t*>(dst);
+  std::memset(bitmap, 0, bitmap_size(count));
+  uint8_t* out = dst + bitmap_size(count);
+  for(uint64_t idx = 0; idx < count; ++idx) {
+    if(!IsEmpty(items[idx])) {
+      bitmap[idx / 64] |= uint64_t{ 1 } << (idx % 64);
+      std::memcpy(out, reinterpret_cast<const uint8_t*>(&items[idx]), sizeof(item_t));
+      out += sizeof(item_t);
+    }
+  }
+  uint64_t size = out - dst;
+  return size == bitmap_size(count) ? 0 : size;
+}
+
+template <class T, class D>
+Status SparseCheckpointFile<T, D>::Decode(const uint8_t* src, uint64_t size, item_t* items,
+    uint64_t count) {
+  uint8_t* dst = reinterpret_cast<uint8_t*>(items);
+  if(size == 0) {
+    std::memset(dst, 0, count * sizeof(item_t));
+    return Status::Ok;
+  }
+  if(size < bitmap_size(count) || (size - bitmap_size(count)) % sizeof(item_t) != 0) {
+    return Status::Corruption;
+  }
+  const uint64_t* bitmap = reinterpret_cast<const uint64_t*>(src);
+  const uint8_t* in = src + bitmap_size(count);
+  const uint8_t* end = src + size;
+  for(uint64_t idx = 0; idx < count; ++idx) {
+    if(bitmap[idx / 64] & (uint64_t{ 1 } << (idx % 64))) {
+      if(in == end) {
+        return Status::Corruption;
+      }
+      std::memcpy(dst + idx * sizeof(item_t), in, sizeof(item_t));
+      in += sizeof(item_t);
+    } else {
+      std::memset(dst + idx * sizeof(item_t), 0, sizeof(item_t));
+    }
+  }
+  return in == end ? Status::Ok : Status::Corruption;
+}
+
+template <class T, class D>
+void SparseCheckpointFile<T, D>::Start(disk_t& disk, file_t&& file, uint64_t num_items,
+    bool incremental) {
+  assert(!pending_);
+  JoinWorkers();
+  disk_ = &disk;
+  file_ = std::move(file);
+  alignment_ = file_.alignment();
+  assert(Utility::IsPowerOfTwo(alignment_));
+  failed_ = false;
+  dense_ = false;
+  next_chunk_ = 0;
+
+  // (Chunk boundaries don't depend on the number of items, so that incremental checkpoints line
+  // up with their predecessors.)
+  uint64_t items_per_chunk = kMaxItemsPerChunk;
+  uint64_t num_chunks = (num_items + items_per_chunk - 1) / items_per_chunk;
+  if(directory_) {
+    aligned_free(directory_);
+  }
+  directory_ = reinterpret_cast<uint8_t*>(aligned_alloc(alignment_,
+               directory_size(num_chunks)));
+  std::memset(directory_, 0, directory_size(num_chunks));
+  header() = SparseCheckpointHeader{ SparseCheckpointHeader::kMagic,
+                                     SparseCheckpointHeader::kVersion, num_items, sizeof(item_t),
+                                     items_per_chunk, num_chunks,
+                                     incremental ? uint64_t{ 1 } : uint64_t{ 0 } };
+  next_offset_ = directory_size(num_chunks);
+}
+
+template <class T, class D>
+void SparseCheckpointFile<T, D>::StartWorkers(void (SparseCheckpointFile::*worker)()) {
+  uint32_t num_workers = maintenance_pool_ ? maintenance_pool_->size() :
+                         std::max(1u, std::thread::hardware_concurrency());
+  num_workers = std::min(num_workers, kMaxNumWorkers);
+  num_workers = static_cast<uint32_t>(std::min<uint64_t>(num_workers, header().num_chunks));
+  num_workers = std::max(1u, num_workers);
+  pending_ = true;
+  active_workers_ = num_workers;
+  if(maintenance_pool_) {
+    for(uint32_t idx = 0; idx < num_workers; ++idx) {
+      maintenance_pool_->Submit([this, worker]() {
+        (this->*worker)();
+      });
+    }
+    return;
+  }
+  std::lock_guard<std::mutex> lock{ workers_mutex_ };
+  for(uint32_t idx = 0; idx < num_workers; ++idx) {
+    workers_.emplace_back(worker, this);
+  }
+}
+
+template <class T, class D>
+void SparseCheckpointFile<T, D>::JoinWorkers() {
+  // (Clearing "pending_" is the last thing the last pool task does with this file.)
+  while(maintenance_pool_ && pending_.load()) {
+    std::this_thread::yield();
+  }
+  std::lock_guard<std::mutex> lock{ workers_mutex_ };
+  for(auto& worker : workers_) {
+    worker.join();
+  }
+  workers_.clear();
+}
+
+template <class T, class D>
+Status SparseCheckpointFile<T, D>::Complete(bool wait) {
+  disk_->TryComplete();
+  if(wait) {
+    PollUntil([this]() {
+      return !pending_.load();
+    });
+  }
+  if(pending_.load()) {
+    return Status::Pending;
+  } else {
+    JoinWorkers();
+    return failed_ ? Status::IOError : Status::Ok;
+  }
+}
+
+template <class T, class D>
+template <class F>
+void SparseCheckpointFile<T, D>::PollUntil(F done) {
+  constexpr uint32_t kYieldsBeforeSleep = 64;
+  uint32_t idle = 0;
+  while(!done()) {
+    if(disk_->TryComplete()) {
+      idle = 0;
+    } else if(++idle < kYieldsBeforeSleep) {
+      std::this_thread::yield();
+    } else {
+      std::this_thread::sleep_for(std::chrono::microseconds{ 50 });
+    }
+  }
+}
+
+template <class T, class D>
+Status SparseCheckpointFile<T, D>::Wait(std::atomic<bool>& done, std::atomic<bool>& failed) {
+  PollUntil([&done]() {
+    return done.load();
+  });
+  return failed ? Status::IOError : Status::Ok;
+}
+
+template <class T, class D>
+Status SparseCheckpointFile<T, D>::Write(const uint8_t* src, uint64_t offset, uint64_t length) {
+  auto callback = [](IAsyncContext* ctxt, Status result, size_t bytes_transferred) {
+    CallbackContext<IoContext> context{ ctxt };
+    *context->failed = (result != Status::Ok || bytes_transferred < context->length);
+    *context->done = true;
+  };
+
+  assert(offset % alignment_ == 0 && length % alignment_ == 0);
+  std::atomic<bool> done{ false };
+  std::atomic<bool> failed{ false };
+  IoContext context{ &done, &failed, length };
+  RETURN_NOT_OK(file_.WriteAsync(src, offset, static_cast<uint32_t>(length), callback,
+                                 context));
+  return Wait(done, failed);
+}
+
+template <class T, class D>
+Status SparseCheckpointFile<T, D>::Read(uint64_t offset, uint8_t* dst, uint64_t length,
+    uint64_t min_length) {
+  auto callback = [](IAsyncContext* ctxt, Status result, size_t bytes_transferred) {
+    CallbackContext<IoContext> context{ ctxt };
+    *context->failed = (result != Status::Ok || bytes_transferred < context->length);
+    *context->done = true;
+  };
+
+  assert(offset % alignment_ == 0 && length % alignment_ == 0);
+  std::atomic<bool> done{ false };
+  std::atomic<bool> failed{ false };
+  IoContext context{ &done, &failed, min_length };
+  RETURN_NOT_OK(file_.ReadAsync(offset, dst, static_cast<uint32_t>(length), callback, context));
+  return Wait(done, failed);
+}
+
+template <class T, class D>
+Status SparseCheckpointFile<T, D>::Checkpoint(disk_t& disk, file_t&& file, uint64_t num_items,
+    get_items_t get_items, bool incremental, std::vector<bool> changed_chunks) {
+  assert(!incremental || can_checkpoint_incrementally(num_items));
+  Start(disk, std::move(file), num_items, incremental);
+  get_items_ = get_items;
+  checkpoint_ = true;
+  changed_chunks_ = std::move(changed_chunks);
+  StartWorkers(&SparseCheckpointFile::CheckpointWorker);
+  return Status::Ok;
+}
+
+template <class T, class D>
+void SparseCheckpointFile<T, D>::CheckpointWorker() {
+  uint64_t buffer_size = pad(max_encoded_size(std::min(header().items_per_chunk,
+                                header().num_items)));
+  uint8_t* buffer = reinterpret_cast<uint8_t*>(aligned_alloc(alignment_, buffer_size));
+  for(uint64_t chunk = next_chunk_++; chunk < header().num_chunks; chunk = next_chunk_++) {
+    uint64_t first = chunk * header().items_per_chunk;
+    bool grown = first + chunk_items(chunk) > base_num_items_;
+    bool changed = chunk < changed_chunks_.size() && changed_chunks_[chunk];
+    if(header().incremental && !grown && !changed) {
+      chunks()[chunk] = SparseCheckpointChunk{ SparseCheckpointChunk::kUnchangedOffset, 0 };
+      continue;
+    }
+    uint64_t size = Encode(get_items_(first), chunk_items(chunk), buffer);
+    if(size == 0) {
+      // All empty: nothing to write.
+      continue;
+    }
+    uint64_t write_size = pad(size);
+    std::memset(buffer + size, 0, write_size - size);
+    uint64_t offset = next_offset_.fetch_add(write_size);
+    chunks()[chunk] = SparseCheckpointChunk{ offset, size };
+    if(Write(buffer, offset, write_size) != Status::Ok) {
+      failed_ = true;
+    }
+  }
+  aligned_free(buffer);
+  FinishWorker();
+}
+
+template <class T, class D>
+Status SparseCheckpointFile<T, D>::Recover(disk_t& disk, file_t&& file, uint64_t num_items,
+    get_items_t get_items, bool incremental, IndexLoadMode load_mode) {
+  Start(disk, std::move(file), num_items, incremental);
+  get_items_ = get_items;
+  checkpoint_ = false;
+  // (The items no longer match what we last checkpointed.)
+  has_base_ = false;
+  uint64_t expected_directory_size = directory_size(header().num_chunks);
+  SparseCheckpointHeader expected = header();
+
+  Status result;
+  if(load_mode != IndexLoadMode::Read) {
+    result = file_.Map(mapping_, load_mode == IndexLoadMode::MapPopulate);
+    if(result == Status::Ok && mapping_.size() < sizeof(expected)) {
+      result = Status::Corruption;
+    }
+    if(result == Status::Ok) {
+      std::memcpy(directory_, mapping_.data(), sizeof(expected));
+      result = CheckHeader(expected);
+    }
+    if(result == Status::Ok && !dense_) {
+      if(mapping_.size() < expected_directory_size) {
+        result = Status::Corruption;
+      } else {
+        std::memcpy(directory_, mapping_.data(), expected_directory_size);
+      }
+    }
+    if(result != Status::Ok) {
+      mapping_.Unmap();
+      file_.Close();
+      return result;
+    }
+    StartWorkers(&SparseCheckpointFile::RecoverWorker);
+    return Status::Ok;
+  }
+
+  // The directory's first block holds the header; read it, then the rest of the directory.
+  result = Read(0, directory_, alignment_, sizeof(expected));
+  if(result == Status::Ok) {
+    result = CheckHeader(expected);
+  }
+  if(result == Status::Ok && !dense_ && expected_directory_size > alignment_) {
+    result = Read(alignment_, directory_ + alignment_, expected_directory_size - alignment_,
+                  expected_directory_size - alignment_);
+  }
+  if(result != Status::Ok) {
+    file_.Close();
+    return result;
+  }
+  StartWorkers(&SparseCheckpointFile::RecoverWorker);
+  return Status::Ok;
+}
+
+template <class T, class D>
+Status SparseCheckpointFile<T, D>::CheckHeader(const SparseCheckpointHeader& expected) {
+  if(header().magic != SparseCheckpointHeader::kMagic) {
+    // A dense file, from before the sparse format; it has no directory, and can't be incremental.
+    header() = expected;
+    if(expected.incremental) {
+      return Status::Corruption;
+    }
+    dense_ = true;
+    return Status::Ok;
+  }
+  if(header().version != SparseCheckpointHeader::kVersion) {
+    // (Written by a newer version of the format.)
+    return Status::Corruption;
+  }
+  return std::memcmp(&header(), &expected, sizeof(expected)) == 0 ? Status::Ok :
+         Status::Corruption;
+}
+
+template <class T, class D>
+void SparseCheckpointFile<T, D>::RecoverDenseChunk(uint64_t chunk, uint8_t* buffer) {
+  uint64_t first = chunk * header().items_per_chunk;
+  uint64_t offset = first * sizeof(item_t);
+  uint64_t size = chunk_items(chunk) * sizeof(item_t);
+  const uint8_t* src = buffer;
+  if(mapping_.data()) {
+    if(offset > mapping_.size() || size > mapping_.size() - offset) {
+      failed_ = true;
+      return;
+    }
+    src = mapping_.data() + offset;
+  } else if(Read(offset, buffer, pad(size), size) != Status::Ok) {
+    failed_ = true;
+    return;
+  }
+  std::memcpy(reinterpret_cast<uint8_t*>(get_items_(first)), src, size);
+}
+
+template <class T, class D>
+void SparseCheckpointFile<T, D>::RecoverWorker() {
+  // (A mapped file needs no buffer: chunks are decoded where they lie.)
+  bool mapped = mapping_.data() != nullptr;
+  uint64_t buffer_size = pad(max_encoded_size(std::min(header().items_per_chunk,
+                                header().num_items)));
+  uint8_t* buffer = mapped ? nullptr :
+                    reinterpret_cast<uint8_t*>(aligned_alloc(alignment_, buffer_size));
+  for(uint64_t chunk = next_chunk_++; chunk < header().num_chunks; chunk = next_chunk_++) {
+    if(dense_) {
+      RecoverDenseChunk(chunk, buffer);
+      continue;
+    }
+    uint64_t first = chunk * header().items_per_chunk;
+    SparseCheckpointChunk entry = chunks()[chunk];
+    if(entry.offset == SparseCheckpointChunk::kUnchangedOffset) {
+      // Already recovered, from an earlier checkpoint.
+      if(!header().incremental) {
+        failed_ = true;
+      }
+      continue;
+    }
+    if(entry.size > max_encoded_size(chunk_items(chunk))) {
+      failed_ = true;
+      continue;
+    }
+    const uint8_t* src = buffer;
+    if(mapped) {
+      if(entry.size > 0 && (entry.offset > mapping_.size() ||
+                            entry.size > mapping_.size() - entry.offset)) {
+        failed_ = true;
+        continue;
+      }
+      src = mapping_.data() + entry.offset;
+    } else if(entry.size > 0 &&
+              Read(entry.offset, buffer, pad(entry.size), entry.size) != Status::Ok) {
+      failed_ = true;
+      continue;
+    }
+    if(Decode(src, entry.size, get_items_(first), chunk_items(chunk)) != Status::Ok) {
+      failed_ = true;
+    }
+  }
+  if(buffer) {
+    aligned_free(buffer);
+  }
+  FinishWorker();
+}
+
+template <class T, class D>
+void SparseCheckpointFile<T, D>::FinishWorker() {
+  if(--active_workers_ > 0) {
+    return;
+  }
+  // Last worker out: when checkpointing, every chunk's entry is now known, so write the directory.
+  if(checkpoint_ && Write(directory_, 0, directory_size(header().num_chunks)) != Status::Ok) {
+    failed_ = true;
+  }
+  mapping_.Unmap();
+  if(file_.Close() != Status::Ok) {
+    failed_ = true;
+  }
+  if(checkpoint_) {
+    // Later checkpoints can build on this one only if it succeeded.
+    has_base_ = !failed_;
+    base_num_items_ = header().num_items;
+    changed_chunks_.clear();
+  }
+  pending_ = false;
+}
+
+}
+} // namespace FASTER::core
@@ -8,6 +8,13 @@
 #include <stdexcept>
 #include <string>
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
 namespace FASTER {
 namespace core {
 
@@ -81,9 +88,183 @@ class Utility {
     return Rotr64(kMagicNum * hashState, 6);
   }
 
+  /// Fast hash for variable-length keys, in the style of wyhash: it consumes 8 bytes at a time,
+  /// 48 bytes per iteration in three independent multiply chains. Keys longer than
+  /// kLongKeyBytes first go through an xxh3-style striped accumulator, which is vectorized with
+  /// SSE2 where available (and computes the same result without it).
+  static inline uint64_t FastHashBytes(const uint8_t* str, size_t len, uint64_t seed = 0) {
+    const uint8_t* p = str;
+    size_t remaining = len;
+    seed ^= kHashSecret[0];
+    if(len > kLongKeyBytes) {
+      uint64_t acc[kNumHashLanes];
+      size_t num_stripes = len / kStripeBytes;
+      AccumulateStripes(acc, p, num_stripes);
+      for(size_t lane = 0; lane < kNumHashLanes; lane += 2) {
+        seed ^= Mix(acc[lane] ^ kHashSecret[lane], acc[lane + 1] ^ kHashSecret[lane + 1]);
+      }
+      p += num_stripes * kStripeBytes;
+      remaining -= num_stripes * kStripeBytes;
+    }
+
+    uint64_t a, b;
+    if(remaining <= 16) {
+      if(remaining >= 4) {
+        size_t offset = (remaining >> 3) << 2;
+        a = (Read32(p) << 32) | Read32(p + offset);
+        b = (Read32(p + remaining - 4) << 32) | Read32(p + remaining - 4 - offset);
+      } else if(remaining > 0) {
+        a = (static_cast<uint64_t>(p[0]) << 16) | (static_cast<uint64_t>(p[remaining >> 1]) << 8) |
+            p[remaining - 1];
+        b = 0;
+      } else {
+        a = b = 0;
+      }
+    } else {
+      if(remaining > 48) {
+        uint64_t seed1 = seed;
+        uint64_t seed2 = seed;
+        do {
+          seed = Mix(Read64(p) ^ kHashSecret[1], Read64(p + 8) ^ seed);
+          seed1 = Mix(Read64(p + 16) ^ kHashSecret[2], Read64(p + 24) ^ seed1);
+          seed2 = Mix(Read64(p + 32) ^ kHashSecret[3], Read64(p + 40) ^ seed2);
+          p += 48;
+          remaining -= 48;
+        } while(remaining > 48);
+        seed ^= seed1 ^ seed2;
+      }
+      while(remaining > 16) {
+        seed = Mix(Read64(p) ^ kHashSecret[1], Read64(p + 8) ^ seed);
+        p += 16;
+        remaining -= 16;
+      }
+      a = Read64(p + remaining - 16);
+      b = Read64(p + remaining - 8);
+    }
+    Multiply128(a ^ kHashSecret[1], b ^ seed, a, b);
+    return Mix(a ^ kHashSecret[0] ^ len, b ^ kHashSecret[1]);
+  }
+
   static constexpr inline bool IsPowerOfTwo(uint64_t x) {
     return (x > 0) && ((x & (x - 1)) == 0);
   }
+
+  /// Keys longer than this are hashed by the striped accumulator, 64 bytes (one stripe) at a
+  /// time.
+  static constexpr size_t kLongKeyBytes = 256;
+  static constexpr size_t kStripeBytes = 64;
+  static constexpr size_t kNumHashLanes = 8;
+
+  /// Scalar version of FastHashBytes()'s striped accumulator. (Exposed for unit tests, which
+  /// check that it matches the vectorized version.)
+  static inline void AccumulateStripesScalar(uint64_t* acc, const uint8_t* p,
+      size_t num_stripes) {
+    InitializeLanes(acc);
+    for(size_t stripe = 0; stripe < num_stripes; ++stripe, p += kStripeBytes) {
+      const uint64_t* secret = &kHashSecret[stripe % kStripesPerBlock];
+      for(size_t lane = 0; lane < kNumHashLanes; ++lane) {
+        uint64_t data_key = Read64(p + 8 * lane) ^ secret[lane];
+        acc[lane] += (data_key & 0xFFFFFFFF) * (data_key >> 32) + Read64(p + 8 * (lane ^ 1));
+      }
+      if(stripe % kStripesPerBlock == kStripesPerBlock - 1) {
+        for(size_t lane = 0; lane < kNumHashLanes; ++lane) {
+          uint64_t a = acc[lane];
+          a ^= a >> 47;
+          a ^= kHashSecret[kStripesPerBlock + lane];
+          acc[lane] = a * kPrime32;
+        }
+      }
+    }
+  }
+
+  static inline void AccumulateStripes(uint64_t* acc, const uint8_t* p, size_t num_stripes) {
+#if defined(__SSE2__) || defined(_M_X64)
+    // Same computation as AccumulateStripesScalar(), two lanes per 128-bit register.
+    InitializeLanes(acc);
+    __m128i vacc[kNumHashLanes / 2];
+    for(size_t idx = 0; idx < kNumHashLanes / 2; ++idx) {
+      vacc[idx] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc + 2 * idx));
+    }
+    const __m128i prime = _mm_set1_epi32(static_cast<int>(kPrime32));
+    for(size_t stripe = 0; stripe < num_stripes; ++stripe, p += kStripeBytes) {
+      const uint64_t* secret = &kHashSecret[stripe % kStripesPerBlock];
+      for(size_t idx = 0; idx < kNumHashLanes / 2; ++idx) {
+        __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16 * idx));
+        __m128i key = _mm_loadu_si128(reinterpret_cast<const __m128i*>(secret + 2 * idx));
+        __m128i data_key = _mm_xor_si128(data, key);
+        __m128i product = _mm_mul_epu32(data_key, _mm_shuffle_epi32(data_key, 0x31));
+        __m128i swapped = _mm_shuffle_epi32(data, 0x4E);
+        vacc[idx] = _mm_add_epi64(vacc[idx], _mm_add_epi64(product, swapped));
+      }
+      if(stripe % kStripesPerBlock == kStripesPerBlock - 1) {
+        for(size_t idx = 0; idx < kNumHashLanes / 2; ++idx) {
+          __m128i key = _mm_loadu_si128(reinterpret_cast<const __m128i*>(
+                                          &kHashSecret[kStripesPerBlock + 2 * idx]));
+          __m128i a = vacc[idx];
+          a = _mm_xor_si128(a, _mm_srli_epi64(a, 47));
+          a = _mm_xor_si128(a, key);
+          __m128i lo = _mm_mul_epu32(a, prime);
+          __m128i hi = _mm_mul_epu32(_mm_srli_epi64(a, 32), prime);
+          vacc[idx] = _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+        }
+      }
+    }
+    for(size_t idx = 0; idx < kNumHashLanes / 2; ++idx) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(acc + 2 * idx), vacc[idx]);
+    }
+#else
+    AccumulateStripesScalar(acc, p, num_stripes);
+#endif
+  }
+
+ private:
+  /// Stripes per block; the accumulators are scrambled after every block.
+  static constexpr size_t kStripesPerBlock = 16;
+  static constexpr uint64_t kPrime32 = 0x9E3779B1;
+  static constexpr uint64_t kHashSecret[kStripesPerBlock + kNumHashLanes] = {
+    0x9b2333197a071c0bull, 0x26b32d3c5c76076full, 0x39545e01fc810f89ull,
+    0x526acc17faa38934ull, 0x558477f9c75f392dull, 0xe4a925c477110888ull,
+    0x28773aa894b60d54ull, 0x360817557e9a7065ull, 0x5de3a311781255c7ull,
+    0xbf47cf8692f4a512ull, 0x2685e157689e0b51ull, 0xaa0e5c2d0972a07full,
+    0x7ec593a8d3e6204dull, 0x7ffe36d493ac18acull, 0xec9bf503399d331eull,
+    0xf3862ee31004234full, 0xac7b466605c79897ull, 0xdbe3e347222c75b9ull,
+    0xa131982d6a6c9d46ull, 0x892383d3b35e750aull, 0xc978f667b2699a4dull,
+    0x87aa921975caa75aull, 0x139ad42c0980adacull, 0xa4ea4aa2e720ddebull
+  };
+
+  static inline uint64_t Read64(const uint8_t* p) {
+    uint64_t result;
+    std::memcpy(&result, p, sizeof(result));
+    return result;
+  }
+  static inline uint64_t Read32(const uint8_t* p) {
+    uint32_t result;
+    std::memcpy(&result, p, sizeof(result));
+    return result;
+  }
+
+  /// 64 x 64 -> 128-bit multiply.
+  static inline void Multiply128(uint64_t a, uint64_t b, uint64_t& lo, uint64_t& hi) {
+#ifdef _MSC_VER
+    lo = _umul128(a, b, &hi);
+#else
+    __uint128_t product = static_cast<__uint128_t>(a) * b;
+    lo = static_cast<uint64_t>(product);
+    hi = static_cast<uint64_t>(product >> 64);
+#endif
+  }
+  /// Multiply, then fold the 128-bit product to 64 bits.
+  static inline uint64_t Mix(uint64_t a, uint64_t b) {
+    uint64_t lo, hi;
+    Multiply128(a, b, lo, hi);
+    return lo ^ hi;
+  }
+
+  static inline void InitializeLanes(uint64_t* acc) {
+    for(size_t lane = 0; lane < kNumHashLanes; ++lane) {
+      acc[lane] = kHashSecret[kStripesPerBlock + lane];
+    }
+  }
 };
 
 }
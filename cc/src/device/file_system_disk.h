@@ -7,7 +7,9 @@
 #include <experimental/filesystem>
 #include <mutex>
 #include <string>
+#include <vector>
 
+#include "../core/checkpoint_retention.h"
 #include "../core/gc_state.h"
 #include "../core/guid.h"
 #include "../core/light_epoch.h"
@@ -82,6 +84,12 @@ class FileSystemFile {
     return file_.device_alignment();
   }
 
+  /// Maps the whole file into memory, read-only. (Reads through the mapping see what was written
+  /// through the file, once the writes have completed.)
+  core::Status Map(environment::FileMapping& mapping, bool populate) const {
+    return mapping.Map(file_.filename(), populate);
+  }
+
  private:
   file_t file_;
   environment::FileOptions file_options_;
@@ -482,9 +490,12 @@ class FileSystemDisk {
     : root_path_{ NormalizePath(root_path) }
     , handler_{ 16 /*max threads*/ }
     , default_file_options_{ unbuffered, delete_on_close }
-    , log_{ root_path_ + "log.log", default_file_options_, &epoch} {
+    , log_{ root_path_ + "log.log", default_file_options_, &epoch}
+    , cold_log_{ root_path_ + "cold.log", default_file_options_, &epoch} {
     core::Status result = log_.Open(&handler_);
     assert(result == core::Status::Ok);
+    result = cold_log_.Open(&handler_);
+    assert(result == core::Status::Ok);
   }
 
   /// Methods required by the (implicit) disk interface.
@@ -499,6 +510,13 @@ class FileSystemDisk {
     return log_;
   }
 
+  const log_file_t& cold_log() const {
+    return cold_log_;
+  }
+  log_file_t& cold_log() {
+    return cold_log_;
+  }
+
   std::string relative_index_checkpoint_path(const core::Guid& token) const {
     std::string retval = "index-checkpoints";
     retval += FASTER::environment::kPathSeparator;
@@ -521,6 +539,11 @@ class FileSystemDisk {
     return root_path_ + relative_cpr_checkpoint_path(token);
   }
 
+  /// Group commits (see FasterKv::Commit()) are recorded in two files, written in turn.
+  std::string commit_path(uint32_t idx) const {
+    return root_path_ + "commit" + std::to_string(idx) + ".dat";
+  }
+
   void CreateIndexCheckpointDirectory(const core::Guid& token) {
     std::string index_dir = index_checkpoint_path(token);
     std::experimental::filesystem::path path{ index_dir };
@@ -543,6 +566,25 @@ class FileSystemDisk {
     std::experimental::filesystem::create_directories(path);
   }
 
+  /// The checkpoints in the store's directory. (Entries that aren't checkpoint directories are
+  /// skipped.)
+  std::vector<core::CheckpointDirectory> ListIndexCheckpoints() const {
+    return ListCheckpoints(root_path_ + "index-checkpoints");
+  }
+  std::vector<core::CheckpointDirectory> ListCprCheckpoints() const {
+    return ListCheckpoints(root_path_ + "cpr-checkpoints");
+  }
+
+  /// Deletes an obsolete checkpoint, with everything in it. (Best effort: errors are ignored.)
+  void RemoveIndexCheckpoint(const core::Guid& token) {
+    std::error_code error;
+    std::experimental::filesystem::remove_all(index_checkpoint_path(token), error);
+  }
+  void RemoveCprCheckpoint(const core::Guid& token) {
+    std::error_code error;
+    std::experimental::filesystem::remove_all(cpr_checkpoint_path(token), error);
+  }
+
   file_t NewFile(const std::string& relative_path) {
     return file_t{ root_path_ + relative_path, default_file_options_ };
   }
@@ -557,6 +599,26 @@ class FileSystemDisk {
   }
 
  private:
+  static std::vector<core::CheckpointDirectory> ListCheckpoints(const std::string& dir) {
+    namespace fs = std::experimental::filesystem;
+    std::vector<core::CheckpointDirectory> directories;
+    std::error_code error;
+    fs::directory_iterator it{ dir, error };
+    for(; !error && it != fs::directory_iterator{}; it.increment(error)) {
+      core::Guid token;
+      if(!fs::is_directory(it->status()) ||
+          !core::Guid::TryParse(it->path().filename().string(), token)) {
+        continue;
+      }
+      std::error_code time_error;
+      auto write_time = fs::last_write_time(it->path(), time_error);
+      if(!time_error) {
+        directories.push_back({ token, write_time, 0 });
+      }
+    }
+    return directories;
+  }
+
   std::string root_path_;
   handler_t handler_;
 
@@ -564,6 +626,8 @@ class FileSystemDisk {
 
   /// Store the log (contains all records).
   log_file_t log_;
+  /// The cold log, which compaction moves long-lived records to (if the store has one).
+  log_file_t cold_log_;
 };
 
 }
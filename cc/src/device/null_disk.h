@@ -6,7 +6,9 @@
 #include <atomic>
 #include <cstdint>
 #include <string>
+#include <vector>
 
+#include "../core/checkpoint_retention.h"
 #include "../core/gc_state.h"
 #include "../core/light_epoch.h"
 #include "../core/guid.h"
@@ -53,6 +55,11 @@ class NullFile {
     return 64;
   }
 
+  core::Status Map(environment::FileMapping& mapping, bool populate) const {
+    // Nothing was ever written.
+    return core::Status::IOError;
+  }
+
   void set_handler(NullHandler* handler) {
   }
 };
@@ -77,6 +84,12 @@ class NullDisk {
   file_t& log() {
     return log_;
   }
+  const file_t& cold_log() const {
+    return cold_log_;
+  }
+  file_t& cold_log() {
+    return cold_log_;
+  }
 
   std::string relative_index_checkpoint_path(const core::Guid& token) const {
     assert(false);
@@ -96,6 +109,11 @@ class NullDisk {
     return "";
   }
 
+  std::string commit_path(uint32_t idx) const {
+    assert(false);
+    return "";
+  }
+
   void CreateIndexCheckpointDirectory(const core::Guid& token) {
     assert(false);
   }
@@ -103,6 +121,19 @@ class NullDisk {
     assert(false);
   }
 
+  std::vector<core::CheckpointDirectory> ListIndexCheckpoints() const {
+    return {};
+  }
+  std::vector<core::CheckpointDirectory> ListCprCheckpoints() const {
+    return {};
+  }
+  void RemoveIndexCheckpoint(const core::Guid& token) {
+    assert(false);
+  }
+  void RemoveCprCheckpoint(const core::Guid& token) {
+    assert(false);
+  }
+
   file_t NewFile(const std::string& relative_path) {
     assert(false);
     return file_t{};
@@ -119,6 +150,7 @@ class NullDisk {
  private:
   handler_t handler_;
   file_t log_;
+  file_t cold_log_;
 };
 
 }
@@ -7,6 +7,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <libgen.h>
+#include <sys/mman.h>
 #include <stdio.h>
 #include <time.h>
 #include "file_linux.h"
@@ -105,6 +106,38 @@ int File::GetCreateDisposition(FileCreateDisposition create_disposition) {
   }
 }
 
+Status FileMapping::Map(const std::string& filename, bool populate) {
+  Unmap();
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if(fd == -1) {
+    return Status::IOError;
+  }
+  struct stat stat_buffer;
+  if(::fstat(fd, &stat_buffer) == -1 || stat_buffer.st_size == 0) {
+    ::close(fd);
+    return Status::IOError;
+  }
+  size_t size = static_cast<size_t>(stat_buffer.st_size);
+  void* data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE | (populate ? MAP_POPULATE : 0),
+                      fd, 0);
+  // (The mapping keeps the file open.)
+  ::close(fd);
+  if(data == MAP_FAILED) {
+    return Status::IOError;
+  }
+  data_ = reinterpret_cast<uint8_t*>(data);
+  size_ = size;
+  return Status::Ok;
+}
+
+void FileMapping::Unmap() {
+  if(data_) {
+    ::munmap(data_, size_);
+    data_ = nullptr;
+    size_ = 0;
+  }
+}
+
 void QueueIoHandler::IoCompletionCallback(io_context_t ctx, struct iocb* iocb, long res,
     long res2) {
   auto callback_context = core::make_context_unique_ptr<IoCallbackContext>(
@@ -138,6 +138,39 @@ class File {
 #endif
 };
 
+/// A read-only view of a whole file, mapped into memory. (Index checkpoints can be recovered from
+/// one instead of being read into a buffer; see SparseCheckpointFile::Recover().)
+class FileMapping {
+ public:
+  FileMapping()
+    : data_{ nullptr }
+    , size_{ 0 } {
+  }
+
+  ~FileMapping() {
+    Unmap();
+  }
+
+  FileMapping(const FileMapping& other) = delete;
+  FileMapping& operator=(const FileMapping& other) = delete;
+
+  /// With "populate" set, the OS reads the whole file in before Map() returns; otherwise, its
+  /// pages fault in as they are first touched.
+  core::Status Map(const std::string& filename, bool populate);
+  void Unmap();
+
+  const uint8_t* data() const {
+    return data_;
+  }
+  uint64_t size() const {
+    return size_;
+  }
+
+ private:
+  uint8_t* data_;
+  uint64_t size_;
+};
+
 class QueueFile;
 
 /// The QueueIoHandler class encapsulates completions for async file I/O, where the completions
@@ -112,6 +112,48 @@ DWORD File::GetCreateDisposition(FileCreateDisposition create_disposition) {
   }
 }
 
+Status FileMapping::Map(const std::string& filename, bool populate) {
+  Unmap();
+  HANDLE file_handle = ::CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                     OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if(file_handle == INVALID_HANDLE_VALUE) {
+    return Status::IOError;
+  }
+  LARGE_INTEGER file_size;
+  if(!::GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart == 0) {
+    ::CloseHandle(file_handle);
+    return Status::IOError;
+  }
+  HANDLE mapping_handle = ::CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0,
+                          nullptr);
+  ::CloseHandle(file_handle);
+  if(!mapping_handle) {
+    return Status::IOError;
+  }
+  void* data = ::MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+  // (The view keeps the mapping, and the file, open.)
+  ::CloseHandle(mapping_handle);
+  if(!data) {
+    return Status::IOError;
+  }
+  data_ = reinterpret_cast<uint8_t*>(data);
+  size_ = file_size.QuadPart;
+  if(populate) {
+    // Ask the OS to read the whole file in. (It's only a hint, and may be ignored.)
+    WIN32_MEMORY_RANGE_ENTRY range{ data_, static_cast<SIZE_T>(size_) };
+    ::PrefetchVirtualMemory(::GetCurrentProcess(), 1, &range, 0);
+  }
+  return Status::Ok;
+}
+
+void FileMapping::Unmap() {
+  if(data_) {
+    ::UnmapViewOfFile(data_);
+    data_ = nullptr;
+    size_ = 0;
+  }
+}
+
 void CALLBACK ThreadPoolIoHandler::IoCompletionCallback(PTP_CALLBACK_INSTANCE instance,
     PVOID context, PVOID overlapped, ULONG ioResult, ULONG_PTR bytesTransferred, PTP_IO io) {
   // context is always nullptr; state is threaded via the OVERLAPPED
@@ -1,10 +1,14 @@
 // Copyright (c) Microsoft Corporation. All rights reserved.
 // Licensed under the MIT license.
 
+#include <atomic>
+#include <experimental/filesystem>
 #include "gtest/gtest.h"
 
+#include "core/compaction_policy.h"
 #include "core/faster.h"
 
+#include "device/file_system_disk.h"
 #include "device/null_disk.h"
 
 #include "test_types.h"
@@ -208,6 +212,862 @@ TEST(Compact, HalfLive) {
   store.StopSession();
 }
 
+/// A value that carries an expiration time (see ValueExpiryTraits).
+class ExpiringValue {
+ public:
+  static constexpr bool kHasExpiration = true;
+
+  ExpiringValue()
+    : value{ 0 }
+    , expiration_{ 0 }
+  {}
+
+  inline static constexpr uint32_t size() {
+    return static_cast<uint32_t>(sizeof(ExpiringValue));
+  }
+  inline uint64_t expiration() const {
+    return expiration_;
+  }
+
+  uint64_t value;
+  uint64_t expiration_;
+};
+
+/// Upserts a value that expires at a given time (0 meaning never).
+class ExpiringUpsertContext : public IAsyncContext {
+ public:
+  typedef Key key_t;
+  typedef ExpiringValue value_t;
+
+  ExpiringUpsertContext(uint64_t key, uint64_t value, uint64_t expiration)
+    : key_{ key }
+    , value_{ value }
+    , expiration_{ expiration }
+  {}
+
+  /// Copy (and deep-copy) constructor.
+  ExpiringUpsertContext(const ExpiringUpsertContext& other)
+    : key_{ other.key_ }
+    , value_{ other.value_ }
+    , expiration_{ other.expiration_ }
+  {}
+
+  inline const Key& key() const {
+    return key_;
+  }
+  inline static constexpr uint32_t value_size() {
+    return sizeof(value_t);
+  }
+  inline void Put(value_t& value) {
+    value.value = value_;
+    value.expiration_ = expiration_;
+  }
+  inline bool PutAtomic(value_t& value) {
+    // (Not atomic; the test is single-threaded.)
+    Put(value);
+    return true;
+  }
+
+ protected:
+  Status DeepCopy_Internal(IAsyncContext*& context_copy) {
+    return IAsyncContext::DeepCopy_Internal(*this, context_copy);
+  }
+
+ private:
+  Key key_;
+  uint64_t value_;
+  uint64_t expiration_;
+};
+
+class ExpiringReadContext : public IAsyncContext {
+ public:
+  typedef Key key_t;
+  typedef ExpiringValue value_t;
+
+  ExpiringReadContext(uint64_t key)
+    : key_{ key }
+  {}
+
+  /// Copy (and deep-copy) constructor.
+  ExpiringReadContext(const ExpiringReadContext& other)
+    : key_{ other.key_ }
+  {}
+
+  inline const Key& key() const {
+    return key_;
+  }
+  inline void Get(const value_t& value) {
+    output = value.value;
+  }
+  inline void GetAtomic(const value_t& value) {
+    output = value.value;
+  }
+
+ protected:
+  Status DeepCopy_Internal(IAsyncContext*& context_copy) {
+    return IAsyncContext::DeepCopy_Internal(*this, context_copy);
+  }
+
+ private:
+  Key key_;
+ public:
+  uint64_t output;
+};
+
+/// Inserts records, a third of which have already expired, and a third of which expired after
+/// an older, unexpiring version was written. Expired records read as NotFound, both before and
+/// after compaction, and compaction (of either type) doesn't copy them (or their older versions)
+/// forward.
+TEST(Compact, Expired) {
+  for (CompactionType type : { CompactionType::Scan, CompactionType::Lookup }) {
+    typedef FasterKv<Key, ExpiringValue, FASTER::device::NullDisk> faster_t;
+
+    faster_t store { 128, 1073741824, "" };
+
+    store.StartSession();
+
+    auto callback = [](IAsyncContext* ctxt, Status result) {
+      ASSERT_TRUE(false);
+    };
+    uint64_t past = ValueExpiryTraits<ExpiringValue>::now() - 1000;
+    uint64_t future = ValueExpiryTraits<ExpiringValue>::now() + 3600 * 1000;
+
+    uint64_t numRecords = 300;
+    for (uint64_t idx = 0; idx < numRecords; ++idx) {
+      ExpiringUpsertContext context{ idx, idx, 0 };
+      ASSERT_EQ(Status::Ok, store.Upsert(context, callback, 1));
+    }
+    for (uint64_t idx = 0; idx < numRecords; ++idx) {
+      // idx % 3 == 0: never expires; 1: expired; 2: expires in an hour.
+      if (idx % 3 == 0) continue;
+      ExpiringUpsertContext context{ idx, idx + 1, idx % 3 == 1 ? past : future };
+      ASSERT_EQ(Status::Ok, store.Upsert(context, callback, 1));
+    }
+
+    auto check = [&]() {
+      for (uint64_t idx = 0; idx < numRecords; ++idx) {
+        ExpiringReadContext context{ idx };
+        Status result = store.Read(context, callback, 1);
+        if (idx % 3 == 1) {
+          ASSERT_EQ(Status::NotFound, result);
+        } else {
+          ASSERT_EQ(Status::Ok, result);
+          ASSERT_EQ(idx % 3 == 0 ? idx : idx + 1, context.output);
+        }
+      }
+    };
+    check();
+
+    // Make the records immutable, so compaction has to copy the live ones forward.
+    Address tail = store.hlog.ShiftReadOnlyToTail();
+    while (store.hlog.safe_read_only_address.load() < tail) {
+      store.Refresh();
+    }
+    store.Compact(tail.control(), CompactionKeepAll{}, type);
+    check();
+
+    // Only the 200 live records were copied forward.
+    uint64_t numCopied = 0;
+    ScanIterator<faster_t> iter(&store.hlog, Buffering::DOUBLE_PAGE, tail,
+                                store.hlog.GetTailAddress(), &store.disk);
+    while (iter.GetNext() != nullptr) ++numCopied;
+    ASSERT_EQ(200, numCopied);
+
+    store.StopSession();
+  }
+}
+
+/// Compacts (with either type of compaction) with a filter that drops a quarter of the records and
+/// rewrites the values of another quarter, and checks what survives.
+TEST(Compact, Filter) {
+  for (CompactionType type : { CompactionType::Scan, CompactionType::Lookup }) {
+    typedef FasterKv<Key, Value, FASTER::device::NullDisk> faster_t;
+
+    faster_t store { 128, 1073741824, "" };
+
+    store.StartSession();
+
+    auto callback = [](IAsyncContext* ctxt, Status result) {
+      ASSERT_TRUE(false);
+    };
+    uint64_t numRecords = 256;
+    for (uint64_t idx = 0; idx < numRecords; ++idx) {
+      UpsertContext context{ idx };
+      ASSERT_EQ(Status::Ok, store.Upsert(context, callback, 1));
+    }
+
+    // Make the records immutable, so compaction has to copy them forward.
+    Address tail = store.hlog.ShiftReadOnlyToTail();
+    while (store.hlog.safe_read_only_address.load() < tail) {
+      store.Refresh();
+    }
+
+    uint64_t numFiltered = 0;
+    auto filter = [&numFiltered](const Key& key, Value& value) {
+      ++numFiltered;
+      if (key.key % 4 == 1) {
+        return CompactionAction::Drop;
+      } else if (key.key % 4 == 2) {
+        value.value *= 10;
+      }
+      return CompactionAction::Keep;
+    };
+    store.Compact(tail.control(), filter, type);
+    ASSERT_EQ(numRecords, numFiltered);
+
+    // Truncate the compacted range; dropped keys are gone.
+    static std::atomic<bool> complete;
+    complete = false;
+    auto truncate_callback = [](uint64_t offset) {};
+    auto complete_callback = []() {
+      complete = true;
+    };
+    ASSERT_TRUE(store.ShiftBeginAddress(tail, truncate_callback, complete_callback));
+    while (!complete) {
+      store.CompletePending(false);
+    }
+
+    for (uint64_t idx = 0; idx < numRecords; ++idx) {
+      ReadContext context{ idx };
+      Status result = store.Read(context, callback, 1);
+      if (idx % 4 == 1) {
+        ASSERT_EQ(Status::NotFound, result);
+      } else {
+        ASSERT_EQ(Status::Ok, result);
+        ASSERT_EQ(idx % 4 == 2 ? idx * 10 : idx, context.output);
+      }
+    }
+
+    store.StopSession();
+  }
+}
+
+/// A 4 KB value, so that a hundred thousand records spill the log to disk.
+class LargeValue {
+ public:
+  LargeValue()
+    : value{ 0 }
+  {}
+
+  inline static constexpr uint32_t size() {
+    return static_cast<uint32_t>(sizeof(LargeValue));
+  }
+
+  uint64_t value;
+  uint8_t padding[4088];
+};
+
+class LargeUpsertContext : public IAsyncContext {
+ public:
+  typedef Key key_t;
+  typedef LargeValue value_t;
+
+  LargeUpsertContext(uint64_t key, uint64_t value)
+    : key_{ key }
+    , value_{ value }
+  {}
+
+  /// Copy (and deep-copy) constructor.
+  LargeUpsertContext(const LargeUpsertContext& other)
+    : key_{ other.key_ }
+    , value_{ other.value_ }
+  {}
+
+  inline const Key& key() const {
+    return key_;
+  }
+  inline static constexpr uint32_t value_size() {
+    return sizeof(value_t);
+  }
+  inline void Put(value_t& value) {
+    value.value = value_;
+  }
+  inline bool PutAtomic(value_t& value) {
+    // (Not atomic; the test is single-threaded.)
+    value.value = value_;
+    return true;
+  }
+
+ protected:
+  Status DeepCopy_Internal(IAsyncContext*& context_copy) {
+    return IAsyncContext::DeepCopy_Internal(*this, context_copy);
+  }
+
+ private:
+  Key key_;
+  uint64_t value_;
+};
+
+class LargeReadContext : public IAsyncContext {
+ public:
+  typedef Key key_t;
+  typedef LargeValue value_t;
+
+  LargeReadContext(uint64_t key)
+    : key_{ key }
+    , output{ 0 }
+  {}
+
+  /// Copy (and deep-copy) constructor.
+  LargeReadContext(const LargeReadContext& other)
+    : key_{ other.key_ }
+    , output{ other.output }
+  {}
+
+  inline const Key& key() const {
+    return key_;
+  }
+  inline void Get(const value_t& value) {
+    output = value.value;
+  }
+  inline void GetAtomic(const value_t& value) {
+    output = value.value;
+  }
+
+ protected:
+  Status DeepCopy_Internal(IAsyncContext*& context_copy) {
+    return IAsyncContext::DeepCopy_Internal(*this, context_copy);
+  }
+
+ private:
+  Key key_;
+ public:
+  uint64_t output;
+};
+
+class LargeDeleteContext : public IAsyncContext {
+ public:
+  typedef Key key_t;
+  typedef LargeValue value_t;
+
+  explicit LargeDeleteContext(uint64_t key)
+    : key_{ key }
+  {}
+
+  inline const Key& key() const {
+    return key_;
+  }
+  inline static constexpr uint32_t value_size() {
+    return LargeValue::size();
+  }
+
+ protected:
+  Status DeepCopy_Internal(IAsyncContext*& context_copy) {
+    return IAsyncContext::DeepCopy_Internal(*this, context_copy);
+  }
+
+ private:
+  Key key_;
+};
+
+class LargeRmwContext : public IAsyncContext {
+ public:
+  typedef Key key_t;
+  typedef LargeValue value_t;
+
+  LargeRmwContext(uint64_t key, uint64_t incr)
+    : key_{ key }
+    , incr_{ incr }
+  {}
+
+  /// Copy (and deep-copy) constructor.
+  LargeRmwContext(const LargeRmwContext& other)
+    : key_{ other.key_ }
+    , incr_{ other.incr_ }
+  {}
+
+  inline const Key& key() const {
+    return key_;
+  }
+  inline static constexpr uint32_t value_size() {
+    return sizeof(value_t);
+  }
+  inline static constexpr uint32_t value_size(const value_t& old_value) {
+    return sizeof(value_t);
+  }
+  inline void RmwInitial(value_t& value) {
+    value.value = incr_;
+  }
+  inline void RmwCopy(const value_t& old_value, value_t& value) {
+    value.value = old_value.value + incr_;
+  }
+  inline bool RmwAtomic(value_t& value) {
+    // (Not atomic; the test is single-threaded.)
+    value.value += incr_;
+    return true;
+  }
+
+ protected:
+  Status DeepCopy_Internal(IAsyncContext*& context_copy) {
+    return IAsyncContext::DeepCopy_Internal(*this, context_copy);
+  }
+
+ private:
+  Key key_;
+  uint64_t incr_;
+};
+
+/// Lookup compaction, on "num_threads" threads, of a range that is on disk, and whose keys have
+/// been overwritten and deleted since (partly on disk, too): only the records that are still the
+/// latest for their keys get copied forward, and every key reads the same after the range is
+/// truncated.
+void CompactOnDisk(uint32_t num_threads) {
+  typedef FASTER::device::FileSystemDisk<FASTER::environment::QueueIoHandler, 1073741824L>
+    disk_t;
+  typedef FasterKv<Key, LargeValue, disk_t> faster_t;
+
+  std::experimental::filesystem::remove_all("logs");
+  std::experimental::filesystem::create_directories("logs");
+  {
+    // 8 pages of 32 MB in memory.
+    faster_t store{ 1 << 17, 268435456, "logs", 0.5 };
+    store.StartSession();
+
+    auto callback = [](IAsyncContext* ctxt, Status result) {
+      // Upserts and deletes don't go to disk.
+      ASSERT_TRUE(false);
+    };
+    constexpr uint64_t kNumRecords = 120000;
+    for (uint64_t idx = 0; idx < kNumRecords; ++idx) {
+      if (idx % 256 == 0) store.Refresh();
+      LargeUpsertContext context{ idx, idx };
+      ASSERT_EQ(Status::Ok, store.Upsert(context, callback, 1));
+    }
+    Address until = store.hlog.GetTailAddress();
+
+    // idx % 3 == 0: overwritten; 1: deleted; 2: untouched, so live in the compacted range.
+    for (uint64_t idx = 0; idx < kNumRecords; ++idx) {
+      if (idx % 256 == 0) store.Refresh();
+      if (idx % 3 == 0) {
+        LargeUpsertContext context{ idx, idx + 1 };
+        ASSERT_EQ(Status::Ok, store.Upsert(context, callback, 1));
+      } else if (idx % 3 == 1) {
+        LargeDeleteContext context{ idx };
+        ASSERT_EQ(Status::Ok, store.Delete(context, callback, 1));
+      }
+    }
+    // The compacted range is on disk, and so is part of what overwrote it.
+    ASSERT_LT(until, store.hlog.head_address.load());
+    ASSERT_LE(until, store.hlog.safe_read_only_address.load());
+
+    // A third of the range is live; sampling it reads from disk.
+    ASSERT_NEAR(1.0 / 3, store.EstimateLiveFraction(until.control(), 8), 0.1);
+
+    Address tail = store.hlog.GetTailAddress();
+    CompactionProgress progress;
+    ASSERT_TRUE(store.Compact(until.control(), CompactionKeepAll{}, CompactionType::Lookup,
+                              num_threads, &progress));
+    ASSERT_EQ(progress.pages_total.load(), progress.pages_done.load());
+    ASSERT_EQ(kNumRecords, progress.records_scanned.load());
+
+    // Only the live third was copied forward.
+    uint64_t numCopied = 0;
+    {
+      ScanIterator<faster_t> iter(&store.hlog, Buffering::DOUBLE_PAGE, tail,
+                                  store.hlog.GetTailAddress(), &store.disk);
+      while (iter.GetNext() != nullptr) ++numCopied;
+    }
+    ASSERT_EQ(kNumRecords / 3, numCopied);
+
+    static std::atomic<bool> complete;
+    complete = false;
+    auto truncate_callback = [](uint64_t offset) {};
+    auto complete_callback = []() {
+      complete = true;
+    };
+    ASSERT_TRUE(store.ShiftBeginAddress(until, truncate_callback, complete_callback));
+    while (!complete) {
+      store.CompletePending(false);
+    }
+
+    static std::atomic<uint64_t> numRead;
+    numRead = 0;
+    auto read_callback = [](IAsyncContext* ctxt, Status result) {
+      CallbackContext<LargeReadContext> context{ ctxt };
+      uint64_t idx = context->key().key;
+      if (idx % 3 == 1) {
+        ASSERT_EQ(Status::NotFound, result);
+      } else {
+        ASSERT_EQ(Status::Ok, result);
+        ASSERT_EQ(idx % 3 == 0 ? idx + 1 : idx, context->output);
+      }
+      ++numRead;
+    };
+    for (uint64_t idx = 0; idx < kNumRecords; ++idx) {
+      if (idx % 256 == 0) store.Refresh();
+      LargeReadContext context{ idx };
+      Status result = store.Read(context, read_callback, 1);
+      if (result != Status::Pending) {
+        read_callback(&context, result);
+      }
+    }
+    ASSERT_TRUE(store.CompletePending(true));
+    ASSERT_EQ(kNumRecords, numRead.load());
+
+    store.StopSession();
+  }
+  std::experimental::filesystem::remove_all("logs");
+}
+
+TEST(Compact, LookupOnDisk) {
+  CompactOnDisk(1);
+}
+
+TEST(Compact, LookupOnDiskConcurrent) {
+  CompactOnDisk(4);
+}
+
+/// Cancels a lookup compaction from its filter: Compact() stops right away, and reports that it
+/// didn't finish.
+TEST(Compact, Cancel) {
+  typedef FasterKv<Key, Value, FASTER::device::NullDisk> faster_t;
+
+  faster_t store { 128, 1073741824, "" };
+
+  store.StartSession();
+
+  auto callback = [](IAsyncContext* ctxt, Status result) {
+    ASSERT_TRUE(false);
+  };
+  uint64_t numRecords = 256;
+  for (uint64_t idx = 0; idx < numRecords; ++idx) {
+    UpsertContext context{ idx };
+    ASSERT_EQ(Status::Ok, store.Upsert(context, callback, 1));
+  }
+
+  Address tail = store.hlog.ShiftReadOnlyToTail();
+  while (store.hlog.safe_read_only_address.load() < tail) {
+    store.Refresh();
+  }
+
+  CompactionProgress progress;
+  uint64_t numFiltered = 0;
+  auto filter = [&numFiltered, &progress](const Key& key, Value& value) {
+    if (++numFiltered == 10) {
+      progress.Cancel();
+    }
+    return CompactionAction::Keep;
+  };
+  ASSERT_FALSE(store.Compact(tail.control(), filter, CompactionType::Lookup, 1, &progress));
+  ASSERT_EQ(10, numFiltered);
+  ASSERT_EQ(10, progress.records_scanned.load());
+  ASSERT_EQ(0, progress.pages_done.load());
+
+  // The records that were copied before the cancellation are still readable, as are the others.
+  for (uint64_t idx = 0; idx < numRecords; ++idx) {
+    ReadContext context{ idx };
+    ASSERT_EQ(Status::Ok, store.Read(context, callback, 1));
+    ASSERT_EQ(idx, context.output);
+  }
+
+  store.StopSession();
+}
+
+/// Starts a multi-threaded lookup compaction while the index is growing: compaction's threads can
+/// start their sessions only once the growth is done, so Compact() has to see it through first.
+TEST(Compact, DuringIndexGrowth) {
+  typedef FasterKv<Key, Value, FASTER::device::NullDisk> faster_t;
+
+  faster_t store { 128, 1073741824, "" };
+
+  store.StartSession();
+
+  auto callback = [](IAsyncContext* ctxt, Status result) {
+    ASSERT_TRUE(false);
+  };
+  uint64_t numRecords = 256;
+  for (uint64_t idx = 0; idx < numRecords; ++idx) {
+    UpsertContext context{ idx };
+    ASSERT_EQ(Status::Ok, store.Upsert(context, callback, 1));
+  }
+
+  Address tail = store.hlog.ShiftReadOnlyToTail();
+  while (store.hlog.safe_read_only_address.load() < tail) {
+    store.Refresh();
+  }
+
+  static std::atomic<bool> grow_done;
+  grow_done = false;
+  ASSERT_TRUE(store.GrowIndex([](uint64_t new_size) {
+    grow_done = true;
+  }));
+  CompactionProgress progress;
+  ASSERT_TRUE(store.Compact(tail.control(), CompactionKeepAll{}, CompactionType::Lookup, 4,
+                            &progress));
+  ASSERT_TRUE(grow_done.load());
+  ASSERT_EQ(numRecords, progress.records_scanned.load());
+
+  for (uint64_t idx = 0; idx < numRecords; ++idx) {
+    ReadContext context{ idx };
+    ASSERT_EQ(Status::Ok, store.Read(context, callback, 1));
+    ASSERT_EQ(idx, context.output);
+  }
+
+  store.StopSession();
+}
+
+/// The automatic compaction policy samples the log's garbage ratio, and compacts and truncates
+/// the log only once a threshold (on the garbage ratio, or on the log's size) is crossed.
+TEST(Compact, AutoCompaction) {
+  typedef FasterKv<Key, Value, FASTER::device::NullDisk> faster_t;
+
+  faster_t store { 128, 1073741824, "" };
+
+  store.StartSession();
+
+  auto callback = [](IAsyncContext* ctxt, Status result) {
+    ASSERT_TRUE(false);
+  };
+  // Writes every key "times" times, each time to a new record (the previous ones are made
+  // read-only, so they can't be updated in place), and makes the whole log compactable.
+  constexpr uint64_t kNumRecords = 256;
+  auto shift_read_only = [&]() {
+    Address tail = store.hlog.ShiftReadOnlyToTail();
+    while (store.hlog.safe_read_only_address.load() < tail) {
+      store.Refresh();
+    }
+  };
+  auto write = [&](uint32_t times) {
+    for (uint32_t time = 0; time < times; ++time) {
+      shift_read_only();
+      for (uint64_t idx = 0; idx < kNumRecords; ++idx) {
+        UpsertContext context{ idx };
+        ASSERT_EQ(Status::Ok, store.Upsert(context, callback, 1));
+      }
+    }
+    shift_read_only();
+  };
+  auto check = [&]() {
+    uint64_t numRecords = 0;
+    ScanIterator<faster_t> iter(&store.hlog, Buffering::UN_BUFFERED,
+                                store.hlog.begin_address.load(),
+                                store.hlog.GetTailAddress(), &store.disk);
+    while (iter.GetNext() != nullptr) ++numRecords;
+    ASSERT_EQ(kNumRecords, numRecords);
+    for (uint64_t idx = 0; idx < kNumRecords; ++idx) {
+      ReadContext context{ idx };
+      ASSERT_EQ(Status::Ok, store.Read(context, callback, 1));
+      ASSERT_EQ(idx, context.output);
+    }
+  };
+
+  // The whole log fits in one sample: 3 in 4 records are garbage.
+  write(4);
+  Address begin = store.hlog.begin_address.load();
+  Address tail = store.hlog.GetTailAddress();
+  AutoCompactionConfig config;
+  config.max_garbage_ratio = 0.9;
+  {
+    AutoCompaction<faster_t> policy{ store, config };
+    ASSERT_FALSE(policy.RunOnce());
+    ASSERT_EQ(0.75, policy.garbage_ratio());
+    ASSERT_NEAR(4.0, policy.space_amplification(), 0.01);
+    ASSERT_EQ(begin, store.hlog.begin_address.load());
+  }
+  config.max_garbage_ratio = 0.5;
+  {
+    AutoCompaction<faster_t> policy{ store, config };
+    ASSERT_TRUE(policy.RunOnce());
+    ASSERT_EQ(1, policy.compactions());
+    ASSERT_EQ(tail.control() - begin.control(), policy.bytes_compacted());
+    ASSERT_EQ(tail, store.hlog.begin_address.load());
+    check();
+
+    // The copies are still mutable, so there is nothing left to compact.
+    ASSERT_FALSE(policy.RunOnce());
+  }
+
+  // Half the log is garbage: not enough for the garbage ratio, but the log is over budget.
+  write(1);
+  config.max_garbage_ratio = 0.9;
+  config.log_size_budget = 1;
+  {
+    AutoCompaction<faster_t> policy{ store, config };
+    ASSERT_TRUE(policy.RunOnce());
+    check();
+  }
+
+  // On a background thread, rate-limited.
+  write(2);
+  config.log_size_budget = 0;
+  config.max_garbage_ratio = 0.5;
+  config.max_bytes_per_second = 1 << 20;
+  config.check_interval = std::chrono::milliseconds{ 1 };
+  {
+    AutoCompaction<faster_t> policy{ store, config };
+    policy.Start();
+    while (policy.compactions() == 0) {
+      store.Refresh();
+      std::this_thread::yield();
+    }
+    policy.Stop();
+    check();
+  }
+
+  store.StopSession();
+}
+
+/// Generational compaction moves the live records into the cold log, rather than to the tail;
+/// once the hybrid log is truncated, reads, RMWs and deletes find the keys there. A second round
+/// moves the newer versions (and the tombstones) to the cold log too, and the cold log's part of
+/// the index is rebuilt on recovery.
+TEST(Compact, ColdLog) {
+  typedef FASTER::device::FileSystemDisk<FASTER::environment::QueueIoHandler, 1073741824L>
+    disk_t;
+  typedef FasterKv<Key, LargeValue, disk_t> faster_t;
+
+  std::experimental::filesystem::remove_all("logs");
+  std::experimental::filesystem::create_directories("logs");
+
+  constexpr uint64_t kNumRecords = 4000;
+  static auto read_callback = [](IAsyncContext* ctxt, Status result) {
+    CallbackContext<LargeReadContext> context{ ctxt };
+    ASSERT_EQ(Status::Ok, result);
+    ASSERT_EQ(context->key().key, context->output);
+  };
+  // idx % 4 == 0: overwritten; 1: deleted; 2: incremented by an RMW; 3: untouched.
+  static auto updated_read_callback = [](IAsyncContext* ctxt, Status result) {
+    CallbackContext<LargeReadContext> context{ ctxt };
+    uint64_t idx = context->key().key;
+    if (idx % 4 == 1) {
+      ASSERT_EQ(Status::NotFound, result);
+    } else {
+      ASSERT_EQ(Status::Ok, result);
+      ASSERT_EQ(idx % 4 == 0 ? idx + 1 : idx % 4 == 2 ? idx + 10 : idx, context->output);
+    }
+  };
+  auto read_all = [](faster_t& store, AsyncCallback callback) {
+    for (uint64_t idx = 0; idx < kNumRecords; ++idx) {
+      if (idx % 256 == 0) store.Refresh();
+      LargeReadContext context{ idx };
+      Status result = store.Read(context, callback, 1);
+      if (result != Status::Pending) {
+        callback(&context, result);
+      }
+    }
+    ASSERT_TRUE(store.CompletePending(true));
+  };
+  auto compact_and_truncate = [](faster_t& store) {
+    Address until = store.hlog.ShiftReadOnlyToTail();
+    while (store.hlog.safe_read_only_address.load() < until) {
+      store.Refresh();
+    }
+    uint64_t cold_size = store.ColdLogSize();
+    Address tail = store.hlog.GetTailAddress();
+    ASSERT_TRUE(store.Compact(until.control()));
+    // Nothing was copied to the tail.
+    ASSERT_LT(cold_size, store.ColdLogSize());
+    ASSERT_EQ(tail, store.hlog.GetTailAddress());
+
+    static std::atomic<bool> complete;
+    complete = false;
+    auto truncate_callback = [](uint64_t offset) {};
+    auto complete_callback = []() {
+      complete = true;
+    };
+    ASSERT_TRUE(store.ShiftBeginAddress(until, truncate_callback, complete_callback));
+    while (!complete) {
+      store.CompletePending(false);
+    }
+  };
+
+  Guid token;
+  uint64_t cold_log_size;
+  {
+    faster_t store{ 1 << 14, 268435456, "logs", 0.5, false, true };
+    store.StartSession();
+
+    auto callback = [](IAsyncContext* ctxt, Status result) {
+      ASSERT_TRUE(false);
+    };
+    for (uint64_t idx = 0; idx < kNumRecords; ++idx) {
+      LargeUpsertContext context{ idx, idx };
+      ASSERT_EQ(Status::Ok, store.Upsert(context, callback, 1));
+    }
+    compact_and_truncate(store);
+    // Every read goes to the cold log.
+    read_all(store, read_callback);
+
+    static auto rmw_callback = [](IAsyncContext* ctxt, Status result) {
+      ASSERT_EQ(Status::Ok, result);
+    };
+    for (uint64_t idx = 0; idx < kNumRecords; ++idx) {
+      if (idx % 256 == 0) store.Refresh();
+      if (idx % 4 == 0) {
+        LargeUpsertContext context{ idx, idx + 1 };
+        ASSERT_EQ(Status::Ok, store.Upsert(context, callback, 1));
+      } else if (idx % 4 == 1) {
+        LargeDeleteContext context{ idx };
+        ASSERT_EQ(Status::Ok, store.Delete(context, callback, 1));
+      } else if (idx % 4 == 2) {
+        // Reads the old value from the cold log.
+        LargeRmwContext context{ idx, 10 };
+        ASSERT_EQ(Status::Pending, store.Rmw(context, rmw_callback, 1));
+      }
+    }
+    ASSERT_TRUE(store.CompletePending(true));
+    read_all(store, updated_read_callback);
+
+    compact_and_truncate(store);
+    read_all(store, updated_read_callback);
+
+    // Growing the index splits the cold log's entries by their records' keys.
+    static std::atomic<bool> grow_done;
+    grow_done = false;
+    ASSERT_TRUE(store.GrowIndex([](uint64_t new_size) {
+      grow_done = true;
+    }));
+    while (!grow_done) {
+      store.CompletePending(false);
+    }
+    read_all(store, updated_read_callback);
+
+    // Of the cold log's 7000 records, only the latest versions of the 3000 keys that weren't
+    // deleted are live; compacting the cold log moves them to its tail, and the rest goes.
+    Address cold_until = store.ColdLogTailAddress();
+    uint64_t cold_size = store.ColdLogSize();
+    ASSERT_TRUE(store.CompactColdLog(cold_until.control()));
+    static std::atomic<bool> cold_complete;
+    cold_complete = false;
+    auto truncate_callback = [](uint64_t offset) {};
+    auto complete_callback = []() {
+      cold_complete = true;
+    };
+    ASSERT_TRUE(store.ShiftColdLogBeginAddress(cold_until, truncate_callback, complete_callback));
+    while (!cold_complete) {
+      store.CompletePending(false);
+    }
+    ASSERT_LT(store.ColdLogSize(), cold_size / 2);
+    read_all(store, updated_read_callback);
+
+    static std::atomic<bool> persisted;
+    persisted = false;
+    auto persistence_callback = [](Status result, uint64_t persistent_serial_num) {
+      ASSERT_EQ(Status::Ok, result);
+      persisted = true;
+    };
+    cold_log_size = store.ColdLogSize();
+    ASSERT_TRUE(store.Checkpoint(nullptr, persistence_callback, token));
+    while (!persisted) {
+      store.CompletePending(false);
+    }
+    store.StopSession();
+  }
+
+  faster_t new_store{ 1 << 14, 268435456, "logs", 0.5, false, true };
+  uint32_t version;
+  std::vector<Guid> session_ids;
+  ASSERT_EQ(Status::Ok, new_store.Recover(token, token, version, session_ids));
+  // (The cold log stays truncated.)
+  ASSERT_EQ(cold_log_size, new_store.ColdLogSize());
+  ASSERT_EQ(1, session_ids.size());
+  new_store.ContinueSession(session_ids[0]);
+  read_all(new_store, updated_read_callback);
+  new_store.StopSession();
+
+  std::experimental::filesystem::remove_all("logs");
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -0,0 +1,484 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include <atomic>
+#include <cstdint>
+#include <experimental/filesystem>
+#include <thread>
+#include <type_traits>
+#include "gtest/gtest.h"
+
+#include "core/faster.h"
+#include "device/file_system_disk.h"
+#include "device/null_disk.h"
+
+#include "test_types.h"
+
+using namespace FASTER::core;
+using FASTER::test::SimpleAtomicValue;
+
+/// 8-byte key that counts how often it's compared against a record's key--i.e., how many records
+/// a lookup had to fetch from the log.
+class CountingKey {
+ public:
+  CountingKey(uint64_t key)
+    : key_{ key } {
+  }
+
+  inline static constexpr uint32_t size() {
+    return static_cast<uint32_t>(sizeof(CountingKey));
+  }
+  inline KeyHash GetHash() const {
+    // (MurmurHash3's 64-bit finalizer, so that every hash bit depends on every key bit.)
+    uint64_t hash = key_;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return KeyHash{ hash };
+  }
+
+  inline bool operator==(const CountingKey& other) const {
+    ++num_compares;
+    return key_ == other.key_;
+  }
+  inline bool operator!=(const CountingKey& other) const {
+    ++num_compares;
+    return key_ != other.key_;
+  }
+
+  static uint64_t num_compares;
+
+ private:
+  uint64_t key_;
+};
+uint64_t CountingKey::num_compares = 0;
+
+using Key = CountingKey;
+using Value = SimpleAtomicValue<uint64_t>;
+
+class UpsertContext : public IAsyncContext {
+ public:
+  typedef Key key_t;
+  typedef Value value_t;
+
+  UpsertContext(uint64_t key)
+    : key_{ key } {
+  }
+
+  /// Copy (and deep-copy) constructor.
+  UpsertContext(const UpsertContext& other)
+    : key_{ other.key_ } {
+  }
+
+  /// The implicit and explicit interfaces require a key() accessor.
+  inline const Key& key() const {
+    return key_;
+  }
+  inline static constexpr uint32_t value_size() {
+    return sizeof(value_t);
+  }
+  /// Non-atomic and atomic Put() methods.
+  inline void Put(Value& value) {
+    value.value = ~key_.GetHash().idx(1ull << 47);
+  }
+  inline bool PutAtomic(Value& value) {
+    value.atomic_value.store(~key_.GetHash().idx(1ull << 47));
+    return true;
+  }
+
+ protected:
+  /// The explicit interface requires a DeepCopy_Internal() implementation.
+  Status DeepCopy_Internal(IAsyncContext*& context_copy) {
+    return IAsyncContext::DeepCopy_Internal(*this, context_copy);
+  }
+
+ private:
+  Key key_;
+};
+
+class ReadContext : public IAsyncContext {
+ public:
+  typedef Key key_t;
+  typedef Value value_t;
+
+  ReadContext(uint64_t key)
+    : key_{ key }
+    , output{ 0 } {
+  }
+
+  /// Copy (and deep-copy) constructor.
+  ReadContext(const ReadContext& other)
+    : key_{ other.key_ }
+    , output{ other.output } {
+  }
+
+  /// The implicit and explicit interfaces require a key() accessor.
+  inline const Key& key() const {
+    return key_;
+  }
+
+  inline void Get(const Value& value) {
+    output = value.value;
+  }
+  inline void GetAtomic(const Value& value) {
+    output = value.atomic_value.load();
+  }
+
+ protected:
+  /// The explicit interface requires a DeepCopy_Internal() implementation.
+  Status DeepCopy_Internal(IAsyncContext*& context_copy) {
+    return IAsyncContext::DeepCopy_Internal(*this, context_copy);
+  }
+
+ private:
+  Key key_;
+ public:
+  uint64_t output;
+};
+
+template <class B>
+using store_t = FasterKv<Key, Value, FASTER::device::NullDisk, B>;
+
+template <class B>
+void Load(store_t<B>& store, uint64_t num_keys) {
+  auto callback = [](IAsyncContext* ctxt, Status result) {
+    // In-memory test.
+    ASSERT_TRUE(false);
+  };
+  for(uint64_t idx = 0; idx < num_keys; ++idx) {
+    UpsertContext context{ idx };
+    Status result = store.Upsert(context, callback, 1);
+    ASSERT_EQ(Status::Ok, result);
+  }
+}
+
+/// Reads keys [begin, end), and returns the number of keys found.
+template <class B>
+uint64_t ReadAll(store_t<B>& store, uint64_t begin, uint64_t end) {
+  auto callback = [](IAsyncContext* ctxt, Status result) {
+    // In-memory test.
+    ASSERT_TRUE(false);
+  };
+  uint64_t num_found = 0;
+  for(uint64_t idx = begin; idx < end; ++idx) {
+    ReadContext context{ idx };
+    Status result = store.Read(context, callback, 1);
+    if(result == Status::Ok) {
+      EXPECT_EQ(~Key{ idx }.GetHash().idx(1ull << 47), context.output);
+      ++num_found;
+    } else {
+      EXPECT_EQ(Status::NotFound, result);
+    }
+  }
+  return num_found;
+}
+
+/// Upsert and read back many more keys than the table has buckets (so buckets overflow and tags
+/// collide), then grow the index and read them again.
+template <class B>
+void UpsertReadGrow() {
+  static constexpr uint64_t kNumKeys = 65536;
+  static std::atomic<bool> grow_done;
+
+  store_t<B> store{ 256, 1073741824, "" };
+  store.StartSession();
+
+  Load(store, kNumKeys);
+  ASSERT_EQ(kNumKeys, ReadAll(store, 0, kNumKeys));
+  ASSERT_EQ(0, ReadAll(store, kNumKeys, 2 * kNumKeys));
+
+  grow_done = false;
+  store.GrowIndex([](uint64_t new_size) {
+    grow_done = true;
+  });
+  while(!grow_done) {
+    store.Refresh();
+    std::this_thread::yield();
+  }
+
+  ASSERT_EQ(kNumKeys, ReadAll(store, 0, kNumKeys));
+  ASSERT_EQ(0, ReadAll(store, kNumKeys, 2 * kNumKeys));
+
+  store.StopSession();
+}
+
+/// Returns the number of record keys compared while looking up absent keys.
+template <class B>
+uint64_t AbsentKeyCompares(uint64_t table_size, uint64_t num_keys) {
+  store_t<B> store{ table_size, 1073741824, "" };
+  store.StartSession();
+  Load(store, num_keys);
+  CountingKey::num_compares = 0;
+  EXPECT_EQ(0, ReadAll(store, num_keys, 2 * num_keys));
+  uint64_t result = CountingKey::num_compares;
+  store.StopSession();
+  return result;
+}
+
+TEST(HashBucket, Layout) {
+  ASSERT_EQ(Constants::kCacheLineBytes, sizeof(HashBucket));
+  ASSERT_EQ(7, HashBucket::kNumEntries);
+
+  ASSERT_EQ(2 * Constants::kCacheLineBytes, sizeof(FingerprintHashBucket<uint8_t>));
+  ASSERT_EQ(13, FingerprintHashBucket<uint8_t>::kNumEntries);
+  ASSERT_EQ(2 * Constants::kCacheLineBytes, sizeof(FingerprintHashBucket<uint16_t>));
+  ASSERT_EQ(12, FingerprintHashBucket<uint16_t>::kNumEntries);
+
+  // Fingerprints come from the hash bits just below the tag.
+  KeyHash hash{ 0x3FFF000000000000ull | (0xABCDull << 32) };
+  ASSERT_EQ(0xAB, FingerprintHashBucket<uint8_t>::Fingerprint(hash, 0));
+  ASSERT_EQ(0xABCD, FingerprintHashBucket<uint16_t>::Fingerprint(hash, 0));
+  ASSERT_EQ(0, HashBucket::Fingerprint(hash, 0));
+
+  ASSERT_EQ(2 * Constants::kCacheLineBytes, sizeof(InlineKeyHashBucket));
+  ASSERT_EQ(7, InlineKeyHashBucket::kNumEntries);
+  ASSERT_EQ(12345, InlineKeyHashBucket::Fingerprint(hash, 12345));
+}
+
+TEST(HashBucket, UpsertRead_HashBucket) {
+  UpsertReadGrow<HashBucket>();
+}
+
+TEST(HashBucket, UpsertRead_Fingerprint8) {
+  UpsertReadGrow<FingerprintHashBucket<uint8_t>>();
+}
+
+TEST(HashBucket, UpsertRead_Fingerprint16) {
+  UpsertReadGrow<FingerprintHashBucket<uint16_t>>();
+}
+
+TEST(HashBucket, FewerFalsePositives) {
+  // 256 keys per bucket: with only the 14-bit tag, about 1.5% of absent-key lookups fetch a
+  // record just to find that its key differs.
+  static constexpr uint64_t kTableSize = 256;
+  static constexpr uint64_t kNumKeys = 65536;
+  uint64_t compares = AbsentKeyCompares<HashBucket>(kTableSize, kNumKeys);
+  uint64_t compares8 = AbsentKeyCompares<FingerprintHashBucket<uint8_t>>(kTableSize, kNumKeys);
+  uint64_t compares16 = AbsentKeyCompares<FingerprintHashBucket<uint16_t>>(kTableSize, kNumKeys);
+  ASSERT_GT(compares, 0);
+  ASSERT_LT(compares8, compares);
+  ASSERT_LE(compares16, compares8);
+}
+
+/// 8-byte key that opts in to storing the whole key in the index. Its hash leaves the tag 0, so
+/// all keys in a bucket collide on their tags.
+class InlineKey {
+ public:
+  static constexpr bool kInlineKey = true;
+  static constexpr uint64_t kNumBuckets = 1024;
+
+  InlineKey(uint64_t key)
+    : key_{ key } {
+  }
+
+  inline static constexpr uint32_t size() {
+    return static_cast<uint32_t>(sizeof(InlineKey));
+  }
+  inline KeyHash GetHash() const {
+    return KeyHash{ key_ % kNumBuckets };
+  }
+  inline uint64_t inline_key() const {
+    return key_;
+  }
+
+  inline bool operator==(const InlineKey& other) const {
+    ++num_compares;
+    return key_ == other.key_;
+  }
+  inline bool operator!=(const InlineKey& other) const {
+    ++num_compares;
+    return key_ != other.key_;
+  }
+
+  static uint64_t num_compares;
+
+ private:
+  uint64_t key_;
+};
+uint64_t InlineKey::num_compares = 0;
+
+TEST(HashBucket, InlineKey_Traits) {
+  static_assert(std::is_same<KeyIndexTraits<InlineKey>::hash_bucket_t,
+                InlineKeyHashBucket>::value, "InlineKey should select InlineKeyHashBucket");
+  static_assert(std::is_same<KeyIndexTraits<CountingKey>::hash_bucket_t, HashBucket>::value,
+                "CountingKey should select HashBucket");
+  static_assert(std::is_same<FasterKv<InlineKey, Value,
+                FASTER::device::NullDisk>::hash_bucket_t, InlineKeyHashBucket>::value,
+                "FasterKv<InlineKey> should use InlineKeyHashBucket");
+  ASSERT_EQ(17, KeyIndexTraits<InlineKey>::inline_key(InlineKey{ 17 }));
+  ASSERT_EQ(0, KeyIndexTraits<CountingKey>::inline_key(CountingKey{ 17 }));
+}
+
+TEST(HashBucket, InlineKey_NoDiskIoForAbsentKeys) {
+  /// Record size is ~1 KB, so most records end up on disk.
+  class LargeValue {
+   public:
+    LargeValue()
+      : value{ 0 } {
+    }
+
+    inline static constexpr uint32_t size() {
+      return static_cast<uint32_t>(sizeof(LargeValue));
+    }
+
+    union {
+      uint64_t value;
+      std::atomic<uint64_t> atomic_value;
+    };
+    uint8_t padding[1016];
+  };
+
+  class InlineUpsertContext : public IAsyncContext {
+   public:
+    typedef InlineKey key_t;
+    typedef LargeValue value_t;
+
+    InlineUpsertContext(uint64_t key)
+      : key_{ key } {
+    }
+
+    /// Copy (and deep-copy) constructor.
+    InlineUpsertContext(const InlineUpsertContext& other)
+      : key_{ other.key_ } {
+    }
+
+    /// The implicit and explicit interfaces require a key() accessor.
+    inline const InlineKey& key() const {
+      return key_;
+    }
+    inline static constexpr uint32_t value_size() {
+      return sizeof(value_t);
+    }
+    /// Non-atomic and atomic Put() methods.
+    inline void Put(LargeValue& value) {
+      value.value = key_.inline_key() + 1;
+    }
+    inline bool PutAtomic(LargeValue& value) {
+      value.atomic_value.store(key_.inline_key() + 1);
+      return true;
+    }
+
+   protected:
+    /// The explicit interface requires a DeepCopy_Internal() implementation.
+    Status DeepCopy_Internal(IAsyncContext*& context_copy) {
+      return IAsyncContext::DeepCopy_Internal(*this, context_copy);
+    }
+
+   private:
+    InlineKey key_;
+  };
+
+  class InlineReadContext : public IAsyncContext {
+   public:
+    typedef InlineKey key_t;
+    typedef LargeValue value_t;
+
+    InlineReadContext(uint64_t key)
+      : key_{ key }
+      , output{ 0 } {
+    }
+
+    /// Copy (and deep-copy) constructor.
+    InlineReadContext(const InlineReadContext& other)
+      : key_{ other.key_ }
+      , output{ other.output } {
+    }
+
+    /// The implicit and explicit interfaces require a key() accessor.
+    inline const InlineKey& key() const {
+      return key_;
+    }
+
+    inline void Get(const LargeValue& value) {
+      output = value.value;
+    }
+    inline void GetAtomic(const LargeValue& value) {
+      output = value.atomic_value.load();
+    }
+
+   protected:
+    /// The explicit interface requires a DeepCopy_Internal() implementation.
+    Status DeepCopy_Internal(IAsyncContext*& context_copy) {
+      return IAsyncContext::DeepCopy_Internal(*this, context_copy);
+    }
+
+   private:
+    InlineKey key_;
+   public:
+    uint64_t output;
+  };
+
+  typedef FASTER::device::FileSystemDisk<FASTER::environment::QueueIoHandler, 67108864L> disk_t;
+  static constexpr uint64_t kNumRecords = 400000;
+
+  std::experimental::filesystem::create_directories("logs_inline");
+  {
+    FasterKv<InlineKey, LargeValue, disk_t> store{ InlineKey::kNumBuckets, 268435456,
+        "logs_inline", 0.5 };
+    store.StartSession();
+
+    for(uint64_t idx = 0; idx < kNumRecords; ++idx) {
+      auto callback = [](IAsyncContext* ctxt, Status result) {
+        // Upserts don't go to disk.
+        ASSERT_TRUE(false);
+      };
+      if(idx % 256 == 0) {
+        store.Refresh();
+      }
+      InlineUpsertContext context{ idx };
+      Status result = store.Upsert(context, callback, 1);
+      ASSERT_EQ(Status::Ok, result);
+    }
+
+    // Absent keys share buckets and tags with keys on disk, but the index knows they're absent.
+    InlineKey::num_compares = 0;
+    for(uint64_t idx = kNumRecords; idx < kNumRecords + 10000; ++idx) {
+      auto callback = [](IAsyncContext* ctxt, Status result) {
+        // Absent keys don't go to disk.
+        ASSERT_TRUE(false);
+      };
+      InlineReadContext context{ idx };
+      Status result = store.Read(context, callback, 1);
+      ASSERT_EQ(Status::NotFound, result);
+    }
+    ASSERT_EQ(0, InlineKey::num_compares);
+
+    // Present keys are still found, on disk or in memory.
+    static std::atomic<uint64_t> records_read;
+    records_read = 0;
+    uint64_t num_pending = 0;
+    for(uint64_t idx = 0; idx < kNumRecords; idx += 97) {
+      auto callback = [](IAsyncContext* ctxt, Status result) {
+        CallbackContext<InlineReadContext> context{ ctxt };
+        ASSERT_EQ(Status::Ok, result);
+        ASSERT_EQ(context->key().inline_key() + 1, context->output);
+        ++records_read;
+      };
+      if(idx % 256 == 0) {
+        store.Refresh();
+      }
+      InlineReadContext context{ idx };
+      Status result = store.Read(context, callback, 1);
+      if(result == Status::Ok) {
+        ASSERT_EQ(idx + 1, context.output);
+        ++records_read;
+      } else {
+        ASSERT_EQ(Status::Pending, result);
+        ++num_pending;
+      }
+    }
+    ASSERT_GT(num_pending, 0);
+    ASSERT_TRUE(store.CompletePending(true));
+    ASSERT_EQ((kNumRecords + 96) / 97, records_read.load());
+
+    store.StopSession();
+  }
+  std::experimental::filesystem::remove_all("logs_inline");
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -2140,6 +2140,337 @@ TEST(InMemFaster, UpsertRead_VariableLengthKey) {
   store.StopSession();
 }
 
+TEST(InMemFaster, ReadInPlace) {
+  using Key = FixedSizeKey<uint64_t>;
+
+  class Value {
+   public:
+    Value()
+      : fields_{} {
+    }
+
+    inline static constexpr uint32_t size() {
+      return static_cast<uint32_t>(sizeof(Value));
+    }
+
+    uint64_t fields_[128];
+  };
+
+  class UpsertContext : public IAsyncContext {
+   public:
+    typedef Key key_t;
+    typedef Value value_t;
+
+    UpsertContext(uint64_t key)
+      : key_{ key } {
+    }
+
+    /// Copy (and deep-copy) constructor.
+    UpsertContext(const UpsertContext& other)
+      : key_{ other.key_ } {
+    }
+
+    /// The implicit and explicit interfaces require a key() accessor.
+    inline const Key& key() const {
+      return key_;
+    }
+    inline static constexpr uint32_t value_size() {
+      return sizeof(value_t);
+    }
+    /// Non-atomic and atomic Put() methods.
+    inline void Put(Value& value) {
+      for(uint64_t idx = 0; idx < 128; ++idx) {
+        value.fields_[idx] = key_.key * idx;
+      }
+    }
+    inline bool PutAtomic(Value& value) {
+      Put(value);
+      return true;
+    }
+
+   protected:
+    /// The explicit interface requires a DeepCopy_Internal() implementation.
+    Status DeepCopy_Internal(IAsyncContext*& context_copy) {
+      return IAsyncContext::DeepCopy_Internal(*this, context_copy);
+    }
+
+   private:
+    Key key_;
+  };
+
+  FasterKv<Key, Value, FASTER::device::NullDisk> store { 128, 1073741824, "" };
+
+  store.StartSession();
+
+  auto callback = [](IAsyncContext* ctxt, Status result) {
+    // In-memory test.
+    ASSERT_TRUE(false);
+  };
+
+  for(uint64_t idx = 0; idx < 256; ++idx) {
+    UpsertContext context{ idx };
+    Status result = store.Upsert(context, callback, 1);
+    ASSERT_EQ(Status::Ok, result);
+  }
+
+  // The visitor projects a single field, straight out of the log.
+  for(uint64_t idx = 0; idx < 256; ++idx) {
+    const Value* first_seen = nullptr;
+    uint64_t field = 0;
+    auto visitor = [&](const Value& value, bool concurrent) {
+      ASSERT_TRUE(concurrent);
+      first_seen = &value;
+      field = value.fields_[7];
+    };
+    Status result = store.ReadInPlace(Key{ idx }, visitor, callback, 1);
+    ASSERT_EQ(Status::Ok, result);
+    ASSERT_EQ(idx * 7, field);
+
+    const Value* second_seen = nullptr;
+    result = store.ReadInPlace(Key{ idx }, [&](const Value& value, bool concurrent) {
+      second_seen = &value;
+    }, callback, 1);
+    ASSERT_EQ(Status::Ok, result);
+    ASSERT_NE(nullptr, first_seen);
+    ASSERT_EQ(first_seen, second_seen);
+  }
+
+  // The visitor doesn't run for a missing key.
+  bool visited = false;
+  Status result = store.ReadInPlace(Key{ 1000 }, [&](const Value& value, bool concurrent) {
+    visited = true;
+  }, callback, 1);
+  ASSERT_EQ(Status::NotFound, result);
+  ASSERT_FALSE(visited);
+
+  store.StopSession();
+}
+
+TEST(InMemFaster, ConditionalUpsert) {
+  using Key = FixedSizeKey<uint64_t>;
+
+  /// The value carries a version, which conditional upserts compare against. The stored version
+  /// is twice the logical one, and odd while an in-place update is under way.
+  class Value {
+   public:
+    Value()
+      : version_{ 0 }
+      , data_{ 0 } {
+    }
+
+    inline static constexpr uint32_t size() {
+      return static_cast<uint32_t>(sizeof(Value));
+    }
+
+    std::atomic<uint64_t> version_;
+    std::atomic<uint64_t> data_;
+  };
+
+  class CasContext : public IAsyncContext {
+   public:
+    typedef Key key_t;
+    typedef Value value_t;
+
+    /// expected_version == 0 means "insert only if the key is missing".
+    CasContext(uint64_t key, uint64_t expected_version, uint64_t data)
+      : key_{ key }
+      , expected_version_{ expected_version }
+      , data_{ data } {
+    }
+
+    /// Copy (and deep-copy) constructor.
+    CasContext(const CasContext& other)
+      : key_{ other.key_ }
+      , expected_version_{ other.expected_version_ }
+      , data_{ other.data_ } {
+    }
+
+    /// The implicit and explicit interfaces require a key() accessor.
+    inline const key_t& key() const {
+      return key_;
+    }
+    inline static constexpr uint32_t value_size() {
+      return sizeof(value_t);
+    }
+    inline bool Compare(const value_t& value) {
+      return value.version_.load() == 2 * expected_version_;
+    }
+    inline bool CompareNotFound() {
+      return expected_version_ == 0;
+    }
+    inline void Put(value_t& value) {
+      value.version_.store(2 * expected_version_ + 2);
+      value.data_.store(data_);
+    }
+    inline bool CompareAndPutAtomic(value_t& value, bool& swapped) {
+      uint64_t expected = 2 * expected_version_;
+      swapped = value.version_.compare_exchange_strong(expected, expected + 1);
+      if(swapped) {
+        value.data_.store(data_);
+        value.version_.store(expected + 2);
+      }
+      return true;
+    }
+
+   protected:
+    /// The explicit interface requires a DeepCopy_Internal() implementation.
+    Status DeepCopy_Internal(IAsyncContext*& context_copy) {
+      return IAsyncContext::DeepCopy_Internal(*this, context_copy);
+    }
+
+   private:
+    key_t key_;
+    uint64_t expected_version_;
+    uint64_t data_;
+  };
+
+  class ReadContext : public IAsyncContext {
+   public:
+    typedef Key key_t;
+    typedef Value value_t;
+
+    ReadContext(uint64_t key)
+      : key_{ key } {
+    }
+
+    /// Copy (and deep-copy) constructor.
+    ReadContext(const ReadContext& other)
+      : key_{ other.key_ } {
+    }
+
+    /// The implicit and explicit interfaces require a key() accessor.
+    inline const key_t& key() const {
+      return key_;
+    }
+
+    inline void Get(const value_t& value) {
+      version = value.version_.load();
+      data = value.data_.load();
+    }
+    inline void GetAtomic(const value_t& value) {
+      do {
+        version = value.version_.load();
+        data = value.data_.load();
+      } while(version % 2 == 1 || version != value.version_.load());
+    }
+
+   protected:
+    /// The explicit interface requires a DeepCopy_Internal() implementation.
+    Status DeepCopy_Internal(IAsyncContext*& context_copy) {
+      return IAsyncContext::DeepCopy_Internal(*this, context_copy);
+    }
+
+   private:
+    key_t key_;
+   public:
+    uint64_t version;
+    uint64_t data;
+  };
+
+  FasterKv<Key, Value, FASTER::device::NullDisk> store { 128, 1073741824, "" };
+
+  store.StartSession();
+
+  auto callback = [](IAsyncContext* ctxt, Status result) {
+    // In-memory test.
+    ASSERT_TRUE(false);
+  };
+
+  // Insert-if-missing succeeds once.
+  {
+    CasContext context{ 1, 0, 100 };
+    ASSERT_EQ(Status::Ok, store.ConditionalUpsert(context, callback, 1));
+  }
+  {
+    CasContext context{ 1, 0, 200 };
+    ASSERT_EQ(Status::Aborted, store.ConditionalUpsert(context, callback, 1));
+  }
+  {
+    // A version compare on a missing key fails.
+    CasContext context{ 2, 5, 300 };
+    ASSERT_EQ(Status::Aborted, store.ConditionalUpsert(context, callback, 1));
+    ReadContext read_context{ 2 };
+    ASSERT_EQ(Status::NotFound, store.Read(read_context, callback, 1));
+  }
+
+  // In place, in the mutable region.
+  ReadContext read_context{ 1 };
+  ASSERT_EQ(Status::Ok, store.Read(read_context, callback, 1));
+  ASSERT_EQ(100, read_context.data);
+  uint64_t version = read_context.version / 2;
+  {
+    CasContext context{ 1, version + 1, 400 };
+    ASSERT_EQ(Status::Aborted, store.ConditionalUpsert(context, callback, 1));
+  }
+  {
+    CasContext context{ 1, version, 500 };
+    ASSERT_EQ(Status::Ok, store.ConditionalUpsert(context, callback, 1));
+  }
+  ASSERT_EQ(Status::Ok, store.Read(read_context, callback, 1));
+  ASSERT_EQ(500, read_context.data);
+  ASSERT_EQ(version + 1, read_context.version / 2);
+  version = read_context.version / 2;
+
+  // Through the tail (RCU), once the record is read-only.
+  store.hlog.ShiftReadOnlyToTail();
+  store.CompletePending(true);
+  {
+    CasContext context{ 1, version + 7, 600 };
+    ASSERT_EQ(Status::Aborted, store.ConditionalUpsert(context, callback, 1));
+  }
+  uint64_t tail_address = store.Size();
+  {
+    CasContext context{ 1, version, 700 };
+    ASSERT_EQ(Status::Ok, store.ConditionalUpsert(context, callback, 1));
+  }
+  ASSERT_GT(store.Size(), tail_address);
+  ASSERT_EQ(Status::Ok, store.Read(read_context, callback, 1));
+  ASSERT_EQ(700, read_context.data);
+  ASSERT_EQ(version + 1, read_context.version / 2);
+
+  store.StopSession();
+
+  // Optimistic concurrency: concurrent read/compare-and-swap increments lose no updates.
+  static constexpr size_t kNumThreads = 8;
+  static constexpr uint64_t kNumIncrements = 2000;
+  static std::atomic<uint64_t> num_aborted{ 0 };
+
+  auto increment_worker = [](FasterKv<Key, Value, FASTER::device::NullDisk>* store_) {
+    store_->StartSession();
+    auto callback = [](IAsyncContext* ctxt, Status result) {
+      // In-memory test.
+      ASSERT_TRUE(false);
+    };
+    for(uint64_t idx = 0; idx < kNumIncrements; ++idx) {
+      while(true) {
+        ReadContext read_context{ 1 };
+        ASSERT_EQ(Status::Ok, store_->Read(read_context, callback, 1));
+        CasContext context{ 1, read_context.version / 2, read_context.data + 1 };
+        Status result = store_->ConditionalUpsert(context, callback, 1);
+        if(result == Status::Ok) {
+          break;
+        }
+        ASSERT_EQ(Status::Aborted, result);
+        ++num_aborted;
+      }
+    }
+    store_->StopSession();
+  };
+
+  std::deque<std::thread> threads{};
+  for(size_t idx = 0; idx < kNumThreads; ++idx) {
+    threads.emplace_back(increment_worker, &store);
+  }
+  for(auto& thread : threads) {
+    thread.join();
+  }
+
+  store.StartSession();
+  ASSERT_EQ(Status::Ok, store.Read(read_context, callback, 1));
+  ASSERT_EQ(700 + kNumThreads * kNumIncrements, read_context.data);
+  store.StopSession();
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
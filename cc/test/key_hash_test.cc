@@ -0,0 +1,103 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <unordered_set>
+#include <vector>
+#include "gtest/gtest.h"
+
+#include "core/key_hash.h"
+
+using namespace FASTER::core;
+
+std::vector<uint8_t> RandomBytes(size_t len, uint64_t seed) {
+  std::mt19937_64 rng{ seed };
+  std::vector<uint8_t> bytes(len);
+  for(auto& byte : bytes) {
+    byte = static_cast<uint8_t>(rng());
+  }
+  return bytes;
+}
+
+TEST(KeyHash, FastHashBytes_Deterministic) {
+  std::vector<uint8_t> bytes = RandomBytes(2048, 1);
+  for(size_t len = 0; len <= bytes.size(); len += 17) {
+    std::vector<uint8_t> copy{ bytes.begin(), bytes.begin() + len };
+    ASSERT_EQ(Utility::FastHashBytes(bytes.data(), len), Utility::FastHashBytes(copy.data(), len));
+    ASSERT_EQ(FastBytesHash{}(bytes.data(), len), Utility::FastHashBytes(bytes.data(), len));
+  }
+}
+
+TEST(KeyHash, FastHashBytes_Lengths) {
+  // Every prefix of an all-zeros buffer hashes differently.
+  std::vector<uint8_t> zeros(1100, 0);
+  std::unordered_set<uint64_t> hashes;
+  for(size_t len = 0; len <= zeros.size(); ++len) {
+    ASSERT_TRUE(hashes.insert(Utility::FastHashBytes(zeros.data(), len)).second) << len;
+  }
+}
+
+TEST(KeyHash, FastHashBytes_BitFlips) {
+  // Flipping any single bit changes the hash, on both the short- and the long-key paths.
+  for(size_t len : { 3, 8, 13, 16, 32, 49, 100, 128, 256, 257, 640, 1100 }) {
+    std::vector<uint8_t> bytes = RandomBytes(len, len);
+    std::unordered_set<uint64_t> hashes;
+    hashes.insert(Utility::FastHashBytes(bytes.data(), len));
+    for(size_t bit = 0; bit < 8 * len; ++bit) {
+      bytes[bit / 8] ^= static_cast<uint8_t>(1 << (bit % 8));
+      ASSERT_TRUE(hashes.insert(Utility::FastHashBytes(bytes.data(), len)).second) << len << " " <<
+          bit;
+      bytes[bit / 8] ^= static_cast<uint8_t>(1 << (bit % 8));
+    }
+  }
+}
+
+TEST(KeyHash, FastHashBytes_SwappedStripes) {
+  // The striped accumulator is sensitive to stripe order.
+  std::vector<uint8_t> bytes = RandomBytes(40 * Utility::kStripeBytes, 2);
+  uint64_t hash = Utility::FastHashBytes(bytes.data(), bytes.size());
+  std::swap_ranges(bytes.begin(), bytes.begin() + Utility::kStripeBytes,
+                   bytes.begin() + 17 * Utility::kStripeBytes);
+  ASSERT_NE(hash, Utility::FastHashBytes(bytes.data(), bytes.size()));
+}
+
+TEST(KeyHash, AccumulateStripes_MatchesScalar) {
+  // (37 stripes span more than two scramble blocks.)
+  std::vector<uint8_t> bytes = RandomBytes(37 * Utility::kStripeBytes + 1, 3);
+  for(size_t num_stripes : { 0, 1, 15, 16, 17, 37 }) {
+    uint64_t acc[Utility::kNumHashLanes];
+    uint64_t expected[Utility::kNumHashLanes];
+    Utility::AccumulateStripes(acc, bytes.data() + 1, num_stripes);
+    Utility::AccumulateStripesScalar(expected, bytes.data() + 1, num_stripes);
+    for(size_t lane = 0; lane < Utility::kNumHashLanes; ++lane) {
+      ASSERT_EQ(expected[lane], acc[lane]) << num_stripes << " " << lane;
+    }
+  }
+}
+
+TEST(KeyHash, FastHashBytes_Distribution) {
+  // Sequential 32-byte keys should spread evenly across buckets and tags.
+  static constexpr uint64_t kNumKeys = 1 << 20;
+  static constexpr uint64_t kTableSize = 1 << 12;
+  std::vector<uint32_t> buckets(kTableSize, 0);
+  std::vector<uint32_t> tags(1 << 14, 0);
+  uint8_t key[32] = { 0 };
+  for(uint64_t idx = 0; idx < kNumKeys; ++idx) {
+    std::memcpy(key + 8, &idx, sizeof(idx));
+    KeyHash hash{ Utility::FastHashBytes(key, sizeof(key)) };
+    ++buckets[hash.idx(kTableSize)];
+    ++tags[hash.tag()];
+  }
+  // Expect 256 keys per bucket and 64 per tag; allow generous slack.
+  ASSERT_LT(*std::max_element(buckets.begin(), buckets.end()), 2 * 256);
+  ASSERT_GT(*std::min_element(buckets.begin(), buckets.end()), 256 / 2);
+  ASSERT_LT(*std::max_element(tags.begin(), tags.end()), 2 * 64);
+  ASSERT_GT(*std::min_element(tags.begin(), tags.end()), 64 / 4);
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -6,6 +6,7 @@
 #include <cstring>
 #include <deque>
 #include <functional>
+#include <random>
 #include <thread>
 #include "gtest/gtest.h"
 #include "core/faster.h"
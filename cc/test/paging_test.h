@@ -539,6 +539,9 @@ TEST(CLASS, UpsertRead_Concurrent) {
   ASSERT_EQ(kNumRecords, records_read.load());
 
   //// Update.
+  // (This session won't refresh while the workers run, so park it; otherwise the workers would wait
+  // for it to let their closed pages go.)
+  store.ParkSession();
   num_writes = 0;
   threads.clear();
   for(size_t idx = 0; idx < kNumThreads; ++idx) {
@@ -547,6 +550,7 @@ TEST(CLASS, UpsertRead_Concurrent) {
   for(auto& thread : threads) {
     thread.join();
   }
+  store.UnparkSession();
 
   ASSERT_EQ(kNumRecords, num_writes.load());
 
@@ -1027,3 +1031,784 @@ TEST(CLASS, Rmw_Concurrent) {
     thread.join();
   }
 }
+
+TEST(CLASS, MultiRead) {
+  class Key {
+   public:
+    Key(uint64_t key)
+      : key_{ key } {
+    }
+
+    inline static constexpr uint32_t size() {
+      return static_cast<uint32_t>(sizeof(Key));
+    }
+    inline KeyHash GetHash() const {
+      return KeyHash{ Utility::GetHashCode(key_) };
+    }
+
+    /// Comparison operators.
+    inline bool operator==(const Key& other) const {
+      return key_ == other.key_;
+    }
+    inline bool operator!=(const Key& other) const {
+      return key_ != other.key_;
+    }
+
+    uint64_t key_;
+  };
+
+  class UpsertContext;
+  class ReadContext;
+
+  class Value {
+   public:
+    Value()
+      : value_{ 0 } {
+    }
+
+    inline static constexpr uint32_t size() {
+      return static_cast<uint32_t>(sizeof(Value));
+    }
+
+    friend class UpsertContext;
+    friend class ReadContext;
+
+   private:
+    uint64_t value_;
+    uint8_t junk_[248];
+  };
+
+  class UpsertContext : public IAsyncContext {
+   public:
+    typedef Key key_t;
+    typedef Value value_t;
+
+    UpsertContext(uint64_t key)
+      : key_{ key } {
+    }
+
+    /// Copy (and deep-copy) constructor.
+    UpsertContext(const UpsertContext& other)
+      : key_{ other.key_ } {
+    }
+
+    /// The implicit and explicit interfaces require a key() accessor.
+    inline const Key& key() const {
+      return key_;
+    }
+    inline static constexpr uint32_t value_size() {
+      return sizeof(value_t);
+    }
+    /// Non-atomic and atomic Put() methods.
+    inline void Put(Value& value) {
+      value.value_ = key_.key_ * 3;
+    }
+    inline bool PutAtomic(Value& value) {
+      value.value_ = key_.key_ * 3;
+      return true;
+    }
+
+   protected:
+    /// The explicit interface requires a DeepCopy_Internal() implementation.
+    Status DeepCopy_Internal(IAsyncContext*& context_copy) {
+      return IAsyncContext::DeepCopy_Internal(*this, context_copy);
+    }
+
+   private:
+    Key key_;
+  };
+
+  class ReadContext : public IAsyncContext {
+   public:
+    typedef Key key_t;
+    typedef Value value_t;
+
+    ReadContext(uint64_t key)
+      : key_{ key } {
+    }
+
+    /// Copy (and deep-copy) constructor.
+    ReadContext(const ReadContext& other)
+      : key_{ other.key_ } {
+    }
+
+    /// The implicit and explicit interfaces require a key() accessor.
+    inline const Key& key() const {
+      return key_;
+    }
+
+    inline void Get(const Value& value) {
+      ASSERT_EQ(key_.key_ * 3, value.value_);
+    }
+    inline void GetAtomic(const Value& value) {
+      ASSERT_EQ(key_.key_ * 3, value.value_);
+    }
+
+   protected:
+    /// The explicit interface requires a DeepCopy_Internal() implementation.
+    Status DeepCopy_Internal(IAsyncContext*& context_copy) {
+      return IAsyncContext::DeepCopy_Internal(*this, context_copy);
+    }
+
+   private:
+    Key key_;
+  };
+
+  std::experimental::filesystem::create_directories("logs");
+
+  // 8 pages!
+  FasterKv<Key, Value, disk_t> store{ 262144, 268435456, "logs", 0.5 };
+
+  Guid session_id = store.StartSession();
+
+  constexpr uint64_t kNumRecords = 1000000;
+  constexpr size_t kBatchSize = 200;
+
+  // Insert.
+  for(uint64_t idx = 0; idx < kNumRecords; ++idx) {
+    auto callback = [](IAsyncContext* ctxt, Status result) {
+      // Upserts don't go to disk.
+      ASSERT_TRUE(false);
+    };
+
+    if(idx % 256 == 0) {
+      store.Refresh();
+    }
+
+    UpsertContext context{ idx };
+    Status result = store.Upsert(context, callback, 1);
+    ASSERT_EQ(Status::Ok, result);
+  }
+
+  // Read, in batches: half of each batch is a run of adjacent records (which share sectors on
+  // disk), the rest is scattered, with every tenth key missing from the store.
+  static std::atomic<uint64_t> records_read{ 0 };
+  auto callback = [](IAsyncContext* ctxt, Status result) {
+    CallbackContext<ReadContext> context{ ctxt };
+    ASSERT_EQ(Status::Ok, result);
+    ++records_read;
+  };
+
+  std::mt19937_64 rng{ 7 };
+  uint64_t expected_found = 0;
+  uint64_t expected_not_found = 0;
+  uint64_t not_found = 0;
+  uint64_t pending = 0;
+  for(uint64_t batch_start = 0; batch_start < kNumRecords; batch_start += 10 * kBatchSize) {
+    std::vector<ReadContext> contexts;
+    for(size_t idx = 0; idx < kBatchSize / 2; ++idx) {
+      contexts.emplace_back(batch_start + idx);
+    }
+    for(size_t idx = kBatchSize / 2; idx < kBatchSize; ++idx) {
+      contexts.emplace_back(idx % 10 == 0 ? kNumRecords + rng() % kNumRecords :
+                            rng() % kNumRecords);
+    }
+    for(size_t idx = 0; idx < kBatchSize; ++idx) {
+      if(contexts[idx].key().key_ < kNumRecords) {
+        ++expected_found;
+      } else {
+        ++expected_not_found;
+      }
+    }
+
+    Status results[kBatchSize];
+    Status result = store.MultiRead(contexts.data(), contexts.size(), results, callback, 1);
+    bool any_pending = false;
+    for(Status status : results) {
+      if(status == Status::Ok) {
+        ++records_read;
+      } else if(status == Status::NotFound) {
+        ++not_found;
+      } else {
+        ASSERT_EQ(Status::Pending, status);
+        ++pending;
+        any_pending = true;
+      }
+    }
+    ASSERT_EQ(any_pending ? Status::Pending : Status::Ok, result);
+    store.CompletePending(false);
+  }
+
+  ASSERT_GT(pending, 0);
+  bool result = store.CompletePending(true);
+  ASSERT_TRUE(result);
+  ASSERT_EQ(expected_found, records_read.load());
+  ASSERT_EQ(expected_not_found, not_found);
+
+  store.StopSession();
+}
+
+TEST(CLASS, DiskChainWalk) {
+  static constexpr uint64_t kNumColliding = 1000;
+
+  class Key {
+   public:
+    Key(uint64_t key)
+      : key_{ key } {
+    }
+
+    inline static constexpr uint32_t size() {
+      return static_cast<uint32_t>(sizeof(Key));
+    }
+    inline KeyHash GetHash() const {
+      // The first kNumColliding keys all share one hash chain.
+      return KeyHash{ Utility::GetHashCode(key_ < kNumColliding ? 0 : key_) };
+    }
+
+    /// Comparison operators.
+    inline bool operator==(const Key& other) const {
+      return key_ == other.key_;
+    }
+    inline bool operator!=(const Key& other) const {
+      return key_ != other.key_;
+    }
+
+    uint64_t key_;
+  };
+
+  class UpsertContext;
+  class ReadContext;
+
+  class Value {
+   public:
+    Value()
+      : value_{ 0 } {
+    }
+
+    inline static constexpr uint32_t size() {
+      return static_cast<uint32_t>(sizeof(Value));
+    }
+
+    friend class UpsertContext;
+    friend class ReadContext;
+
+   private:
+    uint64_t value_;
+    uint8_t junk_[248];
+  };
+
+  class UpsertContext : public IAsyncContext {
+   public:
+    typedef Key key_t;
+    typedef Value value_t;
+
+    UpsertContext(uint64_t key)
+      : key_{ key } {
+    }
+
+    /// Copy (and deep-copy) constructor.
+    UpsertContext(const UpsertContext& other)
+      : key_{ other.key_ } {
+    }
+
+    /// The implicit and explicit interfaces require a key() accessor.
+    inline const Key& key() const {
+      return key_;
+    }
+    inline static constexpr uint32_t value_size() {
+      return sizeof(value_t);
+    }
+    /// Non-atomic and atomic Put() methods.
+    inline void Put(Value& value) {
+      value.value_ = key_.key_ * 3;
+    }
+    inline bool PutAtomic(Value& value) {
+      value.value_ = key_.key_ * 3;
+      return true;
+    }
+
+   protected:
+    /// The explicit interface requires a DeepCopy_Internal() implementation.
+    Status DeepCopy_Internal(IAsyncContext*& context_copy) {
+      return IAsyncContext::DeepCopy_Internal(*this, context_copy);
+    }
+
+   private:
+    Key key_;
+  };
+
+  class ReadContext : public IAsyncContext {
+   public:
+    typedef Key key_t;
+    typedef Value value_t;
+
+    ReadContext(uint64_t key)
+      : key_{ key } {
+    }
+
+    /// Copy (and deep-copy) constructor.
+    ReadContext(const ReadContext& other)
+      : key_{ other.key_ } {
+    }
+
+    /// The implicit and explicit interfaces require a key() accessor.
+    inline const Key& key() const {
+      return key_;
+    }
+
+    inline void Get(const Value& value) {
+      ASSERT_EQ(key_.key_ * 3, value.value_);
+    }
+    inline void GetAtomic(const Value& value) {
+      ASSERT_EQ(key_.key_ * 3, value.value_);
+    }
+
+   protected:
+    /// The explicit interface requires a DeepCopy_Internal() implementation.
+    Status DeepCopy_Internal(IAsyncContext*& context_copy) {
+      return IAsyncContext::DeepCopy_Internal(*this, context_copy);
+    }
+
+   private:
+    Key key_;
+  };
+
+  std::experimental::filesystem::create_directories("logs");
+
+  // 8 pages!
+  FasterKv<Key, Value, disk_t> store{ 262144, 268435456, "logs", 0.5 };
+
+  Guid session_id = store.StartSession();
+
+  // The colliding keys go in first, next to each other, and the rest push them out to disk.
+  constexpr uint64_t kNumRecords = 1000000;
+  for(uint64_t idx = 0; idx < kNumRecords; ++idx) {
+    auto callback = [](IAsyncContext* ctxt, Status result) {
+      // Upserts don't go to disk.
+      ASSERT_TRUE(false);
+    };
+
+    if(idx % 256 == 0) {
+      store.Refresh();
+    }
+
+    UpsertContext context{ idx };
+    Status result = store.Upsert(context, callback, 1);
+    ASSERT_EQ(Status::Ok, result);
+  }
+
+  static std::atomic<uint64_t> records_read{ 0 };
+  uint64_t num_reads = 0;
+  for(uint64_t idx = 0; idx < kNumColliding; idx += 37) {
+    auto callback = [](IAsyncContext* ctxt, Status result) {
+      CallbackContext<ReadContext> context{ ctxt };
+      ASSERT_EQ(Status::Ok, result);
+      ++records_read;
+    };
+
+    ReadContext context{ idx };
+    Status result = store.Read(context, callback, 1);
+    ASSERT_EQ(Status::Pending, result);
+    ++num_reads;
+    store.CompletePending(false);
+  }
+
+  bool result = store.CompletePending(true);
+  ASSERT_TRUE(result);
+  ASSERT_EQ(num_reads, records_read.load());
+
+  // Each read walks the chain back from the newest colliding key; since those records sit next
+  // to each other on disk, most hops should find the next record in a buffer already read.
+  ASSERT_GT(store.DiskChainHops(), num_reads * kNumColliding / 3);
+  ASSERT_GT(store.BufferedDiskChainHops(), store.DiskChainHops() * 9 / 10);
+
+  store.StopSession();
+}
+
+TEST(CLASS, ReadInPlace) {
+  class Key {
+   public:
+    Key(uint64_t key)
+      : key_{ key } {
+    }
+
+    inline static constexpr uint32_t size() {
+      return static_cast<uint32_t>(sizeof(Key));
+    }
+    inline KeyHash GetHash() const {
+      return KeyHash{ Utility::GetHashCode(key_) };
+    }
+
+    /// Comparison operators.
+    inline bool operator==(const Key& other) const {
+      return key_ == other.key_;
+    }
+    inline bool operator!=(const Key& other) const {
+      return key_ != other.key_;
+    }
+
+    uint64_t key_;
+  };
+
+  class Value {
+   public:
+    Value()
+      : value_{ 0 } {
+    }
+
+    inline static constexpr uint32_t size() {
+      return static_cast<uint32_t>(sizeof(Value));
+    }
+
+    uint64_t value_;
+    uint8_t junk_[1016];
+  };
+
+  class UpsertContext : public IAsyncContext {
+   public:
+    typedef Key key_t;
+    typedef Value value_t;
+
+    UpsertContext(uint64_t key)
+      : key_{ key } {
+    }
+
+    /// Copy (and deep-copy) constructor.
+    UpsertContext(const UpsertContext& other)
+      : key_{ other.key_ } {
+    }
+
+    /// The implicit and explicit interfaces require a key() accessor.
+    inline const Key& key() const {
+      return key_;
+    }
+    inline static constexpr uint32_t value_size() {
+      return sizeof(value_t);
+    }
+    /// Non-atomic and atomic Put() methods.
+    inline void Put(Value& value) {
+      value.value_ = key_.key_ * 3;
+    }
+    inline bool PutAtomic(Value& value) {
+      value.value_ = key_.key_ * 3;
+      return true;
+    }
+
+   protected:
+    /// The explicit interface requires a DeepCopy_Internal() implementation.
+    Status DeepCopy_Internal(IAsyncContext*& context_copy) {
+      return IAsyncContext::DeepCopy_Internal(*this, context_copy);
+    }
+
+   private:
+    Key key_;
+  };
+
+  std::experimental::filesystem::create_directories("logs");
+
+  // 8 pages!
+  FasterKv<Key, Value, disk_t> store{ 262144, 268435456, "logs", 0.5 };
+
+  Guid session_id = store.StartSession();
+
+  constexpr uint64_t kNumRecords = 300000;
+  for(uint64_t idx = 0; idx < kNumRecords; ++idx) {
+    auto callback = [](IAsyncContext* ctxt, Status result) {
+      // Upserts don't go to disk.
+      ASSERT_TRUE(false);
+    };
+
+    if(idx % 256 == 0) {
+      store.Refresh();
+    }
+
+    UpsertContext context{ idx };
+    Status result = store.Upsert(context, callback, 1);
+    ASSERT_EQ(Status::Ok, result);
+  }
+
+  // The visitor checks the value where it lies: in the log, or in the I/O buffer.
+  static std::atomic<uint64_t> visited{ 0 };
+  struct Visitor {
+    void operator()(const Value& value, bool concurrent) {
+      ASSERT_EQ(key * 3, value.value_);
+      ++visited;
+    }
+    uint64_t key;
+  };
+  static std::atomic<uint64_t> records_read{ 0 };
+  auto callback = [](IAsyncContext* ctxt, Status result) {
+    CallbackContext<InPlaceReadContext<Key, Value, Visitor>> context{ ctxt };
+    ASSERT_EQ(Status::Ok, result);
+    ASSERT_EQ(context->key().key_, context->visitor().key);
+    ++records_read;
+  };
+
+  uint64_t num_pending = 0;
+  for(uint64_t idx = 0; idx < kNumRecords; idx += 97) {
+    if(idx % 256 == 0) {
+      store.Refresh();
+    }
+    Status result = store.ReadInPlace(Key{ idx }, Visitor{ idx }, callback, 1);
+    if(result == Status::Ok) {
+      ++records_read;
+    } else {
+      ASSERT_EQ(Status::Pending, result);
+      ++num_pending;
+    }
+  }
+  ASSERT_GT(num_pending, 0);
+  bool result = store.CompletePending(true);
+  ASSERT_TRUE(result);
+  ASSERT_EQ((kNumRecords + 96) / 97, records_read.load());
+  ASSERT_EQ(records_read.load(), visited.load());
+
+  store.StopSession();
+}
+
+TEST(CLASS, ConditionalUpsert) {
+  class Key {
+   public:
+    Key(uint64_t key)
+      : key_{ key } {
+    }
+
+    inline static constexpr uint32_t size() {
+      return static_cast<uint32_t>(sizeof(Key));
+    }
+    inline KeyHash GetHash() const {
+      return KeyHash{ Utility::GetHashCode(key_) };
+    }
+
+    /// Comparison operators.
+    inline bool operator==(const Key& other) const {
+      return key_ == other.key_;
+    }
+    inline bool operator!=(const Key& other) const {
+      return key_ != other.key_;
+    }
+
+    uint64_t key_;
+  };
+
+  class Value {
+   public:
+    Value()
+      : version_{ 0 }
+      , data_{ 0 } {
+    }
+
+    inline static constexpr uint32_t size() {
+      return static_cast<uint32_t>(sizeof(Value));
+    }
+
+    uint64_t version_;
+    uint64_t data_;
+    uint8_t junk_[1008];
+  };
+
+  class UpsertContext : public IAsyncContext {
+   public:
+    typedef Key key_t;
+    typedef Value value_t;
+
+    UpsertContext(uint64_t key)
+      : key_{ key } {
+    }
+
+    /// Copy (and deep-copy) constructor.
+    UpsertContext(const UpsertContext& other)
+      : key_{ other.key_ } {
+    }
+
+    /// The implicit and explicit interfaces require a key() accessor.
+    inline const key_t& key() const {
+      return key_;
+    }
+    inline static constexpr uint32_t value_size() {
+      return sizeof(value_t);
+    }
+    /// Non-atomic and atomic Put() methods.
+    inline void Put(value_t& value) {
+      value.version_ = 1;
+      value.data_ = key_.key_;
+    }
+    inline bool PutAtomic(value_t& value) {
+      Put(value);
+      return true;
+    }
+
+   protected:
+    /// The explicit interface requires a DeepCopy_Internal() implementation.
+    Status DeepCopy_Internal(IAsyncContext*& context_copy) {
+      return IAsyncContext::DeepCopy_Internal(*this, context_copy);
+    }
+
+   private:
+    key_t key_;
+  };
+
+  class CasContext : public IAsyncContext {
+   public:
+    typedef Key key_t;
+    typedef Value value_t;
+
+    CasContext(uint64_t key, uint64_t expected_version)
+      : key_{ key }
+      , expected_version_{ expected_version } {
+    }
+
+    /// Copy (and deep-copy) constructor.
+    CasContext(const CasContext& other)
+      : key_{ other.key_ }
+      , expected_version_{ other.expected_version_ } {
+    }
+
+    /// The implicit and explicit interfaces require a key() accessor.
+    inline const key_t& key() const {
+      return key_;
+    }
+    inline static constexpr uint32_t value_size() {
+      return sizeof(value_t);
+    }
+    inline bool Compare(const value_t& value) {
+      return value.version_ == expected_version_;
+    }
+    inline bool CompareNotFound() {
+      return false;
+    }
+    inline void Put(value_t& value) {
+      value.version_ = expected_version_ + 1;
+      value.data_ = key_.key_ * 2;
+    }
+    inline bool CompareAndPutAtomic(value_t& value, bool& swapped) {
+      // (Single-threaded test.)
+      swapped = Compare(value);
+      if(swapped) {
+        Put(value);
+      }
+      return true;
+    }
+
+   protected:
+    /// The explicit interface requires a DeepCopy_Internal() implementation.
+    Status DeepCopy_Internal(IAsyncContext*& context_copy) {
+      return IAsyncContext::DeepCopy_Internal(*this, context_copy);
+    }
+
+   private:
+    key_t key_;
+    uint64_t expected_version_;
+  };
+
+  class ReadContext : public IAsyncContext {
+   public:
+    typedef Key key_t;
+    typedef Value value_t;
+
+    ReadContext(uint64_t key)
+      : key_{ key } {
+    }
+
+    /// Copy (and deep-copy) constructor.
+    ReadContext(const ReadContext& other)
+      : key_{ other.key_ } {
+    }
+
+    /// The implicit and explicit interfaces require a key() accessor.
+    inline const key_t& key() const {
+      return key_;
+    }
+
+    inline void Get(const value_t& value) {
+      // Keys divisible by 2 * 97 were swapped; the other multiples of 97 were not.
+      bool swapped = key_.key_ % (2 * 97) == 0;
+      ASSERT_EQ(swapped ? 2 : 1, value.version_);
+      ASSERT_EQ(swapped ? key_.key_ * 2 : key_.key_, value.data_);
+    }
+    inline void GetAtomic(const value_t& value) {
+      Get(value);
+    }
+
+   protected:
+    /// The explicit interface requires a DeepCopy_Internal() implementation.
+    Status DeepCopy_Internal(IAsyncContext*& context_copy) {
+      return IAsyncContext::DeepCopy_Internal(*this, context_copy);
+    }
+
+   private:
+    key_t key_;
+  };
+
+  std::experimental::filesystem::create_directories("logs");
+
+  // 8 pages!
+  FasterKv<Key, Value, disk_t> store{ 262144, 268435456, "logs", 0.5 };
+
+  Guid session_id = store.StartSession();
+
+  constexpr uint64_t kNumRecords = 300000;
+  for(uint64_t idx = 0; idx < kNumRecords; ++idx) {
+    auto callback = [](IAsyncContext* ctxt, Status result) {
+      // Upserts don't go to disk.
+      ASSERT_TRUE(false);
+    };
+
+    if(idx % 256 == 0) {
+      store.Refresh();
+    }
+
+    UpsertContext context{ idx };
+    Status result = store.Upsert(context, callback, 1);
+    ASSERT_EQ(Status::Ok, result);
+  }
+
+  // Every other compare-and-swap expects the wrong version.
+  static std::atomic<uint64_t> num_swapped{ 0 };
+  static std::atomic<uint64_t> num_aborted{ 0 };
+  auto callback = [](IAsyncContext* ctxt, Status result) {
+    CallbackContext<CasContext> context{ ctxt };
+    if(result == Status::Ok) {
+      ++num_swapped;
+    } else {
+      ASSERT_EQ(Status::Aborted, result);
+      ++num_aborted;
+    }
+  };
+
+  uint64_t num_pending = 0;
+  uint64_t num_cas = 0;
+  for(uint64_t idx = 0; idx < kNumRecords; idx += 97) {
+    if(idx % 256 == 0) {
+      store.Refresh();
+    }
+    CasContext context{ idx, idx % 2 == 0 ? uint64_t{ 1 } : uint64_t{ 7 } };
+    Status result = store.ConditionalUpsert(context, callback, 1);
+    if(result == Status::Ok) {
+      ++num_swapped;
+    } else if(result == Status::Aborted) {
+      ++num_aborted;
+    } else {
+      ASSERT_EQ(Status::Pending, result);
+      ++num_pending;
+    }
+    ++num_cas;
+  }
+  ASSERT_GT(num_pending, 0);
+  bool result = store.CompletePending(true);
+  ASSERT_TRUE(result);
+  ASSERT_EQ((num_cas + 1) / 2, num_swapped.load());
+  ASSERT_EQ(num_cas / 2, num_aborted.load());
+
+  // Read everything back.
+  static std::atomic<uint64_t> records_read{ 0 };
+  for(uint64_t idx = 0; idx < kNumRecords; idx += 97) {
+    auto callback = [](IAsyncContext* ctxt, Status result) {
+      CallbackContext<ReadContext> context{ ctxt };
+      ASSERT_EQ(Status::Ok, result);
+      ++records_read;
+    };
+    ReadContext context{ idx };
+    Status result = store.Read(context, callback, 1);
+    if(result == Status::Ok) {
+      ++records_read;
+    } else {
+      ASSERT_EQ(Status::Pending, result);
+    }
+  }
+  result = store.CompletePending(true);
+  ASSERT_TRUE(result);
+  ASSERT_EQ(num_cas, records_read.load());
+
+  store.StopSession();
+}
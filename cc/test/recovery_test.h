@@ -4,6 +4,7 @@
 #pragma once
 
 #include <experimental/filesystem>
+#include <fstream>
 
 #include "test_types.h"
 
@@ -168,6 +169,263 @@ TEST(CLASS, InternalHashTable) {
   }
 }
 
+TEST(CLASS, InternalHashTable_Sparse) {
+  // Index checkpoints store only non-empty buckets.
+  std::random_device rd{};
+  uint32_t seed = rd();
+  std::mt19937_64 rng{ seed };
+  std::experimental::filesystem::create_directories("test_ht_sparse");
+
+  constexpr uint64_t kNumBuckets = 8388608/8;
+  constexpr uint64_t kNumNonEmptyBuckets = kNumBuckets / 100;
+  std::vector<uint64_t> bucket_idxs;
+  size_t num_bytes_written;
+  {
+    LightEpoch epoch;
+    disk_t checkpoint_disk{ "test_ht_sparse", epoch };
+    file_t checkpoint_file = checkpoint_disk.NewFile("test_ht.dat");
+    Status result = checkpoint_file.Open(&checkpoint_disk.handler());
+    ASSERT_EQ(Status::Ok, result);
+
+    InternalHashTable<disk_t> table{};
+    table.Initialize(kNumBuckets, checkpoint_file.alignment());
+
+    // Fill one bucket in every hundred, plus the first and last buckets.
+    for(uint64_t bucket_idx = 0; bucket_idx < kNumBuckets; bucket_idx += 100) {
+      bucket_idxs.push_back(bucket_idx);
+    }
+    bucket_idxs.push_back(kNumBuckets - 1);
+    for(uint64_t bucket_idx : bucket_idxs) {
+      HashBucketEntry expected{ 0 };
+      bool success = table.bucket(bucket_idx).entries[bucket_idx % HashBucket::kNumEntries]
+                     .compare_exchange_strong(expected, rng() | 1);
+      ASSERT_TRUE(success);
+    }
+
+    result = table.Checkpoint(checkpoint_disk, std::move(checkpoint_file), num_bytes_written);
+    ASSERT_EQ(Status::Ok, result);
+    ASSERT_EQ(kNumBuckets * sizeof(HashBucket), num_bytes_written);
+    result = table.CheckpointComplete(true);
+    ASSERT_EQ(Status::Ok, result);
+  }
+  // (Each non-empty bucket costs its 64 bytes, plus a bit per bucket for the bitmaps.)
+  uint64_t file_size = std::experimental::filesystem::file_size("test_ht_sparse/test_ht.dat");
+  ASSERT_LT(file_size, 2 * kNumNonEmptyBuckets * sizeof(HashBucket) + kNumBuckets / 8 +
+            (1 << 20));
+
+  LightEpoch epoch;
+  disk_t recover_disk{ "test_ht_sparse", epoch };
+  file_t recover_file = recover_disk.NewFile("test_ht.dat");
+  Status result = recover_file.Open(&recover_disk.handler());
+  ASSERT_EQ(Status::Ok, result);
+
+  InternalHashTable<disk_t> recover_table{};
+  result = recover_table.Recover(recover_disk, std::move(recover_file), num_bytes_written);
+  ASSERT_EQ(Status::Ok, result);
+  result = recover_table.RecoverComplete(true);
+  ASSERT_EQ(Status::Ok, result);
+
+  std::mt19937_64 rng2{ seed };
+  uint64_t num_non_empty_entries = 0;
+  for(uint64_t bucket_idx : bucket_idxs) {
+    ASSERT_EQ(rng2() | 1, recover_table.bucket(bucket_idx).entries[bucket_idx %
+              HashBucket::kNumEntries].load().control_);
+  }
+  for(uint64_t bucket_idx = 0; bucket_idx < kNumBuckets; ++bucket_idx) {
+    for(uint32_t entry_idx = 0; entry_idx < HashBucket::kNumEntries; ++entry_idx) {
+      if(!recover_table.bucket(bucket_idx).entries[entry_idx].load().unused()) {
+        ++num_non_empty_entries;
+      }
+    }
+    ASSERT_TRUE(recover_table.bucket(bucket_idx).overflow_entry.load().unused());
+  }
+  ASSERT_EQ(bucket_idxs.size(), num_non_empty_entries);
+}
+
+TEST(CLASS, InternalHashTable_Incremental) {
+  // An incremental checkpoint stores only the chunks of buckets that changed; recovery applies it
+  // on top of its base.
+  std::experimental::filesystem::create_directories("test_ht_incremental");
+
+  constexpr uint64_t kNumBuckets = 8388608/8;
+  constexpr uint64_t kChunkSize = SparseCheckpointFile<HashBucket, disk_t>::kMaxItemsPerChunk;
+  std::mt19937_64 rng{ 17 };
+  InternalHashTable<disk_t> table{};
+  size_t num_bytes_written;
+  {
+    LightEpoch epoch;
+    disk_t checkpoint_disk{ "test_ht_incremental", epoch };
+    file_t checkpoint_file = checkpoint_disk.NewFile("base.dat");
+    ASSERT_EQ(Status::Ok, checkpoint_file.Open(&checkpoint_disk.handler()));
+    table.Initialize(kNumBuckets, checkpoint_file.alignment());
+    ASSERT_FALSE(table.CanCheckpointIncrementally());
+    for(uint64_t bucket_idx = 0; bucket_idx < kNumBuckets; bucket_idx += 7) {
+      table.bucket(bucket_idx).entries[0].store(HashBucketEntry{ rng() | 1 });
+    }
+    ASSERT_EQ(Status::Ok, table.Checkpoint(checkpoint_disk, std::move(checkpoint_file),
+                                           num_bytes_written));
+    ASSERT_EQ(Status::Ok, table.CheckpointComplete(true));
+    ASSERT_TRUE(table.CanCheckpointIncrementally());
+
+    // Touch buckets in two chunks: add an entry to one, and clear an entry in the other.
+    table.bucket(3 * kChunkSize + 1).entries[1].store(HashBucketEntry{ rng() | 1 });
+    table.MarkDirty(3 * kChunkSize + 1);
+    table.bucket(5 * kChunkSize).entries[0].store(HashBucketEntry{ 0 });
+    table.MarkDirty(5 * kChunkSize);
+    checkpoint_file = checkpoint_disk.NewFile("delta.dat");
+    ASSERT_EQ(Status::Ok, checkpoint_file.Open(&checkpoint_disk.handler()));
+    ASSERT_EQ(Status::Ok, table.Checkpoint(checkpoint_disk, std::move(checkpoint_file),
+                                           num_bytes_written, true));
+    ASSERT_EQ(Status::Ok, table.CheckpointComplete(true));
+  }
+  uint64_t base_size = std::experimental::filesystem::file_size("test_ht_incremental/base.dat");
+  uint64_t delta_size = std::experimental::filesystem::file_size("test_ht_incremental/delta.dat");
+  // (Two chunks, out of 16.)
+  ASSERT_LT(delta_size, base_size / 4);
+
+  LightEpoch epoch;
+  disk_t recover_disk{ "test_ht_incremental", epoch };
+  InternalHashTable<disk_t> recover_table{};
+  file_t recover_file = recover_disk.NewFile("base.dat");
+  ASSERT_EQ(Status::Ok, recover_file.Open(&recover_disk.handler()));
+  ASSERT_EQ(Status::Ok, recover_table.Recover(recover_disk, std::move(recover_file),
+            num_bytes_written));
+  ASSERT_EQ(Status::Ok, recover_table.RecoverComplete(true));
+  recover_file = recover_disk.NewFile("delta.dat");
+  ASSERT_EQ(Status::Ok, recover_file.Open(&recover_disk.handler()));
+  ASSERT_EQ(Status::Ok, recover_table.Recover(recover_disk, std::move(recover_file),
+            num_bytes_written, true));
+  ASSERT_EQ(Status::Ok, recover_table.RecoverComplete(true));
+
+  for(uint64_t bucket_idx = 0; bucket_idx < kNumBuckets; ++bucket_idx) {
+    for(uint32_t entry_idx = 0; entry_idx < HashBucket::kNumEntries; ++entry_idx) {
+      ASSERT_EQ(table.bucket(bucket_idx).entries[entry_idx].load().control_,
+                recover_table.bucket(bucket_idx).entries[entry_idx].load().control_);
+    }
+  }
+}
+
+TEST(CLASS, InternalHashTable_Mapped) {
+  // Recovery can decode the checkpoint straight out of a mapping of the file.
+  std::experimental::filesystem::create_directories("test_ht_mapped");
+
+  constexpr uint64_t kNumBuckets = 8388608/8;
+  std::mt19937_64 rng{ 23 };
+  InternalHashTable<disk_t> table{};
+  size_t num_bytes_written;
+  {
+    LightEpoch epoch;
+    disk_t checkpoint_disk{ "test_ht_mapped", epoch };
+    file_t checkpoint_file = checkpoint_disk.NewFile("test_ht.dat");
+    ASSERT_EQ(Status::Ok, checkpoint_file.Open(&checkpoint_disk.handler()));
+    table.Initialize(kNumBuckets, checkpoint_file.alignment());
+    for(uint64_t bucket_idx = 0; bucket_idx < kNumBuckets; bucket_idx += 3) {
+      table.bucket(bucket_idx).entries[bucket_idx % HashBucket::kNumEntries].store(
+        HashBucketEntry{ rng() | 1 });
+    }
+    ASSERT_EQ(Status::Ok, table.Checkpoint(checkpoint_disk, std::move(checkpoint_file),
+                                           num_bytes_written));
+    ASSERT_EQ(Status::Ok, table.CheckpointComplete(true));
+  }
+
+  for(IndexLoadMode load_mode : { IndexLoadMode::Map, IndexLoadMode::MapPopulate }) {
+    LightEpoch epoch;
+    disk_t recover_disk{ "test_ht_mapped", epoch };
+    InternalHashTable<disk_t> recover_table{};
+    file_t recover_file = recover_disk.NewFile("test_ht.dat");
+    ASSERT_EQ(Status::Ok, recover_file.Open(&recover_disk.handler()));
+    ASSERT_EQ(Status::Ok, recover_table.Recover(recover_disk, std::move(recover_file),
+              num_bytes_written, false, load_mode));
+    ASSERT_EQ(Status::Ok, recover_table.RecoverComplete(true));
+
+    for(uint64_t bucket_idx = 0; bucket_idx < kNumBuckets; ++bucket_idx) {
+      for(uint32_t entry_idx = 0; entry_idx < HashBucket::kNumEntries; ++entry_idx) {
+        ASSERT_EQ(table.bucket(bucket_idx).entries[entry_idx].load().control_,
+                  recover_table.bucket(bucket_idx).entries[entry_idx].load().control_);
+      }
+    }
+  }
+
+  // A file too short to hold its directory is rejected.
+  {
+    LightEpoch epoch;
+    disk_t recover_disk{ "test_ht_mapped", epoch };
+    std::experimental::filesystem::resize_file("test_ht_mapped/test_ht.dat", 64);
+    InternalHashTable<disk_t> recover_table{};
+    file_t recover_file = recover_disk.NewFile("test_ht.dat");
+    ASSERT_EQ(Status::Ok, recover_file.Open(&recover_disk.handler()));
+    ASSERT_EQ(Status::Corruption, recover_table.Recover(recover_disk, std::move(recover_file),
+              num_bytes_written, false, IndexLoadMode::Map));
+  }
+}
+
+TEST(CLASS, InternalHashTable_Dense) {
+  // Checkpoints written before the sparse format stored the buckets densely; they still recover.
+  std::experimental::filesystem::create_directories("test_ht_dense");
+
+  constexpr uint64_t kNumBuckets = 8388608/8;
+  std::mt19937_64 rng{ 29 };
+  InternalHashTable<disk_t> table{};
+  table.Initialize(kNumBuckets, 512);
+  for(uint64_t bucket_idx = 0; bucket_idx < kNumBuckets; bucket_idx += 5) {
+    // (Real entries point at 8-byte aligned addresses.)
+    table.bucket(bucket_idx).entries[bucket_idx % HashBucket::kNumEntries].store(
+      HashBucketEntry{ rng() & ~uint64_t{ 7 } });
+  }
+  {
+    std::ofstream out{ "test_ht_dense/test_ht.dat", std::ios::binary };
+    out.write(reinterpret_cast<const char*>(&table.bucket(0)), kNumBuckets * sizeof(HashBucket));
+  }
+
+  for(IndexLoadMode load_mode : { IndexLoadMode::Read, IndexLoadMode::Map }) {
+    LightEpoch epoch;
+    disk_t recover_disk{ "test_ht_dense", epoch };
+    InternalHashTable<disk_t> recover_table{};
+    file_t recover_file = recover_disk.NewFile("test_ht.dat");
+    ASSERT_EQ(Status::Ok, recover_file.Open(&recover_disk.handler()));
+    ASSERT_EQ(Status::Ok, recover_table.Recover(recover_disk, std::move(recover_file),
+              kNumBuckets * sizeof(HashBucket), false, load_mode));
+    ASSERT_EQ(Status::Ok, recover_table.RecoverComplete(true));
+
+    for(uint64_t bucket_idx = 0; bucket_idx < kNumBuckets; ++bucket_idx) {
+      for(uint32_t entry_idx = 0; entry_idx < HashBucket::kNumEntries; ++entry_idx) {
+        ASSERT_EQ(table.bucket(bucket_idx).entries[entry_idx].load().control_,
+                  recover_table.bucket(bucket_idx).entries[entry_idx].load().control_);
+      }
+    }
+  }
+}
+
+TEST(CLASS, CheckpointMetadata_Legacy) {
+  // Metadata files from before the header still read; files with another layout don't.
+  std::experimental::filesystem::create_directories("test_metadata");
+  LegacyIndexMetadata legacy{ 3, 1024, 1024 * sizeof(HashBucket), 0, FixedPageAddress{ 1 },
+                              Address{ 64 }, Address{ 4096 } };
+  {
+    std::ofstream out{ "test_metadata/legacy.dat", std::ios::binary };
+    out.write(reinterpret_cast<const char*>(&legacy), sizeof(legacy));
+  }
+  IndexMetadata metadata;
+  ASSERT_EQ(Status::Ok, ReadCheckpointMetadata("test_metadata/legacy.dat", metadata));
+  ASSERT_EQ(3, metadata.version);
+  ASSERT_EQ(1024, metadata.table_size);
+  ASSERT_EQ(1024 * sizeof(HashBucket), metadata.num_ht_bytes);
+  ASSERT_EQ(Address{ 4096 }, metadata.checkpoint_start_address);
+  ASSERT_FALSE(metadata.incremental());
+  ASSERT_EQ(0, metadata.key_hash_id);
+
+  metadata.base_index_token = Guid::Create();
+  ASSERT_EQ(Status::Ok, WriteCheckpointMetadata("test_metadata/current.dat", metadata));
+  IndexMetadata read_back;
+  ASSERT_EQ(Status::Ok, ReadCheckpointMetadata("test_metadata/current.dat", read_back));
+  ASSERT_EQ(metadata.base_index_token, read_back.base_index_token);
+
+  // (An index metadata file isn't log metadata.)
+  LogMetadata log_metadata;
+  ASSERT_EQ(Status::Corruption, ReadCheckpointMetadata("test_metadata/current.dat",
+            log_metadata));
+}
+
 TEST(CLASS, Serial) {
   class Key {
    public:
@@ -3466,3 +3724,1125 @@ TEST(CLASS, Concurrent_Rmw_Large) {
   ASSERT_GT(records_read, (uint32_t)0);
   ASSERT_LE(records_read, kNumRecords);
 }
+
+/// A 256-byte value, for tests whose logs need to span several pages.
+class PaddedValue {
+ public:
+  PaddedValue()
+    : value{ 0 } {
+  }
+  PaddedValue(const PaddedValue& other)
+    : value{ other.value } {
+  }
+
+  inline static constexpr uint32_t size() {
+    return static_cast<uint32_t>(sizeof(PaddedValue));
+  }
+
+  union {
+    uint64_t value;
+    std::atomic<uint64_t> atomic_value;
+  };
+  uint8_t padding[248];
+};
+
+/// Upserts an 8-byte key, with the given value (by default, the key itself), for the tests
+/// below; V is SimpleAtomicValue<uint64_t> or PaddedValue, and K a FixedSizeKey<uint64_t>.
+template <class V, class K = FixedSizeKey<uint64_t>>
+class KeyValueUpsertContext : public IAsyncContext {
+ public:
+  typedef K key_t;
+  typedef V value_t;
+
+  KeyValueUpsertContext(uint64_t key)
+    : key_{ key }
+    , value_{ key } {
+  }
+  KeyValueUpsertContext(uint64_t key, uint64_t value)
+    : key_{ key }
+    , value_{ value } {
+  }
+  /// Copy (and deep-copy) constructor.
+  KeyValueUpsertContext(const KeyValueUpsertContext& other)
+    : key_{ other.key_ }
+    , value_{ other.value_ } {
+  }
+
+  inline const key_t& key() const {
+    return key_;
+  }
+  inline static constexpr uint32_t value_size() {
+    return sizeof(value_t);
+  }
+  inline void Put(value_t& value) {
+    value.value = value_;
+  }
+  inline bool PutAtomic(value_t& value) {
+    value.atomic_value.store(value_);
+    return true;
+  }
+
+ protected:
+  Status DeepCopy_Internal(IAsyncContext*& context_copy) {
+    return IAsyncContext::DeepCopy_Internal(*this, context_copy);
+  }
+
+ private:
+  key_t key_;
+  uint64_t value_;
+};
+
+/// Reads an 8-byte key's value, for the tests below.
+template <class V, class K = FixedSizeKey<uint64_t>>
+class KeyValueReadContext : public IAsyncContext {
+ public:
+  typedef K key_t;
+  typedef V value_t;
+
+  KeyValueReadContext(uint64_t key)
+    : key_{ key }
+    , output{ 0 } {
+  }
+  /// Copy (and deep-copy) constructor.
+  KeyValueReadContext(const KeyValueReadContext& other)
+    : key_{ other.key_ }
+    , output{ other.output } {
+  }
+
+  inline const key_t& key() const {
+    return key_;
+  }
+  inline void Get(const value_t& value) {
+    output = value.value;
+  }
+  inline void GetAtomic(const value_t& value) {
+    output = value.atomic_value.load();
+  }
+
+ protected:
+  Status DeepCopy_Internal(IAsyncContext*& context_copy) {
+    return IAsyncContext::DeepCopy_Internal(*this, context_copy);
+  }
+
+ private:
+  key_t key_;
+ public:
+  uint64_t output;
+};
+
+TEST(CLASS, IncrementalIndexCheckpoint) {
+  typedef FixedSizeKey<uint64_t> Key;
+  typedef SimpleAtomicValue<uint64_t> Value;
+  typedef KeyValueUpsertContext<Value> UpsertContext;
+  typedef KeyValueReadContext<Value> ReadContext;
+  typedef FasterKv<Key, Value, disk_t> store_t;
+  // (Key hashes are the keys, so each batch of keys fills a contiguous range of buckets.)
+  constexpr uint64_t kTableSize = 1 << 20;
+  constexpr uint64_t kNumBaseRecords = 100000;
+  constexpr uint64_t kFirstDeltaKey = 500000;
+  constexpr uint64_t kNumDeltaRecords = 1000;
+
+  std::experimental::filesystem::remove_all("storage_incremental");
+  std::experimental::filesystem::create_directories("storage_incremental");
+
+  static std::atomic<bool> hybrid_log_checkpoint_completed;
+  auto hybrid_log_persistence_callback = [](Status result, uint64_t persistent_serial_num) {
+    ASSERT_EQ(Status::Ok, result);
+    hybrid_log_checkpoint_completed = true;
+  };
+  auto upsert_callback = [](IAsyncContext* ctxt, Status result) {
+    ASSERT_TRUE(false);
+  };
+
+  Guid session_id;
+  Guid base_token;
+  Guid delta_token;
+  {
+    store_t store{ kTableSize, 268435456, "storage_incremental", 0.4 };
+    session_id = store.StartSession();
+    for(uint64_t key = 0; key < kNumBaseRecords; ++key) {
+      UpsertContext context{ key, key + 1 };
+      ASSERT_EQ(Status::Ok, store.Upsert(context, upsert_callback, 1));
+    }
+    // The first checkpoint is a full one, even when asked for an incremental checkpoint.
+    hybrid_log_checkpoint_completed = false;
+    ASSERT_TRUE(store.Checkpoint(nullptr, hybrid_log_persistence_callback, base_token, true));
+    while(!hybrid_log_checkpoint_completed) {
+      store.CompletePending(false);
+    }
+
+    for(uint64_t key = kFirstDeltaKey; key < kFirstDeltaKey + kNumDeltaRecords; ++key) {
+      UpsertContext context{ key, key + 1 };
+      ASSERT_EQ(Status::Ok, store.Upsert(context, upsert_callback, 2));
+    }
+    hybrid_log_checkpoint_completed = false;
+    ASSERT_TRUE(store.Checkpoint(nullptr, hybrid_log_persistence_callback, delta_token, true));
+    while(!hybrid_log_checkpoint_completed) {
+      store.CompletePending(false);
+    }
+    ASSERT_TRUE(store.CompletePending(true));
+    store.StopSession();
+
+    uint64_t base_size = std::experimental::filesystem::file_size(
+                           store.disk.index_checkpoint_path(base_token) + "ht.dat");
+    uint64_t delta_size = std::experimental::filesystem::file_size(
+                            store.disk.index_checkpoint_path(delta_token) + "ht.dat");
+    ASSERT_LT(delta_size, base_size / 4);
+  }
+
+  // Recovering from the incremental checkpoint also reads its base.
+  store_t new_store{ kTableSize, 268435456, "storage_incremental", 0.4 };
+  uint32_t version;
+  std::vector<Guid> session_ids;
+  ASSERT_EQ(Status::Ok, new_store.Recover(delta_token, delta_token, version, session_ids));
+  ASSERT_EQ(1, session_ids.size());
+  ASSERT_EQ(2, new_store.ContinueSession(session_id));
+
+  static std::atomic<uint64_t> records_read;
+  records_read = 0;
+  auto read_callback = [](IAsyncContext* ctxt, Status result) {
+    CallbackContext<ReadContext> context{ ctxt };
+    ASSERT_EQ(Status::Ok, result);
+    ASSERT_EQ(context->key().key + 1, context->output);
+    ++records_read;
+  };
+  auto read = [&](uint64_t key) {
+    ReadContext context{ key };
+    Status result = new_store.Read(context, read_callback, 3);
+    if(result == Status::Ok) {
+      ASSERT_EQ(key + 1, context.output);
+      ++records_read;
+    } else {
+      ASSERT_EQ(Status::Pending, result);
+    }
+  };
+  for(uint64_t key = 0; key < kNumBaseRecords; ++key) {
+    read(key);
+  }
+  for(uint64_t key = kFirstDeltaKey; key < kFirstDeltaKey + kNumDeltaRecords; ++key) {
+    read(key);
+  }
+  ASSERT_TRUE(new_store.CompletePending(true));
+  ASSERT_EQ(kNumBaseRecords + kNumDeltaRecords, records_read.load());
+  new_store.StopSession();
+}
+
+TEST(CLASS, ParallelReplay) {
+  typedef FixedSizeKey<uint64_t> Key;
+  typedef PaddedValue Value;
+  typedef KeyValueUpsertContext<Value> UpsertContext;
+  typedef KeyValueReadContext<Value> ReadContext;
+  typedef FasterKv<Key, Value, disk_t> store_t;
+  // Every round rewrites every key to a new record: about a million records, or 8 pages, between
+  // the index checkpoint and the log checkpoint; the store holds 6 pages in memory.
+  static constexpr uint64_t kNumRecords = 16384;
+  static constexpr uint64_t kNumRounds = 64;
+
+  std::experimental::filesystem::remove_all("storage_parallel");
+  std::experimental::filesystem::create_directories("storage_parallel");
+
+  static std::atomic<bool> index_checkpoint_completed;
+  index_checkpoint_completed = false;
+  auto index_persistence_callback = [](Status result) {
+    ASSERT_EQ(Status::Ok, result);
+    index_checkpoint_completed = true;
+  };
+  static std::atomic<bool> hybrid_log_checkpoint_completed;
+  hybrid_log_checkpoint_completed = false;
+  auto hybrid_log_persistence_callback = [](Status result, uint64_t persistent_serial_num) {
+    ASSERT_EQ(Status::Ok, result);
+    hybrid_log_checkpoint_completed = true;
+  };
+  auto upsert_callback = [](IAsyncContext* ctxt, Status result) {
+    ASSERT_TRUE(false);
+  };
+
+  Guid session_id;
+  Guid index_token;
+  Guid hybrid_log_token;
+  {
+    store_t store{ 65536, 201326592, "storage_parallel", 0.4 };
+    session_id = store.StartSession();
+    for(uint64_t key = 0; key < kNumRecords; ++key) {
+      UpsertContext context{ key, 0 };
+      ASSERT_EQ(Status::Ok, store.Upsert(context, upsert_callback, 1));
+    }
+    ASSERT_TRUE(store.CheckpointIndex(index_persistence_callback, index_token));
+    while(!index_checkpoint_completed) {
+      store.CompletePending(false);
+    }
+
+    for(uint64_t round = 1; round <= kNumRounds; ++round) {
+      Address tail = store.hlog.ShiftReadOnlyToTail();
+      while(store.hlog.safe_read_only_address.load() < tail) {
+        store.Refresh();
+      }
+      for(uint64_t key = 0; key < kNumRecords; ++key) {
+        if(key % 256 == 0) {
+          store.Refresh();
+        }
+        UpsertContext context{ key, round };
+        ASSERT_EQ(Status::Ok, store.Upsert(context, upsert_callback, round + 1));
+      }
+    }
+    ASSERT_TRUE(store.CheckpointHybridLog(hybrid_log_persistence_callback, hybrid_log_token));
+    while(!hybrid_log_checkpoint_completed) {
+      store.CompletePending(false);
+    }
+    ASSERT_TRUE(store.CompletePending(true));
+    store.StopSession();
+  }
+
+  // Pages are replayed on four threads; each key's entry ends up at its latest record.
+  store_t new_store{ 65536, 201326592, "storage_parallel", 0.4 };
+  uint32_t version;
+  std::vector<Guid> session_ids;
+  ASSERT_EQ(Status::Ok, new_store.Recover(index_token, hybrid_log_token, version, session_ids,
+                                          4));
+  ASSERT_EQ(1, session_ids.size());
+  ASSERT_EQ(kNumRounds + 1, new_store.ContinueSession(session_id));
+
+  static std::atomic<uint64_t> records_read;
+  records_read = 0;
+  auto read_callback = [](IAsyncContext* ctxt, Status result) {
+    CallbackContext<ReadContext> context{ ctxt };
+    ASSERT_EQ(Status::Ok, result);
+    ASSERT_EQ(kNumRounds, context->output);
+    ++records_read;
+  };
+  for(uint64_t key = 0; key < kNumRecords; ++key) {
+    ReadContext context{ key };
+    Status result = new_store.Read(context, read_callback, kNumRounds + 2);
+    if(result == Status::Ok) {
+      ASSERT_EQ(kNumRounds, context.output);
+      ++records_read;
+    } else {
+      ASSERT_EQ(Status::Pending, result);
+    }
+  }
+  ASSERT_TRUE(new_store.CompletePending(true));
+  ASSERT_EQ(kNumRecords, records_read.load());
+  new_store.StopSession();
+}
+
+TEST(CLASS, LazyRecovery) {
+  typedef FixedSizeKey<uint64_t> Key;
+  typedef PaddedValue Value;
+  typedef KeyValueUpsertContext<Value> UpsertContext;
+  typedef KeyValueReadContext<Value> ReadContext;
+  typedef FasterKv<Key, Value, disk_t> store_t;
+  // Key k is upserted with serial number k + 1. The first kNumBaseRecords keys precede the
+  // checkpoint; the rest, about 2 pages of records, are appended while it runs. (The table is
+  // large enough that most buckets don't see any of them.)
+  static constexpr uint64_t kTableSize = 1 << 20;
+  static constexpr uint64_t kNumBaseRecords = 16384;
+  static constexpr uint64_t kNumRecords = 1 << 18;
+
+  std::experimental::filesystem::remove_all("storage_lazy");
+  std::experimental::filesystem::create_directories("storage_lazy");
+
+  static std::atomic<bool> index_checkpoint_completed;
+  index_checkpoint_completed = false;
+  auto index_persistence_callback = [](Status result) {
+    ASSERT_EQ(Status::Ok, result);
+    index_checkpoint_completed = true;
+  };
+  static std::atomic<bool> hybrid_log_checkpoint_completed;
+  hybrid_log_checkpoint_completed = false;
+  static std::atomic<uint64_t> persistent_serial_num;
+  auto hybrid_log_persistence_callback = [](Status result, uint64_t persistent_serial_num_) {
+    ASSERT_EQ(Status::Ok, result);
+    persistent_serial_num = persistent_serial_num_;
+    hybrid_log_checkpoint_completed = true;
+  };
+  auto upsert_callback = [](IAsyncContext* ctxt, Status result) {
+    ASSERT_TRUE(false);
+  };
+
+  Guid session_id;
+  Guid token;
+  {
+    store_t store{ kTableSize, 201326592, "storage_lazy", 0.4 };
+    session_id = store.StartSession();
+    for(uint64_t key = 0; key < kNumBaseRecords; ++key) {
+      UpsertContext context{ key };
+      ASSERT_EQ(Status::Ok, store.Upsert(context, upsert_callback, key + 1));
+    }
+    ASSERT_TRUE(store.Checkpoint(index_persistence_callback, hybrid_log_persistence_callback,
+                                 token));
+    // (Without completing I/Os, the checkpoint can't get past the index checkpoint; the keys
+    // upserted in the meantime all land in the fuzzy region.)
+    for(uint64_t key = kNumBaseRecords; key < kNumRecords; ++key) {
+      UpsertContext context{ key };
+      Status result = store.Upsert(context, upsert_callback, key + 1);
+      ASSERT_TRUE(result == Status::Ok || result == Status::Pending);
+    }
+    while(!index_checkpoint_completed || !hybrid_log_checkpoint_completed) {
+      store.CompletePending(false);
+    }
+    ASSERT_TRUE(store.CompletePending(true));
+    store.StopSession();
+  }
+  ASSERT_GT(persistent_serial_num.load(), kNumBaseRecords);
+
+  // Recover() returns before the fuzzy region has been replayed; reads of the keys whose buckets
+  // it touched go pending until it has.
+  store_t new_store{ kTableSize, 201326592, "storage_lazy", 0.4 };
+  uint32_t version;
+  std::vector<Guid> session_ids;
+  ASSERT_EQ(Status::Ok, new_store.Recover(token, token, version, session_ids, 4, true));
+  ASSERT_EQ(1, session_ids.size());
+  ASSERT_EQ(persistent_serial_num.load(), new_store.ContinueSession(session_id));
+
+  static std::atomic<uint64_t> records_read;
+  records_read = 0;
+  auto read_callback = [](IAsyncContext* ctxt, Status result) {
+    CallbackContext<ReadContext> context{ ctxt };
+    if(context->key().key < persistent_serial_num.load()) {
+      ASSERT_EQ(Status::Ok, result);
+      ASSERT_EQ(context->key().key, context->output);
+    } else {
+      ASSERT_EQ(Status::NotFound, result);
+    }
+    ++records_read;
+  };
+  for(uint64_t key = 0; key < kNumRecords; ++key) {
+    if(key % 1024 == 0) {
+      new_store.CompletePending(false);
+    }
+    ReadContext context{ key };
+    Status result = new_store.Read(context, read_callback, persistent_serial_num.load() + 1);
+    if(result == Status::Pending) {
+      continue;
+    }
+    if(key < persistent_serial_num.load()) {
+      ASSERT_EQ(Status::Ok, result);
+      ASSERT_EQ(key, context.output);
+    } else {
+      ASSERT_EQ(Status::NotFound, result);
+    }
+    ++records_read;
+  }
+  ASSERT_TRUE(new_store.CompletePending(true));
+  ASSERT_EQ(kNumRecords, records_read.load());
+  ASSERT_EQ(Status::Ok, new_store.CompleteRecovery(true));
+  new_store.StopSession();
+}
+
+TEST(CLASS, DeltaSnapshot) {
+  typedef FixedSizeKey<uint64_t> Key;
+  typedef PaddedValue Value;
+  typedef KeyValueUpsertContext<Value> UpsertContext;
+  typedef KeyValueReadContext<Value> ReadContext;
+  typedef FasterKv<Key, Value, disk_t> store_t;
+  // The records fill about two pages and a bit. The first delta updates keys (in place) on the
+  // second page, and the second delta keys on the third page; key k's value is k, or k + 1 once
+  // updated.
+  constexpr uint64_t kTableSize = 1 << 20;
+  constexpr uint64_t kNumRecords = 1 << 18;
+  constexpr uint64_t kFirstDeltaKey = 130000;
+  constexpr uint64_t kSecondDeltaKey = 250000;
+  constexpr uint64_t kNumDeltaRecords = 1000;
+
+  std::experimental::filesystem::remove_all("storage_delta");
+  std::experimental::filesystem::create_directories("storage_delta");
+
+  static std::atomic<bool> hybrid_log_checkpoint_completed;
+  auto hybrid_log_persistence_callback = [](Status result, uint64_t persistent_serial_num) {
+    ASSERT_EQ(Status::Ok, result);
+    hybrid_log_checkpoint_completed = true;
+  };
+  auto upsert_callback = [](IAsyncContext* ctxt, Status result) {
+    ASSERT_TRUE(false);
+  };
+  auto updated = [&](uint64_t key) {
+    return (key >= kFirstDeltaKey && key < kFirstDeltaKey + kNumDeltaRecords) ||
+           (key >= kSecondDeltaKey && key < kSecondDeltaKey + kNumDeltaRecords);
+  };
+
+  Guid session_id;
+  Guid tokens[3];
+  {
+    store_t store{ kTableSize, 268435456, "storage_delta", 0.4 };
+    session_id = store.StartSession();
+    auto checkpoint = [&](Guid& token, LogCheckpointType log_checkpoint_type) {
+      hybrid_log_checkpoint_completed = false;
+      ASSERT_TRUE(store.Checkpoint(nullptr, hybrid_log_persistence_callback, token, false,
+                                   log_checkpoint_type));
+      while(!hybrid_log_checkpoint_completed) {
+        store.CompletePending(false);
+      }
+    };
+
+    for(uint64_t key = 0; key < kNumRecords; ++key) {
+      UpsertContext context{ key, key };
+      ASSERT_EQ(Status::Ok, store.Upsert(context, upsert_callback, 1));
+    }
+    // The first delta snapshot is a full one.
+    checkpoint(tokens[0], LogCheckpointType::DeltaSnapshot);
+
+    for(uint64_t key = kFirstDeltaKey; key < kFirstDeltaKey + kNumDeltaRecords; ++key) {
+      UpsertContext context{ key, key + 1 };
+      ASSERT_EQ(Status::Ok, store.Upsert(context, upsert_callback, 2));
+    }
+    checkpoint(tokens[1], LogCheckpointType::DeltaSnapshot);
+
+    for(uint64_t key = kSecondDeltaKey; key < kSecondDeltaKey + kNumDeltaRecords; ++key) {
+      UpsertContext context{ key, key + 1 };
+      ASSERT_EQ(Status::Ok, store.Upsert(context, upsert_callback, 3));
+    }
+    checkpoint(tokens[2], LogCheckpointType::DeltaSnapshot);
+    ASSERT_TRUE(store.CompletePending(true));
+    store.StopSession();
+
+    // Each delta holds just the one page that was updated.
+    uint64_t base_size = std::experimental::filesystem::file_size(
+                           store.disk.cpr_checkpoint_path(tokens[0]) + "snapshot.dat");
+    ASSERT_EQ(3 * store_t::hlog_t::kPageSize, base_size);
+    for(uint32_t idx = 1; idx < 3; ++idx) {
+      uint64_t delta_size = std::experimental::filesystem::file_size(
+                              store.disk.cpr_checkpoint_path(tokens[idx]) + "snapshot.dat");
+      ASSERT_EQ(store_t::hlog_t::kPageSize, delta_size);
+    }
+  }
+
+  // Recovering from the last delta takes its page from it, and the others from the first delta
+  // and the base.
+  store_t new_store{ kTableSize, 268435456, "storage_delta", 0.4 };
+  uint32_t version;
+  std::vector<Guid> session_ids;
+  ASSERT_EQ(Status::Ok, new_store.Recover(tokens[2], tokens[2], version, session_ids));
+  ASSERT_EQ(1, session_ids.size());
+  ASSERT_EQ(3, new_store.ContinueSession(session_id));
+
+  static std::atomic<uint64_t> records_read;
+  records_read = 0;
+  auto read_callback = [](IAsyncContext* ctxt, Status result) {
+    CallbackContext<ReadContext> context{ ctxt };
+    uint64_t key = context->key().key;
+    ASSERT_EQ(Status::Ok, result);
+    ASSERT_EQ((key >= kFirstDeltaKey && key < kFirstDeltaKey + kNumDeltaRecords) ||
+              (key >= kSecondDeltaKey && key < kSecondDeltaKey + kNumDeltaRecords) ?
+              key + 1 : key, context->output);
+    ++records_read;
+  };
+  for(uint64_t key = 0; key < kNumRecords; ++key) {
+    ReadContext context{ key };
+    Status result = new_store.Read(context, read_callback, 4);
+    if(result == Status::Ok) {
+      ASSERT_EQ(updated(key) ? key + 1 : key, context.output);
+      ++records_read;
+    } else {
+      ASSERT_EQ(Status::Pending, result);
+    }
+  }
+  ASSERT_TRUE(new_store.CompletePending(true));
+  ASSERT_EQ(kNumRecords, records_read.load());
+  new_store.StopSession();
+}
+
+TEST(CLASS, ParkedSessions) {
+  typedef FixedSizeKey<uint64_t> Key;
+  typedef SimpleAtomicValue<uint64_t> Value;
+  typedef KeyValueUpsertContext<Value> UpsertContext;
+  typedef FasterKv<Key, Value, disk_t> store_t;
+  constexpr uint64_t kNumRecords = 1000;
+
+  std::experimental::filesystem::remove_all("storage_parked");
+  std::experimental::filesystem::create_directories("storage_parked");
+
+  static std::atomic<uint32_t> num_callbacks;
+  static std::atomic<uint32_t> num_parked_callbacks;
+  num_callbacks = 0;
+  num_parked_callbacks = 0;
+  auto hybrid_log_persistence_callback = [](Status result, uint64_t persistent_serial_num) {
+    ASSERT_EQ(Status::Ok, result);
+    if(persistent_serial_num == kNumRecords / 2) {
+      // The parked session's serial number, as of parking.
+      ++num_parked_callbacks;
+    }
+    ++num_callbacks;
+  };
+  static std::atomic<bool> grown;
+  grown = false;
+  auto grow_callback = [](uint64_t new_size) {
+    grown = true;
+  };
+  auto upsert_callback = [](IAsyncContext* ctxt, Status result) {
+    ASSERT_TRUE(false);
+  };
+
+  Guid parked_session_id;
+  Guid session_id;
+  Guid token;
+  uint64_t serial_num = 1 << 20;
+  {
+    store_t store{ 1024, 1073741824, "storage_parked" };
+    std::atomic<bool> parked{ false };
+    std::atomic<bool> resume{ false };
+
+    // This session upserts half the keys, then parks, and sits idle while the other session
+    // checkpoints the store and grows the index.
+    std::thread thread{ [&]() {
+      parked_session_id = store.StartSession();
+      for(uint64_t key = 0; key < kNumRecords / 2; ++key) {
+        UpsertContext context{ key };
+        ASSERT_EQ(Status::Ok, store.Upsert(context, upsert_callback, key + 1));
+      }
+      store.ParkSession();
+      parked = true;
+      while(!resume) {
+        std::this_thread::yield();
+      }
+      store.UnparkSession();
+      for(uint64_t key = 0; key < kNumRecords / 2; ++key) {
+        UpsertContext context{ key };
+        ASSERT_EQ(Status::Ok, store.Upsert(context, upsert_callback, kNumRecords + key + 1));
+      }
+      store.StopSession();
+    } };
+
+    session_id = store.StartSession();
+    for(uint64_t key = kNumRecords / 2; key < kNumRecords; ++key) {
+      UpsertContext context{ key };
+      ASSERT_EQ(Status::Ok, store.Upsert(context, upsert_callback, ++serial_num));
+    }
+    while(!parked) {
+      std::this_thread::yield();
+    }
+
+    // The checkpoint completes without the parked session, but still covers it.
+    ASSERT_TRUE(store.Checkpoint(nullptr, hybrid_log_persistence_callback, token));
+    while(num_callbacks < 2) {
+      store.CompletePending(false);
+    }
+    ASSERT_TRUE(store.CompletePending(true));
+    ASSERT_EQ(1, num_parked_callbacks.load());
+
+    ASSERT_TRUE(store.GrowIndex(grow_callback));
+    ASSERT_TRUE(store.CompletePending(true));
+    ASSERT_TRUE(grown);
+
+    // With both sessions parked, this thread drives the next checkpoint itself.
+    store.ParkSession();
+    Guid hybrid_log_token;
+    ASSERT_TRUE(store.CheckpointHybridLog(hybrid_log_persistence_callback, hybrid_log_token));
+    ASSERT_TRUE(store.CompleteAction(true));
+    ASSERT_EQ(4, num_callbacks.load());
+    ASSERT_EQ(2, num_parked_callbacks.load());
+    store.UnparkSession();
+
+    resume = true;
+    thread.join();
+    store.StopSession();
+  }
+
+  store_t new_store{ 1024, 1073741824, "storage_parked" };
+  uint32_t version;
+  std::vector<Guid> session_ids;
+  ASSERT_EQ(Status::Ok, new_store.Recover(token, token, version, session_ids));
+  ASSERT_EQ(2, session_ids.size());
+  ASSERT_EQ(kNumRecords / 2, new_store.ContinueSession(parked_session_id));
+  new_store.StopSession();
+  ASSERT_EQ(serial_num, new_store.ContinueSession(session_id));
+  new_store.StopSession();
+}
+
+TEST(CLASS, MaintenancePool) {
+  typedef FixedSizeKey<uint64_t> Key;
+  typedef SimpleAtomicValue<uint64_t> Value;
+  typedef KeyValueUpsertContext<Value> UpsertContext;
+  typedef KeyValueReadContext<Value> ReadContext;
+  typedef FasterKv<Key, Value, disk_t> store_t;
+  // Each key is upserted twice; the first copies are truncated away before the index grows and
+  // is checkpointed, all with the pool's threads doing the work.
+  static constexpr uint64_t kNumRecords = 1 << 16;
+  static constexpr uint32_t kNumMaintenanceThreads = 2;
+
+  std::experimental::filesystem::remove_all("storage_pool");
+  std::experimental::filesystem::create_directories("storage_pool");
+
+  static std::atomic<uint32_t> num_callbacks;
+  num_callbacks = 0;
+  auto index_persistence_callback = [](Status result) {
+    ASSERT_EQ(Status::Ok, result);
+    ++num_callbacks;
+  };
+  auto hybrid_log_persistence_callback = [](Status result, uint64_t persistent_serial_num) {
+    ASSERT_EQ(Status::Ok, result);
+    ++num_callbacks;
+  };
+  static std::atomic<bool> complete;
+  complete = false;
+  auto truncate_callback = [](uint64_t offset) {};
+  auto complete_callback = []() {
+    complete = true;
+  };
+  static std::atomic<bool> grown;
+  grown = false;
+  auto grow_callback = [](uint64_t new_size) {
+    grown = true;
+  };
+  auto upsert_callback = [](IAsyncContext* ctxt, Status result) {
+    ASSERT_TRUE(false);
+  };
+  auto read_callback = [](IAsyncContext* ctxt, Status result) {
+    ASSERT_TRUE(false);
+  };
+
+  Guid session_id;
+  Guid token;
+  uint64_t serial_num = 0;
+  {
+    store_t store{ 1024, 1073741824, "storage_pool", 0.9, false, false, kNumMaintenanceThreads };
+    session_id = store.StartSession();
+    for(uint64_t key = 0; key < kNumRecords; ++key) {
+      UpsertContext context{ key, key };
+      ASSERT_EQ(Status::Ok, store.Upsert(context, upsert_callback, ++serial_num));
+    }
+    // (The checkpoint flushes the first copies, so that there's a log file to truncate.)
+    Guid first_token;
+    ASSERT_TRUE(store.Checkpoint(index_persistence_callback, hybrid_log_persistence_callback,
+                                 first_token));
+    while(num_callbacks < 2) {
+      store.CompletePending(false);
+    }
+    ASSERT_TRUE(store.CompletePending(true));
+    Address begin_address = store.hlog.GetTailAddress();
+    for(uint64_t key = 0; key < kNumRecords; ++key) {
+      UpsertContext context{ key, key * 2 };
+      ASSERT_EQ(Status::Ok, store.Upsert(context, upsert_callback, ++serial_num));
+    }
+
+    ASSERT_TRUE(store.ShiftBeginAddress(begin_address, truncate_callback, complete_callback));
+    while(!complete) {
+      store.CompletePending(false);
+    }
+    ASSERT_TRUE(store.CompletePending(true));
+    ASSERT_TRUE(store.GrowIndex(grow_callback));
+    ASSERT_TRUE(store.CompletePending(true));
+    ASSERT_TRUE(grown);
+
+    ASSERT_TRUE(store.Checkpoint(index_persistence_callback, hybrid_log_persistence_callback,
+                                 token));
+    while(num_callbacks < 4) {
+      store.CompletePending(false);
+    }
+    ASSERT_TRUE(store.CompletePending(true));
+
+    for(uint64_t key = 0; key < kNumRecords; ++key) {
+      ReadContext context{ key };
+      ASSERT_EQ(Status::Ok, store.Read(context, read_callback, ++serial_num));
+      ASSERT_EQ(key * 2, context.output);
+    }
+    store.StopSession();
+  }
+
+  store_t new_store{ 2048, 1073741824, "storage_pool", 0.9, false, false,
+                     kNumMaintenanceThreads };
+  uint32_t version;
+  std::vector<Guid> session_ids;
+  ASSERT_EQ(Status::Ok, new_store.Recover(token, token, version, session_ids, 4));
+  ASSERT_EQ(1, session_ids.size());
+  ASSERT_EQ(2 * kNumRecords, new_store.ContinueSession(session_id));
+  for(uint64_t key = 0; key < kNumRecords; ++key) {
+    ReadContext context{ key };
+    ASSERT_EQ(Status::Ok, new_store.Read(context, read_callback, key + 1));
+    ASSERT_EQ(key * 2, context.output);
+  }
+  new_store.StopSession();
+}
+
+TEST(CLASS, RecoverWithOlderIndexCheckpoint) {
+  typedef FixedSizeKey<uint64_t> Key;
+  typedef SimpleAtomicValue<uint64_t> Value;
+  typedef KeyValueUpsertContext<Value> UpsertContext;
+  typedef KeyValueReadContext<Value> ReadContext;
+  typedef FasterKv<Key, Value, disk_t> store_t;
+  // A full checkpoint follows the first kNumKeys upserts, and a hybrid-log checkpoint alone
+  // follows the next kNumKeys; recovery pairs the first checkpoint's index with the second
+  // checkpoint's log. Key k is upserted with serial number k + 1.
+  static constexpr uint64_t kNumKeys = 1000;
+
+  std::experimental::filesystem::remove_all("storage_older_index");
+  std::experimental::filesystem::create_directories("storage_older_index");
+
+  static std::atomic<uint32_t> num_callbacks;
+  num_callbacks = 0;
+  auto index_persistence_callback = [](Status result) {
+    ASSERT_EQ(Status::Ok, result);
+    ++num_callbacks;
+  };
+  auto hybrid_log_persistence_callback = [](Status result, uint64_t persistent_serial_num) {
+    ASSERT_EQ(Status::Ok, result);
+    ++num_callbacks;
+  };
+  auto upsert_callback = [](IAsyncContext* ctxt, Status result) {
+    ASSERT_TRUE(false);
+  };
+  auto read_callback = [](IAsyncContext* ctxt, Status result) {
+    ASSERT_TRUE(false);
+  };
+
+  Guid session_id;
+  Guid token;
+  Guid hybrid_log_token;
+  Guid later_index_token;
+  {
+    store_t store{ 1024, 1073741824, "storage_older_index" };
+    session_id = store.StartSession();
+    for(uint64_t key = 0; key < kNumKeys; ++key) {
+      UpsertContext context{ key, key };
+      ASSERT_EQ(Status::Ok, store.Upsert(context, upsert_callback, key + 1));
+    }
+    ASSERT_TRUE(store.Checkpoint(index_persistence_callback, hybrid_log_persistence_callback,
+                                 token));
+    while(num_callbacks < 2) {
+      store.CompletePending(false);
+    }
+    ASSERT_TRUE(store.CompletePending(true));
+
+    for(uint64_t key = kNumKeys; key < 2 * kNumKeys; ++key) {
+      UpsertContext context{ key, key };
+      ASSERT_EQ(Status::Ok, store.Upsert(context, upsert_callback, key + 1));
+    }
+    ASSERT_TRUE(store.CheckpointHybridLog(hybrid_log_persistence_callback, hybrid_log_token));
+    while(num_callbacks < 3) {
+      store.CompletePending(false);
+    }
+    ASSERT_TRUE(store.CompletePending(true));
+
+    // An index checkpoint taken after the hybrid-log checkpoint can't recover with it.
+    ASSERT_TRUE(store.CheckpointIndex(index_persistence_callback, later_index_token));
+    while(num_callbacks < 4) {
+      store.CompletePending(false);
+    }
+    ASSERT_TRUE(store.CompletePending(true));
+    store.StopSession();
+  }
+
+  uint32_t version;
+  std::vector<Guid> session_ids;
+  {
+    store_t new_store{ 1024, 1073741824, "storage_older_index" };
+    ASSERT_EQ(Status::Corruption, new_store.Recover(later_index_token, hybrid_log_token, version,
+              session_ids));
+  }
+
+  store_t new_store{ 1024, 1073741824, "storage_older_index" };
+  ASSERT_EQ(Status::Ok, new_store.Recover(token, hybrid_log_token, version, session_ids));
+  ASSERT_EQ(1, session_ids.size());
+  ASSERT_EQ(2 * kNumKeys, new_store.ContinueSession(session_id));
+  for(uint64_t key = 0; key < 2 * kNumKeys; ++key) {
+    ReadContext context{ key };
+    ASSERT_EQ(Status::Ok, new_store.Read(context, read_callback, key + 1));
+    ASSERT_EQ(key, context.output);
+  }
+  new_store.StopSession();
+}
+
+TEST(CLASS, GroupCommit) {
+  typedef FixedSizeKey<uint64_t> Key;
+  typedef SimpleAtomicValue<uint64_t> Value;
+  typedef KeyValueUpsertContext<Value> UpsertContext;
+  typedef KeyValueReadContext<Value> ReadContext;
+  typedef FasterKv<Key, Value, disk_t> store_t;
+  // Each session commits a few rounds of upserts, all of which fit on the log's tail page; so each
+  // commit flushes a partial page. Session s upserts keys s * kNumKeys + [0, kNumKeys), with
+  // serial numbers key + 1, within the session's range.
+  static constexpr uint32_t kNumSessions = 4;
+  static constexpr uint64_t kNumKeys = 256;
+  static constexpr uint64_t kNumRounds = 4;
+
+  std::experimental::filesystem::remove_all("storage_commit");
+  std::experimental::filesystem::create_directories("storage_commit");
+
+  static uint64_t committed_serial_nums[Thread::kMaxNumThreads];
+  static std::atomic<bool> committed[Thread::kMaxNumThreads];
+  auto commit_callback = [](Status result, uint64_t persistent_serial_num) {
+    ASSERT_EQ(Status::Ok, result);
+    committed_serial_nums[Thread::id()] = persistent_serial_num;
+    committed[Thread::id()] = true;
+  };
+  static std::atomic<uint32_t> num_callbacks;
+  num_callbacks = 0;
+  auto index_persistence_callback = [](Status result) {
+    ASSERT_EQ(Status::Ok, result);
+    ++num_callbacks;
+  };
+  auto hybrid_log_persistence_callback = [](Status result, uint64_t persistent_serial_num) {
+    ASSERT_EQ(Status::Ok, result);
+    ++num_callbacks;
+  };
+  auto upsert_callback = [](IAsyncContext* ctxt, Status result) {
+    ASSERT_TRUE(false);
+  };
+  auto count_checkpoints = [](const std::string& dir) {
+    std::experimental::filesystem::directory_iterator entries{ dir };
+    return static_cast<uint32_t>(std::distance(begin(entries), end(entries)));
+  };
+
+  Guid token;
+  Guid session_ids[kNumSessions];
+  uint64_t serial_nums[kNumSessions];
+  {
+    store_t store{ 1024, 1073741824, "storage_commit" };
+    // Commits recover on top of a checkpoint; this one precedes all the upserts.
+    store.StartSession();
+    ASSERT_TRUE(store.Checkpoint(index_persistence_callback, hybrid_log_persistence_callback,
+                                 token));
+    while(num_callbacks < 2) {
+      store.CompletePending(false);
+    }
+    store.StopSession();
+
+    std::atomic<uint32_t> num_started{ 0 };
+    std::vector<std::thread> threads;
+    for(uint32_t session = 0; session < kNumSessions; ++session) {
+      threads.emplace_back([&, session]() {
+        session_ids[session] = store.StartSession();
+        uint32_t thread_id = Thread::id();
+        ++num_started;
+        while(num_started < kNumSessions) {
+          std::this_thread::yield();
+        }
+        uint64_t begin_key = session * kNumKeys;
+        for(uint64_t round = 0; round < kNumRounds; ++round) {
+          for(uint64_t key = round * kNumKeys / kNumRounds;
+              key < (round + 1) * kNumKeys / kNumRounds; ++key) {
+            UpsertContext context{ begin_key + key };
+            ASSERT_EQ(Status::Ok, store.Upsert(context, upsert_callback, key + 1));
+          }
+          committed[thread_id] = false;
+          ASSERT_TRUE(store.Commit(commit_callback));
+          // (Only one commit at a time, per session.)
+          ASSERT_FALSE(store.Commit(commit_callback));
+          while(!committed[thread_id]) {
+            store.CompletePending(false);
+          }
+          // Everything the session upserted before asking is durable.
+          ASSERT_EQ((round + 1) * kNumKeys / kNumRounds, committed_serial_nums[thread_id]);
+        }
+        serial_nums[session] = committed_serial_nums[thread_id];
+        store.StopSession();
+      });
+    }
+    for(auto& thread : threads) {
+      thread.join();
+    }
+    // Commits don't checkpoint.
+    ASSERT_EQ(1, count_checkpoints("storage_commit/cpr-checkpoints"));
+  }
+
+  store_t new_store{ 1024, 1073741824, "storage_commit" };
+  uint32_t version;
+  std::vector<Guid> recovered_session_ids;
+  ASSERT_EQ(Status::Ok, new_store.Recover(token, token, version, recovered_session_ids));
+  // (Along with the session that took the checkpoint.)
+  ASSERT_EQ(kNumSessions + 1, recovered_session_ids.size());
+  for(uint32_t session = 0; session < kNumSessions; ++session) {
+    ASSERT_EQ(serial_nums[session], new_store.ContinueSession(session_ids[session]));
+    new_store.StopSession();
+  }
+  auto read_callback = [](IAsyncContext* ctxt, Status result) {
+    ASSERT_TRUE(false);
+  };
+  new_store.StartSession();
+  for(uint64_t key = 0; key < kNumSessions * kNumKeys; ++key) {
+    ReadContext context{ key };
+    ASSERT_EQ(Status::Ok, new_store.Read(context, read_callback, key + 1));
+    ASSERT_EQ(key, context.output);
+  }
+  new_store.StopSession();
+}
+
+TEST(CLASS, CheckpointRetention) {
+  typedef FixedSizeKey<uint64_t> Key;
+  typedef SimpleAtomicValue<uint64_t> Value;
+  typedef KeyValueUpsertContext<Value> UpsertContext;
+  typedef KeyValueReadContext<Value> ReadContext;
+  typedef FasterKv<Key, Value, disk_t> store_t;
+  // Each round upserts its own keys, then checkpoints: two full checkpoints (the second with an
+  // incremental index checkpoint), then hybrid-log checkpoints alone.
+  static constexpr uint64_t kNumKeys = 1000;
+  static constexpr uint32_t kNumRounds = 5;
+
+  std::experimental::filesystem::remove_all("storage_retention");
+  std::experimental::filesystem::create_directories("storage_retention");
+
+  static std::atomic<bool> hybrid_log_checkpoint_completed;
+  auto hybrid_log_persistence_callback = [](Status result, uint64_t persistent_serial_num) {
+    ASSERT_EQ(Status::Ok, result);
+    hybrid_log_checkpoint_completed = true;
+  };
+  auto upsert_callback = [](IAsyncContext* ctxt, Status result) {
+    ASSERT_TRUE(false);
+  };
+  auto count_checkpoints = [](const std::string& dir) {
+    std::experimental::filesystem::directory_iterator entries{ dir };
+    return static_cast<uint32_t>(std::distance(begin(entries), end(entries)));
+  };
+
+  Guid session_id;
+  Guid tokens[kNumRounds];
+  {
+    store_t store{ 1024, 1073741824, "storage_retention" };
+    store.SetCheckpointRetention(CheckpointRetention{ 1 });
+    session_id = store.StartSession();
+    for(uint32_t round = 0; round < kNumRounds; ++round) {
+      for(uint64_t key = round * kNumKeys; key < (round + 1) * kNumKeys; ++key) {
+        UpsertContext context{ key };
+        ASSERT_EQ(Status::Ok, store.Upsert(context, upsert_callback, round + 1));
+      }
+      hybrid_log_checkpoint_completed = false;
+      if(round < 2) {
+        ASSERT_TRUE(store.Checkpoint(nullptr, hybrid_log_persistence_callback, tokens[round],
+                                     true));
+      } else {
+        ASSERT_TRUE(store.CheckpointHybridLog(hybrid_log_persistence_callback, tokens[round]));
+      }
+      while(!hybrid_log_checkpoint_completed) {
+        store.CompletePending(false);
+      }
+      ASSERT_TRUE(store.CompletePending(true));
+      // Checkpoints are ordered by version, not by write time: make each one look newer than
+      // the next.
+      std::experimental::filesystem::last_write_time(
+        store.disk.cpr_checkpoint_path(tokens[round]),
+        std::experimental::filesystem::file_time_type::clock::now() + std::chrono::hours(1));
+    }
+    store.StopSession();
+
+    // Only the newest hybrid-log checkpoint is left, with the incremental index checkpoint that it
+    // recovers with, and that checkpoint's base.
+    ASSERT_EQ(1, count_checkpoints("storage_retention/cpr-checkpoints"));
+    ASSERT_TRUE(std::experimental::filesystem::exists(
+                  store.disk.cpr_checkpoint_path(tokens[kNumRounds - 1])));
+    ASSERT_EQ(2, count_checkpoints("storage_retention/index-checkpoints"));
+    ASSERT_TRUE(std::experimental::filesystem::exists(
+                  store.disk.index_checkpoint_path(tokens[0])));
+    ASSERT_TRUE(std::experimental::filesystem::exists(
+                  store.disk.index_checkpoint_path(tokens[1])));
+  }
+
+  store_t new_store{ 1024, 1073741824, "storage_retention" };
+  uint32_t version;
+  std::vector<Guid> session_ids;
+  ASSERT_EQ(Status::Ok, new_store.Recover(tokens[1], tokens[kNumRounds - 1], version,
+                                          session_ids));
+  ASSERT_EQ(1, session_ids.size());
+  ASSERT_EQ(kNumRounds, new_store.ContinueSession(session_id));
+
+  static std::atomic<uint64_t> records_read;
+  records_read = 0;
+  auto read_callback = [](IAsyncContext* ctxt, Status result) {
+    CallbackContext<ReadContext> context{ ctxt };
+    ASSERT_EQ(Status::Ok, result);
+    ASSERT_EQ(context->key().key, context->output);
+    ++records_read;
+  };
+  for(uint64_t key = 0; key < kNumRounds * kNumKeys; ++key) {
+    ReadContext context{ key };
+    Status result = new_store.Read(context, read_callback, kNumRounds + 1);
+    if(result == Status::Ok) {
+      ASSERT_EQ(key, context.output);
+      ++records_read;
+    } else {
+      ASSERT_EQ(Status::Pending, result);
+    }
+  }
+  ASSERT_TRUE(new_store.CompletePending(true));
+  ASSERT_EQ(kNumRounds * kNumKeys, records_read.load());
+  new_store.StopSession();
+}
+
+TEST(CLASS, RecoverResized) {
+  // Each key hashes to itself, with its low bits in the tag, too: shrinking the index merges
+  // buckets whose entries' tags all differ, so it gets the size asked for.
+  struct HashFn {
+    inline size_t operator()(uint64_t key) const {
+      return key | (key << 48);
+    }
+  };
+  typedef FixedSizeKey<uint64_t, HashFn> Key;
+  typedef SimpleAtomicValue<uint64_t> Value;
+  typedef KeyValueUpsertContext<Value, Key> UpsertContext;
+  typedef KeyValueReadContext<Value, Key> ReadContext;
+  typedef FasterKv<Key, Value, disk_t> store_t;
+  static constexpr uint64_t kTableSize = 16384;
+  static constexpr uint64_t kNumKeys = 4096;
+
+  std::experimental::filesystem::remove_all("storage_resize");
+  std::experimental::filesystem::create_directories("storage_resize");
+
+  static std::atomic<bool> hybrid_log_checkpoint_completed;
+  auto hybrid_log_persistence_callback = [](Status result, uint64_t persistent_serial_num) {
+    ASSERT_EQ(Status::Ok, result);
+    hybrid_log_checkpoint_completed = true;
+  };
+  auto upsert_callback = [](IAsyncContext* ctxt, Status result) {
+    ASSERT_TRUE(false);
+  };
+
+  Guid session_id;
+  Guid token;
+  {
+    store_t store{ kTableSize, 1073741824, "storage_resize" };
+    session_id = store.StartSession();
+    for(uint64_t key = 0; key < kNumKeys; ++key) {
+      UpsertContext context{ key };
+      ASSERT_EQ(Status::Ok, store.Upsert(context, upsert_callback, 1));
+    }
+    hybrid_log_checkpoint_completed = false;
+    ASSERT_TRUE(store.Checkpoint(nullptr, hybrid_log_persistence_callback, token));
+    while(!hybrid_log_checkpoint_completed) {
+      store.CompletePending(false);
+    }
+    ASSERT_TRUE(store.CompletePending(true));
+    store.StopSession();
+  }
+
+  static std::atomic<uint64_t> records_read;
+  auto read_callback = [](IAsyncContext* ctxt, Status result) {
+    CallbackContext<ReadContext> context{ ctxt };
+    ASSERT_EQ(Status::Ok, result);
+    ASSERT_EQ(context->key().key, context->output);
+    ++records_read;
+  };
+  auto recover = [&](uint64_t table_size) {
+    store_t new_store{ kTableSize, 1073741824, "storage_resize" };
+    uint32_t version;
+    std::vector<Guid> session_ids;
+    ASSERT_EQ(Status::Ok, new_store.Recover(token, token, version, session_ids, 4, false,
+                                            IndexLoadMode::Read, table_size));
+    ASSERT_EQ(1, session_ids.size());
+    ASSERT_EQ(1, new_store.ContinueSession(session_id));
+    ASSERT_EQ(table_size, new_store.IndexSize());
+
+    records_read = 0;
+    for(uint64_t key = 0; key < kNumKeys; ++key) {
+      ReadContext context{ key };
+      Status result = new_store.Read(context, read_callback, 2);
+      if(result == Status::Ok) {
+        ASSERT_EQ(key, context.output);
+        ++records_read;
+      } else {
+        ASSERT_EQ(Status::Pending, result);
+      }
+    }
+    ASSERT_TRUE(new_store.CompletePending(true));
+    ASSERT_EQ(kNumKeys, records_read.load());
+    // New keys go into the resized index.
+    for(uint64_t key = kNumKeys; key < 2 * kNumKeys; ++key) {
+      UpsertContext context{ key };
+      ASSERT_EQ(Status::Ok, new_store.Upsert(context, upsert_callback, 2));
+      ReadContext read_context{ key };
+      ASSERT_EQ(Status::Ok, new_store.Read(read_context, read_callback, 2));
+      ASSERT_EQ(key, read_context.output);
+    }
+    new_store.StopSession();
+  };
+  // Grow 4x, and shrink 16x.
+  recover(kTableSize * 4);
+  recover(kTableSize / 16);
+}
@@ -5,6 +5,7 @@
 #include "gtest/gtest.h"
 
 #include "core/auto_ptr.h"
+#include "core/record_size_histogram.h"
 
 using namespace FASTER::core;
 
@@ -19,6 +20,34 @@ TEST(UtilityTest, NextPowerOfTwo) {
   EXPECT_EQ(8, next_power_of_two(8));
 }
 
+TEST(UtilityTest, RecordSizeHistogram) {
+  RecordSizeHistogram histogram{ 100 };
+  EXPECT_EQ(100, histogram.read_size());
+
+  // Most records fit in 3 sectors; a few are much larger.
+  for(uint32_t idx = 0; idx < 10 * RecordSizeHistogram::kRecomputeInterval; ++idx) {
+    histogram.Add(idx % 20 == 0 ? 20000 : 1100 + idx % 400);
+  }
+  EXPECT_EQ(3 * RecordSizeHistogram::kBucketSize, histogram.read_size());
+
+  // The histogram follows a shift to larger records.
+  for(uint32_t idx = 0; idx < 100 * RecordSizeHistogram::kRecomputeInterval; ++idx) {
+    histogram.Add(4000);
+  }
+  EXPECT_EQ(8 * RecordSizeHistogram::kBucketSize, histogram.read_size());
+
+  // Read sizes are capped, and never go below the minimum.
+  RecordSizeHistogram huge{ 100 };
+  RecordSizeHistogram tiny{ 1000 };
+  for(uint32_t idx = 0; idx < RecordSizeHistogram::kRecomputeInterval; ++idx) {
+    huge.Add(1 << 20);
+    tiny.Add(16);
+  }
+  EXPECT_EQ(RecordSizeHistogram::kNumBuckets * RecordSizeHistogram::kBucketSize,
+            huge.read_size());
+  EXPECT_EQ(1000, tiny.read_size());
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();